@@ -0,0 +1,166 @@
+#include "ansi.h"
+
+#include "macro.h"
+#include "video.h"
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define LOG_LEVEL LOG_LVL_INFO
+#include "log.h"
+
+#define ANSI_CELLS (VIDEO_ROWS * VIDEO_COLUMNS)
+
+// text attributes, as in CEDA attribute memory
+#define ATTR_REVERSE    0x01
+#define ATTR_BLINK      0x02
+#define ATTR_GLUE(attr) (((attr) >> 4) & 0x7)
+
+// terminal rendition, as a bitmask of SGR parameters
+#define SGR_REVERSE   (1 << 0)
+#define SGR_BLINK     (1 << 1)
+#define SGR_UNDERLINE (1 << 2)
+
+static bool opened = false;
+
+// what the terminal is currently showing
+static uint8_t shadow_chars[ANSI_CELLS];
+static uint8_t shadow_attrs[ANSI_CELLS];
+static bool shadow_valid = false;
+static unsigned int term_cursor = 0; // terminal cursor position (linearized)
+static unsigned int term_sgr = 0;    // terminal current rendition
+
+// output is collected here, and written all at once
+static char out[ANSI_CELLS * 32];
+static size_t out_len = 0;
+
+static void ansi_printf(const char *fmt, ...) {
+    va_list argp;
+    va_start(argp, fmt);
+    const int n = vsnprintf(out + out_len, sizeof(out) - out_len, fmt, argp);
+    va_end(argp);
+
+    if (n > 0)
+        out_len = MIN(out_len + (size_t)n, sizeof(out) - 1);
+}
+
+static void ansi_flush(void) {
+    size_t written = 0;
+    while (written < out_len) {
+        const ssize_t ret =
+            write(STDOUT_FILENO, out + written, out_len - written);
+        if (ret == -1 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            break;
+        written += (size_t)ret;
+    }
+    out_len = 0;
+}
+
+static void ansi_move(unsigned int position) {
+    if (position == term_cursor)
+        return;
+
+    ansi_printf("\x1b[%u;%uH", position / VIDEO_COLUMNS + 1,
+                position % VIDEO_COLUMNS + 1);
+    term_cursor = position;
+}
+
+static unsigned int ansi_sgr(uint8_t attr) {
+    unsigned int sgr = 0;
+
+    if (attr & ATTR_REVERSE)
+        sgr |= SGR_REVERSE;
+    if (attr & ATTR_BLINK)
+        sgr |= SGR_BLINK;
+    if (ATTR_GLUE(attr) == 1 || ATTR_GLUE(attr) == 2 || ATTR_GLUE(attr) == 5)
+        sgr |= SGR_UNDERLINE;
+
+    return sgr;
+}
+
+static void ansi_set_sgr(unsigned int sgr) {
+    if (sgr == term_sgr)
+        return;
+
+    ansi_printf("\x1b[0%s%s%sm", (sgr & SGR_REVERSE) ? ";7" : "",
+                (sgr & SGR_BLINK) ? ";5" : "",
+                (sgr & SGR_UNDERLINE) ? ";4" : "");
+    term_sgr = sgr;
+}
+
+/**
+ * @brief Take over the terminal on stdout.
+ */
+void ansi_open(void) {
+    opened = true;
+    shadow_valid = false;
+    term_sgr = 0;
+    term_cursor = 0;
+
+    // reset rendition, clear screen, cursor home
+    ansi_printf("\x1b[0m\x1b[2J\x1b[H");
+    ansi_flush();
+}
+
+/**
+ * @brief Update the terminal with the current screen content.
+ *
+ * Only cells that differ from what is already shown are emitted.
+ *
+ * @param chars Visible characters, VIDEO_ROWS * VIDEO_COLUMNS.
+ * @param attrs Visible attributes, VIDEO_ROWS * VIDEO_COLUMNS.
+ * @param cursor Cursor position (linearized), out of screen if hidden.
+ */
+void ansi_update(const uint8_t *chars, const uint8_t *attrs,
+                 unsigned int cursor) {
+    if (!opened)
+        return;
+
+    for (unsigned int i = 0; i < ANSI_CELLS; ++i) {
+        if (shadow_valid && chars[i] == shadow_chars[i] &&
+            attrs[i] == shadow_attrs[i])
+            continue;
+
+        shadow_chars[i] = chars[i];
+        shadow_attrs[i] = attrs[i];
+
+        uint8_t c = chars[i];
+        const uint8_t attr = attrs[i];
+        if (c < 0x20 || c >= 0x7f || ATTR_GLUE(attr) == 4)
+            c = ' ';
+
+        ansi_move(i);
+        ansi_set_sgr(ansi_sgr(attr));
+        ansi_printf("%c", c);
+
+        // terminals do not wrap until next char is printed, so the
+        // position of the cursor after the last column is not reliable
+        term_cursor = (i % VIDEO_COLUMNS == VIDEO_COLUMNS - 1) ? ANSI_CELLS
+                                                              : i + 1;
+    }
+    shadow_valid = true;
+
+    if (cursor < ANSI_CELLS) {
+        ansi_move(cursor);
+    }
+
+    if (out_len > 0)
+        ansi_flush();
+}
+
+/**
+ * @brief Give the terminal back, leaving the cursor below the screen.
+ */
+void ansi_close(void) {
+    if (!opened)
+        return;
+
+    ansi_printf("\x1b[0m\x1b[%u;1H\n", VIDEO_ROWS);
+    ansi_flush();
+    opened = false;
+}
@@ -0,0 +1,12 @@
+#ifndef CEDA_ANSI_H
+#define CEDA_ANSI_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+void ansi_open(void);
+void ansi_update(const uint8_t *chars, const uint8_t *attrs,
+                 unsigned int cursor);
+void ansi_close(void);
+
+#endif // CEDA_ANSI_H
@@ -0,0 +1,515 @@
+#include "automation.h"
+
+#include "conf.h"
+#include "keyboard.h"
+#include "macro.h"
+#include "time.h"
+#include "tokenizer.h"
+#include "video.h"
+
+#include <assert.h>
+#include <limits.h>
+#include <regex.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LOG_LEVEL LOG_LVL_INFO
+#include "log.h"
+
+enum { LINE_BUFFER_SIZE = 256 };
+
+static const us_interval_t UPDATE_INTERVAL = 20000; // [us] 20 ms => 50 Hz
+
+#define AUTOMATION_MISSING_PATTERN_STR "missing pattern\n"
+#define AUTOMATION_BAD_PATTERN_STR     "bad regular expression\n"
+#define AUTOMATION_MISSING_TEXT_STR    "missing text\n"
+#define AUTOMATION_BAD_TIMEOUT_STR     "bad timeout\n"
+#define AUTOMATION_UNKNOWN_STR         "unknown automation command\n"
+
+typedef enum automation_step_type_t {
+    AUTOMATION_STEP_EXPECT,
+    AUTOMATION_STEP_TYPE,
+} automation_step_type_t;
+
+typedef struct automation_step_t {
+    struct automation_step_t *next;
+    automation_step_type_t type;
+    char *text;            // pattern for expect, text to type for type
+    size_t size;           // text size, type only
+    regex_t regex;         // compiled pattern, expect only
+    us_interval_t timeout; // [us], 0 => wait forever
+} automation_step_t;
+
+// queue of pending steps, head is the one in progress
+static automation_step_t *head = NULL;
+static automation_step_t *tail = NULL;
+static bool step_started = false;
+static us_time_t deadline = 0; // [us] when current expect gives up
+static us_time_t last_update = 0;
+
+// text representation of the screen, one line for each row
+#define SCREEN_LINE_SIZE (VIDEO_COLUMNS + 1)
+static char screen[VIDEO_ROWS * SCREEN_LINE_SIZE + 1];
+static uint32_t dirty_rows = 0;     // one bit for each row to be decoded again
+static bool screen_changed = false; // screen must be matched again
+
+/**
+ * @brief Keep track of screen rows changed by the emulated software.
+ *
+ * This is called by the video module only while an expect is in progress,
+ * so that there is no overhead at all when automation is idle.
+ *
+ * @param row Changed screen row.
+ */
+static void automation_text_changed(unsigned int row) {
+    assert(row < VIDEO_ROWS);
+
+    dirty_rows |= (uint32_t)1 << row;
+    screen_changed = true;
+}
+
+/**
+ * @brief Decode again only the screen rows which have changed.
+ */
+static void automation_refresh_screen(void) {
+    for (unsigned int row = 0; row < VIDEO_ROWS; ++row) {
+        if (!(dirty_rows & ((uint32_t)1 << row)))
+            continue;
+        video_textRow(&screen[row * SCREEN_LINE_SIZE], row);
+    }
+    dirty_rows = 0;
+}
+
+static void automation_step_delete(automation_step_t *step) {
+    if (step->type == AUTOMATION_STEP_EXPECT)
+        regfree(&step->regex);
+    free(step->text);
+    free(step);
+}
+
+static void automation_enqueue(automation_step_t *step) {
+    step->next = NULL;
+    if (tail == NULL)
+        head = step;
+    else
+        tail->next = step;
+    tail = step;
+}
+
+/**
+ * @brief Discard the current step, and move on to the next one.
+ */
+static void automation_next(void) {
+    assert(head);
+
+    automation_step_t *step = head;
+    head = step->next;
+    if (head == NULL)
+        tail = NULL;
+    automation_step_delete(step);
+
+    step_started = false;
+    video_setTextObserver(NULL);
+}
+
+/**
+ * @brief Unescape text to be typed.
+ *
+ * Supported escape sequences are \r, \n, \t, \e (escape) and \\.
+ * Unknown sequences are copied verbatim.
+ *
+ * @param dst Destination buffer, at least as big as src.
+ * @param src Null-terminated source string.
+ */
+static void automation_unescape(char *dst, const char *src) {
+    for (; *src != '\0'; ++src) {
+        if (*src != '\\' || src[1] == '\0') {
+            *dst++ = *src;
+            continue;
+        }
+
+        ++src;
+        switch (*src) {
+        case 'r':
+            *dst++ = '\r';
+            break;
+        case 'n':
+            *dst++ = '\n';
+            break;
+        case 't':
+            *dst++ = '\t';
+            break;
+        case 'e':
+            *dst++ = 0x1b;
+            break;
+        case '\\':
+            *dst++ = '\\';
+            break;
+        default:
+            *dst++ = '\\';
+            *dst++ = *src;
+            break;
+        }
+    }
+    *dst = '\0';
+}
+
+static const char *automation_expect(const char *arg) {
+    char pattern[LINE_BUFFER_SIZE];
+    unsigned int timeout = 0;
+
+    arg = tokenizer_next_quoted(pattern, arg, LINE_BUFFER_SIZE);
+    if (arg == NULL)
+        return AUTOMATION_MISSING_PATTERN_STR;
+
+    // timeout is optional
+    char word[LINE_BUFFER_SIZE];
+    if (tokenizer_next_word(word, arg, LINE_BUFFER_SIZE) != NULL) {
+        if (tokenizer_next_int(&timeout, word) == NULL)
+            return AUTOMATION_BAD_TIMEOUT_STR;
+    }
+
+    automation_step_t *step = calloc(1, sizeof(*step));
+    CEDA_STRONG_ASSERT_VALID_PTR(step);
+    step->type = AUTOMATION_STEP_EXPECT;
+    step->timeout = (us_interval_t)timeout * 1000 * 1000;
+
+    if (regcomp(&step->regex, pattern, REG_EXTENDED | REG_NEWLINE) != 0) {
+        free(step);
+        return AUTOMATION_BAD_PATTERN_STR;
+    }
+
+    step->text = strdup(pattern);
+    CEDA_STRONG_ASSERT_VALID_PTR(step->text);
+
+    automation_enqueue(step);
+    return NULL;
+}
+
+static const char *automation_type(const char *arg) {
+    char text[LINE_BUFFER_SIZE];
+
+    arg = tokenizer_next_quoted(text, arg, LINE_BUFFER_SIZE);
+    if (arg == NULL)
+        return AUTOMATION_MISSING_TEXT_STR;
+
+    automation_step_t *step = calloc(1, sizeof(*step));
+    CEDA_STRONG_ASSERT_VALID_PTR(step);
+    step->type = AUTOMATION_STEP_TYPE;
+    step->text = malloc(strlen(text) + 1);
+    CEDA_STRONG_ASSERT_VALID_PTR(step->text);
+    automation_unescape(step->text, text);
+    step->size = strlen(step->text);
+
+    automation_enqueue(step);
+    return NULL;
+}
+
+/**
+ * @brief Parse an automation command, and append it to the queue.
+ *
+ * Expected syntax:
+ *  expect "<regex>" [timeout]
+ *  type "<text>"
+ * where
+ *  regex: POSIX extended regular expression, matched against the screen text
+ *  (one line for each row)
+ *  timeout: seconds to wait for the regex to match, 0 or none to wait forever
+ *  text: text to be typed on the keyboard, supporting \r \n \t \e escapes
+ *
+ * @param line Null-terminated command line.
+ *
+ * @return NULL in case of success, pointer to error message otherwise.
+ */
+const char *automation_command(const char *line) {
+    char word[LINE_BUFFER_SIZE];
+
+    line = tokenizer_next_word(word, line, LINE_BUFFER_SIZE);
+    if (line == NULL)
+        return AUTOMATION_UNKNOWN_STR;
+
+    if (strcmp(word, "expect") == 0)
+        return automation_expect(line);
+    if (strcmp(word, "type") == 0)
+        return automation_type(line);
+
+    return AUTOMATION_UNKNOWN_STR;
+}
+
+/**
+ * @brief Append a step typing the whole content of a file, verbatim.
+ *
+ * @param path Path of the file.
+ *
+ * @return true in case of success, false otherwise.
+ */
+bool automation_typeFile(const char *path) {
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) {
+        LOG_ERR("unable to open %s\n", path);
+        return false;
+    }
+
+    automation_step_t *step = calloc(1, sizeof(*step));
+    CEDA_STRONG_ASSERT_VALID_PTR(step);
+    step->type = AUTOMATION_STEP_TYPE;
+
+    size_t capacity = 0;
+    for (;;) {
+        if (step->size == capacity) {
+            capacity = MAX(capacity * 2, (size_t)4096);
+            step->text = realloc(step->text, capacity);
+            CEDA_STRONG_ASSERT_VALID_PTR(step->text);
+        }
+        const size_t n =
+            fread(&step->text[step->size], 1, capacity - step->size, fp);
+        if (n == 0)
+            break;
+        step->size += n;
+    }
+
+    const bool ok = !ferror(fp);
+    (void)fclose(fp);
+    if (!ok) {
+        LOG_ERR("error reading %s\n", path);
+        automation_step_delete(step);
+        return false;
+    }
+
+    automation_enqueue(step);
+    return true;
+}
+
+/**
+ * @brief Load an automation script, and append its steps to the queue.
+ *
+ * A script contains one automation command for each line.
+ * Empty lines and lines beginning with # are ignored.
+ *
+ * @param path Path of the script file.
+ *
+ * @return true in case of success, false otherwise.
+ */
+bool automation_loadScript(const char *path) {
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        LOG_ERR("unable to open automation script %s\n", path);
+        return false;
+    }
+
+    bool ok = true;
+    char line[LINE_BUFFER_SIZE];
+    for (unsigned int n = 1; fgets(line, LINE_BUFFER_SIZE, fp) != NULL; ++n) {
+        line[strcspn(line, "\r\n")] = '\0';
+
+        const char *l = line;
+        while (*l == ' ' || *l == '\t')
+            ++l;
+        if (*l == '\0' || *l == '#')
+            continue;
+
+        const char *error = automation_command(l);
+        if (error != NULL) {
+            LOG_ERR("%s:%u: %s", path, n, error);
+            ok = false;
+            break;
+        }
+    }
+
+    (void)fclose(fp);
+    return ok;
+}
+
+/**
+ * @brief Discard all the pending automation steps.
+ */
+void automation_abort(void) {
+    // stop typing, too
+    if (head != NULL && step_started && head->type == AUTOMATION_STEP_TYPE)
+        keyboard_pasteAbort();
+
+    while (head != NULL)
+        automation_next();
+}
+
+/**
+ * @brief Describe the pending automation steps.
+ *
+ * @return ceda_string_t* Human readable status, owned by the caller.
+ */
+ceda_string_t *automation_status(void) {
+    ceda_string_t *msg = ceda_string_new(0);
+
+    if (head == NULL) {
+        ceda_string_cpy(msg, "no automation in progress\n");
+        return msg;
+    }
+
+    for (const automation_step_t *step = head; step != NULL;
+         step = step->next) {
+        if (step->type == AUTOMATION_STEP_EXPECT)
+            ceda_string_printf(msg, "expect \"%s\" %ld\n", step->text,
+                               step->timeout / 1000 / 1000);
+        else if (step == head && step_started)
+            ceda_string_printf(msg, "type %zu chars\n",
+                               keyboard_pastePending());
+        else
+            ceda_string_printf(msg, "type %zu chars\n", step->size);
+    }
+
+    return msg;
+}
+
+static bool automation_start(void) {
+    const char *script = conf_getString("automation", "script");
+    if (script == NULL)
+        return true;
+
+    LOG_INFO("loading automation script from %s\n", script);
+    return automation_loadScript(script);
+}
+
+static void automation_poll(void) {
+    last_update = time_now_us();
+
+    while (head != NULL) {
+        automation_step_t *step = head;
+
+        if (!step_started) {
+            step_started = true;
+            if (step->type == AUTOMATION_STEP_EXPECT) {
+                // start from a fresh copy of the whole screen, then get
+                // notified only of what changes
+                dirty_rows = UINT32_MAX;
+                screen_changed = true;
+                deadline = last_update + step->timeout;
+                video_setTextObserver(automation_text_changed);
+            } else {
+                // typed as fast as the emulated software reads the keyboard
+                (void)keyboard_paste(step->text, step->size);
+            }
+        }
+
+        if (step->type == AUTOMATION_STEP_TYPE) {
+            // wait until the whole text is in the keyboard FIFO
+            if (keyboard_pastePending() > 0)
+                return;
+            automation_next();
+            continue;
+        }
+
+        if (screen_changed) {
+            screen_changed = false;
+            automation_refresh_screen();
+            if (regexec(&step->regex, screen, 0, NULL, 0) == 0) {
+                LOG_INFO("expect \"%s\": match\n", step->text);
+                automation_next();
+                continue;
+            }
+        }
+
+        if (step->timeout != 0 && last_update >= deadline) {
+            LOG_WARN("expect \"%s\": timeout\n", step->text);
+            automation_abort();
+        }
+
+        return;
+    }
+}
+
+static us_interval_t automation_remaining(void) {
+    if (head == NULL)
+        return LONG_MAX;
+
+    if (!step_started)
+        return 0;
+
+    // poll the keyboard again soon
+    if (head->type == AUTOMATION_STEP_TYPE)
+        return last_update + UPDATE_INTERVAL - time_now_us();
+
+    // screen is changed: must match again
+    if (screen_changed)
+        return 0;
+
+    if (head->timeout == 0)
+        return LONG_MAX;
+
+    return deadline - time_now_us();
+}
+
+static void automation_cleanup(void) {
+    automation_abort();
+}
+
+void automation_init(CEDAModule *mod) {
+    memset(mod, 0, sizeof(*mod));
+    mod->init = automation_init;
+    mod->start = automation_start;
+    mod->poll = automation_poll;
+    mod->remaining = automation_remaining;
+    mod->cleanup = automation_cleanup;
+
+    // rows are separated by new lines, so that ^ and $ match each row
+    for (unsigned int row = 0; row < VIDEO_ROWS; ++row)
+        screen[row * SCREEN_LINE_SIZE + VIDEO_COLUMNS] = '\n';
+    screen[VIDEO_ROWS * SCREEN_LINE_SIZE] = '\0';
+}
+
+#if defined(CEDA_TEST)
+
+#include <criterion/criterion.h>
+
+Test(automation, expect) {
+    CEDAModule mod;
+    video_init(&mod);
+    keyboard_init();
+    automation_init(&mod);
+
+    // discard keyboard initialization garbage
+    uint8_t c;
+    while (keyboard_getChar(&c))
+        ;
+
+    cr_assert_eq(automation_command("expect"), AUTOMATION_MISSING_PATTERN_STR);
+    cr_assert_eq(automation_command("expect \"(\""),
+                 AUTOMATION_BAD_PATTERN_STR);
+    cr_assert_null(automation_command("expect \"^A>\" 10"));
+    cr_assert_null(automation_command("type \"dir\\r\""));
+
+    // nothing on screen yet
+    automation_poll();
+    cr_assert_not_null(head);
+    cr_assert_eq(head->type, AUTOMATION_STEP_EXPECT);
+    cr_assert_leq(automation_remaining(), 10 * 1000 * 1000);
+
+    // prompt appears on the second row
+    video_ram_write(VIDEO_COLUMNS + 0, 'A');
+    cr_assert(screen_changed);
+    video_ram_write(VIDEO_COLUMNS + 1, '>');
+    automation_poll();
+
+    // matched, now typing until keyboard is full
+    cr_assert_not_null(head);
+    cr_assert_eq(head->type, AUTOMATION_STEP_TYPE);
+    cr_assert(keyboard_getChar(&c));
+    cr_assert_eq(c, 0x22); // d
+    cr_assert(keyboard_getChar(&c));
+    cr_assert_eq(c, 0xC0); // no modifiers
+
+    // the rest is typed as soon as the keyboard is read
+    for (unsigned int i = 0; i < 4; ++i)
+        cr_assert(keyboard_getChar(&c));
+    cr_assert_eq(keyboard_pastePending(), 0);
+    cr_assert(keyboard_getChar(&c));
+    cr_assert_eq(c, 0x2B); // return
+    cr_assert(keyboard_getChar(&c));
+    cr_assert_not(keyboard_getChar(&c));
+
+    automation_poll();
+    cr_assert_null(head);
+}
+
+#endif
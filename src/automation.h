@@ -0,0 +1,17 @@
+#ifndef CEDA_AUTOMATION_H
+#define CEDA_AUTOMATION_H
+
+#include "ceda_string.h"
+#include "module.h"
+
+#include <stdbool.h>
+
+void automation_init(CEDAModule *mod);
+
+const char *automation_command(const char *line);
+bool automation_loadScript(const char *path);
+bool automation_typeFile(const char *path);
+void automation_abort(void);
+ceda_string_t *automation_status(void);
+
+#endif // CEDA_AUTOMATION_H
@@ -1,20 +1,27 @@
 #include "ceda.h"
 
 // computer core
+#include "automation.h"
 #include "bios.h"
 #include "bus.h"
 #include "cli.h"
 #include "conf.h"
 #include "cpu.h"
 #include "fdc.h"
+#include "floppy.h"
+#include "gdb.h"
 #include "gui.h"
 #include "int.h"
 #include "limits.h"
 #include "macro.h"
 #include "module.h"
+#include "reactor.h"
+#include "record.h"
 #include "serial.h"
 #include "sio2.h"
+#include "siocap.h"
 #include "speaker.h"
+#include "spool.h"
 #include "ubus.h"
 #include "upd8255.h"
 #include "video.h"
@@ -23,7 +30,7 @@
 #include "charmon.h"
 
 #include <assert.h>
-#include <unistd.h>
+#include <signal.h>
 
 #include "log.h"
 
@@ -39,10 +46,22 @@ static CEDAModule mod_int;
 static CEDAModule mod_serial;
 static CEDAModule mod_ubus;
 static CEDAModule mod_charmon;
+static CEDAModule mod_automation;
+static CEDAModule mod_record;
+static CEDAModule mod_floppy;
+static CEDAModule mod_fdc;
+static CEDAModule mod_spool;
+static CEDAModule mod_siocap;
+static CEDAModule mod_gdb;
+
+// Set by SIGINT and SIGTERM, to quit cleanly, flushing disk images
+static volatile sig_atomic_t quit_signal = 0;
 
 static CEDAModule *modules[] = {
     &mod_bios,    &mod_cli, &mod_gui,    &mod_bus,  &mod_cpu,  &mod_video,
     &mod_speaker, &mod_int, &mod_serial, &mod_sio2, &mod_ubus, &mod_charmon,
+    &mod_automation, &mod_record, &mod_floppy, &mod_fdc, &mod_spool,
+    &mod_siocap, &mod_gdb,
 };
 
 void ceda_init(void) {
@@ -51,6 +70,8 @@ void ceda_init(void) {
     gui_init(&mod_gui);
 
     fdc_init();
+    fdc_initModule(&mod_fdc);
+    floppy_init(&mod_floppy);
     upd8255_init();
     rom_bios_init(&mod_bios);
     video_init(&mod_video);
@@ -62,6 +83,11 @@ void ceda_init(void) {
     int_init(&mod_int);
     serial_init(&mod_serial);
     sio2_init(&mod_sio2);
+    spool_init(&mod_spool);
+    siocap_init(&mod_siocap);
+    gdb_init(&mod_gdb);
+    automation_init(&mod_automation);
+    record_init(&mod_record);
 }
 
 static bool ceda_start(void) {
@@ -94,9 +120,9 @@ static void ceda_remaining(void) {
         }
         wait = MIN(remaining(), wait);
     }
-    if (wait > 0) {
-        usleep((__useconds_t)wait);
-    }
+    // sleep, unless some file descriptor becomes ready earlier;
+    // pending events are dispatched even if there is no time to sleep
+    reactor_wait(wait);
 }
 
 static void ceda_performance(void) {
@@ -112,6 +138,11 @@ static void ceda_performance(void) {
     }
 }
 
+static void ceda_handle_signal(int signum) {
+    (void)signum;
+    quit_signal = 1;
+}
+
 static void ceda_cleanup(void) {
     for (int i = ARRAY_SIZE(modules) - 1; i >= 0; --i) {
         void (*cleanup)(void) = modules[i]->cleanup;
@@ -131,17 +162,26 @@ int ceda_run(void) {
         goto err;
     }
 
+    // quit cleanly on the first signal, a second one is fatal
+    const struct sigaction action = {
+        .sa_handler = ceda_handle_signal,
+        .sa_flags = (int)SA_RESETHAND,
+    };
+    (void)sigaction(SIGINT, &action, NULL);
+    (void)sigaction(SIGTERM, &action, NULL);
+
     // main loop
     for (;;) {
         // poll all modules
         ceda_poll();
 
         // decide wether to exit
-        if (gui_isQuit() || cli_isQuit()) {
+        if (gui_isQuit() || cli_isQuit() || quit_signal) {
             break;
         }
 
         // check for how long each module can sleep, and yield host cpu
+        // while waiting for I/O events
         ceda_remaining();
 
         // retrieve and print modules performance metrics
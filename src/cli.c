@@ -1,16 +1,22 @@
 #include "cli.h"
 
 #include "3rd/disassembler.h"
+#include "automation.h"
 #include "bus.h"
 #include "ceda_string.h"
 #include "cpu.h"
-#include "fifo.h"
+#include "fdc.h"
 #include "floppy.h"
+#include "gdb.h"
 #include "int.h"
 #include "macro.h"
+#include "reactor.h"
+#include "record.h"
+#include "ring.h"
 #include "serial.h"
-#include "time.h"
+#include "siocap.h"
 #include "tokenizer.h"
+#include "video.h"
 
 #include <assert.h>
 #include <ctype.h>
@@ -20,7 +26,8 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #define LOG_LEVEL LOG_LVL_INFO
@@ -31,25 +38,77 @@ static const uint16_t CLI_PORT = 0xceda;
 #define USER_PROMPT_STR "> "
 enum { LINE_BUFFER_SIZE = 128 };   // small line-like stuff
 enum { BLOCK_BUFFER_SIZE = 4096 }; // big page-like stuff
+enum { RX_BUFFER_SIZE = 4096 };        // received, not yet handled
+enum { TX_BUFFER_SIZE = 256 * 1024 }; // queued output cap, for each client
+// room kept in the output queue for the biggest reply, eg. readbin
+enum { TX_RESERVED_SIZE = 0x10000 + 4 * BLOCK_BUFFER_SIZE };
+enum { CLI_MAX_CLIENTS = 8 };
 
 #define USER_BAD_ARG_STR       "bad argument\n"
 #define USER_NO_SPACE_LEFT_STR "no space left\n"
 
 static bool initialized = false;
 static bool quit = false;
-static const us_interval_t UPDATE_INTERVAL = 20000; // [us] 20 ms => 50 Hz
-static us_time_t last_update = 0;                   // last poll() call
 
 static int sockfd = -1;
-static int connfd = -1;
 
-DECLARE_FIFO_TYPE(ceda_string_t *, TxFifo, 8);
-static TxFifo tx_fifo;
+typedef struct cli_client_t {
+    int fd; // -1 if this slot is free
+    char rx_buffer[RX_BUFFER_SIZE];
+    size_t rx_count;
+    char line[LINE_BUFFER_SIZE]; // command line being received
+    size_t line_count;
+    ceda_string_t *last_line; // repeated by an empty line
+    ring_t tx_ring;
+    // raw data expected by writebin, instead of command lines
+    size_t raw_remaining;
+    zuint16 raw_address;
+} cli_client_t;
+
+static cli_client_t clients[CLI_MAX_CLIENTS];
+static cli_client_t *client = NULL; // the one whose command is being handled
 
 bool cli_isQuit(void) {
     return quit;
 }
 
+/**
+ * @brief Watch a client only for what can be currently handled.
+ *
+ * A client is not read while its input buffer is full, which happens when
+ * its commands are not handled because its output queue is nearly full,
+ * so that a client which does not read replies is slowed down, and can not
+ * take more memory than its cap.
+ */
+static void cli_update_events(const cli_client_t *c) {
+    const unsigned int rx_events =
+        (c->rx_count < sizeof(c->rx_buffer)) ? REACTOR_READ : 0;
+    const unsigned int tx_events =
+        (ring_count(&c->tx_ring) == 0) ? 0 : REACTOR_WRITE;
+
+    reactor_modify(c->fd, rx_events | tx_events);
+}
+
+/**
+ * @brief Send raw data to the client whose command is being handled.
+ *
+ * Data is copied in the client output queue, and sent as soon as the client
+ * can receive it. If there is not enough room for all of it, nothing is sent.
+ *
+ * @param data Pointer to the data to send.
+ * @param size Size of the data. [bytes]
+ */
+static void cli_send(const void *data, size_t size) {
+    if (ring_space(&client->tx_ring) < size) {
+        LOG_WARN("client is not reading, discard %zu bytes\n", size);
+        return;
+    }
+    ring_push(&client->tx_ring, data, size);
+
+    // wait for the client to be writable
+    cli_update_events(client);
+}
+
 /**
  * @brief Send a string to the connected client.
  *
@@ -59,9 +118,7 @@ bool cli_isQuit(void) {
  * @param str pointer to the null-terminated C-string to send
  */
 static void cli_send_string(const char *str) {
-    ceda_string_t *message = ceda_string_new(0);
-    ceda_string_cpy(message, str);
-    FIFO_PUSH(&tx_fifo, message);
+    cli_send(str, strlen(str));
 }
 
 static ceda_string_t *cli_quit(const char *arg) {
@@ -326,6 +383,202 @@ static ceda_string_t *cli_write(const char *arg) {
     return NULL;
 }
 
+/**
+ * @brief Parse a memory range, as address and size, both in hex.
+ *
+ * The range can wrap around the end of the address space, but it can not be
+ * empty, or longer than the whole address space.
+ *
+ * @param arg Arguments, starting from the address.
+ * @param address Pointer to the resulting address.
+ * @param size Pointer to the resulting size.
+ * @param msg Error description, if any.
+ *
+ * @return Pointer past the size, or NULL in case of error.
+ */
+static const char *cli_next_range(const char *arg, zuint16 *address,
+                                  unsigned int *size, ceda_string_t *msg) {
+    unsigned int _address;
+    arg = tokenizer_next_hex(&_address, arg);
+    if (arg == NULL) {
+        ceda_string_cpy(msg, USER_BAD_ARG_STR "missing address\n");
+        return NULL;
+    }
+    if (_address >= 0x10000) {
+        ceda_string_cpy(msg, USER_BAD_ARG_STR "address must be 16 bit\n");
+        return NULL;
+    }
+
+    arg = tokenizer_next_hex(size, arg);
+    if (arg == NULL) {
+        ceda_string_cpy(msg, USER_BAD_ARG_STR "missing size\n");
+        return NULL;
+    }
+    if (*size == 0 || *size > 0x10000) {
+        ceda_string_cpy(msg, USER_BAD_ARG_STR "size must be 1 to 10000\n");
+        return NULL;
+    }
+
+    *address = (zuint16)_address;
+    return arg;
+}
+
+/**
+ * @brief Read raw memory content.
+ *
+ * Expected command line syntax:
+ *  readbin <address> <size>
+ *
+ * Memory content is sent as binary data, preceded by its size as 32 bit
+ * little endian integer. Since the size is at most 10000 (hex), its last
+ * byte is always zero, unlike a text error message.
+ */
+static ceda_string_t *cli_readbin(const char *arg) {
+    char word[LINE_BUFFER_SIZE];
+    ceda_string_t *msg = ceda_string_new(0);
+
+    // skip argv[0]
+    arg = tokenizer_next_word(word, arg, LINE_BUFFER_SIZE);
+
+    zuint16 address;
+    unsigned int size;
+    if (cli_next_range(arg, &address, &size, msg) == NULL)
+        return msg;
+    ceda_string_delete(msg);
+
+    ring_t *tx_ring = &client->tx_ring;
+    if (ring_space(tx_ring) < 4 + (size_t)size) {
+        msg = ceda_string_new(0);
+        ceda_string_cpy(msg, USER_NO_SPACE_LEFT_STR);
+        return msg;
+    }
+
+    const uint8_t header[4] = {(uint8_t)(size & 0xff),
+                               (uint8_t)((size >> 8) & 0xff),
+                               (uint8_t)((size >> 16) & 0xff), 0};
+    ring_push(tx_ring, header, sizeof(header));
+
+    // read directly in the output queue
+    struct iovec iov[2];
+    const int n = ring_spaceIov(tx_ring, iov);
+    size_t remaining = size;
+    for (int i = 0; i < n && remaining > 0; ++i) {
+        const size_t chunk = MIN(remaining, iov[i].iov_len);
+        for (size_t j = 0; j < chunk; ++j)
+            ((uint8_t *)iov[i].iov_base)[j] = bus_mem_read(address++);
+        remaining -= chunk;
+    }
+    ring_produce(tx_ring, size);
+
+    cli_update_events(client);
+    return NULL;
+}
+
+/**
+ * @brief Write raw memory content.
+ *
+ * Expected command line syntax:
+ *  writebin <address> <size>
+ *
+ * The command line must be followed by exactly size bytes of binary data,
+ * which are written in memory. The prompt is sent after all of them have
+ * been received.
+ */
+static ceda_string_t *cli_writebin(const char *arg) {
+    char word[LINE_BUFFER_SIZE];
+    ceda_string_t *msg = ceda_string_new(0);
+
+    // skip argv[0]
+    arg = tokenizer_next_word(word, arg, LINE_BUFFER_SIZE);
+
+    unsigned int size;
+    if (cli_next_range(arg, &client->raw_address, &size, msg) == NULL)
+        return msg;
+
+    client->raw_remaining = size;
+
+    ceda_string_delete(msg);
+    return NULL;
+}
+
+/**
+ * @brief Fill memory with a value.
+ *
+ * Expected command line syntax:
+ *  fill <address> <size> <value>
+ */
+static ceda_string_t *cli_fill(const char *arg) {
+    char word[LINE_BUFFER_SIZE];
+    ceda_string_t *msg = ceda_string_new(0);
+
+    // skip argv[0]
+    arg = tokenizer_next_word(word, arg, LINE_BUFFER_SIZE);
+
+    zuint16 address;
+    unsigned int size;
+    arg = cli_next_range(arg, &address, &size, msg);
+    if (arg == NULL)
+        return msg;
+
+    unsigned int value;
+    arg = tokenizer_next_hex(&value, arg);
+    if (arg == NULL) {
+        ceda_string_cpy(msg, USER_BAD_ARG_STR "missing value\n");
+        return msg;
+    }
+    if (value >= 0x100) {
+        ceda_string_cpy(msg, USER_BAD_ARG_STR "value must be 8 bit\n");
+        return msg;
+    }
+
+    for (unsigned int i = 0; i < size; ++i)
+        bus_mem_write(address++, (uint8_t)value);
+
+    ceda_string_delete(msg);
+    return NULL;
+}
+
+/**
+ * @brief Copy memory, even if source and destination overlap.
+ *
+ * Expected command line syntax:
+ *  copy <source> <size> <destination>
+ */
+static ceda_string_t *cli_copy(const char *arg) {
+    char word[LINE_BUFFER_SIZE];
+    ceda_string_t *msg = ceda_string_new(0);
+
+    // skip argv[0]
+    arg = tokenizer_next_word(word, arg, LINE_BUFFER_SIZE);
+
+    zuint16 source;
+    unsigned int size;
+    arg = cli_next_range(arg, &source, &size, msg);
+    if (arg == NULL)
+        return msg;
+
+    unsigned int destination;
+    arg = tokenizer_next_hex(&destination, arg);
+    if (arg == NULL) {
+        ceda_string_cpy(msg, USER_BAD_ARG_STR "missing destination\n");
+        return msg;
+    }
+    if (destination >= 0x10000) {
+        ceda_string_cpy(msg, USER_BAD_ARG_STR "address must be 16 bit\n");
+        return msg;
+    }
+
+    // read everything first, as with memmove()
+    static uint8_t blob[0x10000];
+    for (unsigned int i = 0; i < size; ++i)
+        blob[i] = bus_mem_read((zuint16)(source + i));
+    for (unsigned int i = 0; i < size; ++i)
+        bus_mem_write((zuint16)(destination + i), blob[i]);
+
+    ceda_string_delete(msg);
+    return NULL;
+}
+
 static ceda_string_t *cli_dis(const char *arg) {
     char word[LINE_BUFFER_SIZE];
     ceda_string_t *msg = ceda_string_new(0);
@@ -547,8 +800,20 @@ static ceda_string_t *cli_load_and_run(const char *arg, bool run) {
     return NULL;
 }
 
+/**
+ * @brief Load a floppy image in a drive.
+ *
+ * Expected command line syntax:
+ *  mount <filename> [drive] [delta]
+ * where
+ *  filename: image file name (no spaces allowed)
+ *  drive: drive number, default is 0
+ *  delta: overlay file name; if specified, the image is never written, and
+ *         written sectors are stored in the overlay instead
+ */
 static ceda_string_t *cli_mount(const char *arg) {
     char filename[LINE_BUFFER_SIZE];
+    char delta[LINE_BUFFER_SIZE] = {0};
     unsigned int drive = 0;
 
     // skip argv[0]
@@ -565,12 +830,18 @@ static ceda_string_t *cli_mount(const char *arg) {
 
     // Fetch drive number if specified
     if (arg != NULL) {
-        tokenizer_next_int(&drive, arg);
+        arg = tokenizer_next_int(&drive, arg);
+    }
+
+    // Fetch overlay file name if specified
+    if (arg != NULL) {
+        tokenizer_next_word(delta, arg, LINE_BUFFER_SIZE);
     }
 
     // TODO(giuliof): some error codes and appropriate messages will be
     // implemented
-    if (floppy_load_image(filename, drive) < 0) {
+    if (floppy_load_overlay(filename, delta[0] != '\0' ? delta : NULL,
+                            drive) < 0) {
         ceda_string_t *msg = ceda_string_new(0);
         ceda_string_cpy(msg, "unable to open file\n");
         return msg;
@@ -579,6 +850,53 @@ static ceda_string_t *cli_mount(const char *arg) {
     return NULL;
 }
 
+/**
+ * @brief Load a CP/M disk synthesized from a host directory in a drive.
+ *
+ * Expected command line syntax:
+ *  mountdir <directory> [drive] [rw]
+ * where
+ *  directory: host directory (no spaces allowed)
+ *  drive: drive number, default is 0
+ *  rw: if specified, new and modified files are written back to the
+ *      directory, otherwise the disk is write protected
+ */
+static ceda_string_t *cli_mountdir(const char *arg) {
+    char path[LINE_BUFFER_SIZE];
+    char word[LINE_BUFFER_SIZE] = {0};
+    unsigned int drive = 0;
+
+    // skip argv[0]
+    arg = tokenizer_next_word(path, arg, LINE_BUFFER_SIZE);
+
+    if (arg == NULL) {
+        ceda_string_t *msg = ceda_string_new(0);
+        ceda_string_cpy(msg, "no directory specified\n");
+        return msg;
+    }
+
+    // Actual directory fetch
+    arg = tokenizer_next_word(path, arg, LINE_BUFFER_SIZE);
+
+    // Fetch drive number if specified
+    if (arg != NULL) {
+        arg = tokenizer_next_int(&drive, arg);
+    }
+
+    // Fetch write back flag if specified
+    if (arg != NULL) {
+        tokenizer_next_word(word, arg, LINE_BUFFER_SIZE);
+    }
+
+    if (floppy_load_directory(path, strcmp(word, "rw") == 0, drive) < 0) {
+        ceda_string_t *msg = ceda_string_new(0);
+        ceda_string_cpy(msg, "unable to read directory\n");
+        return msg;
+    }
+
+    return NULL;
+}
+
 static ceda_string_t *cli_umount(const char *arg) {
     char word[LINE_BUFFER_SIZE];
     unsigned int drive = 0;
@@ -602,6 +920,270 @@ static ceda_string_t *cli_umount(const char *arg) {
     return NULL;
 }
 
+/**
+ * @brief Commit or discard the overlay of a floppy drive.
+ *
+ * Expected command line syntax:
+ *  commit [drive]
+ *  discard [drive]
+ * where
+ *  drive: drive number, default is 0
+ */
+static ceda_string_t *cli_overlay(const char *arg) {
+    char word[LINE_BUFFER_SIZE];
+    unsigned int drive = 0;
+
+    // argv[0] tells the operation
+    arg = tokenizer_next_word(word, arg, LINE_BUFFER_SIZE);
+    const bool commit = (strcmp(word, "commit") == 0);
+
+    // Fetch drive number if specified
+    if (arg != NULL) {
+        tokenizer_next_int(&drive, arg);
+    }
+
+    const ssize_t ret =
+        commit ? floppy_commitOverlay(drive) : floppy_discardOverlay(drive);
+    if (ret < 0) {
+        ceda_string_t *msg = ceda_string_new(0);
+        ceda_string_cpy(msg, commit ? "unable to commit overlay\n"
+                                    : "unable to discard overlay\n");
+        return msg;
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Flush written floppy sectors to their image files.
+ *
+ * Expected command line syntax:
+ *  sync [drive]
+ * where
+ *  drive: drive number, all drives with an image loaded if not specified
+ */
+static ceda_string_t *cli_sync(const char *arg) {
+    char word[LINE_BUFFER_SIZE];
+    unsigned int drive;
+
+    // skip argv[0]
+    arg = tokenizer_next_word(word, arg, LINE_BUFFER_SIZE);
+
+    // Sync a single drive, if specified
+    if (arg != NULL && tokenizer_next_int(&drive, arg) != NULL) {
+        if (floppy_sync(drive) < 0) {
+            ceda_string_t *msg = ceda_string_new(0);
+            ceda_string_cpy(msg, "unable to sync drive\n");
+            return msg;
+        }
+        return NULL;
+    }
+
+    if (floppy_syncAll() < 0) {
+        ceda_string_t *msg = ceda_string_new(0);
+        ceda_string_cpy(msg, "unable to sync some drives\n");
+        return msg;
+    }
+
+    return NULL;
+}
+
+enum { FDC_HOT_SECTORS = 10 };
+
+/**
+ * @brief Show per command statistics of the FDC, and its hottest sectors.
+ */
+static ceda_string_t *cli_fdc_stats(void) {
+    const fdc_stats_t *stats = fdc_getStats();
+    ceda_string_t *msg = ceda_string_new(BLOCK_BUFFER_SIZE);
+
+    ceda_string_cpy(msg, "command             count      bytes  emulated ms"
+                         "    host ms\n");
+    unsigned long int busy = 0;
+    for (size_t i = 0; i < FDC_STATS_COMMANDS; ++i) {
+        const fdc_cmd_stats_t *cmd = &stats->commands[i];
+        if (cmd->count == 0)
+            continue;
+        busy += cmd->cycles;
+        ceda_string_printf(msg, "%-18s %6lu %10lu %12.1f %10.1f\n", cmd->name,
+                           cmd->count, cmd->bytes,
+                           (double)cmd->cycles / (CPU_FREQ / 1000.0),
+                           (double)cmd->host_time / 1000.0);
+
+        // latency histogram, only non-empty buckets
+        ceda_string_cat(msg, "  latency [us]:");
+        for (size_t b = 0; b < FDC_STATS_LATENCY_BUCKETS; ++b) {
+            if (cmd->latency[b] == 0)
+                continue;
+            if (b == FDC_STATS_LATENCY_BUCKETS - 1)
+                ceda_string_printf(msg, " >=%lu:%lu", 1UL << (b - 1),
+                                   cmd->latency[b]);
+            else
+                ceda_string_printf(msg, " <%lu:%lu", 1UL << b,
+                                   cmd->latency[b]);
+        }
+        ceda_string_cat(msg, "\n");
+    }
+
+    const unsigned long int elapsed = cpu_getCycles() - stats->since;
+    if (elapsed != 0) {
+        ceda_string_printf(msg, "busy %.1f%% of %.1f emulated ms\n",
+                           100.0 * (double)busy / (double)elapsed,
+                           (double)elapsed / (CPU_FREQ / 1000.0));
+    }
+
+    // find the hottest sectors, by insertion in a sorted list
+    struct {
+        unsigned int drive, track, head, sector;
+        unsigned long int accesses;
+    } hot[FDC_HOT_SECTORS];
+    size_t hot_count = 0;
+    for (unsigned int d = 0; d < FDC_STATS_UNITS; ++d) {
+        for (unsigned int t = 0; t < FDC_STATS_TRACKS; ++t) {
+            for (unsigned int h = 0; h < FDC_STATS_HEADS; ++h) {
+                for (unsigned int s = 0; s < FDC_STATS_SECTORS; ++s) {
+                    const fdc_heat_t *heat = &stats->heat[d][t][h][s];
+                    const unsigned long int accesses =
+                        (unsigned long int)heat->reads + heat->writes;
+                    if (accesses == 0)
+                        continue;
+                    size_t i = hot_count;
+                    for (; i > 0 && hot[i - 1].accesses < accesses; --i) {
+                        if (i < FDC_HOT_SECTORS)
+                            hot[i] = hot[i - 1];
+                    }
+                    if (i == FDC_HOT_SECTORS)
+                        continue;
+                    hot[i].drive = d;
+                    hot[i].track = t;
+                    hot[i].head = h;
+                    hot[i].sector = s;
+                    hot[i].accesses = accesses;
+                    if (hot_count < FDC_HOT_SECTORS)
+                        ++hot_count;
+                }
+            }
+        }
+    }
+
+    if (hot_count != 0)
+        ceda_string_cat(msg, "hottest sectors:\n"
+                             "drive track head sector   reads  writes\n");
+    for (size_t i = 0; i < hot_count; ++i) {
+        const fdc_heat_t *heat =
+            &stats->heat[hot[i].drive][hot[i].track][hot[i].head]
+                        [hot[i].sector];
+        ceda_string_printf(msg, "%5u %5u %4u %6u %7" PRIu32 " %7" PRIu32 "\n",
+                           hot[i].drive, hot[i].track, hot[i].head,
+                           hot[i].sector, heat->reads, heat->writes);
+    }
+
+    return msg;
+}
+
+/**
+ * @brief Show sector accesses of a drive, one row for each track and head
+ * that has been accessed, one character for each sector.
+ */
+static ceda_string_t *cli_fdc_heat(unsigned int drive) {
+    static const char levels[] = " .:-=+*#%@";
+    const fdc_stats_t *stats = fdc_getStats();
+
+    // scale to the hottest sector, and to the last sector accessed
+    unsigned long int hottest = 0;
+    unsigned int sectors = 0;
+    for (unsigned int t = 0; t < FDC_STATS_TRACKS; ++t) {
+        for (unsigned int h = 0; h < FDC_STATS_HEADS; ++h) {
+            for (unsigned int s = 0; s < FDC_STATS_SECTORS; ++s) {
+                const fdc_heat_t *heat = &stats->heat[drive][t][h][s];
+                const unsigned long int accesses =
+                    (unsigned long int)heat->reads + heat->writes;
+                if (accesses == 0)
+                    continue;
+                hottest = MAX(hottest, accesses);
+                sectors = MAX(s + 1, sectors);
+            }
+        }
+    }
+
+    ceda_string_t *msg = ceda_string_new(BLOCK_BUFFER_SIZE);
+    if (hottest == 0) {
+        ceda_string_cpy(msg, "no sector accessed\n");
+        return msg;
+    }
+
+    ceda_string_printf(msg, "track head sectors (max %lu accesses)  reads"
+                            " writes\n",
+                       hottest);
+    for (unsigned int t = 0; t < FDC_STATS_TRACKS; ++t) {
+        for (unsigned int h = 0; h < FDC_STATS_HEADS; ++h) {
+            char row[FDC_STATS_SECTORS + 1];
+            unsigned long int reads = 0;
+            unsigned long int writes = 0;
+            for (unsigned int s = 0; s < sectors; ++s) {
+                const fdc_heat_t *heat = &stats->heat[drive][t][h][s];
+                const unsigned long int accesses =
+                    (unsigned long int)heat->reads + heat->writes;
+                // any access is visible
+                const unsigned long int level =
+                    (accesses * (sizeof(levels) - 2) + hottest - 1) / hottest;
+                row[s] = levels[level];
+                reads += heat->reads;
+                writes += heat->writes;
+            }
+            row[sectors] = '\0';
+            if (reads + writes == 0)
+                continue;
+            ceda_string_printf(msg, "%5u %4u |%s| %lu %lu\n", t, h, row, reads,
+                               writes);
+        }
+    }
+
+    return msg;
+}
+
+/**
+ * @brief Show or reset the statistics of the FDC.
+ *
+ * Expected command line syntax:
+ *  fdc stats [reset]
+ *  fdc heat [drive]
+ * where
+ *  stats: show per command count, bytes transferred, emulated and host time
+ *      from command to result, emulated latency histogram, and the hottest
+ *      sectors
+ *  reset: clear all statistics
+ *  heat: show the sector access heatmap of drive (default is 0)
+ */
+static ceda_string_t *cli_fdc(const char *arg) {
+    char word[LINE_BUFFER_SIZE];
+
+    // skip argv[0]
+    arg = tokenizer_next_word(word, arg, LINE_BUFFER_SIZE);
+
+    arg = tokenizer_next_word(word, arg, LINE_BUFFER_SIZE);
+    if (arg != NULL && strcmp(word, "stats") == 0) {
+        arg = tokenizer_next_word(word, arg, LINE_BUFFER_SIZE);
+        if (arg == NULL)
+            return cli_fdc_stats();
+        if (strcmp(word, "reset") == 0) {
+            fdc_resetStats();
+            return NULL;
+        }
+    } else if (arg != NULL && strcmp(word, "heat") == 0) {
+        unsigned int drive = 0;
+        if (tokenizer_next_int(&drive, arg) == NULL)
+            drive = 0;
+        if (drive < FDC_STATS_UNITS)
+            return cli_fdc_heat(drive);
+    }
+
+    ceda_string_t *msg = ceda_string_new(0);
+    ceda_string_cpy(msg, USER_BAD_ARG_STR "expected stats [reset] or heat "
+                                          "[drive]\n");
+    return msg;
+}
+
 /**
  * @brief Load a chunk of memory from disk.
  *
@@ -757,7 +1339,89 @@ static ceda_string_t *cli_out(const char *arg) {
     return NULL;
 }
 
+/**
+ * @brief Capture serial traffic, or convert a capture.
+ *
+ * Expected command line syntax:
+ *  serial capture [on <file> | off | convert <capture> <output> [text|pcap]]
+ */
+static ceda_string_t *cli_serial_capture(const char *arg) {
+    char word[LINE_BUFFER_SIZE];
+    ceda_string_t *msg = ceda_string_new(0);
+
+    arg = tokenizer_next_word(word, arg, LINE_BUFFER_SIZE);
+    if (arg == NULL) {
+        ceda_string_cpy(msg, siocap_isActive() ? "capturing\n"
+                                               : "not capturing\n");
+        return msg;
+    }
+
+    if (strcmp(word, "on") == 0) {
+        arg = tokenizer_next_word(word, arg, LINE_BUFFER_SIZE);
+        if (arg == NULL) {
+            ceda_string_cpy(msg, USER_BAD_ARG_STR "no file specified\n");
+            return msg;
+        }
+        if (!siocap_start(word)) {
+            ceda_string_cpy(msg, "unable to open file\n");
+            return msg;
+        }
+    } else if (strcmp(word, "off") == 0) {
+        siocap_stop();
+    } else if (strcmp(word, "convert") == 0) {
+        char in_path[LINE_BUFFER_SIZE];
+        char out_path[LINE_BUFFER_SIZE];
+        arg = tokenizer_next_word(in_path, arg, LINE_BUFFER_SIZE);
+        if (arg != NULL)
+            arg = tokenizer_next_word(out_path, arg, LINE_BUFFER_SIZE);
+        if (arg == NULL) {
+            ceda_string_cpy(msg, USER_BAD_ARG_STR "no file specified\n");
+            return msg;
+        }
+
+        siocap_format_t format = SIOCAP_FORMAT_TEXT;
+        if (tokenizer_next_word(word, arg, LINE_BUFFER_SIZE) != NULL) {
+            if (strcmp(word, "pcap") == 0) {
+                format = SIOCAP_FORMAT_PCAP;
+            } else if (strcmp(word, "text") != 0) {
+                ceda_string_cpy(msg, USER_BAD_ARG_STR
+                                "expected text or pcap\n");
+                return msg;
+            }
+        }
+
+        if (!siocap_convert(in_path, out_path, format)) {
+            ceda_string_cpy(msg, "unable to convert file\n");
+            return msg;
+        }
+    } else {
+        ceda_string_cpy(msg, USER_BAD_ARG_STR "expected on, off or convert\n");
+        return msg;
+    }
+
+    ceda_string_delete(msg);
+    return NULL;
+}
+
+/**
+ * @brief Emulate the serial port, or show how it is emulated.
+ *
+ * Expected command line syntax:
+ *  serial [tcp [port] | pty | file <output> [input] | close | capture ...]
+ * where
+ *  tcp: tcp server, on default port if not specified (open is an alias)
+ *  pty: pseudo-terminal, its device is shown
+ *  file: append transmitted data to output, receive data from input;
+ *        both can be fifos (no spaces allowed)
+ *  capture: see cli_serial_capture()
+ */
 static ceda_string_t *cli_serial(const char *arg) {
+    static const char *const backend_names[] = {
+        [SERIAL_BACKEND_NONE] = "closed",
+        [SERIAL_BACKEND_TCP] = "tcp",
+        [SERIAL_BACKEND_PTY] = "pty",
+        [SERIAL_BACKEND_FILE] = "file",
+    };
     char word[LINE_BUFFER_SIZE];
     ceda_string_t *msg = ceda_string_new(0);
 
@@ -767,20 +1431,233 @@ static ceda_string_t *cli_serial(const char *arg) {
     // extract command
     arg = tokenizer_next_word(word, arg, LINE_BUFFER_SIZE);
 
+    bool ok = true;
     if (arg == NULL) {
-        ceda_string_cpy(msg, USER_BAD_ARG_STR "missing command\n");
+        // just show the current status
+    } else if (strcmp(word, "open") == 0 || strcmp(word, "tcp") == 0) {
+        unsigned int port = 0;
+        char port_word[LINE_BUFFER_SIZE];
+        if (tokenizer_next_word(port_word, arg, LINE_BUFFER_SIZE) != NULL &&
+            (tokenizer_next_int(&port, arg) == NULL || port > UINT16_MAX)) {
+            ceda_string_cpy(msg, USER_BAD_ARG_STR "invalid port\n");
+            return msg;
+        }
+        ok = serial_openTcp((uint16_t)port);
+    } else if (strcmp(word, "pty") == 0) {
+        ok = serial_openPty();
+    } else if (strcmp(word, "file") == 0) {
+        char output[LINE_BUFFER_SIZE];
+        char input[LINE_BUFFER_SIZE];
+        arg = tokenizer_next_word(output, arg, LINE_BUFFER_SIZE);
+        if (arg == NULL) {
+            ceda_string_cpy(msg, USER_BAD_ARG_STR "missing output file\n");
+            return msg;
+        }
+        arg = tokenizer_next_word(input, arg, LINE_BUFFER_SIZE);
+        ok = serial_openFile(output, arg != NULL ? input : NULL);
+    } else if (strcmp(word, "close") == 0) {
+        serial_close();
+        ceda_string_delete(msg);
+        return NULL;
+    } else if (strcmp(word, "capture") == 0) {
+        ceda_string_delete(msg);
+        return cli_serial_capture(arg);
+    } else {
+        ceda_string_cpy(msg, USER_BAD_ARG_STR
+                        "expected tcp, pty, file, close or capture\n");
         return msg;
     }
 
-    if (strcmp(word, "open") == 0) {
-        serial_open(0);
+    if (!ok) {
+        ceda_string_cpy(msg, "unable to open serial port\n");
+        return msg;
+    }
+
+    const serial_backend_t backend = serial_getBackend();
+    ceda_string_printf(msg, "%s", backend_names[backend]);
+    if (backend != SERIAL_BACKEND_NONE)
+        ceda_string_printf(msg, " %s", serial_getPath());
+    ceda_string_printf(msg, "\n");
+    return msg;
+}
+
+/**
+ * @brief Start or stop the gdb remote protocol stub, or show its status.
+ *
+ * Expected command line syntax:
+ *  gdb [open [port] | close]
+ * where
+ *  open: listen on the loopback interface, on default port if not specified
+ */
+static ceda_string_t *cli_gdb(const char *arg) {
+    char word[LINE_BUFFER_SIZE];
+    ceda_string_t *msg = ceda_string_new(0);
+
+    // skip argv[0]
+    arg = tokenizer_next_word(word, arg, LINE_BUFFER_SIZE);
+
+    // extract command
+    arg = tokenizer_next_word(word, arg, LINE_BUFFER_SIZE);
+
+    if (arg == NULL) {
+        // just show the current status
+    } else if (strcmp(word, "open") == 0) {
+        unsigned int port = 0;
+        char port_word[LINE_BUFFER_SIZE];
+        if (tokenizer_next_word(port_word, arg, LINE_BUFFER_SIZE) != NULL &&
+            (tokenizer_next_int(&port, arg) == NULL || port > UINT16_MAX)) {
+            ceda_string_cpy(msg, USER_BAD_ARG_STR "invalid port\n");
+            return msg;
+        }
+        if (!gdb_open((uint16_t)port)) {
+            ceda_string_cpy(msg, "unable to open gdb stub\n");
+            return msg;
+        }
     } else if (strcmp(word, "close") == 0) {
-        serial_close();
+        gdb_close();
     } else {
         ceda_string_cpy(msg, USER_BAD_ARG_STR "expected open or close\n");
         return msg;
     }
 
+    const uint16_t port = gdb_getPort();
+    if (port == 0)
+        ceda_string_cpy(msg, "closed\n");
+    else
+        ceda_string_printf(msg, "port %u, %s\n", (unsigned int)port,
+                           gdb_isConnected() ? "connected" : "waiting");
+    return msg;
+}
+
+static ceda_string_t *cli_automation(const char *arg) {
+    ceda_string_t *msg = ceda_string_new(0);
+
+    const char *error = automation_command(arg);
+    if (error != NULL) {
+        ceda_string_cpy(msg, USER_BAD_ARG_STR);
+        ceda_string_cat(msg, error);
+        return msg;
+    }
+
+    ceda_string_delete(msg);
+    return NULL;
+}
+
+static ceda_string_t *cli_expect(const char *arg) {
+    char word[LINE_BUFFER_SIZE];
+
+    // skip argv[0]
+    const char *args = tokenizer_next_word(word, arg, LINE_BUFFER_SIZE);
+
+    // no arguments: show pending automation
+    if (tokenizer_next_word(word, args, LINE_BUFFER_SIZE) == NULL)
+        return automation_status();
+
+    if (strcmp(word, "abort") == 0) {
+        automation_abort();
+        return NULL;
+    }
+
+    return cli_automation(arg);
+}
+
+static ceda_string_t *cli_type(const char *arg) {
+    char word[LINE_BUFFER_SIZE];
+
+    // skip argv[0]
+    const char *args = tokenizer_next_word(word, arg, LINE_BUFFER_SIZE);
+
+    // type "<text>" or type @<file>
+    if (tokenizer_next_word(word, args, LINE_BUFFER_SIZE) == NULL ||
+        word[0] != '@')
+        return cli_automation(arg);
+
+    if (!automation_typeFile(&word[1])) {
+        ceda_string_t *msg = ceda_string_new(0);
+        ceda_string_cpy(msg, "unable to load file\n");
+        return msg;
+    }
+
+    return NULL;
+}
+
+static ceda_string_t *cli_script(const char *arg) {
+    char filename[LINE_BUFFER_SIZE];
+
+    // skip argv[0]
+    arg = tokenizer_next_word(filename, arg, LINE_BUFFER_SIZE);
+
+    arg = tokenizer_next_word(filename, arg, LINE_BUFFER_SIZE);
+    if (arg == NULL) {
+        ceda_string_t *msg = ceda_string_new(0);
+        ceda_string_cpy(msg, "no file specified\n");
+        return msg;
+    }
+
+    if (!automation_loadScript(filename)) {
+        ceda_string_t *msg = ceda_string_new(0);
+        ceda_string_cpy(msg, "unable to load script\n");
+        return msg;
+    }
+
+    return NULL;
+}
+
+static ceda_string_t *cli_capture(const char *arg) {
+    char filename[LINE_BUFFER_SIZE];
+
+    // skip argv[0]
+    arg = tokenizer_next_word(filename, arg, LINE_BUFFER_SIZE);
+
+    arg = tokenizer_next_word(filename, arg, LINE_BUFFER_SIZE);
+    if (arg == NULL) {
+        ceda_string_t *msg = ceda_string_new(0);
+        ceda_string_cpy(msg, "no file specified\n");
+        return msg;
+    }
+
+    if (!record_capture(filename, video_frame())) {
+        ceda_string_t *msg = ceda_string_new(0);
+        ceda_string_cpy(msg, "unable to write file\n");
+        return msg;
+    }
+
+    return NULL;
+}
+
+static ceda_string_t *cli_record(const char *arg) {
+    char word[LINE_BUFFER_SIZE];
+    ceda_string_t *msg = ceda_string_new(0);
+
+    // skip argv[0]
+    arg = tokenizer_next_word(word, arg, LINE_BUFFER_SIZE);
+
+    // extract command
+    arg = tokenizer_next_word(word, arg, LINE_BUFFER_SIZE);
+
+    if (arg == NULL) {
+        ceda_string_cpy(msg, record_isActive() ? "recording\n"
+                                               : "not recording\n");
+        return msg;
+    }
+
+    if (strcmp(word, "start") == 0) {
+        arg = tokenizer_next_word(word, arg, LINE_BUFFER_SIZE);
+        if (arg == NULL) {
+            ceda_string_cpy(msg, USER_BAD_ARG_STR "no file specified\n");
+            return msg;
+        }
+        if (!record_start(word)) {
+            ceda_string_cpy(msg, "unable to open file\n");
+            return msg;
+        }
+    } else if (strcmp(word, "stop") == 0) {
+        record_stop();
+    } else {
+        ceda_string_cpy(msg, USER_BAD_ARG_STR "expected start or stop\n");
+        return msg;
+    }
+
     ceda_string_delete(msg);
     return NULL;
 }
@@ -817,15 +1694,44 @@ static const cli_command cli_commands[] = {
     {"int", "trigger interrupt request", cli_int},
     {"read", "read from memory", cli_read},
     {"write", "write to memory", cli_write},
+    {"readbin", "read raw memory content, prefixed by its size", cli_readbin},
+    {"writebin", "write raw memory content, following the command line",
+     cli_writebin},
+    {"fill", "fill memory with a value", cli_fill},
+    {"copy", "copy memory", cli_copy},
     {"in", "read from io", cli_in},
     {"out", "write to io", cli_out},
-    {"mount", "load floppy image in from specified drive (default is 0)",
+    {"mount",
+     "load floppy image in from specified drive (default is 0), "
+     "optionally with overlay",
      cli_mount},
+    {"mountdir",
+     "load cp/m disk made of host directory files in specified drive "
+     "(default is 0)",
+     cli_mountdir},
     {"umount", "unload floppy from specified drive (default is 0)", cli_umount},
-    {"serial", "open tcp socket to emulate serial port", cli_serial},
+    {"sync", "flush written floppy sectors (default is all drives)",
+     cli_sync},
+    {"commit", "write floppy overlay into its base image", cli_overlay},
+    {"discard", "drop floppy overlay, reverting to its base image",
+     cli_overlay},
+    {"fdc", "show floppy disk controller statistics, or reset them", cli_fdc},
+    {"serial",
+     "emulate serial port with a tcp socket, a pty or files, or show how it "
+     "is emulated; capture serial traffic",
+     cli_serial},
+    {"gdb", "start or stop the gdb stub, or show its status", cli_gdb},
     {"load", "load binary from file", cli_load},
     {"run", "load binary from file and run", cli_run},
     {"save", "save memory dump to file", cli_save},
+    {"expect", "wait for regex on screen, or show/abort pending automation",
+     cli_expect},
+    {"type",
+     "type \"text\" or @file on the keyboard, after pending automation",
+     cli_type},
+    {"script", "run automation script from file", cli_script},
+    {"capture", "save screen to ppm file", cli_capture},
+    {"record", "start or stop recording screen to file", cli_record},
     {"quit", "quit the emulator", cli_quit},
     {"help", "show this help", cli_help},
 };
@@ -839,11 +1745,7 @@ static const cli_command cli_commands[] = {
  * @param line pointer to ceda_string_t string representing the command line
  */
 static void cli_handle_line(ceda_string_t *line) {
-    // TODO(giomba): this is a "memory leak",
-    // because nobody is going to free this last_line ceda_string_t.
-    static ceda_string_t *last_line = NULL;
-    if (last_line == NULL)
-        last_line = ceda_string_new(0);
+    ceda_string_t *last_line = client->last_line;
 
     // size == 0 => reuse last command line
     if (ceda_string_len(line) == 0) {
@@ -874,7 +1776,9 @@ static void cli_handle_line(ceda_string_t *line) {
                 cli_send_string(ceda_string_data(msg));
                 ceda_string_delete(msg);
             }
-            cli_send_string(USER_PROMPT_STR);
+            // prompt follows raw data, if any
+            if (client->raw_remaining == 0)
+                cli_send_string(USER_PROMPT_STR);
             return;
         }
     }
@@ -891,16 +1795,37 @@ static void cli_handle_line(ceda_string_t *line) {
  * This function also discards any '\r' and '\n' from the incoming stream,
  * and produce a nice null-terminated C string for each incoming line.
  *
- * Then, lines are parsed as commands.
+ * Then, lines are parsed as commands, on behalf of the current client.
+ * Data is not handled any more when there could be no room for the reply
+ * in the client output queue.
  *
  * @param buffer Pointer to raw data buffer.
  * @param size Lenght of raw data.
+ *
+ * @return Count of bytes handled, the others must be handled later.
  */
-static void cli_handle_incoming_data(const char *buffer, size_t size) {
-    static char line[LINE_BUFFER_SIZE] = {};
-    static size_t count = 0;
+static size_t cli_handle_incoming_data(const char *buffer, size_t size) {
+    char *const line = client->line;
+    size_t i = 0;
+
+    for (; i < size; ++i) {
+        // wait for the client to read some output
+        if (ring_space(&client->tx_ring) < TX_RESERVED_SIZE)
+            break;
+
+        // raw data for writebin
+        if (client->raw_remaining > 0) {
+            const size_t chunk = MIN(client->raw_remaining, size - i);
+            for (size_t j = 0; j < chunk; ++j)
+                bus_mem_write(client->raw_address++, (uint8_t)buffer[i + j]);
+            client->raw_remaining -= chunk;
+            i += chunk - 1;
+
+            if (client->raw_remaining == 0)
+                cli_send_string(USER_PROMPT_STR);
+            continue;
+        }
 
-    for (size_t i = 0; i < size; ++i) {
         const char c = buffer[i];
 
         // discard cr
@@ -908,18 +1833,20 @@ static void cli_handle_incoming_data(const char *buffer, size_t size) {
             continue;
 
         // new line: handle what has been read
-        if (c == '\n' || count == LINE_BUFFER_SIZE - 1) {
-            line[count] = '\0';
+        if (c == '\n' || client->line_count == LINE_BUFFER_SIZE - 1) {
+            line[client->line_count] = '\0';
             ceda_string_t *line_string = ceda_string_new(0);
             ceda_string_cpy(line_string, line);
             cli_handle_line(line_string);
             ceda_string_delete(line_string);
-            count = 0;
+            client->line_count = 0;
             continue;
         }
 
-        line[count++] = c;
+        line[client->line_count++] = c;
     }
+
+    return i;
 }
 
 static ceda_string_t *cli_help(const char *arg) {
@@ -939,127 +1866,155 @@ static bool cli_start(void) {
     return initialized;
 }
 
-static void cli_poll(void) {
-    last_update = time_now_us();
+static cli_client_t *cli_find_client(int fd) {
+    for (size_t i = 0; i < ARRAY_SIZE(clients); ++i) {
+        if (clients[i].fd == fd)
+            return &clients[i];
+    }
+    return NULL;
+}
 
-    if (!initialized)
-        return;
+static void cli_disconnect(cli_client_t *c) {
+    LOG_DEBUG("disconnect cli client %d\n", c->fd);
+    reactor_remove(c->fd);
+    close(c->fd);
+    c->fd = -1;
 
-    struct timeval timeout;
-    timeout.tv_sec = 0;
-    timeout.tv_usec = 0;
+    ring_cleanup(&c->tx_ring);
+    ceda_string_delete(c->last_line);
+    c->last_line = NULL;
 
-    // if no client is connected, select() for the accept()
-    if (connfd == -1) {
-        fd_set accept_set;
-        FD_ZERO(&accept_set);
-        FD_SET(sockfd, &accept_set);
-        int ret = select(sockfd + 1, &accept_set, NULL, NULL, &timeout);
-        if (ret == -1) {
-            LOG_ERR("error during select while accepting new client: %s\n",
-                    strerror(errno));
-            return;
-        }
-        if (ret == 0) {
-            // just a timeout
-            return;
-        }
+    // there is room for another client
+    reactor_modify(sockfd, REACTOR_READ);
+}
 
-        LOG_DEBUG("accept cli client\n");
-        connfd = accept(sockfd, NULL, NULL);
-        cli_send_string(USER_PROMPT_STR);
+/**
+ * @brief Handle commands received from a client, as long as its output
+ * queue has room for the replies.
+ */
+static void cli_handle_pending_data(cli_client_t *c) {
+    client = c;
+    const size_t handled = cli_handle_incoming_data(c->rx_buffer, c->rx_count);
+    client = NULL;
 
-        // a client is connected, select() for read() or write()
-        // this is reasonable because we handle only one client
-    } else {
-        int ret = -1;
-        fd_set read_set;
-        fd_set write_set;
-        FD_ZERO(&read_set);
-        FD_ZERO(&write_set);
-        FD_SET(connfd, &read_set);
-        FD_SET(connfd, &write_set);
-
-        ret = select(connfd + 1, &read_set, &write_set, NULL, &timeout);
-        if (ret == -1) {
-            LOG_ERR("select error while reading from client: %s\n",
+    c->rx_count -= handled;
+    memmove(c->rx_buffer, &c->rx_buffer[handled], c->rx_count);
+
+    cli_update_events(c);
+}
+
+static void cli_handle_client(int fd, unsigned int events) {
+    cli_client_t *c = cli_find_client(fd);
+    assert(c != NULL);
+
+    // check file descriptors ready for read
+    if (events & REACTOR_READ) {
+        ssize_t ret = recv(fd, &c->rx_buffer[c->rx_count],
+                           sizeof(c->rx_buffer) - c->rx_count, MSG_DONTWAIT);
+        if (ret == -1 && errno != EAGAIN && errno != EWOULDBLOCK &&
+            errno != EINTR) {
+            LOG_ERR("recv error while reading from client: %s\n",
                     strerror(errno));
-            close(connfd);
-            connfd = -1;
+            cli_disconnect(c);
             return;
         }
         if (ret == 0) {
-            // just a timeout
+            // client disconnection
+            cli_disconnect(c);
             return;
         }
-
-        // check file descriptors ready for read
-        if (FD_ISSET(connfd, &read_set)) {
-            char buffer[256];
-            ssize_t ret = recv(connfd, buffer, 256 - 1, 0);
-            if (ret == -1) {
-                LOG_ERR("recv error while reading from client: %s\n",
-                        strerror(errno));
-                close(connfd);
-                connfd = -1;
-                return;
-            }
-            if (ret == 0) {
-                // client disconnection
-                close(connfd);
-                connfd = -1;
-                return;
-            }
-            // data available
-            cli_handle_incoming_data(buffer, (size_t)ret);
+        // data available
+        if (ret > 0) {
+            c->rx_count += (size_t)ret;
+            cli_handle_pending_data(c);
         }
+    }
 
-        // check file descriptors ready for write
-        if (FD_ISSET(connfd, &write_set)) {
-            while (!FIFO_ISEMPTY(&tx_fifo)) {
-                ceda_string_t *message = FIFO_POP(&tx_fifo);
-
-                ssize_t ret = send(connfd, ceda_string_data(message),
-                                   strlen(ceda_string_data(message)), 0);
-                ceda_string_delete(message);
-
-                if (ret == -1) {
-                    LOG_ERR("send error while writing to client: %s\n",
-                            strerror(errno));
-                    close(connfd);
-                    connfd = -1;
-                    return;
-                }
-            }
+    // check file descriptors ready for write
+    if (events & REACTOR_WRITE) {
+        struct iovec iov[2];
+        struct msghdr msg = {
+            .msg_iov = iov,
+            .msg_iovlen = (size_t)ring_dataIov(&c->tx_ring, iov),
+        };
+        ssize_t ret = sendmsg(fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (ret == -1 && errno != EAGAIN && errno != EWOULDBLOCK &&
+            errno != EINTR) {
+            LOG_ERR("send error while writing to client: %s\n",
+                    strerror(errno));
+            cli_disconnect(c);
+            return;
         }
+        if (ret > 0)
+            ring_consume(&c->tx_ring, (size_t)ret);
+
+        // commands left behind for lack of room can be handled now;
+        // the rest of the output is sent when the client is writable again
+        cli_handle_pending_data(c);
     }
 }
 
-static us_interval_t cli_remaining(void) {
-    const us_time_t next_update = last_update + UPDATE_INTERVAL;
-    const us_time_t now = time_now_us();
-    const us_interval_t diff = next_update - now;
-    return diff;
+static void cli_handle_accept(int fd, unsigned int events) {
+    (void)events;
+
+    cli_client_t *c = cli_find_client(-1);
+    if (c == NULL) {
+        // no more clients until one disconnects
+        reactor_modify(sockfd, 0);
+        return;
+    }
+
+    LOG_DEBUG("accept cli client\n");
+    const int connfd = accept(fd, NULL, NULL);
+    if (connfd == -1) {
+        LOG_ERR("error while accepting new client: %s\n", strerror(errno));
+        return;
+    }
+    if (!ring_init(&c->tx_ring, TX_BUFFER_SIZE)) {
+        LOG_ERR("unable to allocate client buffer\n");
+        close(connfd);
+        return;
+    }
+    if (!reactor_add(connfd, REACTOR_READ, cli_handle_client)) {
+        ring_cleanup(&c->tx_ring);
+        close(connfd);
+        return;
+    }
+
+    c->fd = connfd;
+    c->rx_count = 0;
+    c->line_count = 0;
+    c->last_line = ceda_string_new(0);
+    c->raw_remaining = 0;
+
+    client = c;
+    cli_send_string(USER_PROMPT_STR);
+    client = NULL;
 }
 
 void cli_cleanup(void) {
     if (!initialized)
         return;
 
-    if (connfd != -1)
-        close(connfd);
-    if (sockfd != -1)
+    for (size_t i = 0; i < ARRAY_SIZE(clients); ++i) {
+        if (clients[i].fd != -1)
+            cli_disconnect(&clients[i]);
+    }
+    if (sockfd != -1) {
+        reactor_remove(sockfd);
         close(sockfd);
+    }
 }
 
 void cli_init(CEDAModule *mod) {
     memset(mod, 0, sizeof(*mod));
     mod->init = cli_init;
     mod->start = cli_start;
-    mod->poll = cli_poll;
-    mod->remaining = cli_remaining;
     mod->cleanup = cli_cleanup;
 
+    for (size_t i = 0; i < ARRAY_SIZE(clients); ++i)
+        clients[i].fd = -1;
+
     struct sockaddr_in server_addr;
     sockfd = socket(AF_INET, SOCK_STREAM, 0);
     if (sockfd == -1) {
@@ -1083,12 +2038,13 @@ void cli_init(CEDAModule *mod) {
         return;
     }
 
-    if (listen(sockfd, 1) != 0) {
+    if (listen(sockfd, CLI_MAX_CLIENTS) != 0) {
         LOG_WARN("unable to listen(): %s\n", strerror(errno));
         return;
     }
 
-    FIFO_INIT(&tx_fifo);
+    if (!reactor_add(sockfd, REACTOR_READ, cli_handle_accept))
+        return;
 
     LOG_INFO("cli ok\n");
     initialized = true;
@@ -1097,6 +2053,7 @@ void cli_init(CEDAModule *mod) {
 #ifdef CEDA_TEST
 
 #include <criterion/criterion.h>
+#include <limits.h>
 
 struct test {
     bool input; // true => is user input line,
@@ -1105,7 +2062,17 @@ struct test {
 };
 
 static void cli_test_setup(void) {
-    FIFO_INIT(&tx_fifo);
+    // fake client, not watched by the reactor
+    client = &clients[0];
+    client->fd = INT_MAX;
+    client->rx_count = 0;
+    client->line_count = 0;
+    client->raw_remaining = 0;
+    if (client->last_line == NULL)
+        client->last_line = ceda_string_new(0);
+    if (client->tx_ring.buffer == NULL)
+        cr_assert(ring_init(&client->tx_ring, TX_BUFFER_SIZE));
+    ring_flush(&client->tx_ring);
 }
 
 static void run_tests(struct test *tests, size_t n) {
@@ -1125,10 +2092,11 @@ static void run_tests(struct test *tests, size_t n) {
             ceda_string_delete(text);
         } else {
             const char *expected = tst->text ? tst->text : USER_PROMPT_STR;
-            cr_assert(!FIFO_ISEMPTY(&tx_fifo));
-            ceda_string_t *message = FIFO_POP(&tx_fifo);
-            cr_assert_str_eq(ceda_string_data(message), expected);
-            ceda_string_delete(message);
+            char message[BLOCK_BUFFER_SIZE] = {0};
+            const size_t size = strlen(expected);
+            cr_assert_leq(size, sizeof(message) - 1);
+            cr_assert_eq(ring_pop(&client->tx_ring, message, size), size);
+            cr_assert_str_eq(message, expected);
         }
     }
 }
@@ -1186,4 +2154,80 @@ Test(cli, delete, .init = cli_test_setup) {
     run_tests(tests, ARRAY_SIZE(tests));
 }
 
+Test(cli, expect, .init = cli_test_setup) {
+    /* clang-format off */
+    struct test tests[] = {
+        {true,  "expect"},
+        {false, "no automation in progress\n"},
+        {false, USER_PROMPT_STR},
+        {true,  "expect \"(\""},
+        {false, USER_BAD_ARG_STR "bad regular expression\n"},
+        {false, USER_PROMPT_STR},
+        {true,  "expect \"A>\" 5"},
+        {false, USER_PROMPT_STR},
+        {true,  "type \"dir\\r\""},
+        {false, USER_PROMPT_STR},
+        {true,  "expect"},
+        {false, "expect \"A>\" 5\ntype 4 chars\n"},
+        {false, USER_PROMPT_STR},
+        {true,  "expect abort"},
+        {false, USER_PROMPT_STR},
+        {true,  "expect"},
+        {false, "no automation in progress\n"},
+        {false, USER_PROMPT_STR},
+    };
+    /* clang-format on */
+    run_tests(tests, ARRAY_SIZE(tests));
+}
+
+Test(cli, binary, .init = cli_test_setup) {
+    ring_t *tx_ring = &client->tx_ring;
+    char data[64];
+
+    // data follows the command line, then the prompt
+    const char writebin[] = "writebin 100 4\n\x01\x00\xff\x7f";
+    cr_assert_eq(cli_handle_incoming_data(writebin, sizeof(writebin) - 3),
+                 sizeof(writebin) - 3);
+    cr_assert_eq(ring_count(tx_ring), 0);
+    cr_assert_eq(
+        cli_handle_incoming_data(&writebin[sizeof(writebin) - 3], 2), 2);
+    cr_assert_eq(ring_pop(tx_ring, data, sizeof(data)), 2);
+    cr_assert_arr_eq(data, USER_PROMPT_STR, 2);
+
+    // overlapping copy: 0100: 01 00 01 00 ff 7f aa aa
+    const char commands[] = "copy 100 4 102\n"
+                            "fill 106 2 aa\n"
+                            "readbin 100 8\n";
+    cr_assert_eq(cli_handle_incoming_data(commands, sizeof(commands) - 1),
+                 sizeof(commands) - 1);
+    const char expected[] = "> > \x08\x00\x00\x00"
+                            "\x01\x00\x01\x00\xff\x7f\xaa\xaa> ";
+    cr_assert_eq(ring_pop(tx_ring, data, sizeof(data)),
+                 sizeof(expected) - 1);
+    cr_assert_arr_eq(data, expected, sizeof(expected) - 1);
+}
+
+Test(cli, backpressure, .init = cli_test_setup) {
+    static const char command[] = "readbin 0 8000\n";
+    const size_t command_size = sizeof(command) - 1;
+    const size_t reply_size = 4 + 0x8000 + 2;
+    char commands[8 * sizeof(command)] = {0};
+    for (size_t i = 0; i < 8; ++i)
+        strcat(commands, command);
+
+    // commands are left behind while replies could not fit
+    const size_t handled =
+        cli_handle_incoming_data(commands, 8 * command_size);
+    const size_t replies = handled / command_size;
+    cr_assert_lt(replies, 8);
+    cr_assert_eq(handled, replies * command_size);
+    cr_assert_eq(ring_count(&client->tx_ring), replies * reply_size);
+    cr_assert_lt(ring_space(&client->tx_ring), TX_RESERVED_SIZE);
+
+    // until the client reads some output
+    ring_consume(&client->tx_ring, reply_size);
+    cr_assert_eq(cli_handle_incoming_data(&commands[handled], command_size),
+                 command_size);
+}
+
 #endif
@@ -27,7 +27,28 @@ static struct {
     ceda_string_t *bios_rom_path;
     ceda_string_t *char_rom_path;
     ceda_string_t *cge_rom_path;
-} conf;
+    ceda_string_t *automation_script_path;
+    ceda_string_t *video_output;
+    ceda_string_t *video_shm;
+    ceda_string_t *floppy_write;
+    uint32_t floppy_flush_interval;
+    bool floppy_fsync;
+    ceda_string_t *floppy_geometry;
+    bool floppy_gzip_sidecar;
+    ceda_string_t *floppy_cpm_dpb;
+    ceda_string_t *floppy_cpm_system;
+    bool floppy_async;
+    ceda_string_t *fdc_timing;
+    ceda_string_t *serial_baud_a;
+    ceda_string_t *serial_baud_b;
+    uint32_t serial_buffer_size;
+    ceda_string_t *serial_sink_b;
+    uint32_t serial_sink_rotate;
+    uint32_t gdb_port;
+} conf = {
+    // defaults, where not false, 0 or NULL
+    .floppy_flush_interval = 1000,
+};
 
 typedef enum conf_type_t {
     CONF_NONE,
@@ -51,6 +72,24 @@ static conf_tuple_t conf_tuples[] = {
     {"path", "bios_rom", CONF_STR, &conf.bios_rom_path},
     {"path", "char_rom", CONF_STR, &conf.char_rom_path},
     {"path", "cge_rom", CONF_STR, &conf.cge_rom_path},
+    {"automation", "script", CONF_STR, &conf.automation_script_path},
+    {"video", "output", CONF_STR, &conf.video_output},
+    {"video", "shm", CONF_STR, &conf.video_shm},
+    {"floppy", "write", CONF_STR, &conf.floppy_write},
+    {"floppy", "flush_interval", CONF_U32, &conf.floppy_flush_interval},
+    {"floppy", "fsync", CONF_BOOL, &conf.floppy_fsync},
+    {"floppy", "geometry", CONF_STR, &conf.floppy_geometry},
+    {"floppy", "gzip_sidecar", CONF_BOOL, &conf.floppy_gzip_sidecar},
+    {"floppy", "cpm_dpb", CONF_STR, &conf.floppy_cpm_dpb},
+    {"floppy", "cpm_system", CONF_STR, &conf.floppy_cpm_system},
+    {"floppy", "async", CONF_BOOL, &conf.floppy_async},
+    {"fdc", "timing", CONF_STR, &conf.fdc_timing},
+    {"serial", "baud_a", CONF_STR, &conf.serial_baud_a},
+    {"serial", "baud_b", CONF_STR, &conf.serial_baud_b},
+    {"serial", "buffer_size", CONF_U32, &conf.serial_buffer_size},
+    {"serial", "sink_b", CONF_STR, &conf.serial_sink_b},
+    {"serial", "sink_rotate", CONF_U32, &conf.serial_sink_rotate},
+    {"gdb", "port", CONF_U32, &conf.gdb_port},
     {NULL, NULL, CONF_NONE, NULL},
 };
 
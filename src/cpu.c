@@ -10,12 +10,12 @@
 #include "log.h"
 
 #define CPU_CHUNK_CYCLES 4000
-#define CPU_FREQ         4000000                                       // [Hz]
 #define CPU_CHUNK_PERIOD (CPU_CHUNK_CYCLES * 1000L * 1000L / CPU_FREQ) // [us]
 #define CPU_PAUSE_PERIOD 20000 // [us] 20 ms => 50 Hz
 
 static Z80 cpu;
 static bool pause = true;
+static bool running = false; // true while inside z80_run()
 static unsigned long int cycles = 0;
 static us_time_t last_update = 0;
 static us_time_t update_interval = CPU_PAUSE_PERIOD;
@@ -95,7 +95,9 @@ static void cpu_poll(void) {
     const unsigned int requested_cycles =
         (valid_breakpoints == 0) ? CPU_CHUNK_CYCLES : 1;
 
+    running = true;
     cycles += z80_run(&cpu, requested_cycles);
+    running = false;
     cpu_update_performance();
 }
 
@@ -118,6 +120,10 @@ void cpu_pause(bool enable) {
     }
 }
 
+bool cpu_isPaused(void) {
+    return pause;
+}
+
 void cpu_reg(CpuRegs *regs) {
     if (regs == NULL)
         return;
@@ -141,7 +147,24 @@ void cpu_reg(CpuRegs *regs) {
 
 void cpu_step(void) {
     cpu_pause(true);
-    z80_run(&cpu, 1);
+    running = true;
+    cycles += z80_run(&cpu, 1);
+    running = false;
+}
+
+/**
+ * @brief Get the number of clock cycles emulated so far.
+ *
+ * This is accurate also when called by a peripheral during instruction
+ * execution, so it can be used as the emulated time reference.
+ *
+ * @return unsigned long int Emulated cycles since power on.
+ */
+unsigned long int cpu_getCycles(void) {
+    if (running)
+        return cycles + cpu.cycles;
+
+    return cycles;
 }
 
 void cpu_goto(zuint16 address) {
@@ -8,6 +8,7 @@
 #include <stddef.h>
 
 #define CPU_MAX_OPCODE_LEN 6
+#define CPU_FREQ           4000000 // [Hz]
 
 typedef struct CpuGenRegs {
     zuint16 af;
@@ -34,8 +35,10 @@ typedef struct CpuBreakpoint {
 void cpu_init(CEDAModule *mod);
 
 void cpu_pause(bool enable);
+bool cpu_isPaused(void);
 void cpu_reg(CpuRegs *regs);
 void cpu_step(void);
+unsigned long int cpu_getCycles(void);
 
 /**
  * @brief Move the cpu program counter to the given address.
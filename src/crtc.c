@@ -29,6 +29,10 @@ static uint8_t regs[CRTC_REGISTER_COUNT];
 #define REG_LIGHT_PEN_L                    17
 unsigned int rselect = 0; // current register selected
 
+// the CRTC character clock is not known, so the field rate is fixed
+// and registers only define where the vertical sync falls in it
+#define CRTC_FIELD_CYCLES 80000 // [cycles] 20 ms at 4 MHz => 50 Hz
+
 #define CRTC_NOT_IMPLEMENTED_STR "not implemented\n"
 
 void crtc_init(void) {
@@ -105,8 +109,16 @@ void crtc_out(ceda_ioaddr_t address, uint8_t value) {
             return;
         }
 
+        const bool moved = regs[rselect] != value &&
+                           (rselect == REG_START_ADDRESS_H ||
+                            rselect == REG_START_ADDRESS_L);
+
         regs[rselect] = value;
 
+        // the visible text area has moved
+        if (moved)
+            video_invalidateText();
+
         LOG_DEBUG("cursor = %u\n",
                   regs[REG_CURSOR_H] * 256U + regs[REG_CURSOR_L]);
 
@@ -139,3 +151,52 @@ uint16_t crtc_startAddress(void) {
 
     return start_address;
 }
+
+unsigned int crtc_fieldCycles(void) {
+    return CRTC_FIELD_CYCLES;
+}
+
+unsigned int crtc_vsyncCycles(void) {
+    // registers not programmed yet
+    if (regs[REG_VERTICAL_TOT_CHAR] == 0)
+        return 0;
+
+    const unsigned int raster_per_row = regs[REG_MAX_RASTER_RASTER] + 1U;
+    const unsigned int total_raster =
+        (regs[REG_VERTICAL_TOT_CHAR] + 1U) * raster_per_row +
+        regs[REG_TOTAL_RASTER_ADJUST];
+    const unsigned int vsync_raster =
+        regs[REG_VERTICAL_SYNC_PULSE_POSITION] * raster_per_row;
+
+    if (vsync_raster >= total_raster)
+        return 0;
+
+    return (unsigned int)((unsigned long int)CRTC_FIELD_CYCLES * vsync_raster /
+                          total_raster);
+}
+
+#if defined(CEDA_TEST)
+
+#include <criterion/criterion.h>
+
+static void crtc_write(uint8_t reg, uint8_t value) {
+    crtc_out(0, reg);
+    crtc_out(1, value);
+}
+
+Test(crtc, vsync) {
+    cr_assert_eq(crtc_vsyncCycles(), 0);
+
+    // 30 rows of 16 raster lines, vsync after 27 rows
+    crtc_write(REG_VERTICAL_TOT_CHAR, 29);
+    crtc_write(REG_MAX_RASTER_RASTER, 15);
+    crtc_write(REG_TOTAL_RASTER_ADJUST, 0);
+    crtc_write(REG_VERTICAL_SYNC_PULSE_POSITION, 27);
+    cr_assert_eq(crtc_vsyncCycles(), CRTC_FIELD_CYCLES * 27 / 30);
+
+    // vsync out of field
+    crtc_write(REG_VERTICAL_SYNC_PULSE_POSITION, 30);
+    cr_assert_eq(crtc_vsyncCycles(), 0);
+}
+
+#endif
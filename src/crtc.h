@@ -48,4 +48,19 @@ void crtc_cursorRasterSize(uint8_t *start, uint8_t *end);
  */
 uint16_t crtc_startAddress(void);
 
+/**
+ * @brief Get the duration of a video field, in emulated cpu cycles.
+ *
+ * @return unsigned int Field duration. [cycles]
+ */
+unsigned int crtc_fieldCycles(void);
+
+/**
+ * @brief Get when vertical sync begins, from the beginning of a field.
+ *
+ * @return unsigned int Vertical sync offset, in [0, crtc_fieldCycles()).
+ * [cycles]
+ */
+unsigned int crtc_vsyncCycles(void);
+
 #endif // CEDA_CRTC_H
@@ -0,0 +1,166 @@
+#include "fbshm.h"
+
+#include "video.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define LOG_LEVEL LOG_LVL_INFO
+#include "log.h"
+
+#define FBSHM_ROW_HEIGHT (VIDEO_PIXEL_HEIGHT / VIDEO_ROWS)
+#define FBSHM_ROW_SIZE   (FBSHM_ROW_HEIGHT * VIDEO_COLUMNS)
+#define FBSHM_SIZE       (sizeof(fbshm_header_t) + VIDEO_FRAME_SIZE)
+
+static char shm_name[256];
+static fbshm_header_t *header = NULL;
+static uint8_t *bitmap = NULL;
+
+/**
+ * @brief Create the shared memory frame buffer segment.
+ *
+ * @param name Name of the segment, as for shm_open(), eg. "/ceda0".
+ *
+ * @return true in case of success, false otherwise.
+ */
+bool fbshm_open(const char *name) {
+    if (strlen(name) >= sizeof(shm_name)) {
+        LOG_ERR("shm name too long: %s\n", name);
+        return false;
+    }
+
+    // never take over a segment in use, by viewers or another emulator
+    const int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd == -1 && errno == EEXIST) {
+        LOG_ERR("shm %s already exists, if stale remove /dev/shm%s\n", name,
+                name);
+        return false;
+    }
+    if (fd == -1) {
+        LOG_ERR("unable to shm_open %s: %s\n", name, strerror(errno));
+        return false;
+    }
+
+    if (ftruncate(fd, FBSHM_SIZE) != 0) {
+        LOG_ERR("unable to resize shm %s: %s\n", name, strerror(errno));
+        close(fd);
+        shm_unlink(name);
+        return false;
+    }
+
+    void *ptr =
+        mmap(NULL, FBSHM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ptr == MAP_FAILED) {
+        LOG_ERR("unable to mmap shm %s: %s\n", name, strerror(errno));
+        shm_unlink(name);
+        return false;
+    }
+
+    strcpy(shm_name, name);
+    header = ptr;
+    bitmap = (uint8_t *)ptr + sizeof(fbshm_header_t);
+
+    memcpy(header->magic, FBSHM_MAGIC, sizeof(FBSHM_MAGIC));
+    header->version = FBSHM_VERSION;
+    header->header_size = sizeof(fbshm_header_t);
+    header->width = VIDEO_PIXEL_WIDTH;
+    header->height = VIDEO_PIXEL_HEIGHT;
+    header->pitch = VIDEO_COLUMNS;
+    header->row_height = FBSHM_ROW_HEIGHT;
+
+    LOG_INFO("frame buffer exported in shm %s\n", name);
+    return true;
+}
+
+bool fbshm_isOpen(void) {
+    return header != NULL;
+}
+
+/**
+ * @brief Publish a new video field.
+ *
+ * Only the text rows which actually changed are copied in the segment.
+ *
+ * @param frame Frame bitmap, as returned by video_frame().
+ */
+void fbshm_update(const uint8_t *frame) {
+    if (header == NULL)
+        return;
+
+    __atomic_add_fetch(&header->sequence, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    uint32_t dirty_rows = 0;
+    for (unsigned int row = 0; row < VIDEO_ROWS; ++row) {
+        const size_t offset = (size_t)row * FBSHM_ROW_SIZE;
+        if (memcmp(bitmap + offset, frame + offset, FBSHM_ROW_SIZE) == 0)
+            continue;
+        memcpy(bitmap + offset, frame + offset, FBSHM_ROW_SIZE);
+        dirty_rows |= (uint32_t)1 << row;
+    }
+    header->dirty_rows = dirty_rows;
+    ++header->frames;
+
+    __atomic_add_fetch(&header->sequence, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Remove the shared memory frame buffer segment.
+ */
+void fbshm_close(void) {
+    if (header == NULL)
+        return;
+
+    munmap(header, FBSHM_SIZE);
+    shm_unlink(shm_name);
+    header = NULL;
+    bitmap = NULL;
+}
+
+#if defined(CEDA_TEST)
+
+#include <criterion/criterion.h>
+#include <stdio.h>
+
+Test(fbshm, update) {
+    static uint8_t frame[VIDEO_FRAME_SIZE];
+    char name[32];
+    (void)snprintf(name, sizeof(name), "/ceda-test-%d", (int)getpid());
+
+    cr_assert(fbshm_open(name));
+
+    fbshm_update(frame);
+    cr_assert_eq(header->sequence, 2);
+    cr_assert_eq(header->frames, 1);
+    cr_assert_eq(header->dirty_rows, 0);
+
+    frame[FBSHM_ROW_SIZE * 3] = 0xff;
+    frame[VIDEO_FRAME_SIZE - 1] = 0xff;
+    fbshm_update(frame);
+    cr_assert_eq(header->sequence, 4);
+    cr_assert_eq(header->dirty_rows, (1U << 3) | (1U << (VIDEO_ROWS - 1)));
+    cr_assert_arr_eq(bitmap, frame, VIDEO_FRAME_SIZE);
+
+    fbshm_close();
+    cr_assert_eq(shm_unlink(name), -1);
+}
+
+Test(fbshm, exists) {
+    char name[32];
+    (void)snprintf(name, sizeof(name), "/ceda-test-%d", (int)getpid());
+
+    const int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    cr_assert_neq(fd, -1);
+    close(fd);
+
+    // someone else's segment is left alone
+    cr_assert_not(fbshm_open(name));
+    cr_assert_not(fbshm_isOpen());
+    cr_assert_eq(shm_unlink(name), 0);
+}
+
+#endif
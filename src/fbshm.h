@@ -0,0 +1,44 @@
+#ifndef CEDA_FBSHM_H
+#define CEDA_FBSHM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define FBSHM_MAGIC   "CEDAFB1"
+#define FBSHM_VERSION 1
+
+/**
+ * @brief Layout of the shared memory frame buffer segment.
+ *
+ * External viewers can shm_open() the segment read-only and map it.
+ * The bitmap is 1 bpp, most significant bit first, pitch bytes per line,
+ * and immediately follows this header (at offset header_size).
+ *
+ * Consistency is guaranteed by a sequence lock: sequence is odd while the
+ * emulator is updating the segment. A viewer must read sequence, copy what it
+ * needs, then read sequence again: if it is odd or has changed, the copy must
+ * be discarded and retried.
+ *
+ * dirty_rows only describes the last update: a viewer which missed some
+ * updates, that is frames has increased by more than one since its last
+ * copy, must repaint all the rows.
+ */
+typedef struct fbshm_header_t {
+    char magic[8];        // FBSHM_MAGIC, null-terminated
+    uint32_t version;     // FBSHM_VERSION
+    uint32_t header_size; // [bytes] offset of the bitmap in the segment
+    uint16_t width;       // [pixels]
+    uint16_t height;      // [pixels]
+    uint16_t pitch;       // [bytes] bytes for each line of the bitmap
+    uint16_t row_height;  // [pixels] lines for each text row
+    uint32_t sequence;    // sequence lock, odd while writing
+    uint32_t dirty_rows;  // text rows changed by last update, one bit each
+    uint64_t frames;      // updates since start
+} fbshm_header_t;
+
+bool fbshm_open(const char *name);
+bool fbshm_isOpen(void);
+void fbshm_update(const uint8_t *frame);
+void fbshm_close(void);
+
+#endif // CEDA_FBSHM_H
@@ -2,10 +2,14 @@
 
 #include <assert.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 
+#include "conf.h"
+#include "cpu.h"
 #include "fdc_registers.h"
 #include "macro.h"
+#include "time.h"
 
 #define LOG_LEVEL LOG_LVL_DEBUG
 #include "log.h"
@@ -19,6 +23,29 @@
 // available to the processor (RESULT).
 typedef enum fdc_status_t { CMD, ARGS, EXEC, RESULT } fdc_status_t;
 
+// Timing model.
+// In instant mode, seeks complete and data is available as soon as the
+// processor asks for them.
+// In accurate mode, time is measured in emulated cpu cycles: seeks take the
+// step rate time for each track, and sector data is transferred when it
+// passes under the head, at 300 rpm and 250 kbit/s, sectors being evenly
+// spaced on the track. The head is loaded at the beginning of a transfer,
+// if it was unloaded after a seek or after the head unload time.
+// The FDC is clocked at 4 MHz, as needed for 250 kbit/s, so SPECIFY times are
+// twice the ones of the datasheet (which refers to 8 MHz).
+// Overrun is not emulated: data is never lost if the processor is late.
+typedef enum fdc_timing_t {
+    FDC_TIMING_INSTANT,
+    FDC_TIMING_ACCURATE,
+} fdc_timing_t;
+
+// Time reference is the emulated cpu clock
+#define FDC_CYCLES_PER_MS (CPU_FREQ / 1000UL)
+#define FDC_RPM           (300UL)
+#define FDC_REVOLUTION    (CPU_FREQ * 60UL / FDC_RPM) // [cycles]
+#define FDC_BIT_RATE      (250000UL)                  // [bit/s]
+#define FDC_BYTE_CYCLES   (CPU_FREQ * 8UL / FDC_BIT_RATE) // [cycles]
+
 // Operation descriptor.
 // Each operation has an associated command and a variable length argument,
 // execution and resul phases.
@@ -26,6 +53,7 @@ typedef enum fdc_status_t { CMD, ARGS, EXEC, RESULT } fdc_status_t;
 // post execution.
 typedef struct fdc_operation_t {
     fdc_cmd_t cmd;
+    const char *name;
     // An FDC operation is splitted into 4 steps.
     // If a step len is 0, that step must be skipped.
     size_t args_len;
@@ -88,13 +116,26 @@ static bool is_cmd_out_of_sequence(uint8_t cmd);
 static void fdc_compute_next_status(void);
 static void set_invalid_cmd(void);
 static bool fdc_prepare_read(void);
+static int fdc_probe_next_read(void);
+static void fdc_wait_data(void);
+static void fdc_data_ready(void);
+static void fdc_update_rqm(void);
+static void fdc_update_timing(void);
+static void fdc_seek_start(uint8_t drive, uint8_t cylinder);
+static void fdc_transfer_start(void);
+static void fdc_schedule_sector(void);
+static void fdc_data_served(void);
 static bool fdc_commit_write(void);
+static void fdc_stats_begin(void);
+static void fdc_stats_end(void);
+static void fdc_stats_sector(bool write);
 
 /* Local variables */
 // The command descriptors
 static const fdc_operation_t fdc_operations[] = {
     {
         .cmd = FDC_READ_TRACK,
+        .name = "read track",
         .args_len = 8,
         .result_len = 7,
         .pre_exec = pre_exec_read_track,
@@ -103,6 +144,7 @@ static const fdc_operation_t fdc_operations[] = {
     },
     {
         .cmd = FDC_SPECIFY,
+        .name = "specify",
         .args_len = 2,
         .result_len = 0,
         .pre_exec = pre_exec_specify,
@@ -111,6 +153,7 @@ static const fdc_operation_t fdc_operations[] = {
     },
     {
         .cmd = FDC_WRITE_DATA,
+        .name = "write data",
         .args_len = 8,
         .result_len = 7,
         .pre_exec = pre_exec_write_data,
@@ -119,6 +162,7 @@ static const fdc_operation_t fdc_operations[] = {
     },
     {
         .cmd = FDC_READ_DATA,
+        .name = "read data",
         .args_len = 8,
         .result_len = 7,
         .pre_exec = pre_exec_read_data,
@@ -127,6 +171,7 @@ static const fdc_operation_t fdc_operations[] = {
     },
     {
         .cmd = FDC_RECALIBRATE,
+        .name = "recalibrate",
         .args_len = 1,
         .result_len = 0,
         .pre_exec = pre_exec_recalibrate,
@@ -135,6 +180,7 @@ static const fdc_operation_t fdc_operations[] = {
     },
     {
         .cmd = FDC_SENSE_INTERRUPT,
+        .name = "sense interrupt",
         .args_len = 0,
         .result_len = 2,
         .pre_exec = NULL,
@@ -143,6 +189,7 @@ static const fdc_operation_t fdc_operations[] = {
     },
     {
         .cmd = FDC_WRITE_DELETED_DATA,
+        .name = "write deleted data",
         .args_len = 8,
         .result_len = 7,
         .pre_exec = pre_exec_write_data,
@@ -151,6 +198,7 @@ static const fdc_operation_t fdc_operations[] = {
     },
     {
         .cmd = FDC_READ_DELETED_DATA,
+        .name = "read deleted data",
         .args_len = 8,
         .result_len = 7,
         .pre_exec = pre_exec_read_data,
@@ -159,6 +207,7 @@ static const fdc_operation_t fdc_operations[] = {
     },
     {
         .cmd = FDC_FORMAT_TRACK,
+        .name = "format track",
         .args_len = 5,
         .result_len = 7,
         .pre_exec = pre_exec_format_track,
@@ -167,6 +216,7 @@ static const fdc_operation_t fdc_operations[] = {
     },
     {
         .cmd = FDC_SEEK,
+        .name = "seek",
         .args_len = 2,
         .result_len = 0,
         .pre_exec = pre_exec_seek,
@@ -177,12 +227,15 @@ static const fdc_operation_t fdc_operations[] = {
 // This is a dummy operation used when an invalid command has to be handled
 static const fdc_operation_t invalid_op = {
     .cmd = 0x00, // This command code does't exists
+    .name = "invalid",
     .args_len = 0,
     .result_len = 1, // Invalid command has to report just ST0
     .pre_exec = NULL,
     .exec = NULL,
     .post_exec = NULL,
 };
+static_assert(ARRAY_SIZE(fdc_operations) + 1 == FDC_STATS_COMMANDS,
+              "statistics must cover all the commands");
 // Current FDC status
 static fdc_status_t fdc_status = CMD;
 // Currently selected operation
@@ -198,11 +251,43 @@ static uint8_t args[8];
 // Execution buffer, will keep sector's information
 // TODO(giuliof): at the moment its size is the maximum allowed on CEDA, but
 // FDC can theoretically handle bigger sector sizes
-static uint8_t exec_buffer[1024];
+static uint8_t exec_buffer[FDC_SECTOR_BUFFER_SIZE];
 // Result buffer. Each command has maximum 7 bytes as argument.
 static uint8_t result[7];
 static bool tc_status = false;
 static bool int_status = false;
+// Waiting for sector data from the read callback, see fdc_ioComplete()
+static bool io_pending = false;
+
+/* Timing model, accurate mode only */
+static fdc_timing_t timing = FDC_TIMING_INSTANT;
+// From SPECIFY [cycles]
+static unsigned long int step_cycles = 32 * FDC_CYCLES_PER_MS;
+static unsigned long int head_load_cycles = 4 * FDC_CYCLES_PER_MS;
+static unsigned long int head_unload_cycles = 32 * FDC_CYCLES_PER_MS;
+// Seeks in progress (by drive bit) and when they end [cycles]
+static uint8_t seeking = 0;
+static unsigned long int seek_end[4];
+// Head is loaded since the end of the last transfer [cycles]
+static bool head_loaded = false;
+static unsigned long int head_idle_since = 0;
+// Waiting for the disk to rotate: next byte is available at data_at
+static bool data_wait = false;
+static unsigned long int data_at = 0;     // [cycles]
+static unsigned long int sector_start = 0; // [cycles] current sector
+// Earliest time at which the head can read the next sector [cycles]
+static unsigned long int head_ready_at = 0;
+
+/* Instrumentation */
+// Commands are in the same order as fdc_operations, then the invalid one
+static fdc_stats_t stats;
+static fdc_cmd_stats_t *cmd_stats = NULL; // current command
+static unsigned long int cmd_start = 0;   // [cycles]
+static us_time_t cmd_start_time = 0;
+static unsigned long int exec_bytes = 0; // current command
+static unsigned long int total_bytes = 0; // never reset, for performance
+static float perf_value = 0;
+static const char *perf_unit = "Bps";
 
 /* FDC internal registers */
 enum { MSR, ST0, ST1, ST2, ST3, NUM_OF_SREG };
@@ -235,13 +320,22 @@ static void pre_exec_read_track(void) {
 }
 
 // Specify:
-// Just print the register values, since the emulator does not care
+// Drive timings are only used in accurate mode
 static void pre_exec_specify(void) {
+    const unsigned int hut = args[0] & 0xF;
+    const unsigned int srt = args[0] >> 4;
+    const unsigned int hlt = args[1] >> 1;
+
     LOG_DEBUG("FDC Specify\n");
-    LOG_DEBUG("HUT: %d\n", args[0] & 0xF);
-    LOG_DEBUG("SRT: %d\n", args[0] >> 4);
+    LOG_DEBUG("HUT: %d\n", hut);
+    LOG_DEBUG("SRT: %d\n", srt);
     LOG_DEBUG("ND: %d\n", args[1] & 1);
-    LOG_DEBUG("HLT: %d\n", args[1] >> 1);
+    LOG_DEBUG("HLT: %d\n", hlt);
+
+    // 0 is the largest value for all the fields
+    step_cycles = (16 - srt) * 2 * FDC_CYCLES_PER_MS;
+    head_unload_cycles = (hut == 0 ? 16 : hut) * 32 * FDC_CYCLES_PER_MS;
+    head_load_cycles = (hlt == 0 ? 128 : hlt) * 4 * FDC_CYCLES_PER_MS;
 }
 
 // Write data:
@@ -270,6 +364,7 @@ static void pre_exec_write_data(void) {
     idr.record = rw_args->record;
     memcpy(&next_idr, &idr, sizeof(idr));
 
+    fdc_transfer_start();
     fdc_commit_write();
 }
 
@@ -286,9 +381,10 @@ static uint8_t exec_write_data(uint8_t value) {
     }
 
     exec_buffer[rwcount++] = value;
+    ++exec_bytes;
     // From the manual: in NON-DMA mode, interrupt is generated during
     // execution phase (as soon as new data is available)
-    int_status = true;
+    fdc_data_served();
 
     // More data can be written, just go on with the current buffer
     if (rwcount != rwcount_max)
@@ -384,6 +480,7 @@ static void pre_exec_read_data(void) {
     idr.record = rw_args->record;
     memcpy(&next_idr, &idr, sizeof(idr));
 
+    fdc_transfer_start();
     // TODO(giuliof): may be a good idea to pass a sort of "floppy context"
     fdc_prepare_read();
 }
@@ -394,19 +491,36 @@ static uint8_t exec_read_data(uint8_t value) {
 
     uint8_t ret = 0;
 
+    // Sector data is not available yet, nothing to serve
+    if (io_pending)
+        return 0;
+
     // Sector buffer already populated and on-going reading
     if (rwcount < rwcount_max) {
         ret = exec_buffer[rwcount++];
+        ++exec_bytes;
     }
     // No sector buffer or finished one, try to get another sector from image
     else if ((rwcount_max == 0 || rwcount >= rwcount_max)) {
-        if (fdc_prepare_read())
+        if (fdc_prepare_read()) {
             ret = exec_buffer[rwcount++];
+            ++exec_bytes;
+        } else if (io_pending) {
+            return 0;
+        }
+    }
+
+    // Sector is over: if the next one is not available yet, stop requesting
+    // data until it is, so that no byte is served before it arrives
+    if (rwcount_max != 0 && rwcount == rwcount_max &&
+        fdc_probe_next_read() == DISK_IMAGE_PENDING) {
+        fdc_wait_data();
+        return ret;
     }
 
     // From the manual: in NON-DMA mode, interrupt is generated during
     // execution phase (as soon as new data is available)
-    int_status = true;
+    fdc_data_served();
 
     /* Prepare the next buffer to be read */
     return ret;
@@ -452,10 +566,8 @@ static void pre_exec_recalibrate(void) {
     LOG_DEBUG("FDC Recalibrate\n");
     LOG_DEBUG("Drive: %d\n", drive);
 
-    track[drive] = 0;
-
-    // We don't have to actually move the head. The drive is immediately ready
-    int_status = true;
+    // Interrupt is raised when the head reaches track 0
+    fdc_seek_start(drive, 0);
     // Update the status register with the drive info and the seek end flag
     status_register[ST0] = drive;
     // Update the FDD n busy flag, will be cleared by sense interrupt
@@ -466,9 +578,11 @@ static void pre_exec_recalibrate(void) {
 static void post_exec_sense_interrupt(void) {
     LOG_DEBUG("FDC Sense Interrupt\n");
 
-    // Get the last "seeked" drive number from the MSR
+    // Get the last "seeked" drive number from the MSR, among the drives
+    // whose seek has ended
     uint8_t fdc_busy = status_register[MSR] &
-                       (FDC_ST_D3B | FDC_ST_D2B | FDC_ST_D1B | FDC_ST_D0B);
+                       (FDC_ST_D3B | FDC_ST_D2B | FDC_ST_D1B | FDC_ST_D0B) &
+                       (uint8_t)~seeking;
     // This routine should be called only if fdc is busy
     assert(fdc_busy != 0);
     uint8_t drive = 0;
@@ -481,8 +595,8 @@ static void post_exec_sense_interrupt(void) {
         (FDC_ST_D3B | FDC_ST_D2B | FDC_ST_D1B | FDC_ST_D0B))
         int_status = true;
 
-    /* Status Register 0 */
-    result[0] = status_register[ST0] | FDC_ST0_SE;
+    /* Status Register 0, of the drive whose seek has ended */
+    result[0] = FDC_ST0_SE | drive;
     /* PCN  - (current track position) */
     result[1] = track[drive];
 }
@@ -542,7 +656,12 @@ static void pre_exec_format_track(void) {
 }
 
 static uint8_t exec_format_track(uint8_t value) {
+    // All the ID fields have been received, ignore anything else
+    if (rwcount >= rwcount_max)
+        return 0;
+
     exec_buffer[rwcount++] = value;
+    ++exec_bytes;
 
     return 0;
 }
@@ -562,6 +681,13 @@ static void post_exec_format_track(void) {
         uint8_t head = id_field[1];
         uint8_t record = id_field[2] - 1;
 
+        // Medium may have been removed during execution
+        if (write_buffer_cb == NULL) {
+            status_register[ST0] |= 0x40;
+            tc_status = true;
+            break;
+        }
+
         int ret = write_buffer_cb(NULL, drive, phy_head, track[drive], head,
                                   cylinder, record);
 
@@ -601,15 +727,14 @@ static void post_exec_format_track(void) {
 // Seek
 static void pre_exec_seek(void) {
     uint8_t drive = args[0] & 0x03;
-    track[drive] = args[1];
 
     LOG_DEBUG("FDC Seek\n");
     LOG_DEBUG("Drive: %d\n", drive);
     LOG_DEBUG("HD: %d\n", (result[0] >> 2) & 0x01);
-    LOG_DEBUG("NCN: %d\n", track[drive]);
+    LOG_DEBUG("NCN: %d\n", args[1]);
 
-    // We don't have to actually move the head. The drive is immediately ready
-    int_status = true;
+    // Interrupt is raised when the head reaches the new cylinder
+    fdc_seek_start(drive, args[1]);
     // Update the status register with the drive info and the seek end flag
     status_register[ST0] = drive;
     // Update the FDD n busy flag, will be cleared by sense interrupt
@@ -629,7 +754,9 @@ static bool is_cmd_out_of_sequence(uint8_t cmd) {
     // TODO(giuliof): to be correct, I should check int, but it was already
     // cleared in command read/write routine
     else if (cmd == FDC_SENSE_INTERRUPT) {
-        if (fdc_busy)
+        // In accurate mode, there is nothing to sense until a seek ends
+        if (status_register[MSR] & (uint8_t)~seeking &
+            (FDC_ST_D3B | FDC_ST_D2B | FDC_ST_D1B | FDC_ST_D0B))
             ret = false;
     }
     //
@@ -673,9 +800,16 @@ static void fdc_compute_next_status(void) {
         // Set DIO to read for RESULT phase
         status_register[MSR] |= FDC_ST_DIO;
 
+        // Nothing more to wait for, head stays loaded for a while
+        data_wait = false;
+        fdc_update_rqm();
+        if (timing == FDC_TIMING_ACCURATE)
+            head_idle_since = cpu_getCycles();
+
         if (fdc_currop->post_exec)
             fdc_currop->post_exec();
 
+        fdc_stats_end();
         fdc_status = RESULT;
         rwcount_max = fdc_currop->result_len;
         rwcount = 0;
@@ -736,8 +870,14 @@ static bool fdc_prepare_read(void) {
     status_register[ST2] = 0;
     status_register[ST3] = 0;
 
-    // FDC counts sectors from 1
-    assert(sector != 0);
+    // FDC counts sectors from 1, sector 0 is never found
+    if (sector == 0) {
+        LOG_WARN("Sector 0 requested\n");
+        status_register[ST0] |= 0x40;
+        status_register[ST1] |= FDC_ST1_ND;
+        tc_status = true;
+        return false;
+    }
 
     // But all other routines counts sectors from 0
     sector--;
@@ -745,19 +885,23 @@ static bool fdc_prepare_read(void) {
     if (read_buffer_cb == NULL)
         return false;
 
-    int ret =
-        read_buffer_cb(NULL, drive, next_idr.phy_head & FDC_ST0_HD,
-                       track[drive], next_idr.head, next_idr.cylinder, sector);
-
-    if (ret > DISK_IMAGE_NOMEDIUM) {
-        // Buffer is statically allocated, be sure that the data can fit it
-        CEDA_STRONG_ASSERT_TRUE((size_t)ret <= sizeof(exec_buffer));
-
-        ret = read_buffer_cb(exec_buffer, drive, next_idr.phy_head & FDC_ST0_HD,
+    // Sector is loaded in a single call: the buffer is FDC_SECTOR_BUFFER_SIZE
+    // bytes long, and the callback checks that the sector fits it before
+    // filling it
+    int ret = read_buffer_cb(exec_buffer, drive, next_idr.phy_head & FDC_ST0_HD,
                              track[drive], next_idr.head, next_idr.cylinder,
                              sector);
+
+    // Sector data is being fetched, FDC waits for it in EXEC state
+    if (ret == DISK_IMAGE_PENDING) {
+        fdc_wait_data();
+        return false;
     }
 
+    // Data is served from the buffer, never past its end
+    if (ret > DISK_IMAGE_NOMEDIUM)
+        CEDA_STRONG_ASSERT_TRUE((size_t)ret <= sizeof(exec_buffer));
+
     // No medium, FDC is in EXEC state until a disk is inserted, or manual
     // termination
     if (ret == DISK_IMAGE_NOMEDIUM)
@@ -778,6 +922,10 @@ static bool fdc_prepare_read(void) {
 
         // Confirm the current IDR, since the buffer update was successful
         memcpy(&idr, &next_idr, sizeof(idr));
+        fdc_stats_sector(fdc_currop->exec == exec_write_data);
+
+        // Data is available when the sector passes under the head
+        fdc_schedule_sector();
 
         // Multi-sector mode (enabled by default).
         // If read is not interrupted at the end of the sector, the next logical
@@ -818,6 +966,168 @@ static bool fdc_prepare_read(void) {
     return false;
 }
 
+/**
+ * @brief Ask the read callback for the size of the next sector to be read,
+ * which also tells whether its data is available.
+ *
+ * @return the read callback return value, or DISK_IMAGE_NOMEDIUM
+ */
+static int fdc_probe_next_read(void) {
+    rw_args_t *rw_args = (rw_args_t *)args;
+    uint8_t drive = rw_args->unit_head & FDC_ST0_US;
+
+    if (read_buffer_cb == NULL || next_idr.record == 0)
+        return DISK_IMAGE_NOMEDIUM;
+
+    return read_buffer_cb(NULL, drive, next_idr.phy_head & FDC_ST0_HD,
+                          track[drive], next_idr.head, next_idr.cylinder,
+                          next_idr.record - 1);
+}
+
+/**
+ * @brief Stop requesting data until fdc_ioComplete() is called, as the FDC
+ * does while the sector is not under the head yet.
+ */
+static void fdc_wait_data(void) {
+    io_pending = true;
+    fdc_update_rqm();
+}
+
+static void fdc_data_ready(void) {
+    io_pending = false;
+    fdc_update_rqm();
+}
+
+/**
+ * @brief FDC requests data unless it is waiting for the image or the disk
+ */
+static void fdc_update_rqm(void) {
+    if (io_pending || data_wait)
+        status_register[MSR] &= (uint8_t)~FDC_ST_RQM;
+    else
+        status_register[MSR] |= FDC_ST_RQM;
+}
+
+/**
+ * @brief Raise the events whose time has come: end of seeks, and data
+ * passing under the head
+ */
+static void fdc_update_timing(void) {
+    if (timing != FDC_TIMING_ACCURATE)
+        return;
+
+    const unsigned long int now = cpu_getCycles();
+
+    for (uint8_t drive = 0; seeking != 0 && drive < ARRAY_SIZE(seek_end);
+         ++drive) {
+        if ((seeking & (1 << drive)) && now >= seek_end[drive]) {
+            seeking &= (uint8_t) ~(1 << drive);
+            int_status = true;
+        }
+    }
+
+    if (data_wait && now >= data_at) {
+        data_wait = false;
+        fdc_update_rqm();
+        int_status = true;
+    }
+}
+
+/**
+ * @brief Move the head of a drive to a cylinder, interrupt is raised when it
+ * gets there
+ */
+static void fdc_seek_start(uint8_t drive, uint8_t cylinder) {
+    const unsigned int steps = (unsigned int)abs(cylinder - track[drive]);
+    track[drive] = cylinder;
+
+    // We don't have to actually move the head. The drive is immediately ready
+    if (timing != FDC_TIMING_ACCURATE) {
+        int_status = true;
+        return;
+    }
+
+    // Head must be loaded again on the new cylinder
+    if (steps != 0)
+        head_loaded = false;
+
+    seek_end[drive] = cpu_getCycles() + steps * step_cycles;
+    seeking |= (uint8_t)(1 << drive);
+}
+
+/**
+ * @brief Load the head, if needed, at the beginning of a read or write
+ */
+static void fdc_transfer_start(void) {
+    if (timing != FDC_TIMING_ACCURATE)
+        return;
+
+    const unsigned long int now = cpu_getCycles();
+
+    if (head_loaded && now - head_idle_since >= head_unload_cycles)
+        head_loaded = false;
+
+    head_ready_at = head_loaded ? now : now + head_load_cycles;
+    head_loaded = true;
+}
+
+/**
+ * @brief Compute when the current sector begins under the head, and wait for
+ * it
+ *
+ * Sectors are assumed to be evenly spaced on the track, numbered from 1 to
+ * EOT in physical order.
+ */
+static void fdc_schedule_sector(void) {
+    if (timing != FDC_TIMING_ACCURATE)
+        return;
+
+    const rw_args_t *rw_args = (rw_args_t *)args;
+    const unsigned long int sectors = rw_args->eot != 0 ? rw_args->eot : 1;
+    const unsigned long int period = FDC_REVOLUTION / sectors;
+    const unsigned long int position = ((idr.record - 1U) % sectors) * period;
+
+    // first time the sector is under the head, not before the head is ready
+    sector_start = head_ready_at - head_ready_at % FDC_REVOLUTION + position;
+    if (sector_start < head_ready_at)
+        sector_start += FDC_REVOLUTION;
+
+    data_at = sector_start;
+    data_wait = true;
+    int_status = false;
+    fdc_update_rqm();
+
+    // Data may be already there
+    fdc_update_timing();
+}
+
+/**
+ * @brief A byte has been transferred during execution: next one is
+ * immediately available, or when it passes under the head
+ */
+static void fdc_data_served(void) {
+    if (timing != FDC_TIMING_ACCURATE) {
+        int_status = true;
+        return;
+    }
+
+    if (rwcount < rwcount_max) {
+        data_at = sector_start + rwcount * FDC_BYTE_CYCLES;
+    } else {
+        // Next sector is loaded on next request, which must wait for it
+        head_ready_at = sector_start + rwcount_max * FDC_BYTE_CYCLES;
+        const rw_args_t *rw_args = (rw_args_t *)args;
+        const unsigned long int sectors =
+            rw_args->eot != 0 ? rw_args->eot : 1;
+        const unsigned long int period = FDC_REVOLUTION / sectors;
+        data_at = MAX(head_ready_at, sector_start + period);
+    }
+
+    data_wait = true;
+    fdc_update_rqm();
+    fdc_update_timing();
+}
+
 /**
  * @brief This helper routine writes the buffer, populated during the execution
  * phase, into the disk image. It updates the status registers too, moving
@@ -837,8 +1147,14 @@ static bool fdc_commit_write(void) {
     status_register[ST2] = 0;
     status_register[ST3] = 0;
 
-    // FDC counts sectors from 1
-    assert(sector != 0);
+    // FDC counts sectors from 1, sector 0 is never found
+    if (sector == 0) {
+        LOG_WARN("Sector 0 requested\n");
+        status_register[ST0] |= 0x40;
+        status_register[ST1] |= FDC_ST1_ND;
+        tc_status = true;
+        return false;
+    }
 
     // But all other routines counts sectors from 0
     sector--;
@@ -850,6 +1166,10 @@ static bool fdc_commit_write(void) {
         write_buffer_cb(NULL, drive, next_idr.phy_head & FDC_ST0_HD,
                         track[drive], next_idr.head, next_idr.cylinder, sector);
 
+    // Buffer is statically allocated, be sure that the data will fit it
+    if (ret > DISK_IMAGE_NOMEDIUM)
+        CEDA_STRONG_ASSERT_TRUE((size_t)ret <= sizeof(exec_buffer));
+
     // No medium, FDC is in EXEC state until a disk is inserted, or manual
     // termination
     if (ret == DISK_IMAGE_NOMEDIUM)
@@ -870,6 +1190,10 @@ static bool fdc_commit_write(void) {
 
         // Confirm the current IDR, since the buffer update was successful
         memcpy(&idr, &next_idr, sizeof(idr));
+        fdc_stats_sector(fdc_currop->exec == exec_write_data);
+
+        // Data is available when the sector passes under the head
+        fdc_schedule_sector();
 
         // Multi-sector mode (enabled by default).
         // If read is not interrupted at the end of the sector, the next logical
@@ -911,8 +1235,105 @@ static bool fdc_commit_write(void) {
     return false;
 }
 
+/**
+ * @brief Start measuring the command that has just been received
+ */
+static void fdc_stats_begin(void) {
+    const size_t op = fdc_currop == &invalid_op
+                          ? FDC_STATS_COMMANDS - 1
+                          : (size_t)(fdc_currop - fdc_operations);
+
+    cmd_stats = &stats.commands[op];
+    cmd_start = cpu_getCycles();
+    cmd_start_time = time_now_us();
+    exec_bytes = 0;
+}
+
+/**
+ * @brief Account the current command, which is entering the result phase
+ */
+static void fdc_stats_end(void) {
+    if (cmd_stats == NULL)
+        return;
+
+    const unsigned long int cycles = cpu_getCycles() - cmd_start;
+
+    // latency histogram, in power of two [us]
+    unsigned long int us = cycles / (CPU_FREQ / 1000000UL);
+    size_t bucket = 0;
+    for (; us != 0 && bucket < FDC_STATS_LATENCY_BUCKETS - 1; ++bucket)
+        us >>= 1;
+
+    cmd_stats->count++;
+    cmd_stats->bytes += exec_bytes;
+    cmd_stats->cycles += cycles;
+    cmd_stats->host_time += time_now_us() - cmd_start_time;
+    cmd_stats->latency[bucket]++;
+    total_bytes += exec_bytes;
+
+    cmd_stats = NULL;
+}
+
+/**
+ * @brief Count an access to the sector of the current IDR
+ */
+static void fdc_stats_sector(bool write) {
+    const rw_args_t *rw_args = (rw_args_t *)args;
+    const uint8_t drive = rw_args->unit_head & FDC_ST0_US;
+    const unsigned int head = !!(idr.phy_head & FDC_ST0_HD);
+    const unsigned int sector = idr.record - 1U;
+
+    if (track[drive] >= FDC_STATS_TRACKS || sector >= FDC_STATS_SECTORS)
+        return;
+
+    fdc_heat_t *heat = &stats.heat[drive][track[drive]][head][sector];
+    if (write)
+        heat->writes++;
+    else
+        heat->reads++;
+}
+
 /* * * * * * * * * * * * * * *  Public routines   * * * * * * * * * * * * * * */
 
+static void fdc_performance(float *value, const char **unit) {
+    static unsigned long int last_bytes = 0;
+    static us_time_t last_time = 0;
+
+    // FDC is idle most of the time: average over a longer period
+    const us_time_t now = time_now_us();
+    const us_time_t diff_utime = now - last_time;
+    if (diff_utime >= 1000000) {
+        perf_value = (float)(total_bytes - last_bytes) /
+                     ((float)diff_utime / 1000.0F / 1000.0F);
+        last_time = now;
+        last_bytes = total_bytes;
+    }
+
+    *value = perf_value;
+    *unit = perf_unit;
+}
+
+static bool fdc_start(void) {
+    const char *mode = conf_getString("fdc", "timing");
+    if (mode == NULL || strcmp(mode, "instant") == 0) {
+        timing = FDC_TIMING_INSTANT;
+    } else if (strcmp(mode, "accurate") == 0) {
+        timing = FDC_TIMING_ACCURATE;
+    } else {
+        LOG_ERR("unknown fdc timing: %s\n", mode);
+        return false;
+    }
+
+    return true;
+}
+
+void fdc_initModule(CEDAModule *mod) {
+    memset(mod, 0, sizeof(*mod));
+    mod->init = fdc_initModule;
+    mod->start = fdc_start;
+    mod->performance = fdc_performance;
+}
+
 void fdc_init(void) {
     // Reset current command status
     fdc_status = CMD;
@@ -923,6 +1344,15 @@ void fdc_init(void) {
     memset(result, 0, sizeof(result));
     tc_status = false;
     int_status = false;
+    io_pending = false;
+
+    // Reset timing model, but keep its mode
+    step_cycles = 32 * FDC_CYCLES_PER_MS;
+    head_load_cycles = 4 * FDC_CYCLES_PER_MS;
+    head_unload_cycles = 32 * FDC_CYCLES_PER_MS;
+    seeking = 0;
+    head_loaded = false;
+    data_wait = false;
 
     // Reset main status register, but keep RQM active since FDC is always ready
     // to receive requests
@@ -934,9 +1364,25 @@ void fdc_init(void) {
     // Detach any read/write callback
     read_buffer_cb = NULL;
     write_buffer_cb = NULL;
+
+    cmd_stats = NULL;
+    fdc_resetStats();
 }
 
 uint8_t fdc_in(ceda_ioaddr_t address) {
+    // Fast path: in instant mode, bytes of a sector already in the buffer are
+    // served straight away, the state machine only handles the last one
+    if (timing == FDC_TIMING_INSTANT && fdc_status == EXEC &&
+        (address & 0x01) == FDC_ADDR_DATA_REGISTER &&
+        fdc_currop->exec == exec_read_data && !io_pending && !tc_status &&
+        rwcount + 1 < rwcount_max) {
+        int_status = true;
+        ++exec_bytes;
+        return exec_buffer[rwcount++];
+    }
+
+    fdc_update_timing();
+
     // The interrupt is cleared by reading/writing data to the FDC
     int_status = false;
 
@@ -952,6 +1398,9 @@ uint8_t fdc_in(ceda_ioaddr_t address) {
             value = status_register[ST0];
 
             status_register[MSR] &= (uint8_t)~FDC_ST_DIO;
+
+            // No command is running, the last one must not be restarted
+            return value;
         } else if (fdc_status == ARGS) {
             // you should never read during command phase
             LOG_WARN("FDC read access during ARGS phase!\n");
@@ -978,6 +1427,19 @@ uint8_t fdc_in(ceda_ioaddr_t address) {
 }
 
 void fdc_out(ceda_ioaddr_t address, uint8_t value) {
+    // Fast path, as in fdc_in()
+    if (timing == FDC_TIMING_INSTANT && fdc_status == EXEC &&
+        (address & 0x01) == FDC_ADDR_DATA_REGISTER &&
+        fdc_currop->exec == exec_write_data && write_buffer_cb != NULL &&
+        !tc_status && rwcount + 1 < rwcount_max) {
+        int_status = true;
+        ++exec_bytes;
+        exec_buffer[rwcount++] = value;
+        return;
+    }
+
+    fdc_update_timing();
+
     // The interrupt is cleared by reading/writing data to the FDC
     int_status = false;
 
@@ -1015,6 +1477,8 @@ void fdc_out(ceda_ioaddr_t address, uint8_t value) {
 
                 set_invalid_cmd();
             }
+
+            fdc_stats_begin();
         } else if (fdc_status == ARGS) {
             assert(rwcount < sizeof(args) / sizeof(*args));
             args[rwcount] = value;
@@ -1043,12 +1507,20 @@ void fdc_tc_out(ceda_ioaddr_t address, uint8_t value) {
     (void)value;
 
     if (fdc_status == EXEC) {
+        // Pending data is no more needed
+        if (io_pending)
+            fdc_data_ready();
+        data_wait = false;
+        fdc_update_rqm();
+
         tc_status = true;
         fdc_compute_next_status();
     }
 }
 
 bool fdc_getIntStatus(void) {
+    fdc_update_timing();
+
     return int_status;
 }
 
@@ -1062,6 +1534,10 @@ void fdc_kickDiskImage(fdc_read_write_t read_callback,
     read_buffer_cb = read_callback;
     write_buffer_cb = write_callback;
 
+    // Data being fetched came from the previous image, if any
+    if (io_pending)
+        fdc_data_ready();
+
     if (fdc_status == EXEC && fdc_currop->cmd == FDC_READ_DATA) {
         fdc_prepare_read();
     }
@@ -1070,3 +1546,83 @@ void fdc_kickDiskImage(fdc_read_write_t read_callback,
         fdc_commit_write();
     }
 }
+
+void fdc_ioComplete(void) {
+    if (!io_pending)
+        return;
+
+    fdc_data_ready();
+
+    if (fdc_status != EXEC)
+        return;
+
+    // First sector was not available: load it, interrupt is raised if
+    // successful
+    if (rwcount_max == 0) {
+        (void)fdc_prepare_read();
+        return;
+    }
+
+    // Next sector, which will be loaded by the next data request
+    if (fdc_probe_next_read() == DISK_IMAGE_PENDING) {
+        fdc_wait_data();
+        return;
+    }
+
+    // In accurate mode, the sector may not be under the head yet
+    if (!data_wait)
+        int_status = true;
+}
+
+const fdc_stats_t *fdc_getStats(void) {
+    return &stats;
+}
+
+void fdc_resetStats(void) {
+    memset(&stats, 0, sizeof(stats));
+    for (size_t i = 0; i < ARRAY_SIZE(fdc_operations); ++i)
+        stats.commands[i].name = fdc_operations[i].name;
+    stats.commands[FDC_STATS_COMMANDS - 1].name = invalid_op.name;
+    stats.since = cpu_getCycles();
+
+    // A command in progress is accounted from now on
+    if (cmd_stats != NULL) {
+        cmd_start = stats.since;
+        cmd_start_time = time_now_us();
+        exec_bytes = 0;
+    }
+}
+
+#if defined(CEDA_TEST)
+
+#include <criterion/criterion.h>
+
+Test(fdc, senseInterruptWhileSeeking) {
+    fdc_init();
+    timing = FDC_TIMING_ACCURATE;
+
+    fdc_out(FDC_ADDR_DATA_REGISTER, FDC_SEEK);
+    fdc_out(FDC_ADDR_DATA_REGISTER, 0x00);
+    fdc_out(FDC_ADDR_DATA_REGISTER, 5);
+    cr_assert_eq(fdc_getIntStatus(), false);
+
+    // The head is still moving: nothing to sense, and drive is still busy
+    fdc_out(FDC_ADDR_DATA_REGISTER, FDC_SENSE_INTERRUPT);
+    cr_assert_eq(fdc_in(FDC_ADDR_DATA_REGISTER), 0x80);
+    cr_assert_eq(fdc_in(FDC_ADDR_STATUS_REGISTER), FDC_ST_RQM | FDC_ST_D0B);
+    cr_assert_eq(fdc_getIntStatus(), false);
+
+    // Seek ends
+    seek_end[0] = cpu_getCycles();
+    cr_assert_eq(fdc_getIntStatus(), true);
+
+    fdc_out(FDC_ADDR_DATA_REGISTER, FDC_SENSE_INTERRUPT);
+    cr_assert_eq(fdc_in(FDC_ADDR_DATA_REGISTER), FDC_ST0_SE | 0);
+    cr_assert_eq(fdc_in(FDC_ADDR_DATA_REGISTER), 5);
+    cr_assert_eq(fdc_in(FDC_ADDR_STATUS_REGISTER), FDC_ST_RQM);
+    cr_assert_eq(fdc_getIntStatus(), false);
+
+    timing = FDC_TIMING_INSTANT;
+}
+
+#endif
@@ -1,10 +1,13 @@
 #ifndef CEDA_FDC_H
 #define CEDA_FDC_H
 
+#include "module.h"
+#include "time.h"
 #include "type.h"
 
 #include <Z80.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 /**
  * @brief Errors acceptable by the Floppy Disk Controller logic and that can be
@@ -14,24 +17,99 @@ typedef enum disk_image_err_t {
     DISK_IMAGE_NOMEDIUM = 0, // No medium available
     DISK_IMAGE_ERR = -1,     // Generic error
     DISK_IMAGE_INVALID_GEOMETRY = -2,
+    DISK_IMAGE_PENDING = -3, // Data is being fetched, see fdc_ioComplete()
 } disk_image_err_t;
 
+/**
+ * @brief Maximum sector size handled by the Floppy Disk Controller, in bytes.
+ * A non-NULL buffer passed to the r/w callbacks is always this long.
+ */
+#define FDC_SECTOR_BUFFER_SIZE (1024U)
+
+/**
+ * @brief Commands with statistics: the ones of the FDC, plus invalid commands
+ */
+#define FDC_STATS_COMMANDS (11U)
+
+/**
+ * @brief Buckets of the command latency histogram. Bucket i counts commands
+ * that lasted less than 2^i us of emulated time (at least 2^(i-1) us), the
+ * last one also the longer ones.
+ */
+#define FDC_STATS_LATENCY_BUCKETS (24U)
+
+// Size of the sector heatmap, accesses to other sectors are not counted
+#define FDC_STATS_UNITS   (4U)
+#define FDC_STATS_TRACKS  (84U)
+#define FDC_STATS_HEADS   (2U)
+#define FDC_STATS_SECTORS (32U)
+
 /**
  * @brief Signature of the r/w callbacks used by the Floppy Disk Controller.
  * At the moment, there are only a callback for the reading of data from the
  * virtual medium, and callback to write onto it.
  * Other features, like compare, ID read, ... are not yet supported.
+ *
+ * Buffer may be NULL to only fetch sector size. Otherwise, the read callback
+ * fills it and the write callback stores it, in one call. Both return the
+ * sector size, or a disk_image_err_t. Buffer is FDC_SECTOR_BUFFER_SIZE bytes
+ * long: the read callback must check that the sector fits it before filling
+ * it, since the FDC only knows the sector size afterwards.
+ *
+ * The read callback may return DISK_IMAGE_PENDING if sector data is not
+ * available yet (even for a size probe): the FDC stops requesting data
+ * (RQM is cleared) until fdc_ioComplete() is called, then tries again.
  */
 typedef int (*fdc_read_write_t)(uint8_t *buffer, uint8_t unit_number,
                                 bool phy_head, uint8_t phy_track, bool head,
                                 uint8_t track, uint8_t sector);
 
+/**
+ * @brief Statistics of an FDC command, measured from the command byte to the
+ * beginning of the result phase
+ */
+typedef struct fdc_cmd_stats_t {
+    const char *name;
+    unsigned long int count;
+    unsigned long int bytes;  // transferred during execution phase
+    unsigned long int cycles; // [cycles] emulated time
+    us_interval_t host_time;  // [us]
+    unsigned long int latency[FDC_STATS_LATENCY_BUCKETS]; // emulated time
+} fdc_cmd_stats_t;
+
+/**
+ * @brief Access counters of a sector
+ */
+typedef struct fdc_heat_t {
+    uint32_t reads;
+    uint32_t writes;
+} fdc_heat_t;
+
+/**
+ * @brief Statistics of the Floppy Disk Controller, since the last reset.
+ *
+ * Sectors are indexed by physical track and head, and by sector number
+ * counted from 0 (as in r/w callbacks).
+ */
+typedef struct fdc_stats_t {
+    unsigned long int since; // [cycles] emulated time of the last reset
+    fdc_cmd_stats_t commands[FDC_STATS_COMMANDS];
+    fdc_heat_t heat[FDC_STATS_UNITS][FDC_STATS_TRACKS][FDC_STATS_HEADS]
+                   [FDC_STATS_SECTORS];
+} fdc_stats_t;
+
 /**
  * @brief Initialize the Floppy Disk Controller system
  *
  */
 void fdc_init(void);
 
+/**
+ * @brief Register the Floppy Disk Controller module, which applies the FDC
+ * configuration at start. The controller itself is reset by fdc_init().
+ */
+void fdc_initModule(CEDAModule *mod);
+
 /**
  * @brief Read data from the Floppy Disk Controller using its bus
  *
@@ -74,4 +152,22 @@ bool fdc_getIntStatus(void);
 void fdc_kickDiskImage(fdc_read_write_t read_callback,
                        fdc_read_write_t write_callback);
 
+/**
+ * @brief Notify the Floppy Disk Controller that data requested by a read
+ * callback, which returned DISK_IMAGE_PENDING, may be available now.
+ * The interrupt is raised when the data is ready to be transferred.
+ * Nothing happens if the FDC is not waiting for data.
+ */
+void fdc_ioComplete(void);
+
+/**
+ * @brief Get the statistics of the Floppy Disk Controller
+ */
+const fdc_stats_t *fdc_getStats(void);
+
+/**
+ * @brief Reset the statistics of the Floppy Disk Controller
+ */
+void fdc_resetStats(void);
+
 #endif // CEDA_FDC_H
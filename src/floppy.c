@@ -1,17 +1,50 @@
+#define _GNU_SOURCE // fallocate
+
 #include "floppy.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
+#include "conf.h"
 #include "fdc.h"
+#include "floppy_cpmdir.h"
+#include "floppy_format.h"
+#include "floppy_gzip.h"
 #include "macro.h"
+#include "time.h"
 
-#define CFF_MAXIMUM_TRACKS (80U)
-#define CFF_SECTOR_SIZE    (1024U)
-#define CFF_MAX_SECTORS    (5U)
-#define CFF_T0_SECTOR_SIZE (256U)
-#define CFF_T0_MAX_SECTORS (16U)
+#define LOG_LEVEL LOG_LVL_INFO
+#include "log.h"
+
+/*
+ * Overlay (delta) file layout:
+ *  header, padded to FLOPPY_OVERLAY_DATA_OFFSET
+ *  sector data, at the same offset it has in the base image sector data
+ *
+ * The delta file has the same size of the sector data (plus header), but only
+ * the sectors actually written take space on the storage, since the rest of
+ * the file is never touched (sparse file).
+ */
+#define FLOPPY_OVERLAY_MAGIC       "CEDAOVL1"
+#define FLOPPY_OVERLAY_DATA_OFFSET (4096U)
+
+typedef struct floppy_overlay_header_t {
+    char magic[8];       // FLOPPY_OVERLAY_MAGIC, not null-terminated
+    uint64_t image_size; // [bytes] size of the base image sector data
+    // sectors stored in the delta, one bit each, by sector index
+    uint8_t bitmap[FLOPPY_SECTORS_COUNT / 8];
+} floppy_overlay_header_t;
 
 /**
  * @brief Read a sector from a certain drive
@@ -36,28 +69,429 @@ static int floppy_write_buffer(uint8_t *buffer, uint8_t unit_number,
                                bool phy_head, uint8_t phy_track, bool head,
                                uint8_t track, uint8_t sector);
 
-// TODO(giuliof): this structure will contain the type of image loaded.
-// At the moment, only Ceda File Format is supported (linearized binary disk
-// image)
 typedef struct floppy_unit_t {
-    FILE *fd;
+    int fd;
+    uint8_t *map;    // image file, mapped in memory
+    size_t map_size; // [bytes]
+    const floppy_format_t *format; // NULL if no image is loaded
+    floppy_image_t image;
+    unsigned int dirty_count; // sectors waiting to be flushed
+    // copy-on-write overlay, if any: base image is never written
+    int delta_fd;
+    uint8_t *delta; // delta file, mapped in memory
+    floppy_overlay_header_t *overlay;
+    char path[PATH_MAX]; // base image path, to commit the overlay
+    // host directory the disk is synthesized from, if any
+    floppy_cpmdir_t *cpmdir;
 } floppy_unit_t;
 
 floppy_unit_t floppy_units[4];
 
+// Format drivers, in order of preference when sniffing content
+static const floppy_format_t *const floppy_formats[] = {
+    &floppy_format_imd,
+    &floppy_format_cff,
+    &floppy_format_raw,
+};
+
+/*
+ * Write policy.
+ * Images are mapped privately, so written sectors land in the image mapping
+ * without reaching the image file: the mapping acts as a write-back cache.
+ * Written sectors are tracked as dirty, and written to the image file when
+ * flushed. Flush happens when the image is unloaded, when the emulator quits,
+ * every flush_interval (if not 0), on explicit sync, or immediately after
+ * each write in write-through mode.
+ * If flush_fsync is set, a flush only returns when data is on the storage.
+ */
+static bool write_through = false;
+static ms_interval_t flush_interval = 1000; // [ms]
+static bool flush_fsync = false;
+static ms_time_t last_flush = 0;
+
+// Compressed images are written to an overlay next to them, if enabled
+static bool gzip_sidecar = false;
+
+// Size of the beginning of an image needed to recognize its format
+#define FLOPPY_SNIFF_SIZE (512U)
+
+/*
+ * Asynchronous I/O.
+ * Sector data is read straight from the image mapping, which blocks the
+ * emulation whenever it is not in memory yet (eg. images on a network
+ * filesystem), as does decompression of compressed images.
+ * When enabled, a worker thread brings sector data in memory instead: the
+ * read callback only serves sectors which are already there, otherwise it
+ * queues a request and tells the FDC to wait (DISK_IMAGE_PENDING). The FDC
+ * is notified by the module poll once the request has been served.
+ * After each read, the rest of the track and the next track are prefetched.
+ */
+#define FLOPPY_IO_QUEUE_SIZE    (8U)
+#define FLOPPY_IO_POLL_INTERVAL (1000) // [us]
+
+typedef struct floppy_io_request_t {
+    unsigned int unit_number;
+    unsigned int track;
+    unsigned int head;
+    unsigned int sector; // first sector to fetch, up to the end of track
+} floppy_io_request_t;
+
+static bool io_async = false;
+static bool io_running = false;
+static pthread_t io_thread;
+// Request queue, most urgent first
+static pthread_mutex_t io_queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t io_queue_cond = PTHREAD_COND_INITIALIZER;
+static floppy_io_request_t io_queue[FLOPPY_IO_QUEUE_SIZE];
+static size_t io_queue_count = 0;
+static bool io_stop = false;
+// Held by the worker while accessing a unit, and while (un)loading a unit
+static pthread_mutex_t io_unit_lock = PTHREAD_MUTEX_INITIALIZER;
+// Requests not served yet, and whether any was served since last poll
+static atomic_uint io_outstanding;
+static atomic_bool io_completed;
+
+/**
+ * @brief Add a sector to the index of an image
+ *
+ * Sectors which do not fit the index, the FDC buffer or the sector data are
+ * silently ignored, as if they were missing from the disk.
+ */
+void floppy_image_addSector(floppy_image_t *image, unsigned int track,
+                            unsigned int head, unsigned int sector,
+                            size_t offset, size_t size) {
+    if (track >= FLOPPY_MAX_TRACKS || head >= FLOPPY_MAX_HEADS ||
+        sector >= FLOPPY_MAX_SECTORS)
+        return;
+    if (size == 0 || size > FDC_SECTOR_BUFFER_SIZE)
+        return;
+    if (offset + size > image->data_size)
+        return;
+
+    floppy_sector_t *s = &image->sectors[track][head][sector];
+    s->offset = (uint32_t)offset;
+    s->size = (uint16_t)size;
+    s->index =
+        (uint16_t)((track * FLOPPY_MAX_HEADS + head) * FLOPPY_MAX_SECTORS +
+                   sector);
+}
+
+/**
+ * @brief Index an image whose sector data is a linearized dump of the disk,
+ * ordered by sector, then head, then track
+ *
+ * @return false if the geometry does not fit the sector index
+ */
+bool floppy_image_addGeometry(floppy_image_t *image,
+                              const floppy_geometry_t *geometry) {
+    if (geometry->tracks > FLOPPY_MAX_TRACKS ||
+        geometry->heads > FLOPPY_MAX_HEADS ||
+        geometry->sectors > FLOPPY_MAX_SECTORS ||
+        geometry->t0_sectors > FLOPPY_MAX_SECTORS)
+        return false;
+
+    size_t offset = 0;
+    for (unsigned int track = 0; track < geometry->tracks; ++track) {
+        for (unsigned int head = 0; head < geometry->heads; ++head) {
+            const bool first = (track == 0 && head == 0 &&
+                                geometry->t0_sectors != 0);
+            const unsigned int sectors =
+                first ? geometry->t0_sectors : geometry->sectors;
+            const size_t size =
+                first ? geometry->t0_sector_size : geometry->sector_size;
+
+            // Sectors beyond the end of a truncated image do not exist
+            for (unsigned int sector = 0; sector < sectors; ++sector) {
+                floppy_image_addSector(image, track, head, sector, offset,
+                                       size);
+                offset += size;
+            }
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Choose the format driver for an image: by file name extension
+ * first, then by content, falling back to Ceda File Format
+ */
+static const floppy_format_t *floppy_select_format(const char *filename,
+                                                   const uint8_t *file,
+                                                   size_t file_size) {
+    const char *extension = strrchr(filename, '.');
+
+    for (size_t i = 0; extension != NULL && i < ARRAY_SIZE(floppy_formats);
+         ++i)
+        for (const char *const *e = floppy_formats[i]->extensions; *e != NULL;
+             ++e)
+            if (strcasecmp(extension, *e) == 0)
+                return floppy_formats[i];
+
+    for (size_t i = 0; i < ARRAY_SIZE(floppy_formats); ++i)
+        if (floppy_formats[i]->sniff != NULL &&
+            floppy_formats[i]->sniff(file, file_size))
+            return floppy_formats[i];
+
+    return &floppy_format_cff;
+}
+
+/**
+ * @brief Open and map an image file, read only if it can not be written
+ *
+ * @param writable false to always open the image read only
+ * @return is the file descriptor when successful, -1 otherwise
+ */
+static int floppy_map_image(const char *filename, bool writable,
+                            uint8_t **image, size_t *image_size,
+                            bool *read_only) {
+    *read_only = !writable;
+    int fd = open(filename, writable ? O_RDWR : O_RDONLY);
+    if (writable && fd < 0 && (errno == EACCES || errno == EROFS)) {
+        *read_only = true;
+        fd = open(filename, O_RDONLY);
+    }
+
+    if (fd < 0)
+        return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size <= 0) {
+        close(fd);
+        return -1;
+    }
+
+    *image_size = (size_t)st.st_size;
+    const int prot = *read_only ? PROT_READ : (PROT_READ | PROT_WRITE);
+    void *ptr = mmap(NULL, *image_size, prot, MAP_PRIVATE, fd, 0);
+    if (ptr == MAP_FAILED) {
+        LOG_ERR("unable to map %s: %s\n", filename, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    *image = ptr;
+    return fd;
+}
+
+/**
+ * @brief Open and map an overlay file, creating it if empty or missing
+ *
+ * @return is the file descriptor when successful, -1 otherwise
+ */
+static int floppy_map_overlay(const char *filename, size_t image_size,
+                              uint8_t **delta) {
+    const int fd = open(filename, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        LOG_ERR("unable to open %s: %s\n", filename, strerror(errno));
+        return -1;
+    }
+
+    const size_t delta_size = FLOPPY_OVERLAY_DATA_OFFSET + image_size;
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    // new overlay: just make room, data area is left sparse
+    const bool created = (st.st_size == 0);
+    if (created) {
+        floppy_overlay_header_t header = {.image_size = image_size};
+        memcpy(header.magic, FLOPPY_OVERLAY_MAGIC, sizeof(header.magic));
+        if (ftruncate(fd, (off_t)delta_size) < 0 ||
+            pwrite(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)) {
+            LOG_ERR("unable to create %s: %s\n", filename, strerror(errno));
+            close(fd);
+            return -1;
+        }
+    }
+
+    if (!created && (size_t)st.st_size != delta_size) {
+        LOG_ERR("%s does not match base image size\n", filename);
+        close(fd);
+        return -1;
+    }
+
+    void *ptr =
+        mmap(NULL, delta_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (ptr == MAP_FAILED) {
+        LOG_ERR("unable to map %s: %s\n", filename, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    const floppy_overlay_header_t *header = ptr;
+    if (memcmp(header->magic, FLOPPY_OVERLAY_MAGIC, sizeof(header->magic)) !=
+            0 ||
+        header->image_size != image_size) {
+        LOG_ERR("%s is not an overlay for this image\n", filename);
+        munmap(ptr, delta_size);
+        close(fd);
+        return -1;
+    }
+
+    *delta = ptr;
+    return fd;
+}
+
+/**
+ * @brief Release the image file mapping and the sector data
+ *
+ * @return is 0 when successful, -1 otherwise
+ */
+static int floppy_release_image(floppy_unit_t *unit) {
+    floppy_image_t *image = &unit->image;
+
+    floppy_gzip_close(image);
+    free(image->decoded);
+    image->decoded = NULL;
+    image->data = NULL;
+
+    // synthesized disks have no image file
+    if (unit->map == NULL)
+        return 0;
+
+    const int ret = munmap(unit->map, unit->map_size);
+    unit->map = NULL;
+    return ret;
+}
+
+ssize_t floppy_load_overlay(const char *filename, const char *delta,
+                            unsigned int unit_number) {
+    assert(unit_number < ARRAY_SIZE(floppy_units));
+
+    // Just unload previously loaded images
+    floppy_unload_image(unit_number);
+
+    floppy_unit_t *unit = &floppy_units[unit_number];
+    floppy_image_t *image = &unit->image;
+    memset(image, 0, sizeof(*image));
+
+    bool read_only;
+    const int fd = floppy_map_image(filename, delta == NULL, &unit->map,
+                                    &unit->map_size, &read_only);
+    if (fd < 0)
+        return -1;
+
+    image->file = unit->map;
+    image->file_size = unit->map_size;
+
+    // compressed image: format is chosen by the name without extension, or
+    // by the content, which is decompressed on demand
+    char name[PATH_MAX];
+    char sidecar[PATH_MAX];
+    (void)snprintf(name, sizeof(name), "%s", filename);
+    if (floppy_gzip_sniff(unit->map, unit->map_size)) {
+        if (!floppy_gzip_open(image, unit->map, unit->map_size)) {
+            floppy_release_image(unit);
+            close(fd);
+            return -1;
+        }
+
+        char *extension = strrchr(name, '.');
+        if (extension != NULL && strcasecmp(extension, ".gz") == 0)
+            *extension = '\0';
+        (void)floppy_gzip_fetch(image, FLOPPY_SNIFF_SIZE);
+
+        // compressed images are never written, but an overlay can be used
+        read_only = true;
+        if (delta == NULL && gzip_sidecar &&
+            (size_t)snprintf(sidecar, sizeof(sidecar), "%s.delta",
+                             filename) < sizeof(sidecar))
+            delta = sidecar;
+    }
+
+    const floppy_format_t *format =
+        floppy_select_format(name, image->file, image->file_size);
+
+    // the whole image is needed, if sector data must be decoded
+    if (image->gzip != NULL && !format->lazy &&
+        !floppy_gzip_fetch(image, image->file_size)) {
+        floppy_release_image(unit);
+        close(fd);
+        return -1;
+    }
+
+    // by default, sector data is the image file itself
+    image->data = image->file;
+    image->data_size = image->file_size;
+    image->read_only = read_only;
+    if (!format->open(image)) {
+        LOG_ERR("%s is not a valid %s image\n", filename, format->name);
+        floppy_release_image(unit);
+        close(fd);
+        return -1;
+    }
+    LOG_INFO("%s: %s%s image\n", filename, format->name,
+             image->gzip != NULL ? " (compressed)" : "");
+
+    // with an overlay, base image is never written
+    int delta_fd = -1;
+    uint8_t *delta_image = NULL;
+    if (delta != NULL) {
+        if (strlen(filename) < PATH_MAX)
+            delta_fd =
+                floppy_map_overlay(delta, image->data_size, &delta_image);
+        if (delta_fd < 0) {
+            floppy_release_image(unit);
+            close(fd);
+            return -1;
+        }
+        image->read_only = false;
+    }
+
+    if (image->read_only)
+        LOG_WARN("%s is write protected\n", filename);
+
+    pthread_mutex_lock(&io_unit_lock);
+    unit->fd = fd;
+    unit->format = format;
+    unit->delta_fd = delta_fd;
+    unit->delta = delta_image;
+    unit->overlay = (floppy_overlay_header_t *)delta_image;
+    if (delta != NULL)
+        strcpy(unit->path, filename);
+    pthread_mutex_unlock(&io_unit_lock);
+
+    fdc_kickDiskImage(floppy_read_buffer, floppy_write_buffer);
+
+    return 0;
+}
+
 ssize_t floppy_load_image(const char *filename, unsigned int unit_number) {
+    return floppy_load_overlay(filename, NULL, unit_number);
+}
+
+ssize_t floppy_load_directory(const char *path, bool write_back,
+                              unsigned int unit_number) {
     assert(unit_number < ARRAY_SIZE(floppy_units));
 
     // Just unload previously loaded images
     floppy_unload_image(unit_number);
 
-    // TODO(giuliof): if extension is ..., then image format is ...
-    FILE *fd = fopen(filename, "rb+");
+    floppy_unit_t *unit = &floppy_units[unit_number];
+    floppy_image_t *image = &unit->image;
+    memset(image, 0, sizeof(*image));
 
-    if (fd == NULL)
+    floppy_cpmdir_t *cpmdir = floppy_cpmdir_open(image, path);
+    if (cpmdir == NULL)
         return -1;
 
-    floppy_units[unit_number].fd = fd;
+    image->read_only = !write_back;
+    if (image->read_only)
+        LOG_WARN("%s is write protected\n", path);
+
+    pthread_mutex_lock(&io_unit_lock);
+    unit->fd = -1;
+    unit->map = NULL;
+    unit->map_size = 0;
+    unit->format = &floppy_format_cpmdir;
+    unit->delta_fd = -1;
+    unit->delta = NULL;
+    unit->overlay = NULL;
+    unit->cpmdir = cpmdir;
+    pthread_mutex_unlock(&io_unit_lock);
 
     fdc_kickDiskImage(floppy_read_buffer, floppy_write_buffer);
 
@@ -65,143 +499,924 @@ ssize_t floppy_load_image(const char *filename, unsigned int unit_number) {
 }
 
 ssize_t floppy_unload_image(unsigned int unit_number) {
-    FILE *fd = floppy_units[unit_number].fd;
+    floppy_unit_t *unit = &floppy_units[unit_number];
 
-    if (fd == NULL)
+    if (unit->format == NULL)
         return -1;
 
-    floppy_units[unit_number].fd = NULL;
-
     fdc_kickDiskImage(NULL, NULL);
 
-    if (fclose(fd) < 0)
+    ssize_t ret = floppy_sync(unit_number);
+
+    // I/O worker must not be accessing the unit
+    pthread_mutex_lock(&io_unit_lock);
+
+    if (unit->delta != NULL) {
+        if (munmap(unit->delta, FLOPPY_OVERLAY_DATA_OFFSET +
+                                    unit->image.data_size) < 0)
+            ret = -1;
+        if (close(unit->delta_fd) < 0)
+            ret = -1;
+    }
+
+    if (floppy_release_image(unit) < 0)
+        ret = -1;
+    if (unit->fd >= 0 && close(unit->fd) < 0)
+        ret = -1;
+
+    floppy_cpmdir_close(unit->cpmdir);
+
+    unit->fd = -1;
+    unit->format = NULL;
+    unit->cpmdir = NULL;
+    unit->delta_fd = -1;
+    unit->delta = NULL;
+    unit->overlay = NULL;
+
+    pthread_mutex_unlock(&io_unit_lock);
+
+    return ret;
+}
+
+/**
+ * @brief Mapping where written sectors are stored, base image or overlay
+ */
+static uint8_t *floppy_write_target(const floppy_unit_t *unit) {
+    if (unit->delta != NULL)
+        return unit->delta + FLOPPY_OVERLAY_DATA_OFFSET;
+    return unit->image.data;
+}
+
+/**
+ * @brief Write a range of a private mapping to the file it maps
+ *
+ * @param map mapping of the whole file, not sector data inside it
+ * @param begin offset of the range from the beginning of the mapping
+ * @param end offset of the end of the range
+ * @return is 0 when successful, -1 otherwise
+ */
+static int floppy_flush_range(int fd, const uint8_t *map, size_t begin,
+                              size_t end) {
+    while (begin < end) {
+        const ssize_t ret =
+            pwrite(fd, map + begin, end - begin, (off_t)begin);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0) {
+            LOG_ERR("unable to flush image: %s\n", strerror(errno));
+            return -1;
+        }
+        begin += (size_t)ret;
+    }
+
+    return 0;
+}
+
+ssize_t floppy_sync(unsigned int unit_number) {
+    if (unit_number >= ARRAY_SIZE(floppy_units))
+        return -1;
+
+    floppy_unit_t *unit = &floppy_units[unit_number];
+
+    if (unit->format == NULL)
+        return -1;
+
+    if (unit->dirty_count == 0)
+        return 0;
+
+    // Synthesized disk: files are written back to the host directory
+    if (unit->cpmdir != NULL) {
+        for (size_t track = 0; track < FLOPPY_MAX_TRACKS; ++track)
+            for (size_t head = 0; head < FLOPPY_MAX_HEADS; ++head)
+                for (size_t sector = 0; sector < FLOPPY_MAX_SECTORS; ++sector)
+                    unit->image.sectors[track][head][sector].dirty = false;
+        unit->dirty_count = 0;
+
+        return floppy_cpmdir_sync(&unit->image, unit->cpmdir) ? 0 : -1;
+    }
+
+    // Sectors are indexed in image order: adjacent dirty sectors are
+    // coalesced in a single range. Overlay data follows its header, which
+    // must be taken into account for page alignment.
+    const uint8_t *map = unit->image.data;
+    int fd = unit->fd;
+    size_t data_offset = 0;
+    if (unit->delta != NULL) {
+        map = unit->delta;
+        fd = unit->delta_fd;
+        data_offset = FLOPPY_OVERLAY_DATA_OFFSET;
+    }
+    ssize_t ret = 0;
+    size_t begin = 0;
+    size_t end = 0;
+    for (size_t track = 0; track < FLOPPY_MAX_TRACKS; ++track) {
+        for (size_t head = 0; head < FLOPPY_MAX_HEADS; ++head) {
+            for (size_t sector = 0; sector < FLOPPY_MAX_SECTORS; ++sector) {
+                floppy_sector_t *s =
+                    &unit->image.sectors[track][head][sector];
+                if (!s->dirty)
+                    continue;
+                s->dirty = false;
+
+                if (end != 0 && s->offset != end) {
+                    if (floppy_flush_range(fd, map, data_offset + begin,
+                                           data_offset + end) < 0)
+                        ret = -1;
+                    end = 0;
+                }
+                if (end == 0)
+                    begin = s->offset;
+                end = (size_t)s->offset + s->size;
+            }
+        }
+    }
+    if (end != 0 && floppy_flush_range(fd, map, data_offset + begin,
+                                       data_offset + end) < 0)
+        ret = -1;
+
+    // overlay bitmap must follow its data
+    if (unit->delta != NULL) {
+        if (flush_fsync && fdatasync(fd) < 0)
+            ret = -1;
+        if (floppy_flush_range(fd, map, 0, sizeof(floppy_overlay_header_t)) <
+            0)
+            ret = -1;
+    }
+
+    if (flush_fsync && fsync(fd) < 0) {
+        LOG_ERR("unable to fsync image: %s\n", strerror(errno));
+        ret = -1;
+    }
+
+    unit->dirty_count = 0;
+
+    return ret;
+}
+
+ssize_t floppy_syncAll(void) {
+    ssize_t ret = 0;
+
+    for (unsigned int i = 0; i < ARRAY_SIZE(floppy_units); ++i)
+        if (floppy_units[i].format != NULL && floppy_sync(i) < 0)
+            ret = -1;
+
+    last_flush = time_now_ms();
+
+    return ret;
+}
+
+static bool floppy_overlay_test(const floppy_unit_t *unit,
+                                const floppy_sector_t *s) {
+    return unit->overlay->bitmap[s->index / 8] & (1U << (s->index % 8));
+}
+
+static void floppy_overlay_set(floppy_unit_t *unit, const floppy_sector_t *s) {
+    unit->overlay->bitmap[s->index / 8] |= (uint8_t)(1U << (s->index % 8));
+}
+
+/**
+ * @brief Forget all the sectors stored in the overlay, and free their space
+ */
+static ssize_t floppy_overlay_clear(floppy_unit_t *unit) {
+    for (size_t track = 0; track < FLOPPY_MAX_TRACKS; ++track)
+        for (size_t head = 0; head < FLOPPY_MAX_HEADS; ++head)
+            for (size_t sector = 0; sector < FLOPPY_MAX_SECTORS; ++sector)
+                unit->image.sectors[track][head][sector].dirty = false;
+    unit->dirty_count = 0;
+
+    memset(unit->overlay->bitmap, 0, sizeof(unit->overlay->bitmap));
+    if (floppy_flush_range(unit->delta_fd, unit->delta, 0,
+                           sizeof(floppy_overlay_header_t)) < 0)
         return -1;
 
+    // best effort: data is unreachable anyway, once the bitmap is clear
+    (void)fallocate(unit->delta_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                    FLOPPY_OVERLAY_DATA_OFFSET,
+                    (off_t)unit->image.data_size);
+
     return 0;
 }
 
-/*
- * A sector is read from Ceda File Format image.
- * This image is a linearized binary dump of the floppy, ordered by sector,
- * then head, then track.
- * Ceda/Sanco disks have 80 tracks, 2 sides and are formatted, by default, with
- * first track with 256 bytes per sector and 16 sectors per track, others with
- * 1024 bps and 5 spt. The Ceda File Format reflects this formatting layout.
+ssize_t floppy_commitOverlay(unsigned int unit_number) {
+    if (unit_number >= ARRAY_SIZE(floppy_units))
+        return -1;
+
+    floppy_unit_t *unit = &floppy_units[unit_number];
+    if (unit->format == NULL || unit->delta == NULL)
+        return -1;
+
+    // sector data must be stored as it is in the image file
+    if (unit->image.decoded != NULL || unit->image.gzip != NULL) {
+        LOG_ERR("%s images can not be written\n", unit->format->name);
+        return -1;
+    }
+
+    // base image is only mapped for reading, a writable descriptor is
+    // needed just for the time of the commit
+    const int fd = open(unit->path, O_WRONLY);
+    if (fd < 0) {
+        LOG_ERR("unable to open %s: %s\n", unit->path, strerror(errno));
+        return -1;
+    }
+
+    const uint8_t *data = unit->delta + FLOPPY_OVERLAY_DATA_OFFSET;
+    bool ok = true;
+    for (size_t track = 0; track < FLOPPY_MAX_TRACKS && ok; ++track) {
+        for (size_t head = 0; head < FLOPPY_MAX_HEADS && ok; ++head) {
+            for (size_t sector = 0; sector < FLOPPY_MAX_SECTORS && ok;
+                 ++sector) {
+                const floppy_sector_t *s =
+                    &unit->image.sectors[track][head][sector];
+                if (s->size == 0 || !floppy_overlay_test(unit, s))
+                    continue;
+
+                ok = pwrite(fd, data + s->offset, s->size, s->offset) ==
+                     (ssize_t)s->size;
+            }
+        }
+    }
+
+    if (ok && flush_fsync && fsync(fd) < 0)
+        ok = false;
+
+    if (close(fd) < 0)
+        ok = false;
+
+    // in case of failure, keep the overlay: nothing is lost
+    if (!ok) {
+        LOG_ERR("unable to commit overlay to %s\n", unit->path);
+        return -1;
+    }
+
+    return floppy_overlay_clear(unit);
+}
+
+ssize_t floppy_discardOverlay(unsigned int unit_number) {
+    if (unit_number >= ARRAY_SIZE(floppy_units))
+        return -1;
+
+    floppy_unit_t *unit = &floppy_units[unit_number];
+    if (unit->format == NULL || unit->delta == NULL)
+        return -1;
+
+    return floppy_overlay_clear(unit);
+}
+
+/**
+ * @brief Locate a sector in the image loaded in a certain drive
+ *
+ * @param sector_ptr where the sector position is returned, if successful
+ * @return is the sector size when successful, or a disk_image_err_t
  */
-static int floppy_read_buffer(uint8_t *buffer, uint8_t unit_number,
-                              bool phy_head, uint8_t phy_track, bool head,
-                              uint8_t track, uint8_t sector) {
+static int floppy_locate(const floppy_sector_t **sector_ptr,
+                         uint8_t unit_number, bool phy_head, uint8_t phy_track,
+                         bool head, uint8_t track, uint8_t sector) {
     if (unit_number >= ARRAY_SIZE(floppy_units))
         return DISK_IMAGE_NOMEDIUM;
 
-    FILE *fd = floppy_units[unit_number].fd;
-    size_t len = CFF_T0_SECTOR_SIZE;
-    uint32_t offset;
+    const floppy_unit_t *unit = &floppy_units[unit_number];
 
     // No disk loaded
-    if (fd == NULL)
+    if (unit->format == NULL)
         return DISK_IMAGE_NOMEDIUM;
 
-    // Due to its structure, with Ceda File Format the physical head and track
-    // must be same as their logical counterpart.
+    // Sectors are indexed by their physical position, so the physical head
+    // and track must be same as their logical counterpart.
     if (phy_head != head)
         return DISK_IMAGE_INVALID_GEOMETRY;
     if (phy_track != track)
         return DISK_IMAGE_INVALID_GEOMETRY;
 
-    // CFF has up to 80 tracks
-    if (track > CFF_MAXIMUM_TRACKS - 1)
+    if (track > FLOPPY_MAX_TRACKS - 1)
+        return DISK_IMAGE_INVALID_GEOMETRY;
+    if (sector > FLOPPY_MAX_SECTORS - 1)
+        return DISK_IMAGE_INVALID_GEOMETRY;
+
+    const floppy_sector_t *s = &unit->image.sectors[track][head][sector];
+    if (s->size == 0)
         return DISK_IMAGE_INVALID_GEOMETRY;
 
-    // Locate sector start
-    if (track == 0 && head == 0) {
-        // First track different format handling
-        if (sector > CFF_T0_MAX_SECTORS - 1)
-            return DISK_IMAGE_INVALID_GEOMETRY;
-        // Compute byte offset to sector start
-        offset = sector * CFF_T0_SECTOR_SIZE;
+    *sector_ptr = s;
+    return s->size;
+}
+
+/**
+ * @brief Offset in the image of the end of a certain track
+ */
+static size_t floppy_track_end(const floppy_image_t *image, uint8_t track,
+                               bool head) {
+    size_t end = 0;
+    for (size_t sector = 0; sector < FLOPPY_MAX_SECTORS; ++sector) {
+        const floppy_sector_t *s = &image->sectors[track][head][sector];
+        if (s->size != 0)
+            end = MAX(end, (size_t)s->offset + s->size);
+    }
+
+    return end;
+}
+
+/**
+ * @brief Decompress a compressed image up to the end of a certain track
+ */
+static bool floppy_fetch_track(floppy_image_t *image, uint8_t track,
+                               bool head) {
+    return floppy_gzip_fetch(image, floppy_track_end(image, track, head));
+}
+
+/**
+ * @brief Check whether a sector is in memory, in a file mapping
+ */
+static bool floppy_io_resident(const uint8_t *map, const floppy_sector_t *s) {
+    const uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    const uintptr_t begin = (uintptr_t)(map + s->offset) & ~(page - 1);
+    const uintptr_t end = (uintptr_t)(map + s->offset + s->size);
+
+    // sector is never larger than a page, so it spans two pages at most
+    unsigned char vec[2];
+    if (end - begin > sizeof(vec) * page)
+        return true;
+
+    // if unknown, just read it
+    if (mincore((void *)begin, end - begin, vec) < 0)
+        return true;
+
+    for (size_t i = 0; i < (end - begin + page - 1) / page; ++i)
+        if ((vec[i] & 1) == 0)
+            return false;
+
+    return true;
+}
+
+/**
+ * @brief Check whether a sector can be read without waiting for storage
+ *
+ * Compressed images are decompressed a whole track at a time, so the whole
+ * track must be ready.
+ */
+static bool floppy_io_ready(const floppy_unit_t *unit, uint8_t track,
+                            bool head, const floppy_sector_t *s) {
+    const floppy_image_t *image = &unit->image;
+
+    if (image->decoded != NULL)
+        return true;
+
+    if (unit->delta != NULL && floppy_overlay_test(unit, s))
+        return floppy_io_resident(floppy_write_target(unit), s);
+
+    if (image->gzip != NULL)
+        return floppy_gzip_available(image,
+                                     floppy_track_end(image, track, head));
+
+    return floppy_io_resident(image->data, s);
+}
+
+/**
+ * @brief Queue a request for the I/O worker
+ *
+ * @param urgent true if the FDC is waiting for it, to be served first
+ */
+static void floppy_io_request(unsigned int unit_number, unsigned int track,
+                              unsigned int head, unsigned int sector,
+                              bool urgent) {
+    if (track >= FLOPPY_MAX_TRACKS || head >= FLOPPY_MAX_HEADS ||
+        sector >= FLOPPY_MAX_SECTORS)
+        return;
+
+    floppy_io_request_t request = {
+        .unit_number = unit_number,
+        .track = track,
+        .head = head,
+        .sector = sector,
+    };
+
+    pthread_mutex_lock(&io_queue_lock);
+
+    // Requests for the same track are merged
+    for (size_t i = 0; i < io_queue_count; ++i) {
+        floppy_io_request_t *queued = &io_queue[i];
+        if (queued->unit_number != unit_number || queued->track != track ||
+            queued->head != head)
+            continue;
+
+        queued->sector = MIN(queued->sector, sector);
+        if (urgent) {
+            request = *queued;
+            memmove(io_queue + 1, io_queue, i * sizeof(*io_queue));
+            io_queue[0] = request;
+        }
+
+        pthread_mutex_unlock(&io_queue_lock);
+        return;
+    }
+
+    // Queue full: prefetch is dropped, or makes room for urgent requests
+    if (io_queue_count == FLOPPY_IO_QUEUE_SIZE) {
+        if (!urgent) {
+            pthread_mutex_unlock(&io_queue_lock);
+            return;
+        }
+        --io_queue_count;
+        atomic_fetch_sub(&io_outstanding, 1);
+    }
+
+    if (urgent) {
+        memmove(io_queue + 1, io_queue, io_queue_count * sizeof(*io_queue));
+        io_queue[0] = request;
     } else {
-        if (sector > CFF_MAX_SECTORS - 1)
-            return DISK_IMAGE_INVALID_GEOMETRY;
+        io_queue[io_queue_count] = request;
+    }
+    ++io_queue_count;
+    atomic_fetch_add(&io_outstanding, 1);
+
+    pthread_cond_signal(&io_queue_cond);
+    pthread_mutex_unlock(&io_queue_lock);
+}
+
+/**
+ * @brief Queue the rest of the track and the next track for prefetch
+ */
+static void floppy_io_prefetch(unsigned int unit_number, unsigned int track,
+                               unsigned int head, unsigned int sector) {
+    floppy_io_request(unit_number, track, head, sector + 1, false);
+
+    // Next track, in image order
+    if (head + 1 < FLOPPY_MAX_HEADS)
+        floppy_io_request(unit_number, track, head + 1, 0, false);
+    else
+        floppy_io_request(unit_number, track + 1, 0, 0, false);
+}
+
+/**
+ * @brief Bring a range of sectors in memory
+ */
+static void floppy_io_fetch(const floppy_io_request_t *request) {
+    // Reading the image file fills the page cache, which backs the mapping
+    static uint8_t scratch[FLOPPY_MAX_SECTORS * FDC_SECTOR_BUFFER_SIZE];
+
+    pthread_mutex_lock(&io_unit_lock);
+
+    floppy_unit_t *unit = &floppy_units[request->unit_number];
+    floppy_image_t *image = &unit->image;
+
+    if (unit->format == NULL || image->decoded != NULL) {
+        pthread_mutex_unlock(&io_unit_lock);
+        return;
+    }
+
+    if (image->gzip != NULL) {
+        (void)floppy_fetch_track(image, (uint8_t)request->track,
+                                 request->head);
+        pthread_mutex_unlock(&io_unit_lock);
+        return;
+    }
+
+    size_t begin = SIZE_MAX;
+    size_t end = 0;
+    for (size_t sector = request->sector; sector < FLOPPY_MAX_SECTORS;
+         ++sector) {
+        const floppy_sector_t *s =
+            &image->sectors[request->track][request->head][sector];
+        if (s->size == 0)
+            continue;
+        begin = MIN(begin, (size_t)s->offset);
+        end = MAX(end, (size_t)s->offset + s->size);
+    }
+
+    if (begin < end) {
+        const size_t size = MIN(end - begin, sizeof(scratch));
+        (void)pread(unit->fd, scratch, size, (off_t)begin);
+        if (unit->delta != NULL)
+            (void)pread(unit->delta_fd, scratch, size,
+                        (off_t)(FLOPPY_OVERLAY_DATA_OFFSET + begin));
+    }
 
-        // Compute byte offset to sector start
-        offset = track * CFF_SECTOR_SIZE * CFF_MAX_SECTORS * 2;
-        offset += head * CFF_SECTOR_SIZE * CFF_MAX_SECTORS;
-        offset += sector * CFF_SECTOR_SIZE;
+    pthread_mutex_unlock(&io_unit_lock);
+}
+
+static void *floppy_io_worker(void *arg) {
+    (void)arg;
+
+    pthread_mutex_lock(&io_queue_lock);
+    for (;;) {
+        while (io_queue_count == 0 && !io_stop)
+            pthread_cond_wait(&io_queue_cond, &io_queue_lock);
+        if (io_stop)
+            break;
+
+        const floppy_io_request_t request = io_queue[0];
+        --io_queue_count;
+        memmove(io_queue, io_queue + 1, io_queue_count * sizeof(*io_queue));
+        pthread_mutex_unlock(&io_queue_lock);
+
+        floppy_io_fetch(&request);
+        atomic_fetch_sub(&io_outstanding, 1);
+        atomic_store(&io_completed, true);
+
+        pthread_mutex_lock(&io_queue_lock);
+    }
+    pthread_mutex_unlock(&io_queue_lock);
+
+    return NULL;
+}
 
-        // First track has a different format
-        offset -= CFF_SECTOR_SIZE * CFF_MAX_SECTORS;
-        offset += CFF_T0_SECTOR_SIZE * CFF_T0_MAX_SECTORS;
+static int floppy_read_buffer(uint8_t *buffer, uint8_t unit_number,
+                              bool phy_head, uint8_t phy_track, bool head,
+                              uint8_t track, uint8_t sector) {
+    const floppy_sector_t *s;
+    int ret = floppy_locate(&s, unit_number, phy_head, phy_track, head, track,
+                            sector);
 
-        len = CFF_SECTOR_SIZE;
+    // With asynchronous I/O, only serve sectors already in memory
+    if (ret > 0 && io_running) {
+        if (!floppy_io_ready(&floppy_units[unit_number], track, head, s)) {
+            floppy_io_request(unit_number, track, head, sector, true);
+            return DISK_IMAGE_PENDING;
+        }
+        if (buffer)
+            floppy_io_prefetch(unit_number, track, head, sector);
     }
 
-    // If requested, load sector into buffer
-    if (buffer) {
-        if (fseek(fd, offset, SEEK_SET) < 0)
-            return DISK_IMAGE_ERR;
+    // If requested, load sector into buffer, straight from the mapping
+    if (ret > 0 && buffer) {
+        floppy_unit_t *unit = &floppy_units[unit_number];
+        const uint8_t *src = unit->image.data;
+        if (unit->delta != NULL && floppy_overlay_test(unit, s)) {
+            src = floppy_write_target(unit);
+        } else if (unit->image.gzip != NULL) {
+            // I/O worker may be decompressing the same stream
+            pthread_mutex_lock(&io_unit_lock);
+            const bool fetched = floppy_fetch_track(&unit->image, track, head);
+            pthread_mutex_unlock(&io_unit_lock);
+            if (!fetched)
+                return DISK_IMAGE_ERR;
+        }
 
-        len = fread(buffer, sizeof(uint8_t), len, fd);
+        // FDC buffer is FDC_SECTOR_BUFFER_SIZE bytes long
+        CEDA_STRONG_ASSERT_TRUE(s->size <= FDC_SECTOR_BUFFER_SIZE);
+        memcpy(buffer, src + s->offset, s->size);
     }
 
-    return (int)len;
+    return ret;
 }
 
 static int floppy_write_buffer(uint8_t *buffer, uint8_t unit_number,
                                bool phy_head, uint8_t phy_track, bool head,
                                uint8_t track, uint8_t sector) {
-    if (unit_number >= ARRAY_SIZE(floppy_units))
-        return DISK_IMAGE_NOMEDIUM;
+    const floppy_sector_t *s;
+    int ret = floppy_locate(&s, unit_number, phy_head, phy_track, head, track,
+                            sector);
 
-    FILE *fd = floppy_units[unit_number].fd;
-    size_t len = CFF_T0_SECTOR_SIZE;
-    uint32_t offset;
+    // Write protected disk
+    if (ret > 0 && floppy_units[unit_number].image.read_only)
+        return DISK_IMAGE_ERR;
 
-    // No disk loaded, raise error
-    if (fd == NULL)
-        return DISK_IMAGE_NOMEDIUM;
+    if (ret <= 0 || buffer == NULL)
+        return ret;
 
-    // Due to its structure, with Ceda File Format the physical head and track
-    // must be same as their logical counterpart.
-    if (phy_head != head)
-        return DISK_IMAGE_INVALID_GEOMETRY;
-    if (phy_track != track)
-        return DISK_IMAGE_INVALID_GEOMETRY;
+    // Store buffer into sector, straight into the mapping
+    floppy_unit_t *unit = &floppy_units[unit_number];
+    memcpy(floppy_write_target(unit) + s->offset, buffer, s->size);
+    if (unit->delta != NULL)
+        floppy_overlay_set(unit, s);
 
-    // CFF has up to 80 tracks
-    if (track > CFF_MAXIMUM_TRACKS - 1)
-        return DISK_IMAGE_INVALID_GEOMETRY;
+    // floppy_locate only gives read access to the index
+    floppy_sector_t *dirty = &unit->image.sectors[track][head][sector];
+    if (!dirty->dirty) {
+        dirty->dirty = true;
+        ++unit->dirty_count;
+    }
 
-    // Locate sector start
-    if (track == 0 && head == 0) {
-        // First track different format handling
-        if (sector > CFF_T0_MAX_SECTORS - 1)
-            return DISK_IMAGE_INVALID_GEOMETRY;
-        // Compute byte offset to sector start
-        offset = sector * CFF_T0_SECTOR_SIZE;
-    } else {
-        if (sector > CFF_MAX_SECTORS - 1)
-            return DISK_IMAGE_INVALID_GEOMETRY;
+    if (write_through && floppy_sync(unit_number) < 0)
+        return DISK_IMAGE_ERR;
+
+    return ret;
+}
+
+static bool floppy_start(void) {
+    const char *write = conf_getString("floppy", "write");
+    if (write != NULL && strcmp(write, "back") != 0 &&
+        strcmp(write, "through") != 0) {
+        LOG_ERR("unknown floppy write policy: %s\n", write);
+        return false;
+    }
+    write_through = (write != NULL && strcmp(write, "through") == 0);
+
+    const uint32_t *interval = conf_getU32("floppy", "flush_interval");
+    if (interval != NULL)
+        flush_interval = (ms_interval_t)*interval;
+
+    const bool *fsync_enabled = conf_getBool("floppy", "fsync");
+    if (fsync_enabled != NULL)
+        flush_fsync = *fsync_enabled;
+
+    const bool *sidecar = conf_getBool("floppy", "gzip_sidecar");
+    if (sidecar != NULL)
+        gzip_sidecar = *sidecar;
 
-        // Compute byte offset to sector start
-        offset = track * CFF_SECTOR_SIZE * CFF_MAX_SECTORS * 2;
-        offset += head * CFF_SECTOR_SIZE * CFF_MAX_SECTORS;
-        offset += sector * CFF_SECTOR_SIZE;
+    const bool *async = conf_getBool("floppy", "async");
+    if (async != NULL)
+        io_async = *async;
 
-        // First track has a different format
-        offset -= CFF_SECTOR_SIZE * CFF_MAX_SECTORS;
-        offset += CFF_T0_SECTOR_SIZE * CFF_T0_MAX_SECTORS;
+    last_flush = time_now_ms();
 
-        len = CFF_SECTOR_SIZE;
+    if (io_async) {
+        io_stop = false;
+        if (pthread_create(&io_thread, NULL, floppy_io_worker, NULL) == 0)
+            io_running = true;
+        else
+            LOG_WARN("unable to start floppy i/o thread\n");
     }
 
-    // If requested, load sector into buffer
-    if (buffer) {
-        if (fseek(fd, offset, SEEK_SET) < 0)
-            return DISK_IMAGE_ERR;
+    return true;
+}
+
+static void floppy_poll(void) {
+    // Data which the FDC may be waiting for has been fetched
+    if (atomic_exchange(&io_completed, false))
+        fdc_ioComplete();
+
+    if (flush_interval == 0)
+        return;
+
+    if (time_now_ms() - last_flush < flush_interval)
+        return;
+
+    (void)floppy_syncAll();
+}
 
-        len = fwrite(buffer, sizeof(uint8_t), len, fd);
+static us_interval_t floppy_remaining(void) {
+    us_interval_t remaining = LONG_MAX;
+
+    if (atomic_load(&io_completed))
+        return 0;
+    if (atomic_load(&io_outstanding) != 0)
+        remaining = FLOPPY_IO_POLL_INTERVAL;
+
+    if (flush_interval == 0)
+        return remaining;
+
+    const ms_time_t next_flush = last_flush + flush_interval;
+    return MIN(remaining, (next_flush - time_now_ms()) * 1000);
+}
+
+static void floppy_cleanup(void) {
+    if (io_running) {
+        pthread_mutex_lock(&io_queue_lock);
+        io_stop = true;
+        pthread_cond_signal(&io_queue_cond);
+        pthread_mutex_unlock(&io_queue_lock);
+
+        pthread_join(io_thread, NULL);
+        io_running = false;
     }
 
-    return (int)len;
+    // flush and release all the images
+    for (unsigned int i = 0; i < ARRAY_SIZE(floppy_units); ++i)
+        (void)floppy_unload_image(i);
+}
+
+void floppy_init(CEDAModule *mod) {
+    memset(mod, 0, sizeof(*mod));
+    mod->init = floppy_init;
+    mod->start = floppy_start;
+    mod->poll = floppy_poll;
+    mod->remaining = floppy_remaining;
+    mod->cleanup = floppy_cleanup;
+}
+
+#if defined(CEDA_TEST)
+
+#include <criterion/criterion.h>
+
+#define CFF_MAXIMUM_TRACKS (80U)
+#define CFF_SECTOR_SIZE    (1024U)
+#define CFF_MAX_SECTORS    (5U)
+#define CFF_T0_SECTOR_SIZE (256U)
+#define CFF_T0_MAX_SECTORS (16U)
+
+#define CFF_IMAGE_SIZE                                                         \
+    (CFF_T0_SECTOR_SIZE * CFF_T0_MAX_SECTORS +                                 \
+     CFF_SECTOR_SIZE * CFF_MAX_SECTORS * (CFF_MAXIMUM_TRACKS * 2 - 1))
+
+Test(floppy, cff) {
+    char path[] = "/tmp/ceda-floppy-XXXXXX";
+    int fd = mkstemp(path);
+    cr_assert_geq(fd, 0);
+
+    // each sector is filled with its index in the image
+    static uint8_t image[CFF_IMAGE_SIZE];
+    for (size_t i = 0; i < CFF_T0_MAX_SECTORS; ++i)
+        memset(image + i * CFF_T0_SECTOR_SIZE, (int)i, CFF_T0_SECTOR_SIZE);
+    for (size_t i = 0; i < CFF_MAX_SECTORS * (CFF_MAXIMUM_TRACKS * 2 - 1); ++i)
+        memset(image + CFF_T0_SECTOR_SIZE * CFF_T0_MAX_SECTORS +
+                   i * CFF_SECTOR_SIZE,
+               (int)(CFF_T0_MAX_SECTORS + i), CFF_SECTOR_SIZE);
+    cr_assert_eq(write(fd, image, sizeof(image)), (ssize_t)sizeof(image));
+    close(fd);
+
+    fdc_init();
+    cr_assert_eq(floppy_load_image(path, 0), 0);
+
+    uint8_t buffer[FDC_SECTOR_BUFFER_SIZE];
+    cr_assert_eq(floppy_read_buffer(buffer, 0, 0, 0, 0, 0, 3),
+                 CFF_T0_SECTOR_SIZE);
+    cr_assert_eq(buffer[0], 3);
+    cr_assert_eq(floppy_read_buffer(buffer, 0, 1, 1, 1, 1, 2),
+                 CFF_SECTOR_SIZE);
+    cr_assert_eq(buffer[CFF_SECTOR_SIZE - 1], CFF_T0_MAX_SECTORS + 5 * 2 + 2);
+    cr_assert_eq(floppy_read_buffer(buffer, 0, 0, 1, 0, 1, 5),
+                 DISK_IMAGE_INVALID_GEOMETRY);
+    cr_assert_eq(floppy_read_buffer(buffer, 0, 0, 80, 0, 80, 0),
+                 DISK_IMAGE_INVALID_GEOMETRY);
+    cr_assert_eq(floppy_read_buffer(buffer, 1, 0, 0, 0, 0, 0),
+                 DISK_IMAGE_NOMEDIUM);
+
+    memset(buffer, 0xaa, sizeof(buffer));
+    cr_assert_eq(floppy_write_buffer(buffer, 0, 1, 79, 1, 79, 4),
+                 CFF_SECTOR_SIZE);
+    cr_assert_eq(floppy_write_buffer(buffer, 0, 1, 79, 1, 79, 3),
+                 CFF_SECTOR_SIZE);
+    cr_assert_eq(floppy_write_buffer(buffer, 0, 1, 79, 1, 79, 4),
+                 CFF_SECTOR_SIZE);
+    cr_assert_eq(floppy_units[0].dirty_count, 2);
+
+    // image file is written only when flushed
+    fd = open(path, O_RDONLY);
+    cr_assert_geq(fd, 0);
+    uint8_t last;
+    cr_assert_eq(pread(fd, &last, 1, sizeof(image) - 1), 1);
+    cr_assert_eq(last, image[sizeof(image) - 1]);
+    cr_assert_eq(floppy_sync(0), 0);
+    cr_assert_eq(pread(fd, &last, 1, sizeof(image) - 1), 1);
+    cr_assert_eq(last, 0xaa);
+    close(fd);
+    cr_assert_eq(floppy_units[0].dirty_count, 0);
+    cr_assert_not(floppy_units[0].image.sectors[79][1][4].dirty);
+    cr_assert_eq(floppy_write_buffer(buffer, 0, 1, 79, 1, 79, 4),
+                 CFF_SECTOR_SIZE);
+    cr_assert_eq(floppy_unload_image(0), 0);
+    cr_assert_eq(floppy_unload_image(0), -1);
+
+    // written sector is the last one of the image
+    FILE *fp = fopen(path, "rb");
+    cr_assert_not_null(fp);
+    cr_assert_eq(fseek(fp, -1, SEEK_END), 0);
+    cr_assert_eq(fgetc(fp), 0xaa);
+    fclose(fp);
+
+    unlink(path);
+}
+
+Test(floppy, selectFormat) {
+    static uint8_t image[CFF_IMAGE_SIZE];
+
+    cr_assert_eq(floppy_select_format("disk.raw", image, sizeof(image)),
+                 &floppy_format_raw);
+    cr_assert_eq(floppy_select_format("disk.img", image, sizeof(image)),
+                 &floppy_format_cff);
+    cr_assert_eq(floppy_select_format("disk.img", image, 720 * 1024),
+                 &floppy_format_raw);
+    cr_assert_eq(floppy_select_format("disk", image, 1000),
+                 &floppy_format_cff);
+}
+
+Test(floppy, overlay) {
+    char path[] = "/tmp/ceda-floppy-XXXXXX";
+    int fd = mkstemp(path);
+    cr_assert_geq(fd, 0);
+    static uint8_t image[CFF_IMAGE_SIZE];
+    cr_assert_eq(write(fd, image, sizeof(image)), (ssize_t)sizeof(image));
+    close(fd);
+
+    // empty file is a new overlay
+    char delta[] = "/tmp/ceda-delta-XXXXXX";
+    fd = mkstemp(delta);
+    cr_assert_geq(fd, 0);
+    close(fd);
+
+    fdc_init();
+    cr_assert_eq(floppy_load_overlay(path, delta, 0), 0);
+
+    uint8_t buffer[FDC_SECTOR_BUFFER_SIZE];
+    memset(buffer, 0x55, sizeof(buffer));
+    cr_assert_eq(floppy_write_buffer(buffer, 0, 0, 2, 0, 2, 1),
+                 CFF_SECTOR_SIZE);
+    cr_assert_eq(floppy_unload_image(0), 0);
+
+    // base image is untouched, overlay persists across loads
+    FILE *fp = fopen(path, "rb");
+    cr_assert_not_null(fp);
+    cr_assert_eq(fread(image, 1, sizeof(image), fp), sizeof(image));
+    fclose(fp);
+    for (size_t i = 0; i < sizeof(image); ++i)
+        cr_assert_eq(image[i], 0);
+
+    cr_assert_eq(floppy_load_overlay(path, delta, 0), 0);
+    memset(buffer, 0, sizeof(buffer));
+    cr_assert_eq(floppy_read_buffer(buffer, 0, 0, 2, 0, 2, 1),
+                 CFF_SECTOR_SIZE);
+    cr_assert_eq(buffer[0], 0x55);
+
+    // discard reverts to base image
+    cr_assert_eq(floppy_discardOverlay(0), 0);
+    cr_assert_eq(floppy_read_buffer(buffer, 0, 0, 2, 0, 2, 1),
+                 CFF_SECTOR_SIZE);
+    cr_assert_eq(buffer[0], 0);
+
+    // commit writes into base image
+    memset(buffer, 0x77, sizeof(buffer));
+    cr_assert_eq(floppy_write_buffer(buffer, 0, 1, 3, 1, 3, 0),
+                 CFF_SECTOR_SIZE);
+    cr_assert_eq(floppy_commitOverlay(0), 0);
+    memset(buffer, 0, sizeof(buffer));
+    cr_assert_eq(floppy_read_buffer(buffer, 0, 1, 3, 1, 3, 0),
+                 CFF_SECTOR_SIZE);
+    cr_assert_eq(buffer[0], 0x77);
+    cr_assert_eq(floppy_unload_image(0), 0);
+
+    // no overlay, nothing to commit
+    cr_assert_eq(floppy_load_image(path, 0), 0);
+    cr_assert_eq(floppy_commitOverlay(0), -1);
+    cr_assert_eq(floppy_unload_image(0), 0);
+
+    unlink(delta);
+    unlink(path);
 }
+
+#include <zlib.h>
+
+Test(floppy, gzip) {
+    char path[] = "/tmp/ceda-floppy-XXXXXX";
+    int fd = mkstemp(path);
+    cr_assert_geq(fd, 0);
+    close(fd);
+
+    static uint8_t image[CFF_IMAGE_SIZE];
+    memset(image + CFF_IMAGE_SIZE - CFF_SECTOR_SIZE, 0x33, CFF_SECTOR_SIZE);
+    gzFile gz = gzopen(path, "wb");
+    cr_assert_not_null(gz);
+    cr_assert_eq(gzwrite(gz, image, sizeof(image)), (int)sizeof(image));
+    cr_assert_eq(gzclose(gz), Z_OK);
+
+    // format is recognized from the uncompressed size
+    fdc_init();
+    cr_assert_eq(floppy_load_image(path, 0), 0);
+
+    uint8_t buffer[FDC_SECTOR_BUFFER_SIZE];
+    cr_assert_eq(floppy_read_buffer(buffer, 0, 1, 79, 1, 79, 4),
+                 CFF_SECTOR_SIZE);
+    cr_assert_eq(buffer[0], 0x33);
+    cr_assert_eq(floppy_write_buffer(buffer, 0, 1, 79, 1, 79, 4),
+                 DISK_IMAGE_ERR);
+    cr_assert_eq(floppy_unload_image(0), 0);
+
+    unlink(path);
+}
+
+Test(floppy, async) {
+    char path[] = "/tmp/ceda-floppy-XXXXXX";
+    int fd = mkstemp(path);
+    cr_assert_geq(fd, 0);
+    close(fd);
+
+    // compressed image: the last track is not decompressed yet
+    static uint8_t image[CFF_IMAGE_SIZE];
+    memset(image + CFF_IMAGE_SIZE - CFF_SECTOR_SIZE, 0x44, CFF_SECTOR_SIZE);
+    gzFile gz = gzopen(path, "wb");
+    cr_assert_not_null(gz);
+    cr_assert_eq(gzwrite(gz, image, sizeof(image)), (int)sizeof(image));
+    cr_assert_eq(gzclose(gz), Z_OK);
+
+    bool *async = conf_getBool("floppy", "async");
+    cr_assert_not_null(async);
+    *async = true;
+
+    fdc_init();
+    cr_assert(floppy_start());
+    cr_assert(io_running);
+    cr_assert_eq(floppy_load_image(path, 0), 0);
+
+    // first sector is decompressed, but not the rest of its track
+    uint8_t buffer[FDC_SECTOR_BUFFER_SIZE];
+    cr_assert_eq(floppy_read_buffer(buffer, 0, 0, 0, 0, 0, 0),
+                 DISK_IMAGE_PENDING);
+    cr_assert_eq(floppy_read_buffer(buffer, 0, 1, 79, 1, 79, 4),
+                 DISK_IMAGE_PENDING);
+
+    // wait for the worker
+    while (atomic_load(&io_outstanding) != 0)
+        usleep(1000);
+    floppy_poll();
+    cr_assert_eq(floppy_read_buffer(buffer, 0, 1, 79, 1, 79, 4),
+                 CFF_SECTOR_SIZE);
+    cr_assert_eq(buffer[0], 0x44);
+
+    floppy_cleanup();
+    cr_assert_not(io_running);
+    cr_assert_eq(floppy_unload_image(0), -1);
+    *async = false;
+
+    unlink(path);
+}
+
+#endif
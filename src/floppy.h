@@ -1,6 +1,8 @@
 #ifndef CEDA_FLOPPY_H
 #define CEDA_FLOPPY_H
 
+#include "module.h"
+
 #include <stdbool.h>
 #include <stdint.h>
 #include <sys/types.h>
@@ -17,6 +19,35 @@
  */
 ssize_t floppy_load_image(const char *filename, unsigned int unit_number);
 
+/**
+ * @brief Loads floppy image by filename, with a copy-on-write overlay
+ *
+ * The base image is only read, and may be shared by many instances.
+ * Written sectors are stored in the overlay (delta) file, which is created if
+ * it does not exist yet, or reused if it already exists for the same image.
+ *
+ * @param filename string with relative or full base image file path
+ * @param delta string with relative or full overlay file path, may be NULL to
+ *              load the image without overlay
+ * @param unit_number drive number where to load the image
+ * @return is 0 when successful, -1 if any file can not be opened
+ */
+ssize_t floppy_load_overlay(const char *filename, const char *delta,
+                            unsigned int unit_number);
+
+/**
+ * @brief Loads a CP/M disk synthesized from the files of a host directory
+ *
+ * @param path string with relative or full directory path
+ * @param write_back true to write back new and modified files to the
+ *                   directory when the disk is flushed, false to have the
+ *                   disk write protected
+ * @param unit_number drive number where to load the disk
+ * @return is 0 when successful, -1 if the directory can not be read
+ */
+ssize_t floppy_load_directory(const char *path, bool write_back,
+                              unsigned int unit_number);
+
 /**
  * @brief Unload floppy image from a certain drive
  *
@@ -25,4 +56,40 @@ ssize_t floppy_load_image(const char *filename, unsigned int unit_number);
  */
 ssize_t floppy_unload_image(unsigned int unit_number);
 
+/**
+ * @brief Flush the sectors written in a certain drive to its image file
+ *
+ * @param unit_number drive number to be flushed
+ * @return is 0 when successful, -1 if no image is loaded or flush failed
+ */
+ssize_t floppy_sync(unsigned int unit_number);
+
+/**
+ * @brief Flush the sectors written in all the drives with an image loaded
+ *
+ * @return is 0 when successful, -1 if any flush failed
+ */
+ssize_t floppy_syncAll(void);
+
+/**
+ * @brief Write the sectors stored in the overlay of a certain drive into its
+ * base image, then empty the overlay
+ *
+ * @param unit_number drive number
+ * @return is 0 when successful, -1 if the drive has no overlay or the base
+ *         image can not be written
+ */
+ssize_t floppy_commitOverlay(unsigned int unit_number);
+
+/**
+ * @brief Drop all the sectors stored in the overlay of a certain drive,
+ * reverting the disk to its base image
+ *
+ * @param unit_number drive number
+ * @return is 0 when successful, -1 if the drive has no overlay
+ */
+ssize_t floppy_discardOverlay(unsigned int unit_number);
+
+void floppy_init(CEDAModule *mod);
+
 #endif
@@ -0,0 +1,705 @@
+#include "floppy_cpmdir.h"
+
+#include "conf.h"
+#include "macro.h"
+#include "tokenizer.h"
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define LOG_LEVEL LOG_LVL_INFO
+#include "log.h"
+
+/*
+ * CP/M disk synthesized from a host directory.
+ *
+ * The disk has the same layout of a Ceda File Format image. Logical CP/M
+ * tracks are the physical tracks of both sides, in image order, so the
+ * first track of the first side is shorter than the others. After the
+ * reserved (system) tracks, the data area is a sequence of allocation blocks:
+ * the directory comes first, then the files, each one in contiguous blocks.
+ *
+ * Disk parameters must match the ones of the CP/M BIOS in use, and can be
+ * configured, together with an image from which reserved tracks are copied,
+ * so that the disk is bootable.
+ *
+ * Files are written back when the disk is flushed: new and modified files are
+ * created or replaced in the host directory, but files deleted on the disk
+ * are never deleted from the host directory.
+ */
+#define CPM_RECORD_SIZE   (128U)
+#define CPM_EXTENT_SIZE   (16384U) // logical extent, one EX unit
+#define CPM_EMPTY         (0xe5)
+#define CPM_EOF           (0x1a)
+#define CPM_USER_MAX      (15U)
+#define CPM_NAME_SIZE     (8U)
+#define CPM_EXT_SIZE      (3U)
+#define CPM_FILENAME_SIZE (CPM_NAME_SIZE + CPM_EXT_SIZE)
+
+// Default disk parameters
+#define CPM_DEFAULT_BLOCK_SIZE  (2048U)
+#define CPM_DEFAULT_DIR_ENTRIES (128U)
+#define CPM_DEFAULT_RESERVED    (2U)
+
+typedef struct cpm_dirent_t {
+    uint8_t user;                    // user number, or CPM_EMPTY
+    uint8_t name[CPM_FILENAME_SIZE]; // padded with spaces, attributes in msb
+    uint8_t ex;                      // extent number, low bits
+    uint8_t s1;
+    uint8_t s2; // extent number, high bits
+    uint8_t rc; // records in last logical extent
+    uint8_t al[16];
+} cpm_dirent_t;
+
+typedef struct cpm_dpb_t {
+    size_t block_size;    // [bytes]
+    size_t dir_entries;   // directory entries
+    size_t dir_blocks;    // blocks taken by the directory
+    size_t data_offset;   // [bytes] beginning of the data area in the image
+    size_t blocks;        // blocks in the data area
+    bool wide;            // block pointers are 16 bits
+    size_t entry_size;    // [bytes] file data addressed by an entry
+    size_t entry_extents; // logical extents addressed by an entry
+} cpm_dpb_t;
+
+typedef struct cpm_name_t {
+    uint8_t cpm[CPM_FILENAME_SIZE];
+    char host[NAME_MAX + 1];
+} cpm_name_t;
+
+struct floppy_cpmdir_t {
+    char path[PATH_MAX];
+    cpm_dpb_t dpb;
+    // host names of imported files, to write them back with same name
+    cpm_name_t *names;
+    size_t names_count;
+};
+
+static const char CPM_NAME_CHARS[] = "!#$%&'()-@^_{}~";
+
+// Not an image format: the disk is never loaded from a file
+static const char *const CPMDIR_EXTENSIONS[] = {NULL};
+
+const floppy_format_t floppy_format_cpmdir = {
+    .name = "cp/m directory",
+    .extensions = CPMDIR_EXTENSIONS,
+    .sniff = NULL,
+    .open = NULL,
+    .lazy = false,
+};
+
+/**
+ * @brief Compute disk parameters.
+ *
+ * @return false if parameters are not valid for the disk.
+ */
+static bool cpm_dpb_set(cpm_dpb_t *dpb, unsigned int block_size,
+                        unsigned int dir_entries, unsigned int reserved,
+                        size_t image_size) {
+    const floppy_geometry_t *geometry = &floppy_geometry_cff;
+    const size_t t0_size =
+        (size_t)geometry->t0_sectors * geometry->t0_sector_size;
+    const size_t track_size =
+        (size_t)geometry->sectors * geometry->sector_size;
+
+    if (block_size < 1024 || (block_size & (block_size - 1)) != 0 ||
+        dir_entries == 0 || reserved == 0 ||
+        reserved >= geometry->tracks * geometry->heads)
+        return false;
+
+    dpb->block_size = block_size;
+    dpb->dir_entries = dir_entries;
+    dpb->dir_blocks =
+        (dir_entries * sizeof(cpm_dirent_t) + block_size - 1) / block_size;
+    dpb->data_offset = t0_size + (reserved - 1) * track_size;
+    dpb->blocks = (image_size - dpb->data_offset) / block_size;
+    dpb->wide = dpb->blocks > 256;
+    dpb->entry_size = (dpb->wide ? 8 : 16) * dpb->block_size;
+    dpb->entry_extents = dpb->entry_size / CPM_EXTENT_SIZE;
+
+    // as in CP/M, 1 KiB blocks are not allowed with more than 256 blocks
+    if (dpb->entry_extents == 0)
+        return false;
+
+    return dpb->dir_blocks < dpb->blocks;
+}
+
+/**
+ * @brief Compute disk parameters from configuration.
+ *
+ * Expected syntax:
+ *  <block size> <directory entries> <reserved tracks>
+ */
+static bool cpm_dpb(cpm_dpb_t *dpb, size_t image_size) {
+    unsigned int block_size = CPM_DEFAULT_BLOCK_SIZE;
+    unsigned int dir_entries = CPM_DEFAULT_DIR_ENTRIES;
+    unsigned int reserved = CPM_DEFAULT_RESERVED;
+
+    const char *conf = conf_getString("floppy", "cpm_dpb");
+    if (conf != NULL) {
+        conf = tokenizer_next_int(&block_size, conf);
+        if (conf != NULL)
+            conf = tokenizer_next_int(&dir_entries, conf);
+        if (conf != NULL)
+            conf = tokenizer_next_int(&reserved, conf);
+    }
+
+    if (!cpm_dpb_set(dpb, block_size, dir_entries, reserved, image_size)) {
+        LOG_ERR("invalid cp/m disk parameters\n");
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Convert a host file name to CP/M 8.3 format.
+ *
+ * @return false if the name can not be represented on CP/M.
+ */
+static bool cpm_name(uint8_t *cpm, const char *host) {
+    const char *dot = strrchr(host, '.');
+    const size_t name_len = dot ? (size_t)(dot - host) : strlen(host);
+    const size_t ext_len = dot ? strlen(dot + 1) : 0;
+
+    if (name_len == 0 || name_len > CPM_NAME_SIZE || ext_len > CPM_EXT_SIZE)
+        return false;
+
+    memset(cpm, ' ', CPM_FILENAME_SIZE);
+    for (size_t i = 0; host[i] != '\0'; ++i) {
+        const char c = host[i];
+        if (host + i == dot)
+            continue;
+        if (!isalnum((unsigned char)c) && strchr(CPM_NAME_CHARS, c) == NULL)
+            return false;
+
+        const size_t pos = (dot && host + i > dot)
+                               ? CPM_NAME_SIZE + (size_t)(host + i - dot - 1)
+                               : i;
+        cpm[pos] = (uint8_t)toupper((unsigned char)c);
+    }
+
+    return true;
+}
+
+/**
+ * @brief Convert a CP/M 8.3 file name to a host name, in lower case.
+ */
+static void host_name(char *host, const uint8_t *cpm) {
+    size_t len = 0;
+    for (size_t i = 0; i < CPM_FILENAME_SIZE; ++i) {
+        const char c = (char)(cpm[i] & 0x7f);
+        if (i == CPM_NAME_SIZE && (cpm[i] & 0x7f) != ' ')
+            host[len++] = '.';
+        if (c != ' ')
+            host[len++] = (char)tolower((unsigned char)c);
+    }
+    host[len] = '\0';
+}
+
+static void cpm_set_block(const cpm_dpb_t *dpb, cpm_dirent_t *entry,
+                          size_t index, size_t block) {
+    if (dpb->wide) {
+        entry->al[index * 2] = (uint8_t)(block & 0xff);
+        entry->al[index * 2 + 1] = (uint8_t)(block >> 8);
+    } else {
+        entry->al[index] = (uint8_t)block;
+    }
+}
+
+static size_t cpm_get_block(const cpm_dpb_t *dpb, const cpm_dirent_t *entry,
+                            size_t index) {
+    if (dpb->wide)
+        return (size_t)entry->al[index * 2] |
+               (size_t)entry->al[index * 2 + 1] << 8;
+    return entry->al[index];
+}
+
+static cpm_dirent_t *cpm_directory(uint8_t *data, const cpm_dpb_t *dpb) {
+    return (cpm_dirent_t *)(data + dpb->data_offset);
+}
+
+static uint8_t *cpm_block(uint8_t *data, const cpm_dpb_t *dpb, size_t block) {
+    return data + dpb->data_offset + block * dpb->block_size;
+}
+
+/**
+ * @brief Import a host file in the disk.
+ *
+ * @return false if the file does not fit the disk.
+ */
+static bool cpm_import(uint8_t *data, const cpm_dpb_t *dpb,
+                       const uint8_t *name, const char *path,
+                       size_t *next_block, size_t *next_entry) {
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL)
+        return false;
+
+    struct stat st;
+    if (fstat(fileno(fp), &st) < 0) {
+        fclose(fp);
+        return false;
+    }
+
+    const size_t size = (size_t)st.st_size;
+    const size_t records = (size + CPM_RECORD_SIZE - 1) / CPM_RECORD_SIZE;
+    const size_t blocks = (size + dpb->block_size - 1) / dpb->block_size;
+    const size_t entries = MAX((size + dpb->entry_size - 1) / dpb->entry_size,
+                               (size_t)1);
+
+    if (*next_block + blocks > dpb->blocks ||
+        *next_entry + entries > dpb->dir_entries) {
+        fclose(fp);
+        return false;
+    }
+
+    // file data is contiguous, last record is padded with EOF
+    uint8_t *dst = cpm_block(data, dpb, *next_block);
+    const bool ok = fread(dst, 1, size, fp) == size;
+    fclose(fp);
+    if (!ok)
+        return false;
+    memset(dst + size, CPM_EOF, records * CPM_RECORD_SIZE - size);
+
+    const size_t entry_records = dpb->entry_size / CPM_RECORD_SIZE;
+    const size_t block_records = dpb->block_size / CPM_RECORD_SIZE;
+    cpm_dirent_t *directory = cpm_directory(data, dpb);
+    for (size_t e = 0; e < entries; ++e) {
+        cpm_dirent_t *entry = &directory[*next_entry + e];
+        memset(entry, 0, sizeof(*entry));
+        memcpy(entry->name, name, CPM_FILENAME_SIZE);
+
+        const size_t done = MIN(e * entry_records, records);
+        const size_t count = MIN(records - done, entry_records);
+
+        // extent number is the one of last logical extent in the entry
+        size_t extent = e * dpb->entry_extents;
+        if (count > 0)
+            extent += (count - 1) / (CPM_EXTENT_SIZE / CPM_RECORD_SIZE);
+        entry->ex = (uint8_t)(extent & 0x1f);
+        entry->s2 = (uint8_t)(extent >> 5);
+        entry->rc = (uint8_t)(count - (extent - e * dpb->entry_extents) *
+                                          (CPM_EXTENT_SIZE / CPM_RECORD_SIZE));
+
+        for (size_t b = 0; b * block_records < count; ++b)
+            cpm_set_block(dpb, entry,
+                          b, *next_block + done / block_records + b);
+    }
+
+    *next_block += blocks;
+    *next_entry += entries;
+
+    return true;
+}
+
+static int cpm_filter(const struct dirent *entry) {
+    return entry->d_name[0] != '.';
+}
+
+/**
+ * @brief Synthesize a CP/M disk from a host directory.
+ *
+ * @param image Image to be filled, it becomes a Ceda File Format disk.
+ * @param path Host directory.
+ *
+ * @return Handle to write back the disk, NULL in case of error.
+ */
+floppy_cpmdir_t *floppy_cpmdir_open(floppy_image_t *image, const char *path) {
+    const size_t image_size = floppy_geometry_size(&floppy_geometry_cff);
+
+    floppy_cpmdir_t *cpmdir = calloc(1, sizeof(*cpmdir));
+    if (cpmdir == NULL || strlen(path) >= sizeof(cpmdir->path) ||
+        !cpm_dpb(&cpmdir->dpb, image_size)) {
+        free(cpmdir);
+        return NULL;
+    }
+    strcpy(cpmdir->path, path);
+    const cpm_dpb_t *dpb = &cpmdir->dpb;
+
+    struct dirent **list;
+    const int count = scandir(path, &list, cpm_filter, alphasort);
+    if (count < 0) {
+        LOG_ERR("unable to scan %s: %s\n", path, strerror(errno));
+        free(cpmdir);
+        return NULL;
+    }
+
+    uint8_t *data = malloc(image_size);
+    cpmdir->names = calloc(dpb->dir_entries, sizeof(cpm_name_t));
+    if (data == NULL || cpmdir->names == NULL) {
+        for (int i = 0; i < count; ++i)
+            free(list[i]);
+        free(list);
+        free(data);
+        floppy_cpmdir_close(cpmdir);
+        return NULL;
+    }
+    memset(data, CPM_EMPTY, image_size);
+
+    // system tracks, to make the disk bootable
+    const char *system = conf_getString("floppy", "cpm_system");
+    if (system != NULL) {
+        FILE *fp = fopen(system, "rb");
+        if (fp == NULL ||
+            fread(data, 1, dpb->data_offset, fp) != dpb->data_offset)
+            LOG_WARN("unable to read system tracks from %s\n", system);
+        if (fp != NULL)
+            fclose(fp);
+    }
+
+    size_t next_block = dpb->dir_blocks;
+    size_t next_entry = 0;
+    for (int i = 0; i < count; ++i) {
+        char file_path[PATH_MAX];
+        cpm_name_t name;
+        struct stat st;
+
+        const int len = snprintf(file_path, sizeof(file_path), "%s/%s", path,
+                                 list[i]->d_name);
+        const bool regular = len > 0 && (size_t)len < sizeof(file_path) &&
+                             stat(file_path, &st) == 0 && S_ISREG(st.st_mode);
+        bool duplicate = false;
+
+        // each file takes at least a directory entry
+        if (regular && cpmdir->names_count == dpb->dir_entries) {
+            LOG_WARN("%s: directory is full, skip\n", list[i]->d_name);
+        } else if (regular && cpm_name(name.cpm, list[i]->d_name)) {
+            for (size_t n = 0; n < cpmdir->names_count; ++n)
+                duplicate = duplicate || memcmp(cpmdir->names[n].cpm, name.cpm,
+                                                CPM_FILENAME_SIZE) == 0;
+            if (duplicate)
+                LOG_WARN("%s: duplicate cp/m name, skip\n", list[i]->d_name);
+            else if (!cpm_import(data, dpb, name.cpm, file_path, &next_block,
+                                 &next_entry))
+                LOG_WARN("%s: does not fit the disk, skip\n", list[i]->d_name);
+            else {
+                (void)snprintf(name.host, sizeof(name.host), "%s",
+                               list[i]->d_name);
+                cpmdir->names[cpmdir->names_count++] = name;
+            }
+        } else if (regular) {
+            LOG_WARN("%s: not a valid cp/m name, skip\n", list[i]->d_name);
+        }
+
+        free(list[i]);
+    }
+    free(list);
+
+    LOG_INFO("%s: %zu files, %zu/%zu blocks\n", path, cpmdir->names_count,
+             next_block, dpb->blocks);
+
+    image->decoded = data;
+    image->data = data;
+    image->data_size = image_size;
+    floppy_image_addGeometry(image, &floppy_geometry_cff);
+
+    return cpmdir;
+}
+
+/**
+ * @brief Check whether a file already has the given content, apart from the
+ * padding of its last record.
+ */
+static bool cpm_unchanged(const char *path, const uint8_t *content,
+                          size_t size) {
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL)
+        return false;
+
+    struct stat st;
+    bool same = fstat(fileno(fp), &st) == 0 && (size_t)st.st_size <= size &&
+                size - (size_t)st.st_size < CPM_RECORD_SIZE;
+
+    uint8_t buffer[CPM_RECORD_SIZE];
+    size_t pos = 0;
+    while (same && pos < (size_t)st.st_size) {
+        const size_t n = fread(buffer, 1, sizeof(buffer), fp);
+        same = n > 0 && memcmp(buffer, content + pos, n) == 0;
+        pos += n;
+    }
+    fclose(fp);
+
+    // whatever follows is padding
+    for (; same && pos < size; ++pos)
+        same = content[pos] == CPM_EOF;
+
+    return same;
+}
+
+/**
+ * @brief Write a file back to the host directory, replacing it atomically.
+ */
+static bool cpm_export(const char *dir, const char *name,
+                       const uint8_t *content, size_t size) {
+    char path[PATH_MAX];
+    char tmp_path[PATH_MAX];
+    if ((size_t)snprintf(path, sizeof(path), "%s/%s", dir, name) >=
+            sizeof(path) ||
+        (size_t)snprintf(tmp_path, sizeof(tmp_path), "%s/.%s.tmp", dir,
+                         name) >= sizeof(tmp_path))
+        return false;
+
+    if (cpm_unchanged(path, content, size))
+        return true;
+
+    FILE *fp = fopen(tmp_path, "wb");
+    if (fp == NULL)
+        return false;
+
+    bool ok = fwrite(content, 1, size, fp) == size;
+    if (fclose(fp) != 0)
+        ok = false;
+
+    if (ok && rename(tmp_path, path) != 0)
+        ok = false;
+    if (!ok) {
+        (void)remove(tmp_path);
+        return false;
+    }
+
+    LOG_INFO("%s: written back\n", path);
+    return true;
+}
+
+/**
+ * @brief Write the files of the disk back to the host directory.
+ *
+ * @return true in case of success, false if any file could not be written.
+ */
+bool floppy_cpmdir_sync(const floppy_image_t *image, floppy_cpmdir_t *cpmdir) {
+    const cpm_dpb_t *dpb = &cpmdir->dpb;
+    const cpm_dirent_t *directory = cpm_directory(image->data, dpb);
+
+    // holes in files read as zeros
+    uint8_t *content = calloc(dpb->blocks, dpb->block_size);
+    if (content == NULL)
+        return false;
+
+    bool ok = true;
+    for (size_t i = 0; i < dpb->dir_entries; ++i) {
+        const cpm_dirent_t *head = &directory[i];
+        if (head->user != 0)
+            continue;
+
+        // each file is handled once, at its first entry
+        bool seen = false;
+        for (size_t j = 0; j < i && !seen; ++j)
+            seen = directory[j].user == 0 &&
+                   memcmp(directory[j].name, head->name, CPM_FILENAME_SIZE) ==
+                       0;
+        if (seen)
+            continue;
+
+        // collect all the entries of the file
+        size_t records = 0;
+        size_t size = 0;
+        for (size_t j = i; j < dpb->dir_entries; ++j) {
+            const cpm_dirent_t *entry = &directory[j];
+            if (entry->user != 0 ||
+                memcmp(entry->name, head->name, CPM_FILENAME_SIZE) != 0)
+                continue;
+
+            const size_t extent = (size_t)entry->s2 << 5 | entry->ex;
+            const size_t number = extent / dpb->entry_extents;
+            const size_t offset = number * dpb->entry_size;
+            const size_t pointers = dpb->wide ? 8 : 16;
+
+            for (size_t b = 0; b < pointers; ++b) {
+                const size_t block = cpm_get_block(dpb, entry, b);
+                if (block == 0 || block >= dpb->blocks)
+                    continue;
+                const size_t dst = offset + b * dpb->block_size;
+                if (dst + dpb->block_size > dpb->blocks * dpb->block_size)
+                    continue;
+                memcpy(content + dst, cpm_block(image->data, dpb, block),
+                       dpb->block_size);
+                size = MAX(size, dst + dpb->block_size);
+            }
+
+            const size_t rc = MIN((size_t)entry->rc, (size_t)0x80);
+            records = MAX(records, extent * (CPM_EXTENT_SIZE /
+                                             CPM_RECORD_SIZE) + rc);
+        }
+        const size_t file_size = MIN(size, records * CPM_RECORD_SIZE);
+
+        // imported files keep their host name
+        char name[NAME_MAX + 1];
+        host_name(name, head->name);
+        for (size_t n = 0; n < cpmdir->names_count; ++n) {
+            uint8_t cpm[CPM_FILENAME_SIZE];
+            for (size_t c = 0; c < CPM_FILENAME_SIZE; ++c)
+                cpm[c] = head->name[c] & 0x7f;
+            if (memcmp(cpmdir->names[n].cpm, cpm, CPM_FILENAME_SIZE) == 0)
+                strcpy(name, cpmdir->names[n].host);
+        }
+
+        if (!cpm_export(cpmdir->path, name, content, file_size)) {
+            LOG_ERR("%s: unable to write back %s\n", cpmdir->path, name);
+            ok = false;
+        }
+
+        // next file must not see this one in its holes
+        memset(content, 0, size);
+    }
+
+    free(content);
+    return ok;
+}
+
+void floppy_cpmdir_close(floppy_cpmdir_t *cpmdir) {
+    if (cpmdir == NULL)
+        return;
+
+    free(cpmdir->names);
+    free(cpmdir);
+}
+
+#if defined(CEDA_TEST)
+
+#include <criterion/criterion.h>
+#include <unistd.h>
+
+Test(floppy_cpmdir, name) {
+    uint8_t cpm[CPM_FILENAME_SIZE];
+    char host[NAME_MAX + 1];
+
+    cr_assert(cpm_name(cpm, "hello.c"));
+    cr_assert_arr_eq(cpm, "HELLO   C  ", CPM_FILENAME_SIZE);
+    host_name(host, cpm);
+    cr_assert_str_eq(host, "hello.c");
+
+    cr_assert(cpm_name(cpm, "README"));
+    cr_assert_arr_eq(cpm, "README     ", CPM_FILENAME_SIZE);
+    host_name(host, cpm);
+    cr_assert_str_eq(host, "readme");
+
+    cr_assert_not(cpm_name(cpm, "toolongname.c"));
+    cr_assert_not(cpm_name(cpm, "file.long"));
+    cr_assert_not(cpm_name(cpm, "sp ace"));
+    cr_assert_not(cpm_name(cpm, ".hidden"));
+}
+
+Test(floppy_cpmdir, dpb) {
+    const size_t image_size = floppy_geometry_size(&floppy_geometry_cff);
+    cpm_dpb_t dpb;
+
+    cr_assert(cpm_dpb_set(&dpb, CPM_DEFAULT_BLOCK_SIZE,
+                          CPM_DEFAULT_DIR_ENTRIES, CPM_DEFAULT_RESERVED,
+                          image_size));
+    cr_assert_eq(dpb.entry_extents, 1);
+
+    // more than 256 blocks of 1 KiB
+    cr_assert_not(cpm_dpb_set(&dpb, 1024, 64, 2, image_size));
+    cr_assert_gt((image_size - dpb.data_offset) / 1024, 256);
+
+    cr_assert_not(cpm_dpb_set(&dpb, 1536, 64, 2, image_size));
+    cr_assert_not(cpm_dpb_set(&dpb, 2048, 64, 0, image_size));
+}
+
+Test(floppy_cpmdir, roundtrip) {
+    char dir[] = "/tmp/ceda-cpmdir-XXXXXX";
+    cr_assert_not_null(mkdtemp(dir));
+
+    // a file spanning more than one directory entry, and a small one
+    char path[PATH_MAX];
+    static uint8_t big[40000];
+    for (size_t i = 0; i < sizeof(big); ++i)
+        big[i] = (uint8_t)i;
+    (void)snprintf(path, sizeof(path), "%s/Big.bin", dir);
+    FILE *fp = fopen(path, "wb");
+    cr_assert_not_null(fp);
+    cr_assert_eq(fwrite(big, 1, sizeof(big), fp), sizeof(big));
+    fclose(fp);
+    (void)snprintf(path, sizeof(path), "%s/small.txt", dir);
+    fp = fopen(path, "wb");
+    cr_assert_not_null(fp);
+    fputs("hello", fp);
+    fclose(fp);
+
+    static floppy_image_t image;
+    floppy_cpmdir_t *cpmdir = floppy_cpmdir_open(&image, dir);
+    cr_assert_not_null(cpmdir);
+    const cpm_dpb_t *dpb = &cpmdir->dpb;
+    const cpm_dirent_t *directory = cpm_directory(image.data, dpb);
+
+    // 40000 bytes = 313 records = 20 blocks: two entries of 16 KiB (8 blocks)
+    // and one of 7 KiB (4 blocks)
+    cr_assert(dpb->wide);
+    cr_assert_arr_eq(directory[0].name, "BIG     BIN", CPM_FILENAME_SIZE);
+    cr_assert_eq(directory[0].ex, 0);
+    cr_assert_eq(directory[0].rc, 0x80);
+    cr_assert_eq(directory[2].ex, 2);
+    cr_assert_eq(directory[2].rc, 313 - 256);
+    cr_assert_arr_eq(directory[3].name, "SMALL   TXT", CPM_FILENAME_SIZE);
+    cr_assert_eq(directory[3].rc, 1);
+    cr_assert_eq(directory[4].user, CPM_EMPTY);
+    cr_assert_arr_eq(cpm_block(image.data, dpb, cpm_get_block(dpb,
+                                                              &directory[1],
+                                                              0)),
+                     big + 8 * dpb->block_size, dpb->block_size);
+
+    // files missing from the host directory and modified files are written
+    // back
+    cr_assert_eq(unlink(path), 0);
+    cpm_block(image.data, dpb, cpm_get_block(dpb, &directory[0], 0))[0] = 0xff;
+    cr_assert(floppy_cpmdir_sync(&image, cpmdir));
+
+    (void)snprintf(path, sizeof(path), "%s/small.txt", dir);
+    fp = fopen(path, "rb");
+    cr_assert_not_null(fp);
+    fclose(fp);
+
+    (void)snprintf(path, sizeof(path), "%s/Big.bin", dir);
+    fp = fopen(path, "rb");
+    cr_assert_not_null(fp);
+    static uint8_t read_back[sizeof(big) + CPM_RECORD_SIZE];
+    const size_t n = fread(read_back, 1, sizeof(read_back), fp);
+    fclose(fp);
+    cr_assert_eq(n, 313 * CPM_RECORD_SIZE);
+    cr_assert_eq(read_back[0], 0xff);
+    cr_assert_arr_eq(read_back + 1, big + 1, sizeof(big) - 1);
+
+    free(image.decoded);
+    floppy_cpmdir_close(cpmdir);
+    unlink(path);
+    (void)snprintf(path, sizeof(path), "%s/small.txt", dir);
+    unlink(path);
+    rmdir(dir);
+}
+
+Test(floppy_cpmdir, full) {
+    char dir[] = "/tmp/ceda-cpmdir-XXXXXX";
+    cr_assert_not_null(mkdtemp(dir));
+
+    // more files than directory entries
+    char path[PATH_MAX];
+    const size_t files = CPM_DEFAULT_DIR_ENTRIES + 4;
+    for (size_t i = 0; i < files; ++i) {
+        (void)snprintf(path, sizeof(path), "%s/f%03zu", dir, i);
+        FILE *fp = fopen(path, "wb");
+        cr_assert_not_null(fp);
+        fclose(fp);
+    }
+
+    static floppy_image_t image;
+    floppy_cpmdir_t *cpmdir = floppy_cpmdir_open(&image, dir);
+    cr_assert_not_null(cpmdir);
+    cr_assert_eq(cpmdir->names_count, cpmdir->dpb.dir_entries);
+    cr_assert_str_eq(cpmdir->names[cpmdir->names_count - 1].host, "f127");
+
+    free(image.decoded);
+    floppy_cpmdir_close(cpmdir);
+    for (size_t i = 0; i < files; ++i) {
+        (void)snprintf(path, sizeof(path), "%s/f%03zu", dir, i);
+        unlink(path);
+    }
+    rmdir(dir);
+}
+
+#endif
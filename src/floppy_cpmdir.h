@@ -0,0 +1,17 @@
+#ifndef CEDA_FLOPPY_CPMDIR_H
+#define CEDA_FLOPPY_CPMDIR_H
+
+#include "floppy_format.h"
+
+#include <stdbool.h>
+
+typedef struct floppy_cpmdir_t floppy_cpmdir_t;
+
+// Pseudo-format of disks synthesized from a host directory
+extern const floppy_format_t floppy_format_cpmdir;
+
+floppy_cpmdir_t *floppy_cpmdir_open(floppy_image_t *image, const char *path);
+bool floppy_cpmdir_sync(const floppy_image_t *image, floppy_cpmdir_t *cpmdir);
+void floppy_cpmdir_close(floppy_cpmdir_t *cpmdir);
+
+#endif // CEDA_FLOPPY_CPMDIR_H
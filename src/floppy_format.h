@@ -0,0 +1,99 @@
+#ifndef CEDA_FLOPPY_FORMAT_H
+#define CEDA_FLOPPY_FORMAT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Limits of the sector index, large enough for any 5.25" and 8" disk
+#define FLOPPY_MAX_TRACKS  (84U)
+#define FLOPPY_MAX_HEADS   (2U)
+#define FLOPPY_MAX_SECTORS (32U)
+
+#define FLOPPY_SECTORS_COUNT                                                   \
+    (FLOPPY_MAX_TRACKS * FLOPPY_MAX_HEADS * FLOPPY_MAX_SECTORS)
+
+/**
+ * @brief Geometry of a disk with uniform formatting.
+ *
+ * Since CEDA disks have the first track of the first side formatted
+ * differently, this can be described too.
+ */
+typedef struct floppy_geometry_t {
+    unsigned int tracks;
+    unsigned int heads;
+    unsigned int sectors;     // sectors per track
+    unsigned int sector_size; // [bytes]
+    unsigned int t0_sectors;  // sectors in track 0, side 0 (0 if uniform)
+    unsigned int t0_sector_size; // [bytes] in track 0, side 0
+} floppy_geometry_t;
+
+/**
+ * @brief Position of a sector in the sector data of an image.
+ *
+ * Size is 0 if the sector does not exist in the image.
+ */
+typedef struct floppy_sector_t {
+    uint32_t offset;
+    uint16_t size;
+    uint16_t index; // linear sector index, for the overlay bitmap
+    bool dirty;     // written in the mapping, but not yet flushed to the image
+} floppy_sector_t;
+
+typedef struct floppy_gzip_t floppy_gzip_t;
+
+/**
+ * @brief A disk image, as seen by format drivers.
+ *
+ * The image file is mapped in memory, then the format driver builds the
+ * sector index, which is only done once at load.
+ *
+ * Sector data is either the image file itself (when sectors are stored as
+ * they are, eg. raw images), or a buffer allocated by the driver and freed at
+ * unload (decoded). In the latter case, the disk is write protected.
+ *
+ * If the image file is compressed, file is the decompression buffer, which
+ * is filled on demand.
+ */
+typedef struct floppy_image_t {
+    uint8_t *file;       // image file content
+    size_t file_size;    // [bytes]
+    uint8_t *data;       // sector data
+    size_t data_size;    // [bytes]
+    uint8_t *decoded;    // sector data owned by the driver, if any
+    bool read_only;      // disk is write protected
+    floppy_gzip_t *gzip; // decompression state, NULL if not compressed
+    floppy_sector_t sectors[FLOPPY_MAX_TRACKS][FLOPPY_MAX_HEADS]
+                           [FLOPPY_MAX_SECTORS];
+} floppy_image_t;
+
+/**
+ * @brief Disk image format driver.
+ */
+typedef struct floppy_format_t {
+    const char *name;
+    // file name extensions, NULL-terminated list
+    const char *const *extensions;
+    // recognize the format by its content, may be NULL
+    bool (*sniff)(const uint8_t *file, size_t file_size);
+    // build the sector index, return false if the image is not valid
+    bool (*open)(floppy_image_t *image);
+    // sector data is the image file itself, and open only needs its size, so
+    // a compressed image can be decompressed lazily
+    bool lazy;
+} floppy_format_t;
+
+extern const floppy_geometry_t floppy_geometry_cff;
+
+extern const floppy_format_t floppy_format_cff;
+extern const floppy_format_t floppy_format_raw;
+extern const floppy_format_t floppy_format_imd;
+
+void floppy_image_addSector(floppy_image_t *image, unsigned int track,
+                            unsigned int head, unsigned int sector,
+                            size_t offset, size_t size);
+bool floppy_image_addGeometry(floppy_image_t *image,
+                              const floppy_geometry_t *geometry);
+size_t floppy_geometry_size(const floppy_geometry_t *geometry);
+
+#endif // CEDA_FLOPPY_FORMAT_H
@@ -0,0 +1,215 @@
+#include "floppy_gzip.h"
+
+#include "macro.h"
+#include "units.h"
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#define LOG_LEVEL LOG_LVL_INFO
+#include "log.h"
+
+/*
+ * Compressed (gzip) disk images.
+ *
+ * The image is decompressed lazily in a memory buffer, which acts as a cache:
+ * when a track is accessed for the first time, the stream is decompressed up
+ * to the end of that track. Since the compressed file is mapped in memory,
+ * only the part of the file needed to reach the tracks actually touched is
+ * ever read from storage.
+ *
+ * Uncompressed size is taken from the gzip trailer, without decompressing.
+ *
+ * Decompression is strictly sequential: the first access to a track
+ * decompresses all the tracks before it too, so a seek to the last track
+ * costs a full decompression (a few tens of milliseconds at most, for the
+ * largest image). Access points (as in zlib's zran example) would not help,
+ * since building them takes a full pass anyway, and then all the image is
+ * already in the buffer.
+ *
+ * Decompression may run in the floppy I/O thread: data already decompressed
+ * is never touched again, so it can be read by the emulation meanwhile.
+ */
+#define GZIP_MAGIC0     (0x1f)
+#define GZIP_MAGIC1     (0x8b)
+#define GZIP_HEADER_MIN (18) // header (10 bytes) + trailer (8 bytes)
+// Largest image that makes sense for the sector index, with some room for
+// format overhead
+#define GZIP_MAX_SIZE (8 * MiB)
+
+struct floppy_gzip_t {
+    z_stream stream;
+    uint8_t *buffer;        // decompressed image
+    size_t size;            // [bytes] uncompressed size
+    atomic_size_t inflated; // [bytes] decompressed so far
+    // stream is corrupted, no more data can be fetched
+    atomic_bool failed;
+};
+
+bool floppy_gzip_sniff(const uint8_t *file, size_t file_size) {
+    return file_size >= GZIP_HEADER_MIN && file[0] == GZIP_MAGIC0 &&
+           file[1] == GZIP_MAGIC1;
+}
+
+/**
+ * @brief Prepare a compressed image for lazy decompression.
+ *
+ * Image file becomes the decompression buffer, which is initially empty.
+ *
+ * @param image Image to be opened.
+ * @param file Compressed file content.
+ * @param file_size Size of the compressed file content. [bytes]
+ *
+ * @return true in case of success, false otherwise.
+ */
+bool floppy_gzip_open(floppy_image_t *image, const uint8_t *file,
+                      size_t file_size) {
+    if (!floppy_gzip_sniff(file, file_size))
+        return false;
+
+    // ISIZE, little endian, at the end of the trailer
+    const uint8_t *isize = file + file_size - 4;
+    const size_t size = (size_t)isize[0] | (size_t)isize[1] << 8 |
+                        (size_t)isize[2] << 16 | (size_t)isize[3] << 24;
+    if (size == 0 || size > GZIP_MAX_SIZE) {
+        LOG_ERR("unsupported compressed image size: %zu\n", size);
+        return false;
+    }
+
+    floppy_gzip_t *gzip = calloc(1, sizeof(*gzip));
+    if (gzip == NULL)
+        return false;
+
+    gzip->buffer = malloc(size);
+    if (gzip->buffer == NULL) {
+        free(gzip);
+        return false;
+    }
+
+    // zlib does not modify the input, despite its prototype
+    gzip->stream.next_in = (Bytef *)(uintptr_t)file;
+    gzip->stream.avail_in = (uInt)file_size;
+    if (inflateInit2(&gzip->stream, 16 + MAX_WBITS) != Z_OK) {
+        free(gzip->buffer);
+        free(gzip);
+        return false;
+    }
+
+    gzip->size = size;
+    image->gzip = gzip;
+    image->file = gzip->buffer;
+    image->file_size = size;
+
+    return true;
+}
+
+/**
+ * @brief Make sure that the image is decompressed up to a certain point.
+ *
+ * @param image Compressed image.
+ * @param end Offset in the image up to which data is needed. [bytes]
+ *
+ * @return true in case of success, false if data is not available.
+ */
+bool floppy_gzip_fetch(floppy_image_t *image, size_t end) {
+    floppy_gzip_t *gzip = image->gzip;
+
+    end = MIN(end, gzip->size);
+    size_t inflated = gzip->inflated;
+    while (inflated < end && !gzip->failed) {
+        gzip->stream.next_out = gzip->buffer + inflated;
+        gzip->stream.avail_out = (uInt)(end - inflated);
+
+        const int ret = inflate(&gzip->stream, Z_NO_FLUSH);
+        inflated = (size_t)(gzip->stream.next_out - gzip->buffer);
+        gzip->inflated = inflated;
+
+        // stream ended or broken before the expected size
+        if ((ret == Z_STREAM_END && inflated < end) ||
+            (ret != Z_OK && ret != Z_STREAM_END)) {
+            LOG_ERR("compressed image is corrupted\n");
+            gzip->failed = true;
+        }
+    }
+
+    return inflated >= end;
+}
+
+/**
+ * @brief Check whether fetching data up to a certain point would return
+ * immediately, because data is already decompressed or can not be.
+ */
+bool floppy_gzip_available(const floppy_image_t *image, size_t end) {
+    const floppy_gzip_t *gzip = image->gzip;
+
+    return gzip->inflated >= MIN(end, gzip->size) || gzip->failed;
+}
+
+/**
+ * @brief Release decompression resources and buffer.
+ */
+void floppy_gzip_close(floppy_image_t *image) {
+    floppy_gzip_t *gzip = image->gzip;
+    if (gzip == NULL)
+        return;
+
+    inflateEnd(&gzip->stream);
+    free(gzip->buffer);
+    free(gzip);
+
+    image->gzip = NULL;
+}
+
+#if defined(CEDA_TEST)
+
+#include <criterion/criterion.h>
+
+Test(floppy_gzip, fetch) {
+    static uint8_t plain[64 * KiB];
+    for (size_t i = 0; i < sizeof(plain); ++i)
+        plain[i] = (uint8_t)(i / 1024);
+
+    // compress with gzip wrapper
+    static uint8_t file[sizeof(plain) + 1024];
+    z_stream stream = {0};
+    cr_assert_eq(deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED,
+                              16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY),
+                 Z_OK);
+    stream.next_in = plain;
+    stream.avail_in = sizeof(plain);
+    stream.next_out = file;
+    stream.avail_out = sizeof(file);
+    cr_assert_eq(deflate(&stream, Z_FINISH), Z_STREAM_END);
+    const size_t file_size = stream.total_out;
+    deflateEnd(&stream);
+
+    static floppy_image_t image;
+    cr_assert(floppy_gzip_open(&image, file, file_size));
+    cr_assert_eq(image.file_size, sizeof(plain));
+    cr_assert_eq(image.gzip->inflated, 0);
+
+    // only what is needed is decompressed
+    cr_assert_not(floppy_gzip_available(&image, 5000));
+    cr_assert(floppy_gzip_fetch(&image, 5000));
+    cr_assert_eq(image.gzip->inflated, 5000);
+    cr_assert(floppy_gzip_available(&image, 5000));
+    cr_assert_arr_eq(image.file, plain, 5000);
+    cr_assert(floppy_gzip_fetch(&image, 100));
+    cr_assert_eq(image.gzip->inflated, 5000);
+
+    cr_assert(floppy_gzip_fetch(&image, sizeof(plain) + 1));
+    cr_assert_arr_eq(image.file, plain, sizeof(plain));
+    floppy_gzip_close(&image);
+    cr_assert_null(image.gzip);
+
+    // truncated stream, but with a valid trailer
+    const size_t truncated = file_size / 2;
+    memcpy(file + truncated - 4, file + file_size - 4, 4);
+    cr_assert(floppy_gzip_open(&image, file, truncated));
+    cr_assert_not(floppy_gzip_fetch(&image, sizeof(plain)));
+    floppy_gzip_close(&image);
+}
+
+#endif
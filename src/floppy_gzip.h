@@ -0,0 +1,17 @@
+#ifndef CEDA_FLOPPY_GZIP_H
+#define CEDA_FLOPPY_GZIP_H
+
+#include "floppy_format.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+bool floppy_gzip_sniff(const uint8_t *file, size_t file_size);
+bool floppy_gzip_open(floppy_image_t *image, const uint8_t *file,
+                      size_t file_size);
+bool floppy_gzip_fetch(floppy_image_t *image, size_t end);
+bool floppy_gzip_available(const floppy_image_t *image, size_t end);
+void floppy_gzip_close(floppy_image_t *image);
+
+#endif // CEDA_FLOPPY_GZIP_H
@@ -0,0 +1,186 @@
+#include "floppy_format.h"
+
+#include "macro.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define LOG_LEVEL LOG_LVL_INFO
+#include "log.h"
+
+/*
+ * ImageDisk (IMD) format.
+ *
+ * The file begins with an ASCII header "IMD v.vv: date time", followed by a
+ * free comment, terminated by 0x1a. Then, for each track:
+ *  mode (1 byte), cylinder (1 byte), head (1 byte), sectors (1 byte),
+ *  sector size code (1 byte, size is 128 << code),
+ *  sector numbering map (1 byte for each sector),
+ *  cylinder map (1 byte for each sector), if head bit 7 is set,
+ *  head map (1 byte for each sector), if head bit 6 is set,
+ *  sector data records, one for each sector.
+ * Each data record begins with a type byte: 0 means that data is not
+ * available, an odd type is followed by the full sector data, an even type is
+ * followed by a single byte, with which the whole sector is filled.
+ * Deleted data marks and data errors (other types) are not emulated.
+ *
+ * Since some sectors are compressed, sector data is decoded in a buffer at
+ * load time, and the disk is write protected.
+ */
+#define IMD_MAGIC            "IMD "
+#define IMD_COMMENT_END      (0x1a)
+#define IMD_HEAD_CYLINDERMAP (0x80)
+#define IMD_HEAD_HEADMAP     (0x40)
+#define IMD_HEAD_MASK        (0x01)
+#define IMD_SIZE_CODE_MAX    (6)
+
+static const char *const IMD_EXTENSIONS[] = {".imd", NULL};
+
+static bool imd_sniff(const uint8_t *file, size_t file_size) {
+    return file_size >= sizeof(IMD_MAGIC) - 1 &&
+           memcmp(file, IMD_MAGIC, sizeof(IMD_MAGIC) - 1) == 0;
+}
+
+/**
+ * @brief Walk through the image, indexing sectors.
+ *
+ * @param image Image to be indexed.
+ * @param data Where to decode sector data, NULL to only compute its size.
+ *
+ * @return Size of sector data, or 0 if the image is not valid.
+ */
+static size_t imd_walk(floppy_image_t *image, uint8_t *data) {
+    const uint8_t *file = image->file;
+    const size_t file_size = image->file_size;
+
+    const uint8_t *comment_end = memchr(file, IMD_COMMENT_END, file_size);
+    if (comment_end == NULL)
+        return 0;
+
+    size_t pos = (size_t)(comment_end - file) + 1;
+    size_t data_size = 0;
+    while (pos < file_size) {
+        if (file_size - pos < 5)
+            return 0;
+
+        const uint8_t cylinder = file[pos + 1];
+        const uint8_t head = file[pos + 2];
+        const uint8_t sectors = file[pos + 3];
+        const uint8_t size_code = file[pos + 4];
+        pos += 5;
+
+        if (size_code > IMD_SIZE_CODE_MAX)
+            return 0;
+        const size_t size = (size_t)128 << size_code;
+
+        const uint8_t *sector_map = file + pos;
+        pos += sectors;
+        if (head & IMD_HEAD_CYLINDERMAP)
+            pos += sectors;
+        if (head & IMD_HEAD_HEADMAP)
+            pos += sectors;
+        if (pos > file_size)
+            return 0;
+
+        for (size_t i = 0; i < sectors; ++i) {
+            if (pos >= file_size)
+                return 0;
+
+            const uint8_t type = file[pos++];
+            if (type == 0)
+                continue;
+
+            const size_t record = (type & 1) ? size : 1;
+            if (file_size - pos < record)
+                return 0;
+
+            if (data != NULL) {
+                if (type & 1)
+                    memcpy(data + data_size, file + pos, size);
+                else
+                    memset(data + data_size, file[pos], size);
+
+                // Sectors are numbered from 1 on the disk, but from 0 here
+                if (sector_map[i] != 0)
+                    floppy_image_addSector(image, cylinder,
+                                           head & IMD_HEAD_MASK,
+                                           sector_map[i] - 1U, data_size,
+                                           size);
+            }
+
+            pos += record;
+            data_size += size;
+        }
+    }
+
+    return data_size;
+}
+
+static bool imd_open(floppy_image_t *image) {
+    const size_t data_size = imd_walk(image, NULL);
+    if (data_size == 0)
+        return false;
+
+    uint8_t *data = malloc(data_size);
+    if (data == NULL)
+        return false;
+
+    image->decoded = data;
+    image->data = data;
+    image->data_size = data_size;
+    image->read_only = true;
+
+    (void)imd_walk(image, data);
+
+    return true;
+}
+
+const floppy_format_t floppy_format_imd = {
+    .name = "imd",
+    .extensions = IMD_EXTENSIONS,
+    .sniff = imd_sniff,
+    .open = imd_open,
+    .lazy = false,
+};
+
+#if defined(CEDA_TEST)
+
+#include <criterion/criterion.h>
+
+Test(floppy_imd, open) {
+    // clang-format off
+    static uint8_t file[] = {
+        'I', 'M', 'D', ' ', '1', '.', '1', '8', ':', IMD_COMMENT_END,
+        // track 1, head 1, 3 sectors of 256 bytes, interleaved
+        0x05, 1, 1, 3, 1,
+        1, 3, 2,
+        2, 0xe5,    // sector 1, compressed
+        0x00,       // sector 3, missing
+        1,          // sector 2, full data follows
+    };
+    // clang-format on
+    static uint8_t buffer[sizeof(file) + 256];
+    memcpy(buffer, file, sizeof(file));
+    memset(buffer + sizeof(file), 0x42, 256);
+
+    static floppy_image_t image;
+    image.file = buffer;
+    image.file_size = sizeof(buffer);
+    cr_assert(imd_sniff(image.file, image.file_size));
+    cr_assert(imd_open(&image));
+
+    cr_assert(image.read_only);
+    cr_assert_eq(image.data_size, 512);
+    cr_assert_eq(image.sectors[1][1][0].size, 256);
+    cr_assert_eq(image.data[image.sectors[1][1][0].offset], 0xe5);
+    cr_assert_eq(image.sectors[1][1][1].size, 256);
+    cr_assert_eq(image.data[image.sectors[1][1][1].offset + 255], 0x42);
+    cr_assert_eq(image.sectors[1][1][2].size, 0);
+    free(image.decoded);
+
+    // truncated
+    image.file_size = sizeof(buffer) - 1;
+    cr_assert_not(imd_open(&image));
+}
+
+#endif
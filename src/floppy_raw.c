@@ -0,0 +1,165 @@
+#include "floppy_format.h"
+
+#include "conf.h"
+#include "macro.h"
+#include "tokenizer.h"
+
+#include <string.h>
+
+#define LOG_LEVEL LOG_LVL_INFO
+#include "log.h"
+
+/*
+ * Ceda File Format.
+ * This image is a linearized binary dump of the floppy, ordered by sector,
+ * then head, then track.
+ * Ceda/Sanco disks have 80 tracks, 2 sides and are formatted, by default, with
+ * first track with 256 bytes per sector and 16 sectors per track, others with
+ * 1024 bps and 5 spt. The Ceda File Format reflects this formatting layout.
+ */
+const floppy_geometry_t floppy_geometry_cff = {
+    .tracks = 80,
+    .heads = 2,
+    .sectors = 5,
+    .sector_size = 1024,
+    .t0_sectors = 16,
+    .t0_sector_size = 256,
+};
+
+/*
+ * Raw images are linearized binary dumps too, but with any uniform geometry.
+ * Unless configured, the geometry is guessed from the image size.
+ */
+static const floppy_geometry_t RAW_GEOMETRIES[] = {
+    {40, 1, 9, 512, 0, 0},   // 180 KiB, 5.25" SS DD
+    {40, 2, 9, 512, 0, 0},   // 360 KiB, 5.25" DS DD
+    {80, 2, 9, 512, 0, 0},   // 720 KiB, 3.5" DS DD
+    {80, 2, 15, 512, 0, 0},  // 1.2 MiB, 5.25" DS HD
+    {80, 2, 18, 512, 0, 0},  // 1.44 MiB, 3.5" DS HD
+    {77, 1, 26, 128, 0, 0},  // 250 KiB, 8" SS SD (IBM 3740)
+    {80, 2, 16, 256, 0, 0},  // 640 KiB, 5.25" DS DD, 256 bps
+};
+
+size_t floppy_geometry_size(const floppy_geometry_t *geometry) {
+    size_t size = (size_t)geometry->tracks * geometry->heads *
+                  geometry->sectors * geometry->sector_size;
+
+    // first track of first side may be formatted differently
+    if (geometry->t0_sectors != 0) {
+        size -= (size_t)geometry->sectors * geometry->sector_size;
+        size += (size_t)geometry->t0_sectors * geometry->t0_sector_size;
+    }
+
+    return size;
+}
+
+static const char *const CFF_EXTENSIONS[] = {".cff", NULL};
+
+static bool cff_sniff(const uint8_t *file, size_t file_size) {
+    (void)file;
+
+    return file_size == floppy_geometry_size(&floppy_geometry_cff);
+}
+
+static bool cff_open(floppy_image_t *image) {
+    return floppy_image_addGeometry(image, &floppy_geometry_cff);
+}
+
+const floppy_format_t floppy_format_cff = {
+    .name = "cff",
+    .extensions = CFF_EXTENSIONS,
+    .sniff = cff_sniff,
+    .open = cff_open,
+    .lazy = true,
+};
+
+/**
+ * @brief Parse the raw image geometry from configuration.
+ *
+ * Expected syntax:
+ *  <tracks> <heads> <sectors> <sector size> [<t0 sectors> <t0 sector size>]
+ *
+ * @return true if a valid geometry is configured, false otherwise.
+ */
+static bool raw_conf_geometry(floppy_geometry_t *geometry) {
+    const char *conf = conf_getString("floppy", "geometry");
+    if (conf == NULL)
+        return false;
+
+    unsigned int *fields[] = {
+        &geometry->tracks,     &geometry->heads,
+        &geometry->sectors,    &geometry->sector_size,
+        &geometry->t0_sectors, &geometry->t0_sector_size,
+    };
+
+    memset(geometry, 0, sizeof(*geometry));
+    for (size_t i = 0; i < ARRAY_SIZE(fields) && conf != NULL; ++i)
+        conf = tokenizer_next_int(fields[i], conf);
+
+    if (geometry->tracks == 0 || geometry->heads == 0 ||
+        geometry->sectors == 0 || geometry->sector_size == 0 ||
+        (geometry->t0_sectors != 0 && geometry->t0_sector_size == 0)) {
+        LOG_ERR("invalid raw geometry: %s\n",
+                conf_getString("floppy", "geometry"));
+        return false;
+    }
+
+    return true;
+}
+
+// .img is ambiguous, and it is commonly used for CFF images too: such
+// images are recognized by their size
+static const char *const RAW_EXTENSIONS[] = {".raw", NULL};
+
+static bool raw_sniff(const uint8_t *file, size_t file_size) {
+    (void)file;
+
+    for (size_t i = 0; i < ARRAY_SIZE(RAW_GEOMETRIES); ++i)
+        if (file_size == floppy_geometry_size(&RAW_GEOMETRIES[i]))
+            return true;
+
+    return false;
+}
+
+static bool raw_open(floppy_image_t *image) {
+    floppy_geometry_t geometry;
+    if (raw_conf_geometry(&geometry))
+        return floppy_image_addGeometry(image, &geometry);
+
+    for (size_t i = 0; i < ARRAY_SIZE(RAW_GEOMETRIES); ++i)
+        if (image->file_size == floppy_geometry_size(&RAW_GEOMETRIES[i]))
+            return floppy_image_addGeometry(image, &RAW_GEOMETRIES[i]);
+
+    LOG_ERR("unknown raw geometry, set [floppy] geometry\n");
+    return false;
+}
+
+const floppy_format_t floppy_format_raw = {
+    .name = "raw",
+    .extensions = RAW_EXTENSIONS,
+    .sniff = raw_sniff,
+    .open = raw_open,
+    .lazy = true,
+};
+
+#if defined(CEDA_TEST)
+
+#include <criterion/criterion.h>
+
+Test(floppy_raw, geometry) {
+    cr_assert_eq(floppy_geometry_size(&floppy_geometry_cff), 818176);
+    cr_assert(cff_sniff(NULL, 818176));
+    cr_assert_not(raw_sniff(NULL, 818176));
+    cr_assert(raw_sniff(NULL, 737280));
+
+    static floppy_image_t image;
+    image.data_size = image.file_size = 737280;
+    cr_assert(raw_open(&image));
+    cr_assert_eq(image.sectors[0][0][0].size, 512);
+    cr_assert_eq(image.sectors[1][1][8].offset, (3 * 9 + 8) * 512);
+    cr_assert_eq(image.sectors[79][1][8].offset, 737280 - 512);
+    cr_assert_eq(image.sectors[79][1][9].size, 0);
+    cr_assert_eq(image.sectors[80][0][0].size, 0);
+}
+
+#endif
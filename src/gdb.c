@@ -0,0 +1,840 @@
+#include "gdb.h"
+
+#include "bus.h"
+#include "conf.h"
+#include "cpu.h"
+#include "macro.h"
+#include "reactor.h"
+#include "ring.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define LOG_LEVEL LOG_LVL_INFO
+#include "log.h"
+
+#define GDB_TCP_PORT    (0xCEDC)
+#define GDB_PACKET_SIZE (0x1000U) // [bytes] max payload, in both directions
+#define GDB_FRAME_SIZE  (2 * GDB_PACKET_SIZE + 4) // [bytes] escaped, framed
+#define GDB_RING_SIZE   (64U * 1024U)             // [bytes]
+
+#define GDB_SIGINT  (2)
+#define GDB_SIGTRAP (5)
+
+/*
+ * Register numbers, as known by gdb for the z80 architecture.
+ * All of them are 16 bit wide, and transferred as little endian.
+ */
+typedef enum gdb_reg_t {
+    GDB_REG_AF,
+    GDB_REG_BC,
+    GDB_REG_DE,
+    GDB_REG_HL,
+    GDB_REG_SP,
+    GDB_REG_PC,
+    GDB_REG_IX,
+    GDB_REG_IY,
+    GDB_REG_AF_,
+    GDB_REG_BC_,
+    GDB_REG_DE_,
+    GDB_REG_HL_,
+    GDB_REG_IR, // not available
+
+    GDB_REG_CNT,
+} gdb_reg_t;
+
+typedef enum gdb_rx_state_t {
+    GDB_RX_IDLE,      // waiting for $
+    GDB_RX_DATA,      // receiving payload, up to #
+    GDB_RX_CHECKSUM1, // receiving first checksum digit
+    GDB_RX_CHECKSUM2, // receiving second checksum digit
+} gdb_rx_state_t;
+
+static int sockfd = -1; // listening socket
+static int connfd = -1; // client socket
+static uint16_t port = 0;
+static ring_t tx_ring;
+
+static bool no_ack = false;  // client asked to stop acknowledging packets
+static bool running = false; // cpu resumed by client, stop not yet notified
+static bool closing = false; // disconnect client after sending pending data
+
+static gdb_rx_state_t rx_state = GDB_RX_IDLE;
+static char packet[GDB_PACKET_SIZE + 1]; // payload, null-terminated
+static size_t packet_size = 0;
+static bool packet_overflow = false;
+static uint8_t checksum = 0;
+static int expected_checksum = 0; // first digit only, -1 if not valid
+
+static char reply[GDB_PACKET_SIZE];
+static uint8_t frame[GDB_FRAME_SIZE];
+
+static const char hex_digits[] = "0123456789abcdef";
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+/**
+ * @brief Parse a hexadecimal number.
+ *
+ * @return Pointer to the first char after the number, or NULL if there are
+ * no digits at all.
+ */
+static const char *gdb_parse_hex(const char *s, unsigned long int *value) {
+    const char *begin = s;
+
+    *value = 0;
+    for (; hex_value(*s) >= 0; ++s)
+        *value = (*value << 4) | (unsigned long int)hex_value(*s);
+
+    return (s == begin) ? NULL : s;
+}
+
+/**
+ * @brief Parse "<addr>,<len>", common to all memory packets.
+ *
+ * @return Pointer to the first char after the length, or NULL in case of
+ * error.
+ */
+static const char *gdb_parse_range(const char *s, ceda_address_t *address,
+                                   size_t *size) {
+    unsigned long int value;
+
+    s = gdb_parse_hex(s, &value);
+    if (s == NULL || *s != ',' || value > UINT16_MAX)
+        return NULL;
+    *address = (ceda_address_t)value;
+
+    s = gdb_parse_hex(s + 1, &value);
+    if (s == NULL || value > GDB_PACKET_SIZE)
+        return NULL;
+    *size = (size_t)value;
+
+    return s;
+}
+
+static void gdb_update_events(void) {
+    // stop reading requests while a full reply could not be queued
+    const unsigned int rx_events =
+        (closing || ring_space(&tx_ring) < GDB_FRAME_SIZE) ? 0 : REACTOR_READ;
+    const unsigned int tx_events =
+        (ring_count(&tx_ring) == 0) ? 0 : REACTOR_WRITE;
+
+    reactor_modify(connfd, rx_events | tx_events);
+}
+
+static void gdb_disconnect(void) {
+    if (connfd == -1)
+        return;
+
+    LOG_INFO("gdb: client disconnected\n");
+    reactor_remove(connfd);
+    close(connfd);
+    connfd = -1;
+    ring_flush(&tx_ring);
+
+    // accept the next client
+    if (sockfd != -1)
+        reactor_modify(sockfd, REACTOR_READ);
+}
+
+static void gdb_send(const void *data, size_t size) {
+    if (ring_push(&tx_ring, data, size) != size) {
+        LOG_ERR("gdb: client is not reading replies\n");
+        gdb_disconnect();
+        return;
+    }
+    gdb_update_events();
+}
+
+/**
+ * @brief Frame a reply payload as a packet, and send it.
+ *
+ * Payload can be binary: special chars are escaped here.
+ */
+static void gdb_reply(const void *data, size_t size) {
+    const uint8_t *src = data;
+    uint8_t sum = 0;
+    size_t n = 0;
+
+    frame[n++] = '$';
+    for (size_t i = 0; i < size; ++i) {
+        uint8_t c = src[i];
+        if (c == '$' || c == '#' || c == '}' || c == '*') {
+            frame[n++] = '}';
+            sum = (uint8_t)(sum + '}');
+            c ^= 0x20;
+        }
+        frame[n++] = c;
+        sum = (uint8_t)(sum + c);
+    }
+    frame[n++] = '#';
+    frame[n++] = (uint8_t)hex_digits[sum >> 4];
+    frame[n++] = (uint8_t)hex_digits[sum & 0x0f];
+
+    gdb_send(frame, n);
+}
+
+static void gdb_reply_string(const char *str) {
+    gdb_reply(str, strlen(str));
+}
+
+static void gdb_reply_stop(unsigned int signal) {
+    char str[4];
+    snprintf(str, sizeof(str), "S%02x", signal);
+    gdb_reply_string(str);
+}
+
+static void gdb_reply_error(void) {
+    gdb_reply_string("E01");
+}
+
+static size_t gdb_put_hex8(char *dst, uint8_t value) {
+    dst[0] = hex_digits[value >> 4];
+    dst[1] = hex_digits[value & 0x0f];
+    return 2;
+}
+
+static size_t gdb_put_reg(char *dst, const CpuRegs *regs, unsigned int reg) {
+    zuint16 value;
+
+    switch (reg) {
+    case GDB_REG_AF:
+        value = regs->fg.af;
+        break;
+    case GDB_REG_BC:
+        value = regs->fg.bc;
+        break;
+    case GDB_REG_DE:
+        value = regs->fg.de;
+        break;
+    case GDB_REG_HL:
+        value = regs->fg.hl;
+        break;
+    case GDB_REG_SP:
+        value = regs->sp;
+        break;
+    case GDB_REG_PC:
+        value = regs->pc;
+        break;
+    case GDB_REG_IX:
+        value = regs->ix;
+        break;
+    case GDB_REG_IY:
+        value = regs->iy;
+        break;
+    case GDB_REG_AF_:
+        value = regs->bg.af;
+        break;
+    case GDB_REG_BC_:
+        value = regs->bg.bc;
+        break;
+    case GDB_REG_DE_:
+        value = regs->bg.de;
+        break;
+    case GDB_REG_HL_:
+        value = regs->bg.hl;
+        break;
+    default:
+        // unknown value
+        memcpy(dst, "xxxx", 4);
+        return 4;
+    }
+
+    gdb_put_hex8(&dst[0], (uint8_t)(value & 0xff));
+    gdb_put_hex8(&dst[2], (uint8_t)(value >> 8));
+    return 4;
+}
+
+static void gdb_read_registers(void) {
+    CpuRegs regs;
+    cpu_reg(&regs);
+
+    size_t n = 0;
+    for (unsigned int reg = 0; reg < GDB_REG_CNT; ++reg)
+        n += gdb_put_reg(&reply[n], &regs, reg);
+
+    gdb_reply(reply, n);
+}
+
+static void gdb_read_register(const char *args) {
+    unsigned long int reg;
+    if (gdb_parse_hex(args, &reg) == NULL || reg >= GDB_REG_CNT) {
+        gdb_reply_error();
+        return;
+    }
+
+    CpuRegs regs;
+    cpu_reg(&regs);
+    gdb_reply(reply, gdb_put_reg(reply, &regs, (unsigned int)reg));
+}
+
+static void gdb_write_register(const char *args) {
+    unsigned long int reg;
+    args = gdb_parse_hex(args, &reg);
+    if (args == NULL || *args != '=' || strlen(args + 1) != 4) {
+        gdb_reply_error();
+        return;
+    }
+
+    // only the program counter can be changed
+    const int digits[] = {hex_value(args[1]), hex_value(args[2]),
+                          hex_value(args[3]), hex_value(args[4])};
+    if (reg != GDB_REG_PC || digits[0] < 0 || digits[1] < 0 ||
+        digits[2] < 0 || digits[3] < 0) {
+        gdb_reply_error();
+        return;
+    }
+
+    // little endian
+    cpu_goto((zuint16)((digits[2] << 12) | (digits[3] << 8) |
+                       (digits[0] << 4) | digits[1]));
+    gdb_reply_string("OK");
+}
+
+static void gdb_read_memory(const char *args) {
+    ceda_address_t address;
+    size_t size;
+    if (gdb_parse_range(args, &address, &size) == NULL) {
+        gdb_reply_error();
+        return;
+    }
+
+    // hex digits must fit in a single reply
+    size = MIN(size, sizeof(reply) / 2);
+
+    uint8_t blob[GDB_PACKET_SIZE / 2];
+    bus_mem_readsome(blob, address, (ceda_size_t)size);
+
+    for (size_t i = 0; i < size; ++i)
+        gdb_put_hex8(&reply[2 * i], blob[i]);
+    gdb_reply(reply, 2 * size);
+}
+
+static void gdb_read_memory_binary(const char *args) {
+    ceda_address_t address;
+    size_t size;
+    if (gdb_parse_range(args, &address, &size) == NULL) {
+        gdb_reply_error();
+        return;
+    }
+
+    // 'b' marker, then raw data
+    size = MIN(size, sizeof(reply) - 1);
+
+    reply[0] = 'b';
+    bus_mem_readsome((uint8_t *)&reply[1], address, (ceda_size_t)size);
+    gdb_reply(reply, size + 1);
+}
+
+static void gdb_write_memory(const char *args) {
+    ceda_address_t address;
+    size_t size;
+    args = gdb_parse_range(args, &address, &size);
+    if (args == NULL || *args != ':' || strlen(args + 1) != 2 * size) {
+        gdb_reply_error();
+        return;
+    }
+    ++args;
+
+    for (size_t i = 0; i < size; ++i) {
+        const int hi = hex_value(args[2 * i]);
+        const int lo = hex_value(args[2 * i + 1]);
+        if (hi < 0 || lo < 0) {
+            gdb_reply_error();
+            return;
+        }
+        bus_mem_write((ceda_address_t)(address + i), (uint8_t)(hi << 4 | lo));
+    }
+
+    gdb_reply_string("OK");
+}
+
+static void gdb_write_memory_binary(const char *args, size_t args_size) {
+    ceda_address_t address;
+    size_t size;
+    const char *data = gdb_parse_range(args, &address, &size);
+    if (data == NULL || *data != ':') {
+        gdb_reply_error();
+        return;
+    }
+    ++data;
+
+    const char *end = args + args_size;
+    for (size_t i = 0; i < size; ++i) {
+        if (data >= end) {
+            gdb_reply_error();
+            return;
+        }
+        uint8_t c = (uint8_t)*data++;
+        if (c == '}') {
+            if (data >= end) {
+                gdb_reply_error();
+                return;
+            }
+            c = (uint8_t)*data++ ^ 0x20;
+        }
+        bus_mem_write((ceda_address_t)(address + i), c);
+    }
+
+    gdb_reply_string("OK");
+}
+
+/**
+ * @brief Insert or remove a breakpoint.
+ *
+ * Both software and hardware breakpoints are mapped to cpu breakpoints.
+ */
+static void gdb_breakpoint(const char *args, bool insert) {
+    unsigned long int type;
+    unsigned long int address;
+
+    args = gdb_parse_hex(args, &type);
+    if (args == NULL || *args != ',' || type > 1) {
+        // watchpoints are not supported
+        gdb_reply_string("");
+        return;
+    }
+    args = gdb_parse_hex(args + 1, &address);
+    if (args == NULL || address > UINT16_MAX) {
+        gdb_reply_error();
+        return;
+    }
+
+    if (insert) {
+        if (cpu_addBreakpoint((zuint16)address))
+            gdb_reply_string("OK");
+        else
+            gdb_reply_error();
+        return;
+    }
+
+    CpuBreakpoint *breakpoints;
+    const size_t count = cpu_getBreakpoints(&breakpoints);
+    for (size_t i = 0; i < count; ++i) {
+        if (breakpoints[i].valid && breakpoints[i].address == address) {
+            cpu_deleteBreakpoint((unsigned int)i);
+            gdb_reply_string("OK");
+            return;
+        }
+    }
+    gdb_reply_error();
+}
+
+/**
+ * @brief Resume or step the cpu, optionally from another address.
+ */
+static void gdb_resume(const char *args, bool step) {
+    unsigned long int address;
+    if (gdb_parse_hex(args, &address) != NULL)
+        cpu_goto((zuint16)address);
+
+    // possibly step past the breakpoint
+    cpu_step();
+
+    if (step) {
+        gdb_reply_stop(GDB_SIGTRAP);
+        return;
+    }
+
+    // stop is notified as soon as the cpu is paused again
+    running = true;
+    cpu_pause(false);
+}
+
+static void gdb_query(const char *args) {
+    if (strncmp(args, "Supported", strlen("Supported")) == 0) {
+        snprintf(reply, sizeof(reply),
+                 "PacketSize=%x;QStartNoAckMode+;binary-upload+",
+                 GDB_PACKET_SIZE);
+        gdb_reply_string(reply);
+    } else if (strcmp(args, "Attached") == 0) {
+        gdb_reply_string("1");
+    } else if (strcmp(args, "C") == 0) {
+        gdb_reply_string("QC1");
+    } else if (strcmp(args, "fThreadInfo") == 0) {
+        gdb_reply_string("m1");
+    } else if (strcmp(args, "sThreadInfo") == 0) {
+        gdb_reply_string("l");
+    } else {
+        gdb_reply_string("");
+    }
+}
+
+static void gdb_handle_packet(const char *data, size_t size) {
+    LOG_DEBUG("gdb: packet %s\n", data);
+
+    switch (data[0]) {
+    case '?':
+        gdb_reply_stop(GDB_SIGTRAP);
+        break;
+    case 'g':
+        gdb_read_registers();
+        break;
+    case 'p':
+        gdb_read_register(&data[1]);
+        break;
+    case 'P':
+        gdb_write_register(&data[1]);
+        break;
+    case 'm':
+        gdb_read_memory(&data[1]);
+        break;
+    case 'x':
+        gdb_read_memory_binary(&data[1]);
+        break;
+    case 'M':
+        gdb_write_memory(&data[1]);
+        break;
+    case 'X':
+        gdb_write_memory_binary(&data[1], size - 1);
+        break;
+    case 'Z':
+    case 'z':
+        gdb_breakpoint(&data[1], data[0] == 'Z');
+        break;
+    case 'c':
+        gdb_resume(&data[1], false);
+        break;
+    case 's':
+        gdb_resume(&data[1], true);
+        break;
+    case 'H':
+        gdb_reply_string("OK");
+        break;
+    case 'q':
+        gdb_query(&data[1]);
+        break;
+    case 'Q':
+        if (strcmp(&data[1], "StartNoAckMode") == 0) {
+            gdb_reply_string("OK");
+            no_ack = true;
+        } else {
+            gdb_reply_string("");
+        }
+        break;
+    case 'D':
+        // leave the machine running
+        gdb_reply_string("OK");
+        running = false;
+        cpu_pause(false);
+        closing = true;
+        gdb_update_events();
+        break;
+    case 'k':
+        gdb_disconnect();
+        break;
+    default:
+        // not supported
+        gdb_reply_string("");
+        break;
+    }
+}
+
+/**
+ * @brief Extract packets from the incoming stream, and handle them.
+ */
+static void gdb_handle_incoming_data(const uint8_t *buffer, size_t size) {
+    for (size_t i = 0; i < size && connfd != -1 && !closing; ++i) {
+        const uint8_t c = buffer[i];
+
+        switch (rx_state) {
+        case GDB_RX_IDLE:
+            if (c == '$') {
+                rx_state = GDB_RX_DATA;
+                packet_size = 0;
+                packet_overflow = false;
+                checksum = 0;
+            } else if (c == 0x03 && running) {
+                // interrupt
+                cpu_pause(true);
+                running = false;
+                gdb_reply_stop(GDB_SIGINT);
+            }
+            // acks are ignored: tcp is reliable enough
+            break;
+
+        case GDB_RX_DATA:
+            if (c == '#') {
+                rx_state = GDB_RX_CHECKSUM1;
+                break;
+            }
+            checksum = (uint8_t)(checksum + c);
+            if (packet_size < GDB_PACKET_SIZE)
+                packet[packet_size++] = (char)c;
+            else
+                packet_overflow = true;
+            break;
+
+        case GDB_RX_CHECKSUM1:
+            expected_checksum = hex_value((char)c);
+            rx_state = GDB_RX_CHECKSUM2;
+            break;
+
+        case GDB_RX_CHECKSUM2: {
+            const int digit = hex_value((char)c);
+            rx_state = GDB_RX_IDLE;
+
+            if (packet_overflow || expected_checksum < 0 || digit < 0 ||
+                ((expected_checksum << 4) | digit) != checksum) {
+                if (!no_ack)
+                    gdb_send("-", 1);
+                break;
+            }
+            if (!no_ack)
+                gdb_send("+", 1);
+            if (packet_size == 0)
+                break;
+
+            packet[packet_size] = '\0';
+            gdb_handle_packet(packet, packet_size);
+            break;
+        }
+        }
+    }
+}
+
+static void gdb_handle_client(int fd, unsigned int events) {
+    if (events & REACTOR_READ) {
+        uint8_t buffer[4096];
+        const ssize_t ret = recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+        if (ret == 0 ||
+            (ret == -1 && errno != EAGAIN && errno != EWOULDBLOCK &&
+             errno != EINTR)) {
+            gdb_disconnect();
+            return;
+        }
+        if (ret > 0)
+            gdb_handle_incoming_data(buffer, (size_t)ret);
+        if (connfd == -1)
+            return;
+    }
+
+    if (events & REACTOR_WRITE) {
+        struct iovec iov[2];
+        struct msghdr msg = {
+            .msg_iov = iov,
+            .msg_iovlen = (size_t)ring_dataIov(&tx_ring, iov),
+        };
+        const ssize_t ret = sendmsg(fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (ret == -1 && errno != EAGAIN && errno != EWOULDBLOCK &&
+            errno != EINTR) {
+            gdb_disconnect();
+            return;
+        }
+        if (ret > 0)
+            ring_consume(&tx_ring, (size_t)ret);
+
+        if (closing && ring_count(&tx_ring) == 0) {
+            gdb_disconnect();
+            return;
+        }
+    }
+
+    gdb_update_events();
+}
+
+static void gdb_handle_accept(int fd, unsigned int events) {
+    (void)events;
+
+    connfd = accept(fd, NULL, NULL);
+    if (connfd == -1) {
+        LOG_ERR("gdb: unable to accept(): %s\n", strerror(errno));
+        return;
+    }
+    if (!reactor_add(connfd, REACTOR_READ, gdb_handle_client)) {
+        close(connfd);
+        connfd = -1;
+        return;
+    }
+
+    // requests and replies are short, do not delay them
+    (void)setsockopt(connfd, IPPROTO_TCP, TCP_NODELAY, &(int){true},
+                     sizeof(int));
+
+    // only one client is handled at a time
+    reactor_modify(sockfd, 0);
+
+    rx_state = GDB_RX_IDLE;
+    no_ack = false;
+    running = false;
+    closing = false;
+
+    // the client expects to find the target stopped
+    cpu_pause(true);
+
+    LOG_INFO("gdb: client connected\n");
+}
+
+bool gdb_open(uint16_t tcp_port) {
+    if (sockfd != -1) {
+        LOG_INFO("gdb: already open\n");
+        return false;
+    }
+
+    if (tcp_port == 0)
+        tcp_port = GDB_TCP_PORT;
+
+    sockfd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sockfd == -1) {
+        LOG_ERR("gdb: unable to socket(): %s\n", strerror(errno));
+        return false;
+    }
+
+    // local debugging only
+    struct sockaddr_in server_addr;
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    server_addr.sin_port = htons(tcp_port);
+
+    if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &(int){true},
+                   sizeof(int)) != 0) {
+        LOG_ERR("gdb: unable to setsockopt(): %s\n", strerror(errno));
+        gdb_close();
+        return false;
+    }
+
+    if (bind(sockfd, (const struct sockaddr *)&server_addr,
+             sizeof(server_addr)) != 0) {
+        LOG_ERR("gdb: unable to bind(): %s\n", strerror(errno));
+        gdb_close();
+        return false;
+    }
+
+    if (listen(sockfd, 1) != 0) {
+        LOG_ERR("gdb: unable to listen(): %s\n", strerror(errno));
+        gdb_close();
+        return false;
+    }
+
+    if (!reactor_add(sockfd, REACTOR_READ, gdb_handle_accept)) {
+        gdb_close();
+        return false;
+    }
+
+    if (tx_ring.buffer == NULL && !ring_init(&tx_ring, GDB_RING_SIZE)) {
+        LOG_ERR("gdb: unable to allocate buffer\n");
+        gdb_close();
+        return false;
+    }
+
+    port = tcp_port;
+    LOG_INFO("gdb: listening on port %u\n", (unsigned int)port);
+    return true;
+}
+
+void gdb_close(void) {
+    gdb_disconnect();
+
+    if (sockfd != -1) {
+        reactor_remove(sockfd);
+        close(sockfd);
+        sockfd = -1;
+    }
+
+    ring_cleanup(&tx_ring);
+    port = 0;
+}
+
+uint16_t gdb_getPort(void) {
+    return port;
+}
+
+bool gdb_isConnected(void) {
+    return connfd != -1;
+}
+
+static bool gdb_start(void) {
+    const uint32_t *conf_port = conf_getU32("gdb", "port");
+    if (conf_port == NULL || *conf_port == 0)
+        return true;
+
+    if (*conf_port > UINT16_MAX) {
+        LOG_ERR("gdb: invalid port %" PRIu32 "\n", *conf_port);
+        return false;
+    }
+
+    return gdb_open((uint16_t)*conf_port);
+}
+
+static void gdb_poll(void) {
+    // notify the client as soon as the cpu stops, eg. on a breakpoint
+    if (running && cpu_isPaused()) {
+        running = false;
+        gdb_reply_stop(GDB_SIGTRAP);
+    }
+}
+
+void gdb_init(CEDAModule *mod) {
+    memset(mod, 0, sizeof(*mod));
+    mod->init = gdb_init;
+    mod->start = gdb_start;
+    mod->poll = gdb_poll;
+    mod->cleanup = gdb_close;
+}
+
+#if defined(CEDA_TEST)
+
+#include <criterion/criterion.h>
+
+static void gdb_test_request(const char *request, const char *expected) {
+    char frame_str[GDB_FRAME_SIZE];
+    uint8_t sum = 0;
+    for (const char *c = request; *c != '\0'; ++c)
+        sum = (uint8_t)(sum + *c);
+    snprintf(frame_str, sizeof(frame_str), "$%s#%02x", request, sum);
+
+    ring_flush(&tx_ring);
+    gdb_handle_incoming_data((const uint8_t *)frame_str, strlen(frame_str));
+
+    char actual[GDB_FRAME_SIZE] = {0};
+    ring_pop(&tx_ring, actual, sizeof(actual) - 1);
+    cr_assert_str_eq(actual, expected);
+}
+
+Test(gdb, packets) {
+    CEDAModule mod;
+    cpu_init(&mod);
+    cr_assert(ring_init(&tx_ring, GDB_RING_SIZE));
+    connfd = INT_MAX; // fake client
+
+    gdb_test_request("?", "+$S05#b8");
+    gdb_test_request("vMustReplyEmpty", "+$#00");
+
+    // memory, hex and binary
+    gdb_test_request("M100,3:23247d", "+$OK#9a");
+    gdb_test_request("m100,3", "+$23247d#66");
+    gdb_test_request("x100,3", "+$b}\x03}\x04}]#3d");
+    gdb_test_request("X100,2:}\x03" "a", "+$OK#9a");
+    gdb_test_request("m100,2", "+$2361#cc");
+
+    // program counter
+    gdb_test_request("P5=3412", "+$OK#9a");
+    gdb_test_request("p5", "+$3412#ca");
+
+    // bad checksum
+    ring_flush(&tx_ring);
+    gdb_handle_incoming_data((const uint8_t *)"$?#00", 5);
+    cr_assert_eq(ring_count(&tx_ring), 1);
+
+    connfd = -1;
+    ring_cleanup(&tx_ring);
+}
+
+#endif
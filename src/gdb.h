@@ -0,0 +1,41 @@
+#ifndef CEDA_GDB_H
+#define CEDA_GDB_H
+
+#include "module.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * GDB remote serial protocol stub, so that the emulated cpu can be debugged
+ * by gdb (or any other front-end speaking the protocol) with:
+ *  target remote localhost:<port>
+ * Only one client at a time is served, on the loopback interface.
+ */
+
+void gdb_init(CEDAModule *mod);
+
+/**
+ * @brief Start listening for a gdb client.
+ *
+ * @param port Tcp port, or 0 for the default one.
+ *
+ * @return true in case of success, false otherwise.
+ */
+bool gdb_open(uint16_t port);
+
+/**
+ * @brief Stop listening, and disconnect the client, if any.
+ */
+void gdb_close(void);
+
+/**
+ * @brief Get the port the stub is listening on.
+ *
+ * @return Tcp port, or 0 if the stub is closed.
+ */
+uint16_t gdb_getPort(void);
+
+bool gdb_isConnected(void);
+
+#endif // CEDA_GDB_H
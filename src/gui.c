@@ -1,9 +1,11 @@
 #include "gui.h"
 
+#include "conf.h"
 #include "keyboard.h"
 #include "time.h"
 
 #include <SDL2/SDL.h>
+#include <string.h>
 
 #include "log.h"
 
@@ -22,6 +24,11 @@ bool gui_isQuit(void) {
 }
 
 static bool gui_start(void) {
+    // other video outputs do not need a window
+    const char *output = conf_getString("video", "output");
+    if (output != NULL && strcmp(output, "sdl") != 0)
+        return true;
+
     if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO) < 0) {
         LOG_ERR("unable to initialize SDL: %s\n", SDL_GetError());
         return false;
@@ -31,14 +38,40 @@ static bool gui_start(void) {
     return true;
 }
 
+static void gui_paste(void) {
+    if (!SDL_HasClipboardText())
+        return;
+
+    char *text = SDL_GetClipboardText();
+    if (text == NULL)
+        return;
+
+    (void)keyboard_paste(text, strlen(text));
+    SDL_free(text);
+}
+
 static void gui_poll(void) {
     last_update = time_now_us();
 
+    if (!started)
+        return;
+
     if (!SDL_PollEvent(&event))
         return;
 
     quit = (event.type == SDL_QUIT);
 
+    // paste host clipboard with middle click or ctrl+shift+v
+    if ((event.type == SDL_MOUSEBUTTONDOWN &&
+         event.button.button == SDL_BUTTON_MIDDLE) ||
+        (event.type == SDL_KEYDOWN &&
+         event.key.keysym.scancode == SDL_SCANCODE_V &&
+         (event.key.keysym.mod & KMOD_CTRL) &&
+         (event.key.keysym.mod & KMOD_SHIFT))) {
+        gui_paste();
+        return;
+    }
+
     // handle keyboard events
     if (event.type == SDL_KEYDOWN || event.type == SDL_KEYUP) {
         const SDL_KeyboardEvent *key_event =
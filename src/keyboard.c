@@ -7,6 +7,7 @@
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_scancode.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 
 #define LOG_LEVEL LOG_LVL_DEBUG
@@ -42,6 +43,14 @@ static keyboard_serial_fifo_t keyboard_serial_fifo;
 
 static uint8_t modifiers = KEYBOARD_MODIFIERS_DEFAULT;
 
+// Keystrokes pasted from the host, waiting for room in the serial FIFO.
+// The FIFO is refilled as soon as the emulated software reads from it,
+// so text is typed as fast as the BIOS can consume it.
+static ceda_keystroke_t *paste_queue = NULL;
+static size_t paste_capacity = 0; // [keystrokes]
+static size_t paste_head = 0;     // next keystroke to be moved to the FIFO
+static size_t paste_tail = 0;     // one past the last queued keystroke
+
 static void keyboard_toggle_modifier(SDL_Keycode code) {
     switch (code) {
     case SDL_SCANCODE_LSHIFT:
@@ -184,9 +193,138 @@ static const ceda_associator_t associators[] = {
     {SDL_SCANCODE_KP_00, CEDA_ASSOCIATOR_KEY, &(uint8_t){0x4B}},
 };
 
+typedef struct ceda_ascii_key_t {
+    SDL_Scancode sdl;
+    uint8_t modifiers;
+} ceda_ascii_key_t;
+
+// US layout symbols, letters and digits are handled in keyboard_ascii_key()
+static const ceda_ascii_key_t ascii_symbols[128] = {
+    ['\t'] = {SDL_SCANCODE_TAB, 0},
+    ['\n'] = {SDL_SCANCODE_RETURN, 0},
+    ['\r'] = {SDL_SCANCODE_RETURN, 0},
+    [0x1b] = {SDL_SCANCODE_ESCAPE, 0},
+    [' '] = {SDL_SCANCODE_SPACE, 0},
+    ['!'] = {SDL_SCANCODE_1, KEYBOARD_MODIFIER_SHIFT},
+    ['"'] = {SDL_SCANCODE_APOSTROPHE, KEYBOARD_MODIFIER_SHIFT},
+    ['#'] = {SDL_SCANCODE_3, KEYBOARD_MODIFIER_SHIFT},
+    ['$'] = {SDL_SCANCODE_4, KEYBOARD_MODIFIER_SHIFT},
+    ['%'] = {SDL_SCANCODE_5, KEYBOARD_MODIFIER_SHIFT},
+    ['&'] = {SDL_SCANCODE_7, KEYBOARD_MODIFIER_SHIFT},
+    ['\''] = {SDL_SCANCODE_APOSTROPHE, 0},
+    ['('] = {SDL_SCANCODE_9, KEYBOARD_MODIFIER_SHIFT},
+    [')'] = {SDL_SCANCODE_0, KEYBOARD_MODIFIER_SHIFT},
+    ['*'] = {SDL_SCANCODE_8, KEYBOARD_MODIFIER_SHIFT},
+    ['+'] = {SDL_SCANCODE_EQUALS, KEYBOARD_MODIFIER_SHIFT},
+    [','] = {SDL_SCANCODE_COMMA, 0},
+    ['-'] = {SDL_SCANCODE_MINUS, 0},
+    ['.'] = {SDL_SCANCODE_PERIOD, 0},
+    ['/'] = {SDL_SCANCODE_SLASH, 0},
+    [':'] = {SDL_SCANCODE_SEMICOLON, KEYBOARD_MODIFIER_SHIFT},
+    [';'] = {SDL_SCANCODE_SEMICOLON, 0},
+    ['<'] = {SDL_SCANCODE_COMMA, KEYBOARD_MODIFIER_SHIFT},
+    ['='] = {SDL_SCANCODE_EQUALS, 0},
+    ['>'] = {SDL_SCANCODE_PERIOD, KEYBOARD_MODIFIER_SHIFT},
+    ['?'] = {SDL_SCANCODE_SLASH, KEYBOARD_MODIFIER_SHIFT},
+    ['@'] = {SDL_SCANCODE_2, KEYBOARD_MODIFIER_SHIFT},
+    ['['] = {SDL_SCANCODE_LEFTBRACKET, 0},
+    ['\\'] = {SDL_SCANCODE_BACKSLASH, 0},
+    [']'] = {SDL_SCANCODE_RIGHTBRACKET, 0},
+    ['^'] = {SDL_SCANCODE_6, KEYBOARD_MODIFIER_SHIFT},
+    ['_'] = {SDL_SCANCODE_MINUS, KEYBOARD_MODIFIER_SHIFT},
+    ['`'] = {SDL_SCANCODE_GRAVE, 0},
+    ['{'] = {SDL_SCANCODE_LEFTBRACKET, KEYBOARD_MODIFIER_SHIFT},
+    ['|'] = {SDL_SCANCODE_BACKSLASH, KEYBOARD_MODIFIER_SHIFT},
+    ['}'] = {SDL_SCANCODE_RIGHTBRACKET, KEYBOARD_MODIFIER_SHIFT},
+    ['~'] = {SDL_SCANCODE_GRAVE, KEYBOARD_MODIFIER_SHIFT},
+};
+
+/**
+ * @brief Find which host key (and modifiers) would produce an ASCII char.
+ *
+ * @param c ASCII character.
+ * @param key Pointer to resulting key.
+ *
+ * @return true if the character can be typed, false otherwise.
+ */
+static bool keyboard_ascii_key(char c, ceda_ascii_key_t *key) {
+    if (c >= 'a' && c <= 'z') {
+        key->sdl = (SDL_Scancode)(SDL_SCANCODE_A + (c - 'a'));
+        key->modifiers = 0;
+    } else if (c >= 'A' && c <= 'Z') {
+        key->sdl = (SDL_Scancode)(SDL_SCANCODE_A + (c - 'A'));
+        key->modifiers = KEYBOARD_MODIFIER_SHIFT;
+    } else if (c == '0') {
+        key->sdl = SDL_SCANCODE_0;
+        key->modifiers = 0;
+    } else if (c >= '1' && c <= '9') {
+        key->sdl = (SDL_Scancode)(SDL_SCANCODE_1 + (c - '1'));
+        key->modifiers = 0;
+    } else if (c < 0) {
+        return false;
+    } else if (ascii_symbols[(size_t)c].sdl != SDL_SCANCODE_UNKNOWN) {
+        *key = ascii_symbols[(size_t)c];
+    } else if (c >= 0x01 && c <= 0x1a) {
+        // control characters are typed as CTRL + letter
+        key->sdl = (SDL_Scancode)(SDL_SCANCODE_A + (c - 0x01));
+        key->modifiers = KEYBOARD_MODIFIER_CTRL;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Translate an ASCII char to a CEDA keystroke.
+ *
+ * @param c ASCII character.
+ * @param keystroke Pointer to resulting keystroke.
+ *
+ * @return true if the character can be typed, false otherwise.
+ */
+static bool keyboard_ascii_keystroke(char c, ceda_keystroke_t *keystroke) {
+    ceda_ascii_key_t ascii_key;
+    if (!keyboard_ascii_key(c, &ascii_key))
+        return false;
+
+    for (size_t i = 0; i < ARRAY_SIZE(associators); ++i) {
+        const ceda_associator_t *const associator = &associators[i];
+        if (associator->sdl != ascii_key.sdl ||
+            associator->type != CEDA_ASSOCIATOR_KEY)
+            continue;
+
+        keystroke->key = *((uint8_t *)associator->ptr);
+        keystroke->modifiers = KEYBOARD_MODIFIERS_DEFAULT | ascii_key.modifiers;
+        return true;
+    }
+
+    return false;
+}
+
+/**
+ * @brief Move pasted keystrokes to the serial FIFO, as long as there is room.
+ */
+static void keyboard_paste_refill(void) {
+    while (paste_head < paste_tail &&
+           FIFO_FREE(&keyboard_serial_fifo) >= 2) {
+        const ceda_keystroke_t *keystroke = &paste_queue[paste_head++];
+        FIFO_PUSH(&keyboard_serial_fifo, keystroke->key);
+        FIFO_PUSH(&keyboard_serial_fifo, keystroke->modifiers);
+    }
+
+    if (paste_head == paste_tail)
+        paste_head = paste_tail = 0;
+}
+
 void keyboard_init(void) {
     FIFO_INIT(&keyboard_serial_fifo);
 
+    free(paste_queue);
+    paste_queue = NULL;
+    paste_capacity = 0;
+    paste_head = paste_tail = 0;
+
     // Insert some NUL chars in the FIFO,
     // to trick the BIOS routines which reset the SIO/2
     // by flushing its FIFOs by reading 3 chars.
@@ -245,5 +383,69 @@ bool keyboard_getChar(uint8_t *c) {
         return false;
 
     *c = FIFO_POP(&keyboard_serial_fifo);
+    keyboard_paste_refill();
     return true;
 }
+
+/**
+ * @brief Type some text on the keyboard, as fast as the emulated software
+ * reads it.
+ *
+ * Text is translated to keystrokes assuming a US host layout, and queued
+ * after any text still being typed. A CR LF pair is typed as a single return,
+ * and characters that can not be typed are discarded with a warning.
+ *
+ * @param text ASCII text, not necessarily null-terminated.
+ * @param size Size of text. [bytes]
+ *
+ * @return Count of keystrokes queued.
+ */
+size_t keyboard_paste(const char *text, size_t size) {
+    // make room for the worst case, one keystroke for each char
+    if (paste_tail + size > paste_capacity && paste_head > 0) {
+        memmove(paste_queue, &paste_queue[paste_head],
+                (paste_tail - paste_head) * sizeof(*paste_queue));
+        paste_tail -= paste_head;
+        paste_head = 0;
+    }
+    if (paste_tail + size > paste_capacity) {
+        paste_capacity = paste_tail + size;
+        paste_queue =
+            realloc(paste_queue, paste_capacity * sizeof(*paste_queue));
+        CEDA_STRONG_ASSERT_VALID_PTR(paste_queue);
+    }
+
+    size_t queued = 0;
+    size_t discarded = 0;
+    for (size_t i = 0; i < size; ++i) {
+        if (text[i] == '\n' && i > 0 && text[i - 1] == '\r')
+            continue;
+
+        if (!keyboard_ascii_keystroke(text[i], &paste_queue[paste_tail])) {
+            ++discarded;
+            continue;
+        }
+        ++paste_tail;
+        ++queued;
+    }
+
+    if (discarded > 0)
+        LOG_WARN("discarded %zu chars which can not be typed\n", discarded);
+
+    keyboard_paste_refill();
+    return queued;
+}
+
+/**
+ * @brief Count of pasted keystrokes not yet delivered to the serial FIFO.
+ */
+size_t keyboard_pastePending(void) {
+    return paste_tail - paste_head;
+}
+
+/**
+ * @brief Discard the pasted keystrokes not yet delivered to the serial FIFO.
+ */
+void keyboard_pasteAbort(void) {
+    paste_head = paste_tail = 0;
+}
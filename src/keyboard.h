@@ -3,6 +3,7 @@
 
 #include <SDL2/SDL.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 void keyboard_init(void);
 
@@ -10,4 +11,10 @@ void keyboard_handleEvent(const SDL_KeyboardEvent *event);
 
 bool keyboard_getChar(uint8_t *c);
 
+size_t keyboard_paste(const char *text, size_t size);
+
+size_t keyboard_pastePending(void);
+
+void keyboard_pasteAbort(void);
+
 #endif // CEDA_KEYBOARD_H
@@ -4,11 +4,17 @@
 #include <criterion/criterion.h>
 #endif
 
+#ifdef CEDA_BENCH
+#include "tests/bench_fdc.h"
+#endif
+
 #include <stdio.h>
 
 #define LOG_LEVEL LOG_LVL_INFO
 #include "log.h"
 
+// Fuzz targets are linked with libFuzzer, which provides its own main()
+#ifndef CEDA_FUZZ
 int main(int argc, char *argv[]) {
     int ret = 0;
 
@@ -24,6 +30,10 @@ int main(int argc, char *argv[]) {
         ret = !criterion_run_all_tests(set);
     criterion_finalize(set);
 
+#elif defined(CEDA_BENCH)
+    LOG_INFO("CEDA Benchmark\n");
+    ret = bench_fdc(argc, argv);
+
 #else
     LOG_INFO("CEDA Emulator\n");
 
@@ -35,3 +45,4 @@ int main(int argc, char *argv[]) {
 
     return ret;
 }
+#endif
@@ -0,0 +1,213 @@
+#define _GNU_SOURCE // ppoll
+#include "reactor.h"
+
+#include "macro.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+
+#define LOG_LEVEL LOG_LVL_INFO
+#include "log.h"
+
+typedef struct reactor_entry_t {
+    int fd;                    // -1 if the slot is free
+    unsigned int events;       // events of interest
+    reactor_handler_t handler; // called when events occur
+    unsigned long generation;  // tells apart entries reusing the same slot
+} reactor_entry_t;
+
+static reactor_entry_t entries[REACTOR_MAX_FDS] = {
+    [0 ... REACTOR_MAX_FDS - 1] = {.fd = -1},
+};
+static unsigned long generation = 0;
+
+static reactor_entry_t *reactor_find(int fd) {
+    if (fd < 0)
+        return NULL;
+
+    for (size_t i = 0; i < ARRAY_SIZE(entries); ++i) {
+        if (entries[i].fd == fd)
+            return &entries[i];
+    }
+    return NULL;
+}
+
+static short reactor_poll_events(unsigned int events) {
+    short poll_events = 0;
+    if (events & REACTOR_READ)
+        poll_events |= POLLIN;
+    if (events & REACTOR_WRITE)
+        poll_events |= POLLOUT;
+    return poll_events;
+}
+
+bool reactor_add(int fd, unsigned int events, reactor_handler_t handler) {
+    if (fd < 0 || handler == NULL || reactor_find(fd) != NULL)
+        return false;
+
+    reactor_entry_t *entry = NULL;
+    for (size_t i = 0; i < ARRAY_SIZE(entries) && entry == NULL; ++i) {
+        if (entries[i].fd == -1)
+            entry = &entries[i];
+    }
+    if (entry == NULL) {
+        LOG_ERR("no room to watch fd %d\n", fd);
+        return false;
+    }
+
+    entry->fd = fd;
+    entry->events = events;
+    entry->handler = handler;
+    entry->generation = ++generation;
+
+    return true;
+}
+
+void reactor_modify(int fd, unsigned int events) {
+    reactor_entry_t *entry = reactor_find(fd);
+    if (entry == NULL)
+        return;
+
+    entry->events = events;
+}
+
+void reactor_remove(int fd) {
+    reactor_entry_t *entry = reactor_find(fd);
+    if (entry == NULL)
+        return;
+
+    entry->fd = -1;
+    entry->events = 0;
+    entry->handler = NULL;
+}
+
+void reactor_wait(us_interval_t timeout) {
+    struct pollfd fds[REACTOR_MAX_FDS];
+    unsigned long generations[REACTOR_MAX_FDS];
+
+    // idle slots and suspended entries are ignored by ppoll(), which also
+    // does not report hang up on them
+    for (size_t i = 0; i < ARRAY_SIZE(entries); ++i) {
+        const reactor_entry_t *entry = &entries[i];
+        const bool active = entry->fd != -1 && entry->events != 0;
+        fds[i].fd = active ? entry->fd : -1;
+        fds[i].events = reactor_poll_events(entry->events);
+        fds[i].revents = 0;
+        generations[i] = entry->generation;
+    }
+
+    if (timeout < 0)
+        timeout = 0;
+
+    const struct timespec ts = {
+        .tv_sec = timeout / (1000 * 1000),
+        .tv_nsec = (timeout % (1000 * 1000)) * 1000,
+    };
+
+    const int ret = ppoll(fds, ARRAY_SIZE(fds), &ts, NULL);
+    if (ret == -1 && errno != EINTR)
+        LOG_ERR("ppoll error: %s\n", strerror(errno));
+    if (ret <= 0)
+        return;
+
+    for (size_t i = 0; i < ARRAY_SIZE(entries); ++i) {
+        if (fds[i].revents == 0)
+            continue;
+
+        // a previous handler may have removed this entry, or changed its
+        // events of interest
+        const reactor_entry_t *entry = &entries[i];
+        if (entry->fd != fds[i].fd || entry->generation != generations[i])
+            continue;
+
+        unsigned int events = 0;
+        if (fds[i].revents & POLLIN)
+            events |= REACTOR_READ;
+        if (fds[i].revents & POLLOUT)
+            events |= REACTOR_WRITE;
+        // let handlers find out about errors from read() or write()
+        if (fds[i].revents & (POLLERR | POLLHUP | POLLNVAL))
+            events = entry->events;
+        events &= entry->events;
+
+        if (events != 0)
+            entry->handler(entry->fd, events);
+    }
+}
+
+#ifdef CEDA_TEST
+
+#include <criterion/criterion.h>
+
+#include <unistd.h>
+
+static int test_fds[2];
+static unsigned int test_events;
+static unsigned int test_calls;
+
+static void test_handler(int fd, unsigned int events) {
+    (void)fd;
+    test_events = events;
+    ++test_calls;
+}
+
+static void test_remove_handler(int fd, unsigned int events) {
+    (void)events;
+    reactor_remove(fd);
+    ++test_calls;
+}
+
+static void reactor_test_setup(void) {
+    for (size_t i = 0; i < ARRAY_SIZE(entries); ++i)
+        reactor_remove(entries[i].fd);
+    cr_assert_eq(pipe(test_fds), 0);
+    test_events = 0;
+    test_calls = 0;
+}
+
+static void reactor_test_teardown(void) {
+    reactor_remove(test_fds[0]);
+    reactor_remove(test_fds[1]);
+    close(test_fds[0]);
+    close(test_fds[1]);
+}
+
+Test(reactor, dispatch, .init = reactor_test_setup,
+     .fini = reactor_test_teardown) {
+    cr_assert(reactor_add(test_fds[0], REACTOR_READ, test_handler));
+    cr_assert_not(reactor_add(test_fds[0], REACTOR_READ, test_handler));
+
+    // nothing to read yet
+    reactor_wait(0);
+    cr_assert_eq(test_calls, 0);
+
+    cr_assert_eq(write(test_fds[1], "x", 1), 1);
+    reactor_wait(1000 * 1000);
+    cr_assert_eq(test_calls, 1);
+    cr_assert_eq(test_events, REACTOR_READ);
+
+    // suspended watch
+    reactor_modify(test_fds[0], 0);
+    reactor_wait(0);
+    cr_assert_eq(test_calls, 1);
+
+    reactor_modify(test_fds[0], REACTOR_READ | REACTOR_WRITE);
+    reactor_wait(0);
+    cr_assert_eq(test_calls, 2);
+    cr_assert_eq(test_events, REACTOR_READ);
+}
+
+Test(reactor, removeFromHandler, .init = reactor_test_setup,
+     .fini = reactor_test_teardown) {
+    cr_assert(reactor_add(test_fds[1], REACTOR_WRITE, test_remove_handler));
+
+    reactor_wait(0);
+    cr_assert_eq(test_calls, 1);
+
+    // no longer watched
+    reactor_wait(0);
+    cr_assert_eq(test_calls, 1);
+}
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef CEDA_REACTOR_H
+#define CEDA_REACTOR_H
+
+#include "time.h"
+
+#include <stdbool.h>
+
+/*
+ * I/O reactor, owned by the main loop.
+ * Modules register their file descriptors, with the events they are
+ * interested in and a handler to be called when those events occur.
+ * The main loop waits on all of them at once, instead of sleeping, so that
+ * incoming data wakes up the emulator immediately.
+ */
+
+#define REACTOR_READ  (1U << 0) // fd is readable (or hung up)
+#define REACTOR_WRITE (1U << 1) // fd is writable
+
+#define REACTOR_MAX_FDS (32U)
+
+/**
+ * @brief Handle events occurred on a file descriptor.
+ *
+ * @param fd file descriptor
+ * @param events REACTOR_READ and/or REACTOR_WRITE
+ */
+typedef void (*reactor_handler_t)(int fd, unsigned int events);
+
+/**
+ * @brief Watch a file descriptor.
+ *
+ * @param fd file descriptor, must not be already registered
+ * @param events events of interest, REACTOR_READ and/or REACTOR_WRITE
+ * @param handler called from reactor_wait() when events occur
+ *
+ * @return true if the file descriptor has been registered
+ */
+bool reactor_add(int fd, unsigned int events, reactor_handler_t handler);
+
+/**
+ * @brief Change events of interest of a registered file descriptor.
+ *
+ * Does nothing if fd is not registered.
+ * No event (0) suspends the watch, even on hang up or error.
+ */
+void reactor_modify(int fd, unsigned int events);
+
+/**
+ * @brief Stop watching a file descriptor.
+ *
+ * Does nothing if fd is not registered. Must be called before closing it.
+ * Safe to be called from handlers.
+ */
+void reactor_remove(int fd);
+
+/**
+ * @brief Wait for events, and dispatch them to their handlers.
+ *
+ * @param timeout maximum time to wait, 0 to just dispatch pending events [us]
+ */
+void reactor_wait(us_interval_t timeout);
+
+#endif // CEDA_REACTOR_H
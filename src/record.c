@@ -0,0 +1,245 @@
+#include "record.h"
+
+#include "macro.h"
+#include "video.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#define LOG_LEVEL LOG_LVL_INFO
+#include "log.h"
+
+/*
+ * Recording stream format, all integers are little endian:
+ *
+ *  header: "CEDAREC1" (8 bytes), width (u16), height (u16), in pixels
+ *
+ * then a sequence of records, each beginning with a tag byte:
+ *  'F': a new frame follows, 1 bpp, msb first, width / 8 bytes per line
+ *  'R': a repeat count (u32) follows: the previous frame has been shown
+ *       this many more times
+ *
+ * One record is appended for each frame presented on the host (50 Hz), unless
+ * the frame has not changed since the previous one: in this case, just the
+ * repeat count is incremented, so that a static screen costs nothing.
+ */
+static const char RECORD_MAGIC[] = "CEDAREC1";
+#define RECORD_TAG_FRAME  'F'
+#define RECORD_TAG_REPEAT 'R'
+
+// PPM colors for lit and unlit pixels, same as the SDL window
+static const uint8_t PPM_LIT[3] = {0, 192, 0};
+static const uint8_t PPM_UNLIT[3] = {0, 0, 0};
+
+static FILE *record_fp = NULL;
+static uint8_t last_frame[VIDEO_FRAME_SIZE];
+static bool last_written = false; // last_frame has been recorded
+static uint32_t repeat = 0;        // pending repeats of last frame
+
+static void put_u16(uint8_t *dst, uint16_t value) {
+    dst[0] = (uint8_t)(value & 0xff);
+    dst[1] = (uint8_t)(value >> 8);
+}
+
+static void put_u32(uint8_t *dst, uint32_t value) {
+    for (size_t i = 0; i < sizeof(value); ++i)
+        dst[i] = (uint8_t)((value >> (8 * i)) & 0xff);
+}
+
+/**
+ * @brief Save a frame as a PPM still image.
+ *
+ * @param path Destination file path.
+ * @param frame Frame bitmap, as returned by video_frame().
+ *
+ * @return true in case of success, false otherwise.
+ */
+bool record_capture(const char *path, const uint8_t *frame) {
+    FILE *fp = fopen(path, "wb");
+    if (fp == NULL) {
+        LOG_ERR("unable to open %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    (void)fprintf(fp, "P6\n%d %d\n255\n", VIDEO_PIXEL_WIDTH,
+                  VIDEO_PIXEL_HEIGHT);
+
+    bool ok = true;
+    uint8_t line[VIDEO_PIXEL_WIDTH * 3];
+    for (size_t y = 0; y < VIDEO_PIXEL_HEIGHT && ok; ++y) {
+        for (size_t x = 0; x < VIDEO_PIXEL_WIDTH; ++x) {
+            const uint8_t segment = frame[y * VIDEO_COLUMNS + x / 8];
+            const bool lit = segment & (0x80 >> (x % 8));
+            memcpy(&line[x * 3], lit ? PPM_LIT : PPM_UNLIT, 3);
+        }
+        ok = fwrite(line, 1, sizeof(line), fp) == sizeof(line);
+    }
+
+    if (fclose(fp) != 0)
+        ok = false;
+
+    if (!ok)
+        LOG_ERR("error writing %s\n", path);
+
+    return ok;
+}
+
+static bool record_write_repeat(void) {
+    if (repeat == 0)
+        return true;
+
+    uint8_t record[1 + sizeof(uint32_t)];
+    record[0] = RECORD_TAG_REPEAT;
+    put_u32(&record[1], repeat);
+    repeat = 0;
+
+    return fwrite(record, 1, sizeof(record), record_fp) == sizeof(record);
+}
+
+/**
+ * @brief Start recording video fields to file.
+ *
+ * @param path Destination file path.
+ *
+ * @return true in case of success, false otherwise.
+ */
+bool record_start(const char *path) {
+    if (record_fp != NULL)
+        record_stop();
+
+    record_fp = fopen(path, "wb");
+    if (record_fp == NULL) {
+        LOG_ERR("unable to open %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    uint8_t header[sizeof(RECORD_MAGIC) - 1 + 2 * sizeof(uint16_t)];
+    memcpy(header, RECORD_MAGIC, sizeof(RECORD_MAGIC) - 1);
+    put_u16(&header[sizeof(RECORD_MAGIC) - 1], VIDEO_PIXEL_WIDTH);
+    put_u16(&header[sizeof(RECORD_MAGIC) + 1], VIDEO_PIXEL_HEIGHT);
+
+    if (fwrite(header, 1, sizeof(header), record_fp) != sizeof(header)) {
+        LOG_ERR("error writing %s\n", path);
+        (void)fclose(record_fp);
+        record_fp = NULL;
+        return false;
+    }
+
+    // first frame is always written in full
+    repeat = 0;
+    last_written = false;
+
+    LOG_INFO("recording to %s\n", path);
+    return true;
+}
+
+/**
+ * @brief Stop recording, and close the file.
+ */
+void record_stop(void) {
+    if (record_fp == NULL)
+        return;
+
+    bool ok = record_write_repeat();
+    if (fclose(record_fp) != 0)
+        ok = false;
+    record_fp = NULL;
+
+    if (!ok)
+        LOG_ERR("error writing recording\n");
+}
+
+bool record_isActive(void) {
+    return record_fp != NULL;
+}
+
+/**
+ * @brief Append a video field to the recording, if any.
+ *
+ * @param frame Frame bitmap, as returned by video_frame().
+ */
+void record_frame(const uint8_t *frame) {
+    if (record_fp == NULL)
+        return;
+
+    const bool same =
+        last_written && memcmp(frame, last_frame, sizeof(last_frame)) == 0;
+    if (same) {
+        ++repeat;
+        if (repeat != UINT32_MAX)
+            return;
+    }
+
+    bool ok = record_write_repeat();
+    if (!same) {
+        memcpy(last_frame, frame, sizeof(last_frame));
+        last_written = true;
+        ok = ok && fputc(RECORD_TAG_FRAME, record_fp) != EOF;
+        ok = ok && fwrite(last_frame, 1, sizeof(last_frame), record_fp) ==
+                       sizeof(last_frame);
+    }
+
+    if (!ok) {
+        LOG_ERR("error writing recording, stop\n");
+        record_stop();
+    }
+}
+
+void record_init(CEDAModule *mod) {
+    memset(mod, 0, sizeof(*mod));
+    mod->init = record_init;
+    mod->cleanup = record_stop;
+}
+
+#if defined(CEDA_TEST)
+
+#include <criterion/criterion.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+Test(record, repeat) {
+    static uint8_t frame[VIDEO_FRAME_SIZE];
+    char path[] = "/tmp/ceda-record-XXXXXX";
+    int fd = mkstemp(path);
+    cr_assert_geq(fd, 0);
+    close(fd);
+
+    cr_assert(record_start(path));
+    for (int i = 0; i < 100; ++i)
+        record_frame(frame);
+    frame[0] = 0xff;
+    record_frame(frame);
+    record_frame(frame);
+    record_stop();
+
+    // header, first frame, repeat, new frame, repeat
+    struct stat st;
+    cr_assert_eq(stat(path, &st), 0);
+    cr_assert_eq(st.st_size, 12 + (1 + VIDEO_FRAME_SIZE) + 5 +
+                                 (1 + VIDEO_FRAME_SIZE) + 5);
+
+    static uint8_t data[12 + 2 * (1 + VIDEO_FRAME_SIZE + 5)];
+    FILE *fp = fopen(path, "rb");
+    cr_assert_not_null(fp);
+    cr_assert_eq(fread(data, 1, sizeof(data), fp), sizeof(data));
+    fclose(fp);
+
+    const uint8_t *record = data + 12;
+    cr_assert_eq(record[0], RECORD_TAG_FRAME);
+    cr_assert_eq(record[1], 0);
+    record += 1 + VIDEO_FRAME_SIZE;
+    cr_assert_eq(record[0], RECORD_TAG_REPEAT);
+    cr_assert_eq(record[1], 99);
+    record += 5;
+    cr_assert_eq(record[0], RECORD_TAG_FRAME);
+    cr_assert_eq(record[1], 0xff);
+    record += 1 + VIDEO_FRAME_SIZE;
+    cr_assert_eq(record[0], RECORD_TAG_REPEAT);
+    cr_assert_eq(record[1], 1);
+
+    unlink(path);
+}
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef CEDA_RECORD_H
+#define CEDA_RECORD_H
+
+#include "module.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+void record_init(CEDAModule *mod);
+
+bool record_capture(const char *path, const uint8_t *frame);
+
+bool record_start(const char *path);
+void record_stop(void);
+bool record_isActive(void);
+void record_frame(const uint8_t *frame);
+
+#endif // CEDA_RECORD_H
@@ -0,0 +1,174 @@
+#include "ring.h"
+
+#include "macro.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+bool ring_init(ring_t *ring, size_t size) {
+    size_t capacity = 1;
+    while (capacity < size)
+        capacity <<= 1;
+
+    ring->buffer = malloc(capacity);
+    if (ring->buffer == NULL)
+        return false;
+
+    ring->size = capacity;
+    ring->head = 0;
+    ring->tail = 0;
+    return true;
+}
+
+void ring_cleanup(ring_t *ring) {
+    free(ring->buffer);
+    memset(ring, 0, sizeof(*ring));
+}
+
+size_t ring_count(const ring_t *ring) {
+    return ring->tail - ring->head;
+}
+
+size_t ring_space(const ring_t *ring) {
+    return ring->size - ring_count(ring);
+}
+
+void ring_flush(ring_t *ring) {
+    ring->head = ring->tail;
+}
+
+/**
+ * @brief Split a run of bytes starting at a free running index in (at most)
+ * two contiguous segments, since it could wrap around the end of the buffer.
+ */
+static int ring_segments(const ring_t *ring, size_t index, size_t size,
+                         struct iovec iov[2]) {
+    if (size == 0)
+        return 0;
+
+    const size_t offset = index & (ring->size - 1);
+    const size_t contiguous = MIN(size, ring->size - offset);
+
+    iov[0].iov_base = ring->buffer + offset;
+    iov[0].iov_len = contiguous;
+    if (contiguous == size)
+        return 1;
+
+    iov[1].iov_base = ring->buffer;
+    iov[1].iov_len = size - contiguous;
+    return 2;
+}
+
+int ring_dataIov(const ring_t *ring, struct iovec iov[2]) {
+    return ring_segments(ring, ring->head, ring_count(ring), iov);
+}
+
+int ring_spaceIov(const ring_t *ring, struct iovec iov[2]) {
+    return ring_segments(ring, ring->tail, ring_space(ring), iov);
+}
+
+void ring_consume(ring_t *ring, size_t size) {
+    assert(size <= ring_count(ring));
+    ring->head += size;
+}
+
+void ring_produce(ring_t *ring, size_t size) {
+    assert(size <= ring_space(ring));
+    ring->tail += size;
+}
+
+size_t ring_push(ring_t *ring, const void *data, size_t size) {
+    struct iovec iov[2];
+    const uint8_t *src = data;
+
+    size = MIN(size, ring_space(ring));
+    const int n = ring_segments(ring, ring->tail, size, iov);
+    for (int i = 0; i < n; ++i) {
+        memcpy(iov[i].iov_base, src, iov[i].iov_len);
+        src += iov[i].iov_len;
+    }
+    ring->tail += size;
+
+    return size;
+}
+
+size_t ring_pop(ring_t *ring, void *data, size_t size) {
+    struct iovec iov[2];
+    uint8_t *dst = data;
+
+    size = MIN(size, ring_count(ring));
+    const int n = ring_segments(ring, ring->head, size, iov);
+    for (int i = 0; i < n; ++i) {
+        memcpy(dst, iov[i].iov_base, iov[i].iov_len);
+        dst += iov[i].iov_len;
+    }
+    ring->head += size;
+
+    return size;
+}
+
+#ifdef CEDA_TEST
+
+#include <criterion/criterion.h>
+
+Test(ring, pushPop) {
+    ring_t ring;
+    uint8_t data[16];
+
+    cr_assert(ring_init(&ring, 6));
+    cr_assert_eq(ring.size, 8);
+    cr_assert_eq(ring_space(&ring), 8);
+
+    cr_assert_eq(ring_push(&ring, "abcdef", 6), 6);
+    cr_assert_eq(ring_pop(&ring, data, 4), 4);
+    cr_assert_arr_eq(data, "abcd", 4);
+
+    // wrap around the end of the buffer, and fill it
+    cr_assert_eq(ring_push(&ring, "ghijklmnop", 10), 6);
+    cr_assert_eq(ring_count(&ring), 8);
+    cr_assert_eq(ring_space(&ring), 0);
+    cr_assert_eq(ring_push(&ring, "q", 1), 0);
+
+    cr_assert_eq(ring_pop(&ring, data, sizeof(data)), 8);
+    cr_assert_arr_eq(data, "efghijkl", 8);
+    cr_assert_eq(ring_pop(&ring, data, sizeof(data)), 0);
+
+    ring_cleanup(&ring);
+}
+
+Test(ring, iov) {
+    ring_t ring;
+    struct iovec iov[2];
+
+    cr_assert(ring_init(&ring, 8));
+    cr_assert_eq(ring_dataIov(&ring, iov), 0);
+    cr_assert_eq(ring_spaceIov(&ring, iov), 1);
+    cr_assert_eq(iov[0].iov_len, 8);
+
+    memcpy(iov[0].iov_base, "abcdef", 6);
+    ring_produce(&ring, 6);
+    ring_consume(&ring, 4);
+
+    // free space wraps around the end of the buffer
+    cr_assert_eq(ring_spaceIov(&ring, iov), 2);
+    cr_assert_eq(iov[0].iov_len, 2);
+    cr_assert_eq(iov[1].iov_len, 4);
+    memcpy(iov[0].iov_base, "gh", 2);
+    memcpy(iov[1].iov_base, "ij", 2);
+    ring_produce(&ring, 4);
+
+    // and so does data
+    cr_assert_eq(ring_dataIov(&ring, iov), 2);
+    cr_assert_eq(iov[0].iov_len, 4);
+    cr_assert_arr_eq(iov[0].iov_base, "efgh", 4);
+    cr_assert_eq(iov[1].iov_len, 2);
+    cr_assert_arr_eq(iov[1].iov_base, "ij", 2);
+
+    ring_consume(&ring, 6);
+    cr_assert_eq(ring_count(&ring), 0);
+
+    ring_cleanup(&ring);
+}
+
+#endif
@@ -0,0 +1,95 @@
+#ifndef CEDA_RING_H
+#define CEDA_RING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+/*
+ * Byte ring buffer, for bulk transfers.
+ * Unlike fifo.h, size is chosen at run time, and data is copied in blocks;
+ * the ring can also be read from or written to by readv() and writev()
+ * directly, without intermediate copies.
+ * Not thread safe.
+ */
+
+typedef struct ring_t {
+    uint8_t *buffer;
+    size_t size; // [bytes] always a power of two
+    size_t head; // next byte to pop, free running
+    size_t tail; // next byte to push, free running
+} ring_t;
+
+/**
+ * @brief Allocate ring buffer memory.
+ *
+ * @param size [bytes] capacity, rounded up to the next power of two
+ *
+ * @return true if the ring buffer has been allocated
+ */
+bool ring_init(ring_t *ring, size_t size);
+
+/**
+ * @brief Release ring buffer memory. Safe on a never initialized ring.
+ */
+void ring_cleanup(ring_t *ring);
+
+/**
+ * @brief Return number of bytes in the ring.
+ */
+size_t ring_count(const ring_t *ring);
+
+/**
+ * @brief Return number of bytes that can be pushed in the ring.
+ */
+size_t ring_space(const ring_t *ring);
+
+/**
+ * @brief Discard all the bytes in the ring.
+ */
+void ring_flush(ring_t *ring);
+
+/**
+ * @brief Copy bytes at the end of the ring.
+ *
+ * @return number of bytes actually copied, less than size if ring is full
+ */
+size_t ring_push(ring_t *ring, const void *data, size_t size);
+
+/**
+ * @brief Copy and remove bytes from the beginning of the ring.
+ *
+ * @return number of bytes actually copied, less than size if ring is empty
+ */
+size_t ring_pop(ring_t *ring, void *data, size_t size);
+
+/**
+ * @brief Describe bytes in the ring, as input for writev().
+ *
+ * Bytes must then be removed by ring_consume().
+ *
+ * @return number of iovec actually used, 0 if ring is empty
+ */
+int ring_dataIov(const ring_t *ring, struct iovec iov[2]);
+
+/**
+ * @brief Describe free space in the ring, as output for readv().
+ *
+ * Bytes written in the free space must then be added by ring_produce().
+ *
+ * @return number of iovec actually used, 0 if ring is full
+ */
+int ring_spaceIov(const ring_t *ring, struct iovec iov[2]);
+
+/**
+ * @brief Remove bytes from the beginning of the ring.
+ */
+void ring_consume(ring_t *ring, size_t size);
+
+/**
+ * @brief Add bytes written in the free space to the end of the ring.
+ */
+void ring_produce(ring_t *ring, size_t size);
+
+#endif // CEDA_RING_H
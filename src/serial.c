@@ -1,145 +1,246 @@
+#define _GNU_SOURCE // accept4, cfmakeraw
 #include "serial.h"
 
-#include "fifo.h"
+#include "conf.h"
+#include "reactor.h"
+#include "ring.h"
 #include "sio2.h"
-#include "time.h"
 
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pty.h>
+#include <stdio.h>
 #include <string.h>
 #include <sys/socket.h>
-#include <sys/time.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <termios.h>
 #include <unistd.h>
 
 #define LOG_LEVEL LOG_LVL_INFO
 #include "log.h"
 
 #define SERIAL_TCP_PORT            (0xCEDB)
-#define SERIAL_NETWORK_BUFFER_SIZE 64U
-
-DECLARE_FIFO_TYPE(char, SerialFifo, 64);
-static int sockfd = -1;
-static int connfd = -1;
-static SerialFifo tx_fifo;
-static SerialFifo rx_fifo;
+#define SERIAL_BUFFER_SIZE_DEFAULT (64U * 1024U) // [bytes]
+
+static serial_backend_t backend = SERIAL_BACKEND_NONE;
+static int sockfd = -1; // tcp listening socket
+static int rxfd = -1;   // incoming data is read from here
+static int txfd = -1;   // outgoing data is written here, can be rxfd
+static int ptsfd = -1;  // pty slave, kept open so that master never hangs up
+static char path[PATH_MAX]; // where the peer can be found
+static size_t buffer_size = SERIAL_BUFFER_SIZE_DEFAULT; // for each ring
+static ring_t tx_ring;
+static ring_t rx_ring;
+
+/**
+ * @brief Watch the peer only for what can be currently handled.
+ *
+ * Incoming data is not read while the rx ring is full, so that the peer is
+ * slowed down instead of losing data (eg. by tcp flow control), and the peer
+ * is not waited for being writable while there is nothing to send.
+ */
+static void serial_update_events(void) {
+    const unsigned int rx_events =
+        (ring_space(&rx_ring) == 0) ? 0 : REACTOR_READ;
+    const unsigned int tx_events =
+        (ring_count(&tx_ring) == 0) ? 0 : REACTOR_WRITE;
+
+    if (rxfd == txfd) {
+        reactor_modify(rxfd, rx_events | tx_events);
+        return;
+    }
+    reactor_modify(rxfd, rx_events);
+    reactor_modify(txfd, tx_events);
+}
 
 static bool serial_getChar(uint8_t *c) {
-    if (FIFO_ISEMPTY(&rx_fifo))
+    const bool was_full = ring_space(&rx_ring) == 0;
+    if (ring_pop(&rx_ring, c, 1) == 0)
         return false;
 
-    *c = (uint8_t)FIFO_POP(&rx_fifo);
+    if (was_full)
+        serial_update_events();
     return true;
 }
 
 static bool serial_putChar(uint8_t c) {
-    if (FIFO_ISFULL(&tx_fifo))
+    const bool was_empty = ring_count(&tx_ring) == 0;
+    if (ring_push(&tx_ring, &c, 1) == 0)
         return false;
 
     LOG_DEBUG("serial: transmitting: %02x (%c)\n", (unsigned int)c,
               isprint(c) ? c : ' ');
 
-    FIFO_PUSH(&tx_fifo, (char)c);
+    if (was_empty)
+        serial_update_events();
     return true;
 }
 
-static void serial_poll(void) {
-    struct timeval timeout;
-    timeout.tv_sec = 0;
-    timeout.tv_usec = 0;
+static void serial_close_fd(int *fd) {
+    if (*fd == -1)
+        return;
+
+    reactor_remove(*fd);
+    close(*fd);
+    *fd = -1;
+}
 
-    if (sockfd < 0)
+/**
+ * @brief Stop exchanging data with the peer.
+ *
+ * The tcp backend waits for a new client, the others are just left idle.
+ */
+static void serial_disconnect(void) {
+    if (txfd == rxfd)
+        txfd = -1;
+    serial_close_fd(&rxfd);
+    serial_close_fd(&txfd);
+    ring_flush(&tx_ring);
+
+    reactor_modify(sockfd, REACTOR_READ);
+}
+
+static void serial_receive(int fd) {
+    // read straight into the ring, no more than it can hold
+    struct iovec iov[2];
+    const int iovcnt = ring_spaceIov(&rx_ring, iov);
+    if (iovcnt == 0)
         return;
 
-    if (connfd == -1) {
-        fd_set accept_set;
-        FD_ZERO(&accept_set);
-        FD_SET(sockfd, &accept_set);
-        int ret = select(sockfd + 1, &accept_set, NULL, NULL, &timeout);
-        if (ret == -1) {
-            LOG_ERR(
-                "serial: error during select while accepting new client: %s\n",
-                strerror(errno));
+    ssize_t ret = readv(fd, iov, iovcnt);
+    if (ret == -1) {
+        if (errno == EAGAIN || errno == EINTR)
             return;
-        }
-        if (ret == 0) // timeout
+        LOG_ERR("serial: read error: %s\n", strerror(errno));
+        LOG_ERR("serial: connection reset\n");
+        serial_disconnect();
+        return;
+    }
+    if (ret == 0) {
+        // an input file has been read completely, just stop reading
+        if (backend == SERIAL_BACKEND_FILE && fd != txfd) {
+            LOG_INFO("serial: end of input file\n");
+            serial_close_fd(&rxfd);
             return;
-
-        connfd = accept(sockfd, NULL, NULL);
-        if (connfd != -1) {
-            LOG_INFO("serial: accept client\n");
         }
+        // client disconnection
+        serial_disconnect();
+        LOG_INFO("serial: client disconnected\n");
+        return;
+    }
+    // data available
+    ring_produce(&rx_ring, (size_t)ret);
+}
+
+static void serial_transmit(int fd) {
+    struct iovec iov[2];
+    const int iovcnt = ring_dataIov(&tx_ring, iov);
+    if (iovcnt == 0)
+        return;
+
+    ssize_t ret;
+    if (backend == SERIAL_BACKEND_TCP) {
+        // a gone tcp client must not raise SIGPIPE
+        const struct msghdr msg = {
+            .msg_iov = iov,
+            .msg_iovlen = (size_t)iovcnt,
+        };
+        ret = sendmsg(fd, &msg, MSG_NOSIGNAL);
     } else {
-        int ret = -1;
-        fd_set read_set;
-        fd_set write_set;
-        FD_ZERO(&read_set);
-        FD_ZERO(&write_set);
-        FD_SET(connfd, &read_set);
-        FD_SET(connfd, &write_set);
-
-        ret = select(connfd + 1, &read_set, &write_set, NULL, &timeout);
-        if (ret == -1) {
-            LOG_ERR("serial: select error while reading from client: %s\n",
-                    strerror(errno));
-            close(connfd);
-            connfd = -1;
-            return;
-        }
-        if (ret == 0) // timeout
+        ret = writev(fd, iov, iovcnt);
+    }
+
+    if (ret == -1) {
+        if (errno == EAGAIN || errno == EINTR)
             return;
+        LOG_ERR("serial: write error: %s\n", strerror(errno));
+        LOG_ERR("serial: connection reset\n");
+        serial_disconnect();
+        return;
+    }
 
-        // check file descriptors ready for read
-        if (FD_ISSET(connfd, &read_set)) {
-            char buffer[SERIAL_NETWORK_BUFFER_SIZE];
-            const size_t to_receive = MIN((size_t)SERIAL_NETWORK_BUFFER_SIZE,
-                                          (size_t)FIFO_FREE(&rx_fifo));
-            if (to_receive > 0) {
-                ssize_t ret = recv(connfd, buffer, to_receive, 0);
-                if (ret == -1) {
-                    LOG_ERR(
-                        "serial: recv error while reading from client: %s\n",
-                        strerror(errno));
-                    LOG_ERR("serial: connection reset\n");
-                    close(connfd);
-                    connfd = -1;
-                    return;
-                }
-                if (ret == 0) {
-                    // client disconnection
-                    close(connfd);
-                    connfd = -1;
-                    LOG_INFO("serial: client disconnected\n");
-                    return;
-                }
-                // data available
-                for (ssize_t i = 0; i < ret && !FIFO_ISFULL(&rx_fifo); ++i)
-                    FIFO_PUSH(&rx_fifo, buffer[i]);
-            }
-        }
+    // a short write keeps what has not been written yet in the ring
+    ring_consume(&tx_ring, (size_t)ret);
+}
 
-        // check file descriptors ready for write
-        if (FD_ISSET(connfd, &write_set)) {
-            char buffer[SERIAL_NETWORK_BUFFER_SIZE];
-            size_t n = 0;
-            while (n < SERIAL_NETWORK_BUFFER_SIZE && !FIFO_ISEMPTY(&tx_fifo))
-                buffer[n++] = FIFO_POP(&tx_fifo);
-            ssize_t ret = send(connfd, buffer, n, 0);
-
-            if (ret == -1) {
-                LOG_ERR("serial: send error while writing to client: %s\n",
-                        strerror(errno));
-                LOG_ERR("serial: connection reset\n");
-                close(connfd);
-                connfd = -1;
-                return;
-            }
-        }
+static void serial_handle_io(int fd, unsigned int events) {
+    // check file descriptors ready for read
+    if ((events & REACTOR_READ) && fd == rxfd)
+        serial_receive(fd);
+
+    // check file descriptors ready for write, unless they have been closed
+    if ((events & REACTOR_WRITE) && fd == txfd)
+        serial_transmit(fd);
+
+    serial_update_events();
+}
+
+static void serial_handle_accept(int fd, unsigned int events) {
+    (void)events;
+
+    // only one client is handled at a time
+    if (rxfd != -1)
+        return;
+
+    // a slow client must not stall the emulator, see serial_transmit()
+    const int connfd = accept4(fd, NULL, NULL, SOCK_NONBLOCK);
+    if (connfd == -1) {
+        LOG_ERR("serial: error while accepting new client: %s\n",
+                strerror(errno));
+        return;
+    }
+    if (!reactor_add(connfd, 0, serial_handle_io)) {
+        close(connfd);
+        return;
     }
+    rxfd = txfd = connfd;
+    LOG_INFO("serial: accept client\n");
+
+    // characters are sent as soon as they are transmitted, do not wait for
+    // more of them to fill a segment
+    if (setsockopt(connfd, IPPROTO_TCP, TCP_NODELAY, &(int){true},
+                   sizeof(int)) != 0)
+        LOG_WARN("serial: unable to setsockopt(): %s\n", strerror(errno));
+
+    // no more clients until this one disconnects
+    reactor_modify(sockfd, 0);
+    serial_update_events();
 }
 
-bool serial_open(uint16_t port) {
-    if (sockfd >= 0) {
+static bool serial_attach(serial_backend_t new_backend) {
+    if (rxfd != -1 && !reactor_add(rxfd, 0, serial_handle_io)) {
+        serial_close();
+        return false;
+    }
+    if (txfd != -1 && txfd != rxfd &&
+        !reactor_add(txfd, 0, serial_handle_io)) {
+        serial_close();
+        return false;
+    }
+
+    if (!ring_init(&tx_ring, buffer_size) ||
+        !ring_init(&rx_ring, buffer_size)) {
+        LOG_ERR("serial: unable to allocate buffers\n");
+        serial_close();
+        return false;
+    }
+
+    backend = new_backend;
+    serial_update_events();
+
+    sio2_attachPeripheral(SIO_CHANNEL_A, serial_getChar, serial_putChar);
+
+    LOG_INFO("serial: open ok\n");
+    return true;
+}
+
+bool serial_openTcp(uint16_t port) {
+    if (backend != SERIAL_BACKEND_NONE) {
         LOG_INFO("serial: port already open\n");
         return false;
     }
@@ -162,39 +263,145 @@ bool serial_open(uint16_t port) {
     if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &(int){true},
                    sizeof(int)) != 0) {
         LOG_ERR("serial: unable to setsockopt(): %s\n", strerror(errno));
+        serial_close();
         return false;
     }
 
     if (bind(sockfd, (const struct sockaddr *)&server_addr,
              sizeof(server_addr)) != 0) {
         LOG_ERR("serial: unable to bind(): %s\n", strerror(errno));
+        serial_close();
         return false;
     }
 
     if (listen(sockfd, 1) != 0) {
         LOG_ERR("serial: unable to listen(): %s\n", strerror(errno));
+        serial_close();
         return false;
     }
 
-    FIFO_INIT(&tx_fifo);
-    FIFO_INIT(&rx_fifo);
+    if (!reactor_add(sockfd, REACTOR_READ, serial_handle_accept)) {
+        serial_close();
+        return false;
+    }
 
-    sio2_attachPeripheral(SIO_CHANNEL_A, serial_getChar, serial_putChar);
+    snprintf(path, sizeof(path), "port %u", (unsigned int)port);
+    return serial_attach(SERIAL_BACKEND_TCP);
+}
 
-    LOG_INFO("serial: open ok\n");
-    return true;
+bool serial_openPty(void) {
+    if (backend != SERIAL_BACKEND_NONE) {
+        LOG_INFO("serial: port already open\n");
+        return false;
+    }
+
+    int ptmfd = -1;
+    if (openpty(&ptmfd, &ptsfd, path, NULL, NULL) != 0) {
+        LOG_ERR("serial: unable to openpty(): %s\n", strerror(errno));
+        return false;
+    }
+    rxfd = txfd = ptmfd;
+
+    // pass bytes through as they are, as a real serial line would do
+    struct termios tio;
+    if (tcgetattr(ptsfd, &tio) == 0) {
+        cfmakeraw(&tio);
+        (void)tcsetattr(ptsfd, TCSANOW, &tio);
+    }
+
+    if (fcntl(ptmfd, F_SETFL, O_NONBLOCK) != 0) {
+        LOG_ERR("serial: unable to fcntl(): %s\n", strerror(errno));
+        serial_close();
+        return false;
+    }
+
+    LOG_INFO("serial: pty %s\n", path);
+    return serial_attach(SERIAL_BACKEND_PTY);
+}
+
+/**
+ * @brief Open a file for the file backend.
+ *
+ * Fifos are opened for both reading and writing, so that they never hang up,
+ * and writes never block, whether there is a peer on the other side or not.
+ */
+static int serial_open_file(const char *name, bool output) {
+    struct stat st;
+    const bool fifo = stat(name, &st) == 0 && S_ISFIFO(st.st_mode);
+
+    int flags = O_NONBLOCK | O_CLOEXEC;
+    if (fifo)
+        flags |= O_RDWR;
+    else if (output)
+        flags |= O_WRONLY | O_CREAT | O_APPEND;
+    else
+        flags |= O_RDONLY;
+
+    const int fd = open(name, flags, 0644);
+    if (fd == -1)
+        LOG_ERR("serial: unable to open %s: %s\n", name, strerror(errno));
+    return fd;
+}
+
+bool serial_openFile(const char *output, const char *input) {
+    if (backend != SERIAL_BACKEND_NONE) {
+        LOG_INFO("serial: port already open\n");
+        return false;
+    }
+
+    txfd = serial_open_file(output, true);
+    if (txfd == -1)
+        return false;
+
+    if (input != NULL) {
+        rxfd = serial_open_file(input, false);
+        if (rxfd == -1) {
+            serial_close();
+            return false;
+        }
+    }
+
+    snprintf(path, sizeof(path), "%s", output);
+    return serial_attach(SERIAL_BACKEND_FILE);
+}
+
+serial_backend_t serial_getBackend(void) {
+    return backend;
+}
+
+const char *serial_getPath(void) {
+    if (backend == SERIAL_BACKEND_NONE)
+        return NULL;
+    return path;
 }
 
 void serial_close(void) {
-    sio2_detachPeripheral(SIO_CHANNEL_A);
+    if (backend != SERIAL_BACKEND_NONE)
+        sio2_detachPeripheral(SIO_CHANNEL_A);
+
+    if (txfd == rxfd)
+        txfd = -1;
+    serial_close_fd(&rxfd);
+    serial_close_fd(&txfd);
+    serial_close_fd(&sockfd);
+    if (ptsfd != -1) {
+        close(ptsfd);
+        ptsfd = -1;
+    }
+    ring_cleanup(&tx_ring);
+    ring_cleanup(&rx_ring);
 
-    if (connfd != -1)
-        close(connfd);
+    if (backend != SERIAL_BACKEND_NONE)
+        LOG_INFO("serial: close ok\n");
+    backend = SERIAL_BACKEND_NONE;
+}
 
-    if (sockfd != -1)
-        close(sockfd);
+static bool serial_start(void) {
+    const uint32_t *size = conf_getU32("serial", "buffer_size");
+    if (size != NULL && *size > 0)
+        buffer_size = *size;
 
-    LOG_INFO("serial: close ok\n");
+    return true;
 }
 
 static void serial_cleanup(void) {
@@ -204,6 +411,6 @@ static void serial_cleanup(void) {
 void serial_init(CEDAModule *mod) {
     memset(mod, 0, sizeof(*mod));
     mod->init = serial_init;
-    mod->poll = serial_poll;
+    mod->start = serial_start;
     mod->cleanup = serial_cleanup;
 }
@@ -6,9 +6,60 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+typedef enum serial_backend_t {
+    SERIAL_BACKEND_NONE, // serial port is closed
+    SERIAL_BACKEND_TCP,  // tcp server, for a single client
+    SERIAL_BACKEND_PTY,  // pseudo-terminal
+    SERIAL_BACKEND_FILE, // plain files or fifos
+} serial_backend_t;
+
 void serial_init(CEDAModule *mod);
 
-bool serial_open(uint16_t port);
+/**
+ * @brief Emulate the serial port with a tcp server.
+ *
+ * @param port tcp port to listen on, 0 for the default one
+ *
+ * @return true if the serial port has been opened
+ */
+bool serial_openTcp(uint16_t port);
+
+/**
+ * @brief Emulate the serial port with a pseudo-terminal.
+ *
+ * Host tools can open the pty slave device as a serial device,
+ * see serial_getPath().
+ *
+ * @return true if the serial port has been opened
+ */
+bool serial_openPty(void);
+
+/**
+ * @brief Emulate the serial port with files.
+ *
+ * Transmitted data is appended to the output file, and received data is read
+ * from the input file, if any. Both of them can be fifos.
+ *
+ * @param output path of the output file, created if it does not exist
+ * @param input path of the input file, or NULL
+ *
+ * @return true if the serial port has been opened
+ */
+bool serial_openFile(const char *output, const char *input);
+
+/**
+ * @brief Return how the serial port is currently emulated.
+ */
+serial_backend_t serial_getBackend(void);
+
+/**
+ * @brief Return where the peer can find the serial port.
+ *
+ * @return pty slave device, output file or tcp port (eg. "port 52955"),
+ * NULL if the serial port is closed
+ */
+const char *serial_getPath(void);
+
 void serial_close(void);
 
 #endif // CEDA_SERIAL_PORT_H
@@ -1,19 +1,36 @@
 #include "sio2.h"
 
 #include <assert.h>
+#include <ctype.h>
+#include <limits.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "bus.h"
+#include "conf.h"
+#include "cpu.h"
 #include "fifo.h"
 #include "int.h"
 #include "keyboard.h"
 #include "macro.h"
+#include "siocap.h"
 
 #define LOG_LEVEL LOG_LVL_DEBUG
 #include "log.h"
 
 DECLARE_FIFO_TYPE(uint8_t, SIOFIFO, (3 + 1));
 
+// Line timing.
+// Characters are received and transmitted at the baud rate of the channel,
+// measured in emulated cpu cycles, so that serial throughput does not depend
+// on how often the SIO/2 is polled. Each character is shifted in (out) for
+// the time of a frame: start bit, 8 data bits, parity bit if enabled, and
+// the stop bits programmed in write register 4.
+// Baud rate clocks come from the timer, which is not emulated yet, so the
+// baud rate of each channel is configured by the user. If unlimited, the
+// FIFOs are filled (drained) as fast as the processor reads (writes) them.
+#define SIO2_DEFAULT_BAUD_RATE (19200UL)
+
 typedef struct SIOChannel {
     uint8_t reg_index;    //< pointer to indexed internal register
     uint8_t read_regs[3]; //< read registers
@@ -26,6 +43,14 @@ typedef struct SIOChannel {
     bool rx_int_enabled; //< enable interrupts on RX
     bool tx_int_enabled; //< enable interrupts on TX
 
+    unsigned long int baud_rate;   //< line speed, 0 if unlimited [bit/s]
+    unsigned int frame_half_bits;  //< frame length, in half bits
+    unsigned long int char_cycles; //< time of a frame [cycles]
+    bool rx_shifting;              //< a character is being received
+    uint8_t rx_shift;              //< character being received
+    unsigned long int rx_done;     //< end of last reception [cycles]
+    unsigned long int tx_done;     //< end of last transmission [cycles]
+
     // Get character from attached serial peripheral (callback).
     // If NULL, no peripheral is phisically attached.
     sio_channel_try_read_t getc;
@@ -58,6 +83,21 @@ static SIOChannel channels[SIO_CHANNEL_CNT];
 // vector byte to pass back to Z80 when an interrupt must be generated
 static uint8_t sio_interrupt_vector = 0;
 
+/**
+ * @brief Compute the time of a frame, from baud rate and frame format.
+ *
+ * @param channel Pointer to the channel.
+ */
+static void sio_channel_update_timing(SIOChannel *channel) {
+    if (channel->baud_rate == 0) {
+        channel->char_cycles = 0;
+        return;
+    }
+
+    channel->char_cycles = channel->frame_half_bits * (unsigned long)CPU_FREQ /
+                           (2 * channel->baud_rate);
+}
+
 /**
  * @brief Reinitialize an already initialized channel.
  *
@@ -76,6 +116,9 @@ static void sio_channel_reinit(SIOChannel *channel) {
     channel->tx_enabled = false;
     channel->rx_int_enabled = false;
     channel->tx_int_enabled = false;
+    channel->frame_half_bits = 2 * (1 + 8 + 1); // 8N1
+    channel->rx_shifting = false;
+    sio_channel_update_timing(channel);
 }
 
 /**
@@ -85,24 +128,114 @@ static void sio_channel_reinit(SIOChannel *channel) {
  */
 static void sio_channel_init(SIOChannel *channel) {
     memset(channel, 0, sizeof(*channel));
+    channel->baud_rate = SIO2_DEFAULT_BAUD_RATE;
     sio_channel_reinit(channel);
 }
 
-static us_interval_t sio2_remaining(void) {
-    // SIO2 state can not change faster than the minimum amount needed
-    // to transmit (or receive) a frame via serial (10 bits), so there is
-    // no point in polling faster
-#define SIO2_MAX_BAUD_RATE (19200)
-#define SERIAL_FRAME_MIN_DURATION_US                                           \
-    (1000ULL * 1000ULL / SIO2_MAX_BAUD_RATE * 10)
+static sio_channel_idx_t sio_channel_index(const SIOChannel *channel) {
+    return (sio_channel_idx_t)(channel - channels);
+}
+
+/**
+ * @brief Receive characters from the attached peripheral, as long as their
+ * frame has ended by now, and there is room in the RX FIFO.
+ *
+ * @param channel Pointer to the channel.
+ * @param now Current time. [cycles]
+ */
+static void sio_channel_receive(SIOChannel *channel, unsigned long int now) {
+    // no peripheral phisically attached
+    if (!channel->getc)
+        return;
+
+    for (;;) {
+        // try get next char from peripheral, it starts as soon as the line
+        // is free
+        if (!channel->rx_shifting) {
+            if (!channel->getc(&channel->rx_shift))
+                break;
+            const unsigned long int start = MAX(now, channel->rx_done);
+            siocap_byte(sio_channel_index(channel), SIOCAP_RX,
+                        channel->rx_shift, start);
+            channel->rx_shifting = true;
+            channel->rx_done = start + channel->char_cycles;
+        }
+
+        // char is still on the line
+        if (now < channel->rx_done)
+            break;
+
+        // Not enough space in RX FIFO, wait.
+        // This does not actually happen on real hardware, but
+        // do we really want to handle the buffer overrun condition?
+        if (FIFO_ISFULL(&channel->rx_fifo))
+            break;
+
+        channel->rx_shifting = false;
+
+        // if receiver is disabled, discard incoming data
+        if (!channel->rx_enabled)
+            continue;
+
+        LOG_DEBUG("sio2: channel %c: received char: %02x (%c)\n",
+                  (channel == &channels[SIO_CHANNEL_A]) ? 'A' : 'B',
+                  channel->rx_shift,
+                  isprint(channel->rx_shift) ? channel->rx_shift : ' ');
 
-    return SERIAL_FRAME_MIN_DURATION_US;
+        // put char in RX fifo, and signal RX char available
+        FIFO_PUSH(&channel->rx_fifo, channel->rx_shift);
+        channel->read_regs[0] |= (1U << RX_CHAR_AVAILABLE_BIT);
+    }
+}
+
+/**
+ * @brief Transmit characters to the attached peripheral, as soon as the line
+ * is free.
+ *
+ * TX buffer is empty when the last character written by the processor has
+ * begun its transmission.
+ *
+ * @param channel Pointer to the channel.
+ * @param now Current time. [cycles]
+ */
+static void sio_channel_transmit(SIOChannel *channel, unsigned long int now) {
+    while (!FIFO_ISEMPTY(&channel->tx_fifo)) {
+        // previous char is still on the line
+        if (now < channel->tx_done)
+            break;
+
+        // Try put char to peripheral, if any, and if transmitter is enabled.
+        // Otherwise, char is just lost.
+        const uint8_t c = FIFO_PEEK(&channel->tx_fifo);
+        const unsigned long int start = MAX(now, channel->tx_done);
+        if (channel->putc && channel->tx_enabled) {
+            if (!channel->putc(c))
+                break;
+            siocap_byte(sio_channel_index(channel), SIOCAP_TX, c, start);
+        }
+
+        // actually remove char from TX FIFO
+        (void)FIFO_POP(&channel->tx_fifo);
+        channel->tx_done = start + channel->char_cycles;
+    }
+
+    if (FIFO_ISEMPTY(&channel->tx_fifo))
+        channel->read_regs[0] |= (1 << TX_BUFFER_EMPTY_BIT);
+    else
+        channel->read_regs[0] &= (uint8_t) ~(1 << TX_BUFFER_EMPTY_BIT);
 }
 
 static uint8_t sio_channel_read_data(SIOChannel *channel) {
+    const unsigned long int now = cpu_getCycles();
+
+    sio_channel_receive(channel, now);
+
     if (!FIFO_ISEMPTY(&channel->rx_fifo)) {
         const uint8_t c = FIFO_POP(&channel->rx_fifo);
 
+        // next char may be already there
+        sio_channel_receive(channel, now);
+
         // reset "data available" bit in read reg 0
         if (FIFO_ISEMPTY(&channel->rx_fifo))
             channel->read_regs[0] &= (uint8_t) ~(1 << RX_CHAR_AVAILABLE_BIT);
@@ -122,9 +255,7 @@ static void sio_channel_write_data(SIOChannel *channel, uint8_t value) {
 
     FIFO_PUSH(&channel->tx_fifo, value);
 
-    if (!FIFO_ISFULL(&channel->tx_fifo)) {
-        channel->read_regs[0] |= (1 << TX_BUFFER_EMPTY_BIT);
-    }
+    sio_channel_transmit(channel, cpu_getCycles());
 }
 
 static uint8_t sio_channel_read_control(SIOChannel *channel) {
@@ -138,6 +269,13 @@ static uint8_t sio_channel_read_control(SIOChannel *channel) {
     if (channel->reg_index >= ARRAY_SIZE(channel->read_regs))
         return 0x55;
 
+    // status may have changed since last poll
+    if (channel->reg_index == 0) {
+        const unsigned long int now = cpu_getCycles();
+        sio_channel_receive(channel, now);
+        sio_channel_transmit(channel, now);
+    }
+
     return channel->read_regs[channel->reg_index];
 }
 
@@ -238,9 +376,14 @@ static void write_register_3(SIOChannel *channel, uint8_t value) {
 }
 
 static void write_register_4(SIOChannel *channel, uint8_t value) {
-    // not implemented
-    (void)channel;
-    (void)value;
+    // stop bits, in half bits (0 is for synchronous modes, not supported)
+    static const unsigned int stop_half_bits[] = {2, 2, 3, 4};
+
+    // clock mode is not needed, since baud rate is known
+    const unsigned int parity = value & 0x1;
+    channel->frame_half_bits =
+        2 * (1 + 8 + parity) + stop_half_bits[value >> 2 & 0x3];
+    sio_channel_update_timing(channel);
 }
 
 static void write_register_5(SIOChannel *channel, uint8_t value) {
@@ -331,8 +474,28 @@ void sio2_out(ceda_ioaddr_t address, uint8_t value) {
 }
 
 static bool sio2_start(void) {
-    // acquire dynamic resources
-    // (nothing to do at the moment)
+    static const char *const baud_keys[SIO_CHANNEL_CNT] = {"baud_a",
+                                                            "baud_b"};
+
+    for (size_t i = 0; i < ARRAY_SIZE(channels); ++i) {
+        SIOChannel *channel = &channels[i];
+        const char *baud = conf_getString("serial", baud_keys[i]);
+        if (baud == NULL)
+            continue;
+
+        if (strcmp(baud, "unlimited") == 0) {
+            channel->baud_rate = 0;
+        } else {
+            char *end;
+            channel->baud_rate = strtoul(baud, &end, 10);
+            if (*end != '\0' || channel->baud_rate == 0) {
+                LOG_ERR("sio2: invalid %s: %s\n", baud_keys[i], baud);
+                return false;
+            }
+        }
+        sio_channel_update_timing(channel);
+    }
+
     return true;
 }
 
@@ -342,34 +505,12 @@ static void sio2_cleanup(void) {
 }
 
 static void sio2_poll(void) {
-    // try to read data from external serial peripherals
-    for (size_t i = 0; i < ARRAY_SIZE(channels); ++i) {
-        SIOChannel *channel = &channels[i];
-        // no peripheral phisically attached
-        if (!channel->getc)
-            continue;
-
-        // Not enough space in RX FIFO, skip.
-        // This does not actually happen on real hardware, but
-        // do we really want to handle the buffer overrun condition?
-        if (FIFO_ISFULL(&channel->rx_fifo))
-            continue;
+    const unsigned long int now = cpu_getCycles();
 
-        // try get char from peripheral
-        uint8_t c;
-        const bool ok = channel->getc(&c);
-        if (!ok) // no char available
-            continue;
-
-        // if receiver is disabled, discard incoming data
-        if (!channel->rx_enabled)
-            continue;
-
-        LOG_DEBUG("sio2: channel %zu: received char: %02x (%c)\n", i, c,
-                  isprint(c) ? c : ' ');
-
-        // put char in RX fifo
-        FIFO_PUSH(&channel->rx_fifo, c);
+    // exchange data with external serial peripherals
+    for (size_t i = 0; i < ARRAY_SIZE(channels); ++i) {
+        sio_channel_receive(&channels[i], now);
+        sio_channel_transmit(&channels[i], now);
     }
 
     for (size_t i = 0; i < ARRAY_SIZE(channels); ++i) {
@@ -378,38 +519,10 @@ static void sio2_poll(void) {
         if (FIFO_ISEMPTY(&channel->rx_fifo))
             continue;
 
-        // signal RX char available
-        channel->read_regs[0] |= (1U << RX_CHAR_AVAILABLE_BIT);
-
         // generate interrupt request, if interrupts are enabled
         if (channel->rx_int_enabled)
             int_irq(INTPRIO_SIO2, sio_interrupt_vector);
     }
-
-    // try to write data to external serial peripherals
-    for (size_t i = 0; i < ARRAY_SIZE(channels); ++i) {
-        SIOChannel *channel = &channels[i];
-        // no peripheral phisically attached
-        if (!channel->putc)
-            continue;
-
-        // skip if transmitter is not enabled
-        if (!channel->tx_enabled)
-            continue;
-
-        // nothing to send to this peripheral
-        if (FIFO_ISEMPTY(&channel->tx_fifo))
-            continue;
-
-        // try put char to peripheral
-        const uint8_t c = FIFO_PEEK(&channel->tx_fifo);
-        const bool ok = channel->putc(c);
-        if (!ok)
-            continue;
-
-        // actually remove char from TX FIFO
-        (void)FIFO_POP(&channel->tx_fifo);
-    }
 }
 
 void sio2_attachPeripheral(sio_channel_idx_t channel,
@@ -430,7 +543,6 @@ void sio2_init(CEDAModule *mod) {
     mod->init = sio2_init;
     mod->start = sio2_start;
     mod->poll = sio2_poll;
-    mod->remaining = sio2_remaining;
     mod->cleanup = sio2_cleanup;
 
     for (size_t i = 0; i < ARRAY_SIZE(channels); ++i)
@@ -439,3 +551,104 @@ void sio2_init(CEDAModule *mod) {
     // attach keyboard to channel B
     channels[SIO_CHANNEL_B].getc = keyboard_getChar;
 }
+
+#if defined(CEDA_TEST)
+
+#include <criterion/criterion.h>
+
+static uint8_t test_rx_count = 0;
+static uint8_t test_tx_count = 0;
+
+static bool test_getc(uint8_t *c) {
+    *c = (uint8_t)('A' + test_rx_count++);
+    return true;
+}
+
+static bool test_putc(uint8_t c) {
+    (void)c;
+    ++test_tx_count;
+    return true;
+}
+
+Test(sio2, frameTime) {
+    SIOChannel *channel = &channels[SIO_CHANNEL_A];
+    sio_channel_init(channel);
+
+    // 8N1 at 19200 baud, 10 bits
+    cr_assert_eq(channel->char_cycles, 2083);
+
+    // even parity, 2 stop bits, 12 bits
+    write_register_4(channel, 0x4F);
+    cr_assert_eq(channel->char_cycles, 2500);
+
+    // 1.5 stop bits, 10.5 bits
+    write_register_4(channel, 0x48);
+    cr_assert_eq(channel->char_cycles, 2187);
+
+    channel->baud_rate = 0;
+    sio_channel_update_timing(channel);
+    cr_assert_eq(channel->char_cycles, 0);
+}
+
+Test(sio2, rxTiming) {
+    SIOChannel *channel = &channels[SIO_CHANNEL_A];
+    sio_channel_init(channel);
+    channel->getc = test_getc;
+    channel->rx_enabled = true;
+    test_rx_count = 0;
+
+    // first char is on the line until its frame ends
+    sio_channel_receive(channel, 1000);
+    cr_assert(FIFO_ISEMPTY(&channel->rx_fifo));
+    sio_channel_receive(channel, 1000 + 2082);
+    cr_assert(FIFO_ISEMPTY(&channel->rx_fifo));
+    sio_channel_receive(channel, 1000 + 2083);
+    cr_assert_eq(FIFO_COUNT(&channel->rx_fifo), 1);
+    cr_assert(channel->read_regs[0] & (1 << RX_CHAR_AVAILABLE_BIT));
+
+    // then one char for each frame, back to back, until FIFO is full
+    sio_channel_receive(channel, 1000 + 2083 * 2);
+    cr_assert_eq(FIFO_COUNT(&channel->rx_fifo), 2);
+    sio_channel_receive(channel, 1000 + 2083 * 10);
+    cr_assert(FIFO_ISFULL(&channel->rx_fifo));
+    cr_assert_eq(FIFO_POP(&channel->rx_fifo), 'A');
+    cr_assert_eq(FIFO_POP(&channel->rx_fifo), 'B');
+    cr_assert_eq(FIFO_POP(&channel->rx_fifo), 'C');
+
+    // unlimited: FIFO is filled as soon as there is room, once the char on
+    // the line is received
+    channel->baud_rate = 0;
+    sio_channel_update_timing(channel);
+    sio_channel_receive(channel, 1000 + 2083 * 11);
+    cr_assert(FIFO_ISFULL(&channel->rx_fifo));
+    cr_assert_eq(FIFO_POP(&channel->rx_fifo), 'D');
+
+    channel->getc = NULL;
+}
+
+Test(sio2, txTiming) {
+    SIOChannel *channel = &channels[SIO_CHANNEL_A];
+    sio_channel_init(channel);
+    channel->putc = test_putc;
+    channel->tx_enabled = true;
+    test_tx_count = 0;
+
+    // first char is transmitted immediately, second one waits for the line
+    FIFO_PUSH(&channel->tx_fifo, 'A');
+    sio_channel_transmit(channel, 1000);
+    cr_assert_eq(test_tx_count, 1);
+    cr_assert(channel->read_regs[0] & (1 << TX_BUFFER_EMPTY_BIT));
+
+    FIFO_PUSH(&channel->tx_fifo, 'B');
+    sio_channel_transmit(channel, 1000 + 2082);
+    cr_assert_eq(test_tx_count, 1);
+    cr_assert_not(channel->read_regs[0] & (1 << TX_BUFFER_EMPTY_BIT));
+
+    sio_channel_transmit(channel, 1000 + 2083);
+    cr_assert_eq(test_tx_count, 2);
+    cr_assert(channel->read_regs[0] & (1 << TX_BUFFER_EMPTY_BIT));
+
+    channel->putc = NULL;
+}
+
+#endif
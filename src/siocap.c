@@ -0,0 +1,332 @@
+#include "siocap.h"
+
+#include "cpu.h"
+#include "macro.h"
+#include "time.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define LOG_LEVEL LOG_LVL_INFO
+#include "log.h"
+
+/*
+ * Capture stream format, all integers are little endian:
+ *
+ *  header: "CEDACAP1" (8 bytes), cpu frequency (u32), in Hz
+ *
+ * then a record for each byte, made of:
+ *  - (delta << 2) | (channel << 1) | direction, as unsigned LEB128 varint,
+ *    where delta is the time elapsed since the previous record (since power
+ *    on, for the first one), in cpu cycles, channel is 0 for A and 1 for B,
+ *    and direction is 0 for rx and 1 for tx;
+ *  - the byte itself.
+ *
+ * Records are usually 2 to 5 bytes long, and they are collected in memory,
+ * then written in large blocks, at least once a second.
+ */
+static const char SIOCAP_MAGIC[] = "CEDACAP1";
+#define SIOCAP_HEADER_SIZE    (sizeof(SIOCAP_MAGIC) - 1 + sizeof(uint32_t))
+#define SIOCAP_BUFFER_SIZE    (64U * 1024U)   // [bytes]
+#define SIOCAP_RECORD_MAX     (10U + 1U)      // [bytes] u64 varint, byte
+#define SIOCAP_FLUSH_INTERVAL (1000L * 1000L) // [us]
+
+// pcap file format constants
+#define PCAP_MAGIC          (0xa1b2c3d4U)
+#define PCAP_VERSION_MAJOR  (2U)
+#define PCAP_VERSION_MINOR  (4U)
+#define PCAP_SNAPLEN        (65535U)
+#define PCAP_LINKTYPE_USER0 (147U)
+
+static int capture_fd = -1;
+static uint8_t buffer[SIOCAP_BUFFER_SIZE];
+static size_t buffer_used = 0;
+static unsigned long int last_cycles = 0;
+static us_time_t last_flush = 0;
+
+static void put_u16(uint8_t *dst, uint16_t value) {
+    dst[0] = (uint8_t)(value & 0xff);
+    dst[1] = (uint8_t)(value >> 8);
+}
+
+static void put_u32(uint8_t *dst, uint32_t value) {
+    for (size_t i = 0; i < sizeof(value); ++i)
+        dst[i] = (uint8_t)((value >> (8 * i)) & 0xff);
+}
+
+static uint32_t get_u32(const uint8_t *src) {
+    uint32_t value = 0;
+    for (size_t i = 0; i < sizeof(value); ++i)
+        value |= (uint32_t)src[i] << (8 * i);
+    return value;
+}
+
+static bool siocap_write(const void *data, size_t size) {
+    const uint8_t *src = data;
+    while (size > 0) {
+        const ssize_t ret = write(capture_fd, src, size);
+        if (ret == -1 && errno == EINTR)
+            continue;
+        if (ret == -1)
+            return false;
+        src += ret;
+        size -= (size_t)ret;
+    }
+    return true;
+}
+
+static void siocap_flush(void) {
+    last_flush = time_now_us();
+    if (buffer_used == 0)
+        return;
+
+    const bool ok = siocap_write(buffer, buffer_used);
+    buffer_used = 0;
+
+    if (!ok) {
+        LOG_ERR("error writing serial capture: %s, stop\n", strerror(errno));
+        siocap_stop();
+    }
+}
+
+bool siocap_start(const char *path) {
+    if (capture_fd != -1)
+        siocap_stop();
+
+    capture_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (capture_fd == -1) {
+        LOG_ERR("unable to open %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    uint8_t header[SIOCAP_HEADER_SIZE];
+    memcpy(header, SIOCAP_MAGIC, sizeof(SIOCAP_MAGIC) - 1);
+    put_u32(&header[sizeof(SIOCAP_MAGIC) - 1], CPU_FREQ);
+
+    if (!siocap_write(header, sizeof(header))) {
+        LOG_ERR("error writing %s\n", path);
+        close(capture_fd);
+        capture_fd = -1;
+        return false;
+    }
+
+    buffer_used = 0;
+    last_cycles = 0;
+    last_flush = time_now_us();
+
+    LOG_INFO("capturing serial traffic to %s\n", path);
+    return true;
+}
+
+void siocap_stop(void) {
+    if (capture_fd == -1)
+        return;
+
+    siocap_flush();
+    if (capture_fd != -1 && close(capture_fd) != 0)
+        LOG_ERR("error writing serial capture\n");
+    capture_fd = -1;
+}
+
+bool siocap_isActive(void) {
+    return capture_fd != -1;
+}
+
+void siocap_byte(sio_channel_idx_t channel, siocap_dir_t dir, uint8_t c,
+                 unsigned long int cycles) {
+    if (capture_fd == -1)
+        return;
+
+    if (buffer_used + SIOCAP_RECORD_MAX > sizeof(buffer)) {
+        siocap_flush();
+        if (capture_fd == -1)
+            return;
+    }
+
+    // timestamps of different channels may be slightly out of order
+    const unsigned long int delta =
+        (cycles > last_cycles) ? cycles - last_cycles : 0;
+    last_cycles = MAX(last_cycles, cycles);
+
+    uint64_t value = ((uint64_t)delta << 2) | ((uint64_t)channel << 1) | dir;
+    do {
+        uint8_t bits = (uint8_t)(value & 0x7f);
+        value >>= 7;
+        if (value != 0)
+            bits |= 0x80;
+        buffer[buffer_used++] = bits;
+    } while (value != 0);
+    buffer[buffer_used++] = c;
+}
+
+/**
+ * @brief Read next record of a capture file.
+ *
+ * @return false at the end of the file, or if the record is truncated
+ */
+static bool siocap_read_record(FILE *fp, unsigned long int *cycles,
+                               unsigned int *channel, unsigned int *dir,
+                               uint8_t *c) {
+    uint64_t value = 0;
+    for (unsigned int shift = 0;; shift += 7) {
+        const int bits = fgetc(fp);
+        if (bits == EOF || shift >= 64)
+            return false;
+        value |= (uint64_t)(bits & 0x7f) << shift;
+        if ((bits & 0x80) == 0)
+            break;
+    }
+
+    const int data = fgetc(fp);
+    if (data == EOF)
+        return false;
+
+    *cycles += (unsigned long int)(value >> 2);
+    *channel = (value >> 1) & 1;
+    *dir = value & 1;
+    *c = (uint8_t)data;
+    return true;
+}
+
+bool siocap_convert(const char *in_path, const char *out_path,
+                    siocap_format_t format) {
+    FILE *in = fopen(in_path, "rb");
+    if (in == NULL) {
+        LOG_ERR("unable to open %s: %s\n", in_path, strerror(errno));
+        return false;
+    }
+
+    uint8_t header[SIOCAP_HEADER_SIZE];
+    if (fread(header, 1, sizeof(header), in) != sizeof(header) ||
+        memcmp(header, SIOCAP_MAGIC, sizeof(SIOCAP_MAGIC) - 1) != 0) {
+        LOG_ERR("%s is not a serial capture\n", in_path);
+        (void)fclose(in);
+        return false;
+    }
+    uint32_t freq = get_u32(&header[sizeof(SIOCAP_MAGIC) - 1]);
+    if (freq == 0)
+        freq = CPU_FREQ;
+
+    FILE *out = fopen(out_path, "wb");
+    if (out == NULL) {
+        LOG_ERR("unable to open %s: %s\n", out_path, strerror(errno));
+        (void)fclose(in);
+        return false;
+    }
+
+    bool ok = true;
+    if (format == SIOCAP_FORMAT_PCAP) {
+        uint8_t pcap_header[24];
+        put_u32(&pcap_header[0], PCAP_MAGIC);
+        put_u16(&pcap_header[4], PCAP_VERSION_MAJOR);
+        put_u16(&pcap_header[6], PCAP_VERSION_MINOR);
+        put_u32(&pcap_header[8], 0);  // thiszone
+        put_u32(&pcap_header[12], 0); // sigfigs
+        put_u32(&pcap_header[16], PCAP_SNAPLEN);
+        put_u32(&pcap_header[20], PCAP_LINKTYPE_USER0);
+        ok = fwrite(pcap_header, 1, sizeof(pcap_header), out) ==
+             sizeof(pcap_header);
+    }
+
+    unsigned long int cycles = 0;
+    unsigned int channel;
+    unsigned int dir;
+    uint8_t c;
+    while (ok && siocap_read_record(in, &cycles, &channel, &dir, &c)) {
+        const unsigned long int sec = cycles / freq;
+        const unsigned long int usec =
+            (unsigned long int)((uint64_t)(cycles % freq) * 1000000U / freq);
+
+        if (format == SIOCAP_FORMAT_PCAP) {
+            // packet: channel, direction, byte
+            uint8_t record[16 + 3];
+            put_u32(&record[0], (uint32_t)sec);
+            put_u32(&record[4], (uint32_t)usec);
+            put_u32(&record[8], 3);  // captured length
+            put_u32(&record[12], 3); // original length
+            record[16] = (uint8_t)channel;
+            record[17] = (uint8_t)dir;
+            record[18] = c;
+            ok = fwrite(record, 1, sizeof(record), out) == sizeof(record);
+        } else {
+            ok = fprintf(out, "%lu.%06lu %lu %c %s %02x %c\n", sec, usec,
+                         cycles, channel ? 'B' : 'A', dir ? "tx" : "rx",
+                         (unsigned int)c, isprint(c) ? c : '.') > 0;
+        }
+    }
+
+    if (fclose(out) != 0)
+        ok = false;
+    (void)fclose(in);
+
+    if (!ok)
+        LOG_ERR("error writing %s\n", out_path);
+    return ok;
+}
+
+static void siocap_poll(void) {
+    if (capture_fd == -1)
+        return;
+
+    if (time_now_us() - last_flush >= SIOCAP_FLUSH_INTERVAL)
+        siocap_flush();
+}
+
+static us_interval_t siocap_remaining(void) {
+    if (capture_fd == -1 || buffer_used == 0)
+        return LONG_MAX;
+
+    return last_flush + SIOCAP_FLUSH_INTERVAL - time_now_us();
+}
+
+void siocap_init(CEDAModule *mod) {
+    memset(mod, 0, sizeof(*mod));
+    mod->init = siocap_init;
+    mod->poll = siocap_poll;
+    mod->remaining = siocap_remaining;
+    mod->cleanup = siocap_stop;
+}
+
+#if defined(CEDA_TEST)
+
+#include <criterion/criterion.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+Test(siocap, convert) {
+    char path[] = "/tmp/ceda-siocap-XXXXXX";
+    int fd = mkstemp(path);
+    cr_assert_geq(fd, 0);
+    close(fd);
+    char text_path[sizeof(path) + 4];
+    snprintf(text_path, sizeof(text_path), "%s.txt", path);
+
+    cr_assert(siocap_start(path));
+    siocap_byte(SIO_CHANNEL_A, SIOCAP_RX, 'A', 40);
+    siocap_byte(SIO_CHANNEL_B, SIOCAP_TX, 0x0d, 4000040);
+    siocap_stop();
+
+    // header, then two records of 3 and 5 bytes
+    struct stat st;
+    cr_assert_eq(stat(path, &st), 0);
+    cr_assert_eq(st.st_size, SIOCAP_HEADER_SIZE + 3 + 5);
+
+    cr_assert(siocap_convert(path, text_path, SIOCAP_FORMAT_TEXT));
+    FILE *fp = fopen(text_path, "r");
+    cr_assert_not_null(fp);
+    char text[128] = {0};
+    cr_assert_gt(fread(text, 1, sizeof(text) - 1, fp), 0);
+    fclose(fp);
+    cr_assert_str_eq(text, "0.000010 40 A rx 41 A\n"
+                           "1.000010 4000040 B tx 0d .\n");
+
+    unlink(path);
+    unlink(text_path);
+}
+
+#endif
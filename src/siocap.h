@@ -0,0 +1,57 @@
+#ifndef CEDA_SIOCAP_H
+#define CEDA_SIOCAP_H
+
+#include "module.h"
+#include "sio2.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef enum siocap_dir_t {
+    SIOCAP_RX = 0, // from peripheral to SIO/2
+    SIOCAP_TX = 1, // from SIO/2 to peripheral
+} siocap_dir_t;
+
+typedef enum siocap_format_t {
+    SIOCAP_FORMAT_TEXT, // one line for each byte
+    SIOCAP_FORMAT_PCAP, // libpcap, LINKTYPE_USER0
+} siocap_format_t;
+
+void siocap_init(CEDAModule *mod);
+
+/**
+ * @brief Start capturing bytes exchanged on SIO/2 channels.
+ *
+ * @param path Destination file path, truncated if it exists.
+ *
+ * @return true in case of success, false otherwise.
+ */
+bool siocap_start(const char *path);
+
+/**
+ * @brief Stop capturing, and close the file.
+ */
+void siocap_stop(void);
+
+bool siocap_isActive(void);
+
+/**
+ * @brief Append a byte to the capture, if active.
+ *
+ * @param channel SIO/2 channel
+ * @param dir Direction of the byte.
+ * @param c Byte.
+ * @param cycles Time at which the byte has begun crossing the line. [cycles]
+ */
+void siocap_byte(sio_channel_idx_t channel, siocap_dir_t dir, uint8_t c,
+                 unsigned long int cycles);
+
+/**
+ * @brief Convert a capture file to another format.
+ *
+ * @return true in case of success, false otherwise.
+ */
+bool siocap_convert(const char *in_path, const char *out_path,
+                    siocap_format_t format);
+
+#endif // CEDA_SIOCAP_H
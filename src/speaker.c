@@ -31,7 +31,7 @@ static Mix_Chunk chunk = {
 static bool speaker_start(void) {
     if (!gui_isStarted()) {
         LOG_WARN("no gui: default to terminal speaker\n");
-        return false;
+        return true;
     }
 
     if (Mix_OpenAudio(SPEAKER_SAMPLE_RATE, AUDIO_U8, 1, SPEAKER_SAMPLE_SIZE) <
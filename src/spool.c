@@ -0,0 +1,547 @@
+#define _GNU_SOURCE // pipe2
+#include "spool.h"
+
+#include "conf.h"
+#include "keyboard.h"
+#include "macro.h"
+#include "reactor.h"
+#include "ring.h"
+#include "sio2.h"
+#include "time.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <netdb.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define LOG_LEVEL LOG_LVL_INFO
+#include "log.h"
+
+#define SPOOL_BUFFER_SIZE  (256U * 1024U) // [bytes]
+#define SPOOL_BATCH_SIZE   (32U * 1024U)  // [bytes] written as soon as queued
+#define SPOOL_FLUSH_DELAY  (500L * 1000L) // [us] max delay of queued data
+#define SPOOL_REOPEN_DELAY (1000L * 1000L) // [us] between attempts to open
+#define SPOOL_CONNECT_WAIT (1000)          // [ms] on quit, for tcp connection
+#define SPOOL_DRAIN_WAIT   (1000L * 1000L) // [us] on quit, for queued data
+#define SPOOL_ROTATE_KEEP  (9U)            // rotated files to keep
+
+typedef enum spool_sink_t {
+    SPOOL_SINK_NONE,
+    SPOOL_SINK_FILE, // append to a file, rotated when too big
+    SPOOL_SINK_PIPE, // standard input of a host command
+    SPOOL_SINK_TCP,  // connect to a tcp server
+} spool_sink_t;
+
+static spool_sink_t sink = SPOOL_SINK_NONE;
+static char target[PATH_MAX]; // file path, command or tcp host
+static const char *port = NULL; // tcp port, in target buffer
+static uint32_t rotate_size = 0; // [bytes] 0 never rotate
+
+static int sink_fd = -1;
+static pid_t child = -1;         // pipe command process, until reaped
+static bool connecting = false;  // tcp connection in progress
+static bool flushing = false;    // waiting for sink_fd to be writable
+static size_t written = 0;       // [bytes] written in current file
+static us_time_t next_open = 0;  // do not try opening again before this
+static us_time_t first_queued;   // when oldest data in the ring was queued
+static ring_t ring;
+
+static void spool_handle_write(int fd, unsigned int events);
+
+static bool spool_open_file(void) {
+    sink_fd = open(target, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (sink_fd == -1) {
+        LOG_WARN("spool: unable to open %s: %s\n", target, strerror(errno));
+        return false;
+    }
+
+    struct stat st;
+    written = (fstat(sink_fd, &st) == 0) ? (size_t)st.st_size : 0;
+    return true;
+}
+
+/**
+ * @brief Reap the pipe command, if it has quit.
+ */
+static void spool_reap(void) {
+    if (child != -1 && waitpid(child, NULL, WNOHANG) != 0)
+        child = -1;
+}
+
+static bool spool_open_pipe(void) {
+    // command ends as soon as it reads the end of its input, but it may take
+    // a while: do not start another one meanwhile
+    spool_reap();
+    if (child != -1) {
+        LOG_WARN("spool: %s is still running\n", target);
+        return false;
+    }
+
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) != 0) {
+        LOG_WARN("spool: unable to pipe(): %s\n", strerror(errno));
+        return false;
+    }
+
+    child = fork();
+    if (child == -1) {
+        LOG_WARN("spool: unable to fork(): %s\n", strerror(errno));
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+    if (child == 0) {
+        dup2(fds[0], STDIN_FILENO);
+        execl("/bin/sh", "sh", "-c", target, (char *)NULL);
+        _exit(127);
+    }
+
+    close(fds[0]);
+    sink_fd = fds[1];
+    (void)fcntl(sink_fd, F_SETFL, O_NONBLOCK);
+    return true;
+}
+
+static bool spool_open_tcp(void) {
+    const struct addrinfo hints = {
+        .ai_family = AF_UNSPEC,
+        .ai_socktype = SOCK_STREAM,
+    };
+    struct addrinfo *res;
+    const int ret = getaddrinfo(target, port, &hints, &res);
+    if (ret != 0) {
+        LOG_WARN("spool: unable to resolve %s: %s\n", target,
+                 gai_strerror(ret));
+        return false;
+    }
+
+    // connect without blocking the emulator, see spool_connected()
+    for (struct addrinfo *ai = res; ai != NULL; ai = ai->ai_next) {
+        sink_fd = socket(ai->ai_family,
+                         ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                         ai->ai_protocol);
+        if (sink_fd == -1)
+            continue;
+        if (connect(sink_fd, ai->ai_addr, ai->ai_addrlen) == 0)
+            break;
+        if (errno == EINPROGRESS) {
+            connecting = true;
+            break;
+        }
+        close(sink_fd);
+        sink_fd = -1;
+    }
+    freeaddrinfo(res);
+
+    if (sink_fd == -1) {
+        LOG_WARN("spool: unable to connect to %s:%s\n", target, port);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Open the sink, unless it has failed too recently.
+ */
+static bool spool_open(void) {
+    static bool (*const open_sink[])(void) = {
+        [SPOOL_SINK_FILE] = spool_open_file,
+        [SPOOL_SINK_PIPE] = spool_open_pipe,
+        [SPOOL_SINK_TCP] = spool_open_tcp,
+    };
+
+    const us_time_t now = time_now_us();
+    if (sink == SPOOL_SINK_NONE || now < next_open)
+        return false;
+    next_open = now + SPOOL_REOPEN_DELAY;
+
+    if (!open_sink[sink]())
+        return false;
+
+    if (!reactor_add(sink_fd, 0, spool_handle_write)) {
+        close(sink_fd);
+        sink_fd = -1;
+        return false;
+    }
+    return true;
+}
+
+static void spool_close(void) {
+    if (sink_fd == -1)
+        return;
+
+    reactor_remove(sink_fd);
+    close(sink_fd);
+    sink_fd = -1;
+    flushing = false;
+    connecting = false;
+
+    // otherwise, the command is reaped later, without waiting for it
+    spool_reap();
+}
+
+/**
+ * @brief Rename current file as .1, .1 as .2, and so on, then start a new
+ * one.
+ */
+static void spool_rotate(void) {
+    char from[PATH_MAX + 16];
+    char to[PATH_MAX + 16];
+
+    spool_close();
+
+    for (unsigned int i = SPOOL_ROTATE_KEEP - 1; i > 0; --i) {
+        snprintf(from, sizeof(from), "%s.%u", target, i);
+        snprintf(to, sizeof(to), "%s.%u", target, i + 1);
+        (void)rename(from, to);
+    }
+    snprintf(to, sizeof(to), "%s.1", target);
+    if (rename(target, to) != 0)
+        LOG_WARN("spool: unable to rotate %s: %s\n", target, strerror(errno));
+
+    next_open = 0;
+    (void)spool_open();
+}
+
+/**
+ * @brief Check whether a tcp connection in progress has been established.
+ *
+ * @return false if connection has failed
+ */
+static bool spool_connected(void) {
+    int error = 0;
+    socklen_t len = sizeof(error);
+    if (getsockopt(sink_fd, SOL_SOCKET, SO_ERROR, &error, &len) != 0)
+        error = errno;
+    if (error != 0) {
+        LOG_WARN("spool: unable to connect to %s:%s: %s\n", target, port,
+                 strerror(error));
+        return false;
+    }
+
+    connecting = false;
+    LOG_INFO("spool: connected to %s:%s\n", target, port);
+    return true;
+}
+
+/**
+ * @brief Write as much queued data as possible, at once.
+ *
+ * @return false in case of error, and the sink must be closed
+ */
+static bool spool_write(void) {
+    struct iovec iov[2];
+    const int iovcnt = ring_dataIov(&ring, iov);
+    if (iovcnt == 0)
+        return true;
+
+    ssize_t ret;
+    if (sink == SPOOL_SINK_TCP) {
+        // a server which has closed the connection must not raise SIGPIPE
+        const struct msghdr msg = {
+            .msg_iov = iov,
+            .msg_iovlen = (size_t)iovcnt,
+        };
+        ret = sendmsg(sink_fd, &msg, MSG_NOSIGNAL);
+    } else {
+        ret = writev(sink_fd, iov, iovcnt);
+    }
+
+    if (ret == -1) {
+        if (errno == EAGAIN || errno == EINTR)
+            return true;
+        LOG_WARN("spool: write error: %s\n", strerror(errno));
+        return false;
+    }
+
+    ring_consume(&ring, (size_t)ret);
+    written += (size_t)ret;
+
+    if (sink == SPOOL_SINK_FILE && rotate_size != 0 && written >= rotate_size)
+        spool_rotate();
+
+    return true;
+}
+
+static void spool_handle_write(int fd, unsigned int events) {
+    (void)fd;
+    (void)events;
+
+    if (connecting && !spool_connected()) {
+        spool_close();
+        return;
+    }
+
+    if (!spool_write()) {
+        spool_close();
+        return;
+    }
+
+    // file may have been rotated, and reopened or not
+    flushing = (sink_fd != -1 && ring_count(&ring) != 0);
+    reactor_modify(sink_fd, flushing ? REACTOR_WRITE : 0);
+}
+
+static void spool_flush_start(void) {
+    if (sink_fd == -1 && !spool_open())
+        return;
+
+    reactor_modify(sink_fd, REACTOR_WRITE);
+    flushing = true;
+}
+
+/**
+ * @brief Write all the queued data, waiting for the sink if needed.
+ */
+static void spool_drain(void) {
+    if (sink_fd == -1) {
+        next_open = 0;
+        (void)spool_open();
+    }
+
+    if (connecting) {
+        struct pollfd pfd = {.fd = sink_fd, .events = POLLOUT};
+        if (poll(&pfd, 1, SPOOL_CONNECT_WAIT) != 1 || !spool_connected())
+            spool_close();
+    }
+
+    // a stalled reader must not hang the emulator on quit
+    const us_time_t deadline = time_now_us() + SPOOL_DRAIN_WAIT;
+    while (sink_fd != -1 && ring_count(&ring) != 0) {
+        const us_time_t left = deadline - time_now_us();
+        if (left <= 0)
+            break;
+
+        struct pollfd pfd = {.fd = sink_fd, .events = POLLOUT};
+        const int ret = poll(&pfd, 1, (int)((left + 999) / 1000));
+        if (ret == 1 && !spool_write())
+            spool_close();
+        else if (ret == -1 && errno != EINTR)
+            spool_close();
+    }
+
+    if (ring_count(&ring) != 0)
+        LOG_WARN("spool: %zu bytes lost\n", ring_count(&ring));
+}
+
+static bool spool_putChar(uint8_t c) {
+    const bool was_empty = ring_count(&ring) == 0;
+
+    // the emulated printer is busy, until data can be queued again
+    if (ring_push(&ring, &c, 1) == 0)
+        return false;
+
+    if (was_empty)
+        first_queued = time_now_us();
+    if (!flushing && ring_count(&ring) >= SPOOL_BATCH_SIZE)
+        spool_flush_start();
+
+    return true;
+}
+
+static bool spool_start(void) {
+    static const struct {
+        const char *prefix;
+        spool_sink_t sink;
+    } sinks[] = {
+        {"file:", SPOOL_SINK_FILE},
+        {"pipe:", SPOOL_SINK_PIPE},
+        {"tcp:", SPOOL_SINK_TCP},
+    };
+
+    const char *conf_sink = conf_getString("serial", "sink_b");
+    if (conf_sink == NULL || strcmp(conf_sink, "none") == 0)
+        return true;
+
+    for (size_t i = 0; i < ARRAY_SIZE(sinks); ++i) {
+        const size_t len = strlen(sinks[i].prefix);
+        if (strncmp(conf_sink, sinks[i].prefix, len) == 0) {
+            sink = sinks[i].sink;
+            snprintf(target, sizeof(target), "%s", conf_sink + len);
+            break;
+        }
+    }
+
+    char *colon = strrchr(target, ':');
+    if (sink == SPOOL_SINK_TCP && colon != NULL) {
+        *colon = '\0';
+        port = colon + 1;
+    }
+
+    if (sink == SPOOL_SINK_NONE || target[0] == '\0' ||
+        (sink == SPOOL_SINK_TCP && port == NULL)) {
+        LOG_ERR("spool: invalid sink_b: %s\n", conf_sink);
+        return false;
+    }
+
+    const uint32_t *conf_rotate = conf_getU32("serial", "sink_rotate");
+    if (conf_rotate != NULL)
+        rotate_size = *conf_rotate;
+
+    if (!ring_init(&ring, SPOOL_BUFFER_SIZE)) {
+        LOG_ERR("spool: unable to allocate buffer\n");
+        return false;
+    }
+
+    // a command which has quit must not kill the emulator
+    if (sink == SPOOL_SINK_PIPE)
+        (void)signal(SIGPIPE, SIG_IGN);
+
+    // errors are reported early, but the sink could be available later
+    (void)spool_open();
+
+    sio2_attachPeripheral(SIO_CHANNEL_B, keyboard_getChar, spool_putChar);
+
+    return true;
+}
+
+static void spool_poll(void) {
+    if (sink_fd == -1)
+        spool_reap();
+
+    if (flushing || ring_count(&ring) == 0)
+        return;
+
+    if (time_now_us() - first_queued >= SPOOL_FLUSH_DELAY)
+        spool_flush_start();
+}
+
+static us_interval_t spool_remaining(void) {
+    // a closed command is checked periodically, until it quits
+    const us_interval_t reap = (sink_fd == -1 && child != -1)
+                                   ? SPOOL_REOPEN_DELAY
+                                   : LONG_MAX;
+
+    if (flushing || ring_count(&ring) == 0)
+        return reap;
+
+    us_time_t deadline = first_queued + SPOOL_FLUSH_DELAY;
+    if (sink_fd == -1)
+        deadline = MAX(deadline, next_open);
+
+    return MIN(deadline - time_now_us(), reap);
+}
+
+static void spool_cleanup(void) {
+    if (sink == SPOOL_SINK_NONE)
+        return;
+
+    spool_drain();
+    spool_close();
+    ring_cleanup(&ring);
+}
+
+void spool_init(CEDAModule *mod) {
+    memset(mod, 0, sizeof(*mod));
+    mod->init = spool_init;
+    mod->start = spool_start;
+    mod->poll = spool_poll;
+    mod->remaining = spool_remaining;
+    mod->cleanup = spool_cleanup;
+}
+
+#ifdef CEDA_TEST
+
+#include <criterion/criterion.h>
+
+#include <stdlib.h>
+
+static size_t spool_test_file_size(const char *path) {
+    struct stat st;
+    cr_assert_eq(stat(path, &st), 0);
+    return (size_t)st.st_size;
+}
+
+Test(spool, fileRotation) {
+    char dir[] = "/tmp/ceda-spool-XXXXXX";
+    cr_assert_not_null(mkdtemp(dir));
+    char rotated[PATH_MAX + 16];
+    snprintf(target, sizeof(target), "%s/printer.txt", dir);
+    snprintf(rotated, sizeof(rotated), "%s.1", target);
+
+    sink = SPOOL_SINK_FILE;
+    rotate_size = 10;
+    cr_assert(ring_init(&ring, SPOOL_BUFFER_SIZE));
+    cr_assert(spool_open());
+
+    // just queued, until a batch is complete or too old
+    for (int i = 0; i < 12; ++i)
+        cr_assert(spool_putChar('a'));
+    cr_assert_eq(spool_test_file_size(target), 0);
+    cr_assert_gt(spool_remaining(), 0);
+    cr_assert_leq(spool_remaining(), SPOOL_FLUSH_DELAY);
+
+    // too big, rotated once written
+    spool_drain();
+    cr_assert_eq(spool_test_file_size(target), 0);
+    cr_assert_eq(spool_test_file_size(rotated), 12);
+
+    for (int i = 0; i < 5; ++i)
+        cr_assert(spool_putChar('b'));
+    spool_cleanup();
+    cr_assert_eq(spool_test_file_size(target), 5);
+    cr_assert_eq(spool_test_file_size(rotated), 12);
+
+    unlink(target);
+    unlink(rotated);
+    rmdir(dir);
+}
+
+Test(spool, drainStalled) {
+    // command which never reads its input
+    snprintf(target, sizeof(target), "sleep 2");
+    sink = SPOOL_SINK_PIPE;
+    cr_assert(ring_init(&ring, SPOOL_BUFFER_SIZE));
+    cr_assert(spool_open());
+
+    // more than a pipe can hold
+    static uint8_t data[SPOOL_BUFFER_SIZE];
+    cr_assert_eq(ring_push(&ring, data, sizeof(data)), sizeof(data));
+
+    // gives up at the deadline
+    const us_time_t begin = time_now_us();
+    spool_drain();
+    const us_time_t elapsed = time_now_us() - begin;
+    cr_assert_geq(elapsed, SPOOL_DRAIN_WAIT);
+    cr_assert_lt(elapsed, SPOOL_DRAIN_WAIT + 500L * 1000L);
+    cr_assert_neq(ring_count(&ring), 0);
+
+    spool_close();
+    ring_cleanup(&ring);
+}
+
+Test(spool, pipeReap) {
+    // command which does not quit at the end of its input
+    snprintf(target, sizeof(target), "sleep 1");
+    sink = SPOOL_SINK_PIPE;
+    cr_assert(spool_open());
+
+    // closing does not wait for the command
+    const us_time_t begin = time_now_us();
+    spool_close();
+    cr_assert_lt(time_now_us() - begin, 500L * 1000L);
+    cr_assert_neq(child, -1);
+    cr_assert_eq(spool_remaining(), SPOOL_REOPEN_DELAY);
+
+    // not started again while running
+    next_open = 0;
+    cr_assert_not(spool_open());
+
+    for (int i = 0; i < 500 && child != -1; ++i) {
+        usleep(10 * 1000);
+        spool_poll();
+    }
+    cr_assert_eq(child, -1);
+    cr_assert_eq(spool_remaining(), LONG_MAX);
+}
+
+#endif
@@ -0,0 +1,15 @@
+#ifndef CEDA_SPOOL_H
+#define CEDA_SPOOL_H
+
+#include "module.h"
+
+/*
+ * Spool of the data transmitted on SIO/2 channel B (eg. printer output).
+ * Data is buffered, and written in large batches to a file, to the standard
+ * input of a host command, or to a tcp server, as configured by
+ * `[serial] sink_b`.
+ */
+
+void spool_init(CEDAModule *mod);
+
+#endif // CEDA_SPOOL_H
@@ -0,0 +1,242 @@
+#include "bench_fdc.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../fdc.h"
+#include "../fdc_registers.h"
+
+/*
+ * FDC benchmark.
+ * A disk with CEDA geometry is kept in memory, then it is formatted, written
+ * and read track by track, driving the FDC as the BIOS does: command and
+ * result bytes are transferred when RQM is set, execution data when INT is
+ * raised. Only the execution phase is timed, since it is the hot path.
+ */
+
+#define BENCH_TRACKS      (80U)
+#define BENCH_HEADS       (2U)
+#define BENCH_SECTORS     (5U)
+#define BENCH_SECTOR_SIZE (1024U)
+#define BENCH_N           (3U) // sector size factor, 128 << N bytes
+#define BENCH_TRACK_SIZE  (BENCH_SECTORS * BENCH_SECTOR_SIZE)
+
+static uint8_t image[BENCH_TRACKS][BENCH_HEADS][BENCH_SECTORS]
+                    [BENCH_SECTOR_SIZE];
+static uint8_t track_buffer[BENCH_TRACK_SIZE];
+
+typedef struct bench_result_t {
+    const char *name;
+    unsigned long int sectors;
+    unsigned long int bytes;
+    unsigned long int ns; // [ns] spent in execution phase
+} bench_result_t;
+
+static int bench_read(uint8_t *buffer, uint8_t unit_number, bool phy_head,
+                      uint8_t phy_track, bool head, uint8_t track,
+                      uint8_t sector) {
+    (void)unit_number;
+    (void)head;
+    (void)track;
+
+    if (phy_track >= BENCH_TRACKS || sector >= BENCH_SECTORS)
+        return DISK_IMAGE_INVALID_GEOMETRY;
+
+    if (buffer != NULL)
+        memcpy(buffer, image[phy_track][phy_head][sector], BENCH_SECTOR_SIZE);
+
+    return BENCH_SECTOR_SIZE;
+}
+
+static int bench_write(uint8_t *buffer, uint8_t unit_number, bool phy_head,
+                       uint8_t phy_track, bool head, uint8_t track,
+                       uint8_t sector) {
+    (void)unit_number;
+    (void)head;
+    (void)track;
+
+    if (phy_track >= BENCH_TRACKS || sector >= BENCH_SECTORS)
+        return DISK_IMAGE_INVALID_GEOMETRY;
+
+    if (buffer != NULL)
+        memcpy(image[phy_track][phy_head][sector], buffer, BENCH_SECTOR_SIZE);
+
+    return BENCH_SECTOR_SIZE;
+}
+
+static unsigned long int bench_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long int)ts.tv_sec * 1000000000UL +
+           (unsigned long int)ts.tv_nsec;
+}
+
+static void bench_wait_rqm(void) {
+    while ((fdc_in(FDC_ADDR_STATUS_REGISTER) & FDC_ST_RQM) == 0)
+        ;
+}
+
+static void bench_wait_int(void) {
+    while (!fdc_getIntStatus())
+        ;
+}
+
+static void bench_command(const uint8_t *command, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        bench_wait_rqm();
+        fdc_out(FDC_ADDR_DATA_REGISTER, command[i]);
+    }
+}
+
+/**
+ * @brief Read the result phase
+ *
+ * @return ST0
+ */
+static uint8_t bench_result(size_t size) {
+    uint8_t st0 = 0;
+    for (size_t i = 0; i < size; ++i) {
+        bench_wait_rqm();
+        const uint8_t value = fdc_in(FDC_ADDR_DATA_REGISTER);
+        if (i == 0)
+            st0 = value;
+    }
+    return st0;
+}
+
+static bool bench_seek(uint8_t cylinder) {
+    const uint8_t seek[] = {FDC_SEEK, 0, cylinder};
+    const uint8_t sense[] = {FDC_SENSE_INTERRUPT};
+
+    bench_command(seek, sizeof(seek));
+    bench_wait_int();
+    bench_command(sense, sizeof(sense));
+    const uint8_t st0 = bench_result(2);
+
+    return (st0 & (FDC_ST0_IC | FDC_ST0_SE)) == FDC_ST0_SE;
+}
+
+static bool bench_format(uint8_t cylinder, uint8_t head,
+                         bench_result_t *result) {
+    const uint8_t command[] = {
+        FDC_FORMAT_TRACK | FDC_CMD_ARGS_MF_bm,
+        (uint8_t)(head << 2),
+        BENCH_N,
+        BENCH_SECTORS,
+        0x35, // GPL
+        0xE5, // filler byte
+    };
+
+    bench_command(command, sizeof(command));
+
+    const unsigned long int start = bench_now_ns();
+    for (uint8_t sector = 1; sector <= BENCH_SECTORS; ++sector) {
+        const uint8_t id_field[] = {cylinder, head, sector, BENCH_N};
+        bench_command(id_field, sizeof(id_field));
+    }
+    fdc_tc_out(0, 0);
+    result->ns += bench_now_ns() - start;
+
+    result->sectors += BENCH_SECTORS;
+    result->bytes += BENCH_TRACK_SIZE;
+
+    return (bench_result(7) & FDC_ST0_IC) == 0;
+}
+
+static bool bench_transfer(uint8_t cylinder, uint8_t head, bool write,
+                           bench_result_t *result) {
+    const uint8_t command[] = {
+        (write ? FDC_WRITE_DATA : FDC_READ_DATA) | FDC_CMD_ARGS_MF_bm,
+        (uint8_t)(head << 2),
+        cylinder,
+        head,
+        1, // first record
+        BENCH_N,
+        BENCH_SECTORS, // EOT
+        0x35,          // GPL
+        0xFF,          // DTL
+    };
+
+    bench_command(command, sizeof(command));
+
+    const unsigned long int start = bench_now_ns();
+    for (size_t i = 0; i < BENCH_TRACK_SIZE; ++i) {
+        bench_wait_int();
+        if (write)
+            fdc_out(FDC_ADDR_DATA_REGISTER, track_buffer[i]);
+        else
+            track_buffer[i] = fdc_in(FDC_ADDR_DATA_REGISTER);
+    }
+    fdc_tc_out(0, 0);
+    result->ns += bench_now_ns() - start;
+
+    result->sectors += BENCH_SECTORS;
+    result->bytes += BENCH_TRACK_SIZE;
+
+    return (bench_result(7) & FDC_ST0_IC) == 0;
+}
+
+static void bench_fill(uint8_t cylinder, uint8_t head, unsigned int pass) {
+    for (size_t i = 0; i < BENCH_TRACK_SIZE; ++i)
+        track_buffer[i] = (uint8_t)(i ^ cylinder ^ (head << 7) ^ pass);
+}
+
+static bool bench_check(uint8_t cylinder, uint8_t head, unsigned int pass) {
+    for (size_t i = 0; i < BENCH_TRACK_SIZE; ++i) {
+        if (track_buffer[i] != (uint8_t)(i ^ cylinder ^ (head << 7) ^ pass))
+            return false;
+    }
+    return true;
+}
+
+static void bench_print(const bench_result_t *result) {
+    const double seconds = (double)result->ns / 1e9;
+    printf("%-12s %8lu sectors %10.1f sectors/s %8.2f ns/byte\n", result->name,
+           result->sectors, (double)result->sectors / seconds,
+           (double)result->ns / (double)result->bytes);
+}
+
+int bench_fdc(int argc, char *argv[]) {
+    unsigned int passes = 20;
+    if (argc > 1)
+        passes = (unsigned int)strtoul(argv[1], NULL, 0);
+
+    bench_result_t format = {.name = "format track"};
+    bench_result_t write = {.name = "write data"};
+    bench_result_t read = {.name = "read data"};
+
+    fdc_init();
+    fdc_kickDiskImage(bench_read, bench_write);
+
+    for (unsigned int pass = 0; pass < passes; ++pass) {
+        for (uint8_t cylinder = 0; cylinder < BENCH_TRACKS; ++cylinder) {
+            if (!bench_seek(cylinder)) {
+                fprintf(stderr, "seek failed on track %u\n", cylinder);
+                return 1;
+            }
+            for (uint8_t head = 0; head < BENCH_HEADS; ++head) {
+                bench_fill(cylinder, head, pass);
+                if (!bench_format(cylinder, head, &format) ||
+                    !bench_transfer(cylinder, head, true, &write) ||
+                    !bench_transfer(cylinder, head, false, &read)) {
+                    fprintf(stderr, "transfer failed on track %u, head %u\n",
+                            cylinder, head);
+                    return 1;
+                }
+                if (!bench_check(cylinder, head, pass)) {
+                    fprintf(stderr, "data mismatch on track %u, head %u\n",
+                            cylinder, head);
+                    return 1;
+                }
+            }
+        }
+    }
+
+    bench_print(&format);
+    bench_print(&write);
+    bench_print(&read);
+
+    return 0;
+}
@@ -0,0 +1,16 @@
+#ifndef CEDA_BENCH_FDC_H
+#define CEDA_BENCH_FDC_H
+
+/**
+ * @brief Run the FDC benchmark, and print its results.
+ *
+ * Expected command line syntax:
+ *  ceda-bench [passes]
+ * where
+ *  passes: how many times the whole disk is formatted, written and read
+ *
+ * @return exit status
+ */
+int bench_fdc(int argc, char *argv[]);
+
+#endif // CEDA_BENCH_FDC_H
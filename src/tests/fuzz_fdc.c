@@ -0,0 +1,136 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "../fdc.h"
+#include "../fdc_registers.h"
+
+/*
+ * FDC fuzz target, for libFuzzer.
+ * The input is a stream of bus operations, the low 3 bits of each byte
+ * selecting the operation, and the other ones its argument (if any), so that
+ * any byte stream is a valid input. Guest software must not be able to crash
+ * the emulator, whatever it sends to the FDC.
+ */
+
+enum {
+    FUZZ_OUT,         // write next byte in data register
+    FUZZ_OUT_COMMAND, // write command with argument bits in data register
+    FUZZ_IN,          // read data register
+    FUZZ_STATUS,      // read main status register
+    FUZZ_TC,          // terminal count
+    FUZZ_INT,         // poll interrupt line
+    FUZZ_MEDIUM,      // change medium behavior
+    FUZZ_IO_COMPLETE, // notify that pending reads may be complete
+};
+
+// How the fake medium behaves
+enum {
+    FUZZ_MEDIUM_OK,
+    FUZZ_MEDIUM_ERROR,
+    FUZZ_MEDIUM_PENDING,
+    FUZZ_MEDIUM_NONE,
+};
+
+static uint8_t medium = FUZZ_MEDIUM_OK;
+static bool pending = false;
+static uint8_t sector_data[FDC_SECTOR_BUFFER_SIZE];
+
+static int fuzz_sector_size(uint8_t sector) {
+    // a different size for each sector, up to the maximum one
+    return 128 << (sector % 4);
+}
+
+static int fuzz_read(uint8_t *buffer, uint8_t unit_number, bool phy_head,
+                     uint8_t phy_track, bool head, uint8_t track,
+                     uint8_t sector) {
+    (void)unit_number;
+    (void)phy_head;
+    (void)head;
+
+    if (medium == FUZZ_MEDIUM_ERROR || phy_track != track)
+        return DISK_IMAGE_INVALID_GEOMETRY;
+
+    // data is fetched every other call, as the floppy worker thread would do
+    if (medium == FUZZ_MEDIUM_PENDING) {
+        pending = !pending;
+        if (pending)
+            return DISK_IMAGE_PENDING;
+    }
+
+    const int size = fuzz_sector_size(sector);
+    if (buffer != NULL)
+        memcpy(buffer, sector_data, (size_t)size);
+
+    return size;
+}
+
+static int fuzz_write(uint8_t *buffer, uint8_t unit_number, bool phy_head,
+                      uint8_t phy_track, bool head, uint8_t track,
+                      uint8_t sector) {
+    (void)unit_number;
+    (void)phy_head;
+    (void)head;
+
+    if (medium == FUZZ_MEDIUM_ERROR || phy_track != track)
+        return DISK_IMAGE_INVALID_GEOMETRY;
+
+    const int size = fuzz_sector_size(sector);
+    if (buffer != NULL)
+        memcpy(sector_data, buffer, (size_t)size);
+
+    return size;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    medium = FUZZ_MEDIUM_OK;
+    pending = false;
+
+    fdc_init();
+    fdc_kickDiskImage(fuzz_read, fuzz_write);
+
+    for (size_t i = 0; i < size; ++i) {
+        const uint8_t operation = data[i] & 0x07;
+        const uint8_t argument = data[i] >> 3;
+
+        switch (operation) {
+        case FUZZ_OUT:
+            if (++i < size)
+                fdc_out(FDC_ADDR_DATA_REGISTER, data[i]);
+            break;
+        case FUZZ_OUT_COMMAND:
+            // commands are sparse in the byte space, help reaching them
+            fdc_out(FDC_ADDR_DATA_REGISTER,
+                    (uint8_t)((argument & 0x0F) | ((argument & 0x10) << 3) |
+                              FDC_CMD_ARGS_MF_bm));
+            break;
+        case FUZZ_IN:
+            (void)fdc_in(FDC_ADDR_DATA_REGISTER);
+            break;
+        case FUZZ_STATUS:
+            (void)fdc_in(FDC_ADDR_STATUS_REGISTER);
+            break;
+        case FUZZ_TC:
+            fdc_tc_out(0, 0);
+            break;
+        case FUZZ_INT:
+            (void)fdc_getIntStatus();
+            break;
+        case FUZZ_MEDIUM:
+            medium = argument & 0x03;
+            pending = false;
+            if (medium == FUZZ_MEDIUM_NONE)
+                fdc_kickDiskImage(NULL, NULL);
+            else
+                fdc_kickDiskImage(fuzz_read, fuzz_write);
+            break;
+        case FUZZ_IO_COMPLETE:
+            fdc_ioComplete();
+            break;
+        }
+    }
+
+    return 0;
+}
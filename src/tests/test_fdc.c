@@ -2,6 +2,7 @@
 #include <criterion/criterion.h>
 #include <criterion/parameterized.h>
 #include <stdio.h>
+#include <string.h>
 
 // TODO(giuliof) source path is src!
 #include "../fdc.h"
@@ -144,6 +145,24 @@ Test(ceda_fdc, seekCommand) {
     cr_assert_eq(fdc_getIntStatus(), false);
 }
 
+/**
+ * @brief Reading data while no command is running must not restart the last
+ * one
+ */
+Test(ceda_fdc, readInCommandPhase) {
+    fdc_init();
+
+    // Sense interrupt is invalid, since no seek is running
+    fdc_out(FDC_ADDR_DATA_REGISTER, FDC_SENSE_INTERRUPT);
+    cr_expect_eq(fdc_in(FDC_ADDR_DATA_REGISTER), 0x80);
+    assert_fdc_sr(FDC_ST_RQM);
+
+    fdc_in(FDC_ADDR_DATA_REGISTER);
+
+    // FDC is still in idle state
+    assert_fdc_sr(FDC_ST_RQM);
+}
+
 /* Invalid Seek Sequence
  * From the manual: "a Sense Interrupt Status command must be sent after a Seek
  * or Recalibrate Interrupt, otherwise the FDC will consider the next command to
@@ -240,6 +259,70 @@ Test(ceda_fdc, readCommandNoMedium) {
     cr_assert_eq(fdc_getIntStatus(), true);
 }
 
+// Sector data is available only once fake_data_ready is set
+static bool fake_data_ready = false;
+
+// NOLINTNEXTLINE
+static int fake_read_pending(uint8_t *buffer, uint8_t unit_number,
+                             bool phy_head, uint8_t phy_track, bool head,
+                             uint8_t track, uint8_t sector) {
+    (void)buffer;
+    (void)unit_number;
+    (void)phy_head;
+    (void)phy_track;
+    (void)head;
+    (void)track;
+    (void)sector;
+
+    if (!fake_data_ready)
+        return DISK_IMAGE_PENDING;
+
+    return 4;
+}
+
+Test(ceda_fdc, readCommandPending) {
+    uint8_t arguments[8] = {
+        0, // drive number
+        1, // cylinder
+        0, // head
+        1, // record
+        0, // N - bytes per sector size factor
+        5, // EOT (end of track)
+        0, // GPL (ignored)
+        4, // DTL
+    };
+
+    fdc_init();
+
+    fake_data_ready = false;
+    fdc_kickDiskImage(fake_read_pending, NULL);
+
+    fdc_out(FDC_ADDR_DATA_REGISTER, FDC_READ_DATA);
+    sendBuffer(arguments, sizeof(arguments));
+
+    // Data is being fetched, FDC is not ready
+    cr_assert_eq(fdc_getIntStatus(), false);
+    assert_fdc_sr(FDC_ST_DIO | FDC_ST_EXM | FDC_ST_CB);
+
+    // Completion raises the interrupt
+    fake_data_ready = true;
+    fdc_ioComplete();
+    cr_assert_eq(fdc_getIntStatus(), true);
+    assert_fdc_sr(FDC_ST_RQM | FDC_ST_DIO | FDC_ST_EXM | FDC_ST_CB);
+
+    // Next sector is not available: FDC waits after the last byte
+    fake_data_ready = false;
+    for (size_t i = 0; i < 4; i++)
+        fdc_in(FDC_ADDR_DATA_REGISTER);
+    cr_assert_eq(fdc_getIntStatus(), false);
+    assert_fdc_sr(FDC_ST_DIO | FDC_ST_EXM | FDC_ST_CB);
+
+    fake_data_ready = true;
+    fdc_ioComplete();
+    cr_assert_eq(fdc_getIntStatus(), true);
+    assert_fdc_sr(FDC_ST_RQM | FDC_ST_DIO | FDC_ST_EXM | FDC_ST_CB);
+}
+
 /*
  * Note: the ST1/ST2 reported during errors are fixed to 0x20 0x20, for every
  * error that the callbacks may raise. This would change if errors handling is
@@ -353,6 +436,74 @@ Test(ceda_fdc, readCommandOverEot) {
     assert_fdc_sr(FDC_ST_RQM);
 }
 
+Test(ceda_fdc, readCommandSectorZero) {
+    const uint8_t arguments[8] = {
+        0, // drive number
+        0, // cylinder
+        0, // head
+        0, // record, sectors are counted from 1
+        0, // N - bytes per sector size factor
+        6, // EOT (end of track)
+        0, // GPL (ignored)
+        4, // DTL
+    };
+
+    uint8_t result[7];
+
+    fdc_init();
+
+    // Link a fake reading function
+    fdc_kickDiskImage(fake_read, NULL);
+
+    fdc_out(FDC_ADDR_DATA_REGISTER, FDC_READ_DATA);
+    sendBuffer(arguments, sizeof(arguments));
+
+    // Sector is not found, FDC is NOT in execution mode
+    assert_fdc_sr(FDC_ST_RQM | FDC_ST_DIO | FDC_ST_CB);
+
+    receiveBuffer(result, sizeof(result));
+
+    cr_assert_eq(result[0] & FDC_ST0_IC, 0x40);
+    cr_assert_eq(result[1] & FDC_ST1_ND, FDC_ST1_ND);
+
+    // Execution is finished
+    assert_fdc_sr(FDC_ST_RQM);
+}
+
+Test(ceda_fdc, writeCommandSectorZero) {
+    const uint8_t arguments[8] = {
+        0, // drive number
+        0, // cylinder
+        0, // head
+        0, // record, sectors are counted from 1
+        0, // N - bytes per sector size factor
+        6, // EOT (end of track)
+        0, // GPL (ignored)
+        4, // DTL
+    };
+
+    uint8_t result[7];
+
+    fdc_init();
+
+    // Link a fake writing function
+    fdc_kickDiskImage(NULL, fake_write);
+
+    fdc_out(FDC_ADDR_DATA_REGISTER, FDC_WRITE_DATA);
+    sendBuffer(arguments, sizeof(arguments));
+
+    // Sector is not found, FDC is NOT in execution mode
+    assert_fdc_sr(FDC_ST_RQM | FDC_ST_DIO | FDC_ST_CB);
+
+    receiveBuffer(result, sizeof(result));
+
+    cr_assert_eq(result[0] & FDC_ST0_IC, 0x40);
+    cr_assert_eq(result[1] & FDC_ST1_ND, FDC_ST1_ND);
+
+    // Execution is finished
+    assert_fdc_sr(FDC_ST_RQM);
+}
+
 /**
  * @brief This section covers the cases described in table 2-2 of xxxxxxx
  * datasheet.
@@ -782,6 +933,116 @@ Test(ceda_fdc, formatCommand) {
     assert_fdc_sr(FDC_ST_RQM);
 }
 
+static size_t formatted_count = 0;
+
+// NOLINTNEXTLINE
+static int fake_write_count(uint8_t *buffer, uint8_t unit_number,
+                            bool phy_head, uint8_t phy_track, bool head,
+                            uint8_t track, uint8_t sector) {
+    static const uint8_t expected_sectors[] = {0, 1};
+
+    (void)unit_number;
+    (void)phy_head;
+    (void)phy_track;
+    (void)head;
+    (void)track;
+
+    // Only sectors in the ID fields are formatted, in order
+    if (buffer != NULL) {
+        cr_assert_lt(formatted_count, sizeof(expected_sectors));
+        cr_assert_eq(sector, expected_sectors[formatted_count++]);
+    }
+
+    return 4;
+}
+
+/**
+ * @brief Bytes sent after all the ID fields are ignored
+ */
+Test(ceda_fdc, formatCommandExtraBytes) {
+    const uint8_t arguments[] = {
+        0x01 | FDC_ST0_HD,
+        0x01,
+        0x02, // two sectors per track
+        0x00, // gap (we don't care)
+        0x35, // fill byte
+    };
+
+    const uint8_t id_fields[] = {
+        0x00, 0x01, 0x01, 0x01, // first sector
+        0x00, 0x01, 0x02, 0x01, // second sector
+    };
+
+    uint8_t result[7];
+
+    fdc_init();
+
+    fdc_kickDiskImage(NULL, fake_write_count);
+
+    fdc_out(FDC_ADDR_DATA_REGISTER, FDC_FORMAT_TRACK);
+    sendBuffer(arguments, sizeof(arguments));
+    for (size_t i = 0; i < sizeof(id_fields); ++i)
+        fdc_out(FDC_ADDR_DATA_REGISTER, id_fields[i]);
+
+    // Far more than the execution buffer can hold
+    for (size_t i = 0; i < 4 * FDC_SECTOR_BUFFER_SIZE; ++i)
+        fdc_out(FDC_ADDR_DATA_REGISTER, 0xff);
+
+    fdc_tc_out(0, 0);
+
+    receiveBuffer(result, sizeof(result));
+
+    cr_assert_eq(result[0], 0x01 | FDC_ST0_HD);
+    cr_assert_eq(result[1], 0);
+    cr_assert_eq(result[2], 0);
+    cr_assert_eq(formatted_count, 2);
+
+    // Execution is finished
+    assert_fdc_sr(FDC_ST_RQM);
+}
+
+/**
+ * @brief Removing the medium during execution ends the command with an error
+ */
+Test(ceda_fdc, formatCommandNoMedium) {
+    const uint8_t arguments[] = {
+        0x01 | FDC_ST0_HD,
+        0x01,
+        0x01, // one sector per track
+        0x00, // gap (we don't care)
+        0x35, // fill byte
+    };
+
+    uint8_t result[7];
+
+    fdc_init();
+
+    fdc_kickDiskImage(NULL, fake_write);
+
+    fdc_out(FDC_ADDR_DATA_REGISTER, FDC_FORMAT_TRACK);
+    sendBuffer(arguments, sizeof(arguments));
+
+    // FDC is in execution mode
+    assert_fdc_sr(FDC_ST_RQM | FDC_ST_EXM | FDC_ST_CB);
+
+    fdc_out(FDC_ADDR_DATA_REGISTER, 0x00);
+    fdc_out(FDC_ADDR_DATA_REGISTER, 0x01);
+    fdc_out(FDC_ADDR_DATA_REGISTER, 0x01);
+    fdc_out(FDC_ADDR_DATA_REGISTER, 0x01);
+
+    // Medium is removed
+    fdc_kickDiskImage(NULL, NULL);
+
+    fdc_tc_out(0, 0);
+
+    receiveBuffer(result, sizeof(result));
+
+    cr_assert_eq(result[0] & FDC_ST0_IC, 0x40);
+
+    // Execution is finished
+    assert_fdc_sr(FDC_ST_RQM);
+}
+
 Test(ceda_fdc, formatCommandInvalidParams) {
     uint8_t arguments[] = {
         0x03 | FDC_ST0_HD, // drive number
@@ -858,3 +1119,60 @@ Test(ceda_fdc, invalidCommand) {
     // FDC is in idle state
     assert_fdc_sr(FDC_ST_RQM);
 }
+
+/**
+ * @brief Commands and sector accesses are accounted in FDC statistics
+ */
+Test(ceda_fdc, statistics) {
+    const uint8_t arguments[8] = {
+        0, // drive number
+        0, // cylinder
+        0, // head
+        6, // record
+        0, // N - bytes per sector size factor
+        6, // EOT (end of track)
+        0, // GPL (ignored)
+        4, // DTL
+    };
+
+    uint8_t result[7];
+
+    fdc_init();
+    fdc_kickDiskImage(fake_read_check_track, NULL);
+
+    fdc_out(FDC_ADDR_DATA_REGISTER, FDC_READ_DATA);
+    sendBuffer(arguments, sizeof(arguments));
+
+    // Read sector 6, then try to read beyond EOT
+    for (int i = 0; i < 5; i++)
+        fdc_in(FDC_ADDR_DATA_REGISTER);
+
+    receiveBuffer(result, sizeof(result));
+
+    // Force an invalid command
+    fdc_out(FDC_ADDR_DATA_REGISTER, 0x00);
+    fdc_in(FDC_ADDR_DATA_REGISTER);
+
+    const fdc_stats_t *stats = fdc_getStats();
+    const fdc_cmd_stats_t *read = NULL;
+    for (size_t i = 0; i < FDC_STATS_COMMANDS; i++) {
+        if (strcmp(stats->commands[i].name, "read data") == 0)
+            read = &stats->commands[i];
+    }
+    cr_assert_not_null(read);
+    cr_expect_eq(read->count, 1);
+    cr_expect_eq(read->bytes, 4);
+
+    cr_expect_eq(stats->commands[FDC_STATS_COMMANDS - 1].count, 1);
+    cr_expect_eq(stats->commands[FDC_STATS_COMMANDS - 1].bytes, 0);
+
+    // Sectors are counted from 0
+    cr_expect_eq(stats->heat[0][0][0][5].reads, 1);
+    cr_expect_eq(stats->heat[0][0][0][5].writes, 0);
+    cr_expect_eq(stats->heat[0][0][0][6].reads, 0);
+
+    fdc_resetStats();
+    cr_expect_eq(read->count, 0);
+    cr_expect_eq(stats->heat[0][0][0][5].reads, 0);
+    cr_assert_str_eq(read->name, "read data");
+}
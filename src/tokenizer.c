@@ -104,6 +104,55 @@ const char *tokenizer_next_int(unsigned int *dst, const char *src) {
     return src;
 }
 
+/**
+ * @brief Extract a double-quoted string from a null-terminated C string.
+ *
+ * The string may contain spaces, and double quotes can be escaped as \".
+ * Any other backslash sequence is copied verbatim, so that the caller can
+ * apply its own escaping rules (eg. regular expressions).
+ * If the string does not begin with a double quote, this behaves exactly like
+ * tokenizer_next_word().
+ *
+ * @param word Pointer to destination null-terminated string.
+ * @param src Pointer to input string to inspect.
+ * @param size Size of destination word buffer.
+ *
+ * @return const char* Pointer to first char after the closing quote in the
+ * input string. NULL if there are no more words, or if the closing quote is
+ * missing.
+ */
+const char *tokenizer_next_quoted(char *word, const char *src, size_t size) {
+    assert(src);
+
+    // skip leading spaces
+    while (*src == ' ')
+        ++src;
+
+    if (*src != '"')
+        return tokenizer_next_word(word, src, size);
+
+    size_t idx = 1; // skip opening quote
+    size_t len = 0;
+    for (;; ++idx) {
+        // missing closing quote
+        if (src[idx] == '\0')
+            return NULL;
+
+        if (src[idx] == '"')
+            break;
+
+        // unescape only the double quote
+        if (src[idx] == '\\' && src[idx + 1] == '"')
+            ++idx;
+
+        if (len < size - 1)
+            word[len++] = src[idx];
+    }
+
+    word[len] = '\0';
+    return src + idx + 1;
+}
+
 #if defined(CEDA_TEST)
 
 #include <criterion/criterion.h>
@@ -157,4 +206,22 @@ Test(tokenizer, next_int) {
     cr_assert_eq(prompt, NULL);
 }
 
-#endif
\ No newline at end of file
+Test(tokenizer, next_quoted) {
+    const char *prompt = "expect  \"A> \\\"x\\\" \\.\" 10 \"open";
+
+    char word[LINE_BUFFER_SIZE];
+    prompt = tokenizer_next_quoted(word, prompt, LINE_BUFFER_SIZE);
+    cr_assert_str_eq(word, "expect");
+
+    prompt = tokenizer_next_quoted(word, prompt, LINE_BUFFER_SIZE);
+    cr_assert_str_eq(word, "A> \"x\" \\.");
+
+    prompt = tokenizer_next_quoted(word, prompt, LINE_BUFFER_SIZE);
+    cr_assert_str_eq(word, "10");
+
+    // missing closing quote
+    prompt = tokenizer_next_quoted(word, prompt, LINE_BUFFER_SIZE);
+    cr_assert_eq(prompt, NULL);
+}
+
+#endif
@@ -6,5 +6,6 @@
 const char *tokenizer_next_word(char *word, const char *src, size_t size);
 const char *tokenizer_next_hex(unsigned int *dst, const char *src);
 const char *tokenizer_next_int(unsigned int *dst, const char *src);
+const char *tokenizer_next_quoted(char *word, const char *src, size_t size);
 
 #endif // CEDA_TOKENIZER_H
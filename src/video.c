@@ -1,9 +1,13 @@
 #include "video.h"
 
+#include "ansi.h"
 #include "conf.h"
+#include "cpu.h"
 #include "crtc.h"
+#include "fbshm.h"
 #include "gui.h"
 #include "macro.h"
+#include "record.h"
 #include "time.h"
 #include "units.h"
 
@@ -11,6 +15,7 @@
 #include <assert.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/time.h>
 
 #define LOG_LEVEL LOG_LVL_INFO
@@ -18,11 +23,6 @@
 
 #define VIDEO_CHAR_MEM_SIZE 0x800
 #define VIDEO_ATTR_MEM_SIZE VIDEO_CHAR_MEM_SIZE
-#define VIDEO_COLUMNS       80
-#define VIDEO_ROWS          25
-
-#define CRT_PIXEL_WIDTH  640
-#define CRT_PIXEL_HEIGHT 400
 
 #define CHAR_ROM_PATH "rom/CGV7.2_ROM.bin"
 #define CHAR_ROM_SIZE (ceda_size_t)(4 * KiB)
@@ -39,6 +39,11 @@ static zuint8 char_rom[CHAR_ROM_SIZE];
 static zuint8 cge_rom[CGE_ROM_SIZE];
 static bool cge_installed = false;
 
+// rendered frame, 1 bpp, VIDEO_COLUMNS bytes per line
+static zuint8 framebuffer[VIDEO_FRAME_SIZE];
+
+static bool ansi = false; // output to terminal
+
 static SDL_Window *window = NULL;
 static SDL_Surface *surface = NULL;
 static SDL_Renderer *renderer = NULL;
@@ -47,9 +52,13 @@ static bool started = false;
 static float perf_value = 0;
 static const char *perf_unit = "fps";
 
-static unsigned long int fields = 0; // displayed video fields
+static unsigned long int fields = 0; // emulated video fields
 
-static bool frame_sync = false; // set to true for each new frame
+static bool frame_sync = false;           // set to true for each new frame
+static unsigned long int field_start = 0; // [cycles] current field beginning
+static bool vsync_done = false;           // current field already had vsync
+
+static video_text_observer_t text_observer = NULL;
 
 static bool video_load_roms(void) {
     // load character generator rom
@@ -120,15 +129,35 @@ static bool video_load_roms(void) {
 }
 
 static bool video_start(void) {
-    if (!gui_isStarted())
+    const char *output = conf_getString("video", "output");
+    if (output != NULL && strcmp(output, "sdl") != 0 &&
+        strcmp(output, "none") != 0 && strcmp(output, "ansi") != 0) {
+        LOG_ERR("unknown video output: %s\n", output);
         return false;
+    }
 
     if (!video_load_roms())
         return false;
 
+    const char *shm = conf_getString("video", "shm");
+    if (shm != NULL && !fbshm_open(shm))
+        return false;
+
+    if (output != NULL && strcmp(output, "ansi") == 0) {
+        ansi = true;
+        ansi_open();
+    }
+
+    // headless: frames are still rendered for capture and recording
+    if (!gui_isStarted()) {
+        LOG_INFO("no gui: video is headless\n");
+        started = true;
+        return true;
+    }
+
     window = SDL_CreateWindow("ceda cemu", SDL_WINDOWPOS_UNDEFINED,
-                              SDL_WINDOWPOS_UNDEFINED, CRT_PIXEL_WIDTH,
-                              CRT_PIXEL_HEIGHT,
+                              SDL_WINDOWPOS_UNDEFINED, VIDEO_PIXEL_WIDTH,
+                              VIDEO_PIXEL_HEIGHT,
                               SDL_WINDOW_RESIZABLE | SDL_WINDOW_SHOWN);
     if (window == NULL) {
         LOG_ERR("unable to create window: %s\n", SDL_GetError());
@@ -141,9 +170,9 @@ static bool video_start(void) {
         return false;
     }
 
-    SDL_SetWindowMinimumSize(window, CRT_PIXEL_WIDTH, CRT_PIXEL_HEIGHT);
-    if (SDL_RenderSetLogicalSize(renderer, CRT_PIXEL_WIDTH, CRT_PIXEL_HEIGHT) <
-        0) {
+    SDL_SetWindowMinimumSize(window, VIDEO_PIXEL_WIDTH, VIDEO_PIXEL_HEIGHT);
+    if (SDL_RenderSetLogicalSize(renderer, VIDEO_PIXEL_WIDTH,
+                                 VIDEO_PIXEL_HEIGHT) < 0) {
         LOG_ERR("sdl error: %s\n", SDL_GetError());
         return false;
     }
@@ -152,8 +181,8 @@ static bool video_start(void) {
         return false;
     }
 
-    surface = SDL_CreateRGBSurfaceWithFormat(SDL_SWSURFACE, CRT_PIXEL_WIDTH,
-                                             CRT_PIXEL_HEIGHT, 1,
+    surface = SDL_CreateRGBSurfaceWithFormat(SDL_SWSURFACE, VIDEO_PIXEL_WIDTH,
+                                             VIDEO_PIXEL_HEIGHT, 1,
                                              SDL_PIXELFORMAT_INDEX1MSB);
     SDL_Color colors[2] = {{0, 0, 0, 255}, {0, 192, 0, 255}};
     SDL_SetPaletteColors(surface->format->palette, colors, 0, 2);
@@ -186,23 +215,17 @@ static void video_update_performance(void) {
     last_fields = fields;
 }
 
-static void video_poll(void) {
-    const us_time_t now = time_now_us();
-    if (now < last_update + UPDATE_INTERVAL)
-        return;
-    last_update = now;
-
-    if (!started)
-        return;
-
-    ++fields;
-    frame_sync = true;
+static void video_update_fields(void);
 
+/**
+ * @brief Render current video memory content in the frame buffer.
+ */
+static void video_render(void) {
     // get CRTC base address
     const uint16_t crtc_start_address = crtc_startAddress();
 
-    // get base pointer of SDL surface bitmap
-    zuint8 *pixels = (zuint8 *)(surface->pixels);
+    // get base pointer of frame buffer bitmap
+    zuint8 *pixels = framebuffer;
 
     for (size_t row = 0; row < VIDEO_ROWS; ++row) {
         for (size_t column = 0; column < VIDEO_COLUMNS; ++column) {
@@ -230,7 +253,7 @@ static void video_poll(void) {
             // this does not emulate 100% the CRTC scan lines, but it's easier
             // and no one cares (yet)
             for (int i = 0; i < 16; ++i) {
-                // compute pointer to SDL frame buffer memory where char will
+                // compute pointer to frame buffer memory where char will
                 // reside
                 zuint8 *pixels_segment = pixels + (row * 16) * VIDEO_COLUMNS +
                                          column + (ptrdiff_t)i * VIDEO_COLUMNS;
@@ -359,14 +382,66 @@ static void video_poll(void) {
               (ptrdiff_t)raster * VIDEO_COLUMNS) ^= 0xff;
         }
     }
+}
+
+/**
+ * @brief Show the visible text on the terminal.
+ */
+static void video_ansi_update(void) {
+    static uint8_t chars[VIDEO_ROWS * VIDEO_COLUMNS];
+    static uint8_t attrs[VIDEO_ROWS * VIDEO_COLUMNS];
+
+    const uint16_t start_address = crtc_startAddress();
+    for (size_t i = 0; i < ARRAY_SIZE(chars); ++i) {
+        chars[i] = mem_char[(start_address + i) % ARRAY_SIZE(mem_char)];
+        attrs[i] = mem_attr[(start_address + i) % ARRAY_SIZE(mem_attr)];
+    }
+
+    ansi_update(chars, attrs,
+                (crtc_cursorPosition() - start_address) %
+                    ARRAY_SIZE(mem_char));
+}
+
+/**
+ * @brief Show the frame buffer in the SDL window.
+ */
+static void video_present(void) {
+    zuint8 *pixels = (zuint8 *)(surface->pixels);
+    for (size_t line = 0; line < VIDEO_PIXEL_HEIGHT; ++line) {
+        memcpy(pixels + line * (size_t)surface->pitch,
+               framebuffer + line * VIDEO_COLUMNS, VIDEO_COLUMNS);
+    }
 
-    // render
     SDL_RenderClear(renderer);
     SDL_Texture *texture = SDL_CreateTextureFromSurface(renderer, surface);
     SDL_RenderCopy(renderer, texture, NULL, NULL);
     SDL_RenderPresent(renderer);
     SDL_DestroyTexture(texture);
     SDL_UpdateWindowSurface(window);
+}
+
+static void video_poll(void) {
+    const us_time_t now = time_now_us();
+    if (now < last_update + UPDATE_INTERVAL)
+        return;
+    last_update = now;
+
+    if (!started)
+        return;
+
+    video_update_fields();
+
+    // when headless, render only if someone is looking
+    if (window != NULL || record_isActive() || fbshm_isOpen()) {
+        video_render();
+        if (window != NULL)
+            video_present();
+        record_frame(framebuffer);
+        fbshm_update(framebuffer);
+    }
+
+    if (ansi)
+        video_ansi_update();
 
     // measure performance
     video_update_performance();
@@ -379,6 +454,11 @@ static us_time_t video_remaining(void) {
     return diff;
 }
 
+static void video_cleanup(void) {
+    fbshm_close();
+    ansi_close();
+}
+
 void video_init(CEDAModule *mod) {
     // mod init
     memset(mod, 0, sizeof(*mod));
@@ -386,7 +466,7 @@ void video_init(CEDAModule *mod) {
     mod->start = video_start;
     mod->poll = video_poll;
     mod->remaining = video_remaining;
-    mod->cleanup = NULL;
+    mod->cleanup = video_cleanup;
     mod->performance = video_performance;
 
     // default to character memory
@@ -404,7 +484,17 @@ void video_ram_write(ceda_address_t address, uint8_t value) {
 
     LOG_DEBUG("write [%04x] <= %02x\n", address, value);
 
+    const bool changed = (mem[address] != value);
     mem[address] = value;
+
+    // only characters in the visible area are interesting as text
+    if (text_observer == NULL || mem != mem_char || !changed)
+        return;
+
+    const unsigned int offset =
+        (unsigned int)(address - crtc_startAddress()) % VIDEO_CHAR_MEM_SIZE;
+    if (offset < VIDEO_ROWS * VIDEO_COLUMNS)
+        text_observer(offset / VIDEO_COLUMNS);
 }
 
 /**
@@ -420,6 +510,32 @@ void video_bank(bool attr) {
     }
 }
 
+/**
+ * @brief Advance video fields up to current emulated time.
+ *
+ * Fields are generated by the CRTC at a fixed rate of emulated cpu cycles,
+ * independently of when frames are presented on the host.
+ * This is evaluated lazily, only when someone looks at it.
+ */
+static void video_update_fields(void) {
+    const unsigned long int now = cpu_getCycles();
+    const unsigned long int field_cycles = crtc_fieldCycles();
+
+    // complete past fields, latching the vsync if it has been missed
+    while (now - field_start >= field_cycles) {
+        if (!vsync_done)
+            frame_sync = true;
+        field_start += field_cycles;
+        vsync_done = false;
+        ++fields;
+    }
+
+    if (!vsync_done && now - field_start >= crtc_vsyncCycles()) {
+        frame_sync = true;
+        vsync_done = true;
+    }
+}
+
 /**
  * @brief Reset video frame sync circuit.
  *
@@ -427,6 +543,7 @@ void video_bank(bool attr) {
  *
  */
 void video_frameSyncReset(void) {
+    video_update_fields();
     frame_sync = 0;
 }
 
@@ -436,5 +553,69 @@ void video_frameSyncReset(void) {
  * @return Return true when new frame sync since last reset, false otherwise.
  */
 bool video_frameSync(void) {
+    video_update_fields();
     return frame_sync;
 }
+
+/**
+ * @brief Register a callback to be notified of screen text changes.
+ *
+ * The observer is called for every write to character memory which actually
+ * changes the content of a visible row, and for all the rows when the
+ * displayed area is moved (eg. scroll).
+ * Only one observer is supported.
+ *
+ * @param observer Callback, or NULL to unregister.
+ */
+void video_setTextObserver(video_text_observer_t observer) {
+    text_observer = observer;
+}
+
+/**
+ * @brief Notify the text observer that all the visible rows have changed.
+ */
+void video_invalidateText(void) {
+    if (text_observer == NULL)
+        return;
+
+    for (unsigned int row = 0; row < VIDEO_ROWS; ++row)
+        text_observer(row);
+}
+
+/**
+ * @brief Decode a visible screen row to plain text.
+ *
+ * Non printable characters are replaced with spaces.
+ *
+ * @param text Destination buffer, at least VIDEO_COLUMNS long.
+ * It is not null-terminated.
+ * @param row Screen row, in [0, VIDEO_ROWS).
+ */
+void video_textRow(char *text, unsigned int row) {
+    assert(row < VIDEO_ROWS);
+
+    const uint16_t start_address = crtc_startAddress();
+
+    for (unsigned int column = 0; column < VIDEO_COLUMNS; ++column) {
+        const zuint8 c =
+            mem_char[(start_address + row * VIDEO_COLUMNS + column) %
+                     ARRAY_SIZE(mem_char)];
+        text[column] = (c >= 0x20 && c < 0x7f) ? (char)c : ' ';
+    }
+}
+
+/**
+ * @brief Get the last rendered frame.
+ *
+ * The frame is a VIDEO_PIXEL_WIDTH x VIDEO_PIXEL_HEIGHT bitmap, 1 bpp, most
+ * significant bit first, VIDEO_COLUMNS bytes per line.
+ * When headless, the frame is rendered on demand.
+ *
+ * @return const uint8_t* Pointer to VIDEO_FRAME_SIZE bytes.
+ */
+const uint8_t *video_frame(void) {
+    if (window == NULL && !record_isActive() && !fbshm_isOpen())
+        video_render();
+
+    return framebuffer;
+}
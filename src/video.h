@@ -7,6 +7,20 @@
 #include <Z80.h>
 #include <stdbool.h>
 
+#define VIDEO_COLUMNS 80
+#define VIDEO_ROWS    25
+
+#define VIDEO_PIXEL_WIDTH  640
+#define VIDEO_PIXEL_HEIGHT 400
+#define VIDEO_FRAME_SIZE   (VIDEO_PIXEL_HEIGHT * VIDEO_COLUMNS)
+
+/**
+ * @brief Callback invoked when the text shown in a screen row changes.
+ *
+ * @param row Screen row which has been touched, in [0, VIDEO_ROWS).
+ */
+typedef void (*video_text_observer_t)(unsigned int row);
+
 void video_init(CEDAModule *mod);
 bool video_isStarted(void);
 
@@ -17,4 +31,10 @@ void video_bank(bool attr);
 void video_frameSyncReset(void);
 bool video_frameSync(void);
 
+void video_setTextObserver(video_text_observer_t observer);
+void video_invalidateText(void);
+void video_textRow(char *text, unsigned int row);
+
+const uint8_t *video_frame(void);
+
 #endif // CEDA_VIDEO_H